@@ -4,6 +4,8 @@
  * Released under the MIT license, see LICENSE.txt
  */
 
+// for open_memstream
+#define _POSIX_C_SOURCE 200809L
 #include <assert.h>
 #include <getopt.h>
 #include <stdio.h>
@@ -13,6 +15,9 @@
 #include "multipleAligner.h"
 #include "commonC.h"
 #include "stateMachine.h"
+#include "indexedFasta.h"
+#include "threadPool.h"
+#include "reorderBuffer.h"
 
 #include "../sonLib/lib/sonLibTypes.h"
 #include "../sonLib/lib/bioioC.h"
@@ -53,6 +58,9 @@ void usage() {
                 "-v --outputExpectations [FILE] : Instead of realigning, switches to calculating expectations, dumping out expectations as matrix in the given file.\n");
     fprintf(stderr,
                 "-y --loadHmm [FILE] : Loads HMM from given file.\n");
+    fprintf(stderr,
+            "-n --threads : (int >= 1) Number of alignments realigned at the same time, the output is in the input "
+            "order, default 1\n");
 }
 
 struct PairwiseAlignment *convertAlignedPairsToPairwiseAlignment(char *seqName1, char *seqName2, double score,
@@ -220,43 +228,26 @@ void rebasePairwiseAlignmentCoordinates(int64_t *start, int64_t *end, int64_t *s
     }
 }
 
-char *getSubSequence(char *seq, int64_t start, int64_t end, bool strand) {
-    if (strand) {
-        return stString_getSubString(seq, start, end - start);
-    }
-    seq = stString_getSubString(seq, end, start - end);
-    char *rSeq = stString_reverseComplementString(seq);
-    free(seq);
-    return rSeq;
-}
-
-stHash *sequences = NULL;
-void addToSequencesHash(const char *header, const char *sequence, int64_t length) {
-    stList *tokens = stString_split(header);
-    char *firstToken = stList_get(tokens, 0);
-    if (stHash_search(sequences, (char *) firstToken) != NULL) {
-        st_logInfo(
-                "Got a repeat header: %s with sequence length: %" PRIi64 " vs. the existing hashed sequence of length: %" PRIi64 ", complete header: %s\n",
-                (char *) firstToken, length, strlen(stHash_search(sequences, (char *) firstToken)), header);
-        if (length > strlen(stHash_search(sequences, (char *) firstToken))) { //The new sequence is a more complete version of the original sequence (can happen with overlapping fragments).
-            st_logInfo("Replacing sequence\n");
-#ifndef NDEBUG
-            //Check old sequence is substring of new string
-            char *cA = stString_getSubString(sequence, 0, strlen(stHash_search(sequences, (char *) firstToken)));
-            assert(stString_eq(cA, stHash_search(sequences, (char * ) firstToken)));
-            free(cA);
-#endif
-            //Remove the old sequence and cleanup
-            free(stHash_removeAndFreeKey(sequences, firstToken)); //The old first token is not cleaned up currently - a memory leak
-            //Now insert the new sequence
-            stHash_insert(sequences, stString_copy(firstToken), stString_copy(sequence));
+// the input fasta files, indexed
+stList *sequenceFiles = NULL;
+
+char *getSubSequence(const char *contig, int64_t start, int64_t end, bool strand) {
+    // a contig in more than one file uses the longest sequence (a more complete version of the same fragment)
+    IndexedFasta *fasta = NULL;
+    int64_t ordinal = -1, length = -1;
+    for (int64_t i = 0; i < stList_length(sequenceFiles); i++) {
+        IndexedFasta *f = stList_get(sequenceFiles, i);
+        int64_t j = indexedFasta_getOrdinal(f, contig);
+        if (j >= 0 && indexedFasta_getSequenceLength(f, j) > length) {
+            fasta = f;
+            ordinal = j;
+            length = indexedFasta_getSequenceLength(f, j);
         }
-    } else {
-        st_logInfo("Adding sequence for header: %s, with length %" PRIi64 ", complete header: %s\n",
-                (char *) firstToken, strlen(sequence), header);
-        stHash_insert(sequences, stString_copy(firstToken), stString_copy(sequence));
     }
-    stList_destruct(tokens);
+    if (fasta == NULL) {
+        st_errAbort("No sequence for contig %s in the input fasta files\n", contig);
+    }
+    return indexedFasta_getSubSequence(fasta, ordinal, start, end, strand, FALSE);
 }
 
 void *convertToAnchorPair(void *aPair, void *extraArg) {
@@ -335,19 +326,26 @@ double scoreByPosteriorProbabilityIgnoringGaps(stList *alignedPairs) {
     return 100.0 * totalScore(alignedPairs) / ((double) stList_length(alignedPairs) * PAIR_ALIGNMENT_PROB_1);
 }
 
-void writePosteriorProbs(char *posteriorProbsFile, stList *alignedPairs) {
+void writePosteriorProbs(FILE *fH, stList *alignedPairs) {
     /*
-     * Writes the posterior match probabibilities to a tab separated file, each line being X coordinate, Y coordinate, Match probability
+     * Writes the posterior match probabibilities tab separated, each line being X coordinate, Y coordinate, Match probability
      */
-    FILE *fH = fopen(posteriorProbsFile, "w");
     for(int64_t i=0;i<stList_length(alignedPairs); i++) {
         stIntTuple *aPair = stList_get(alignedPairs, i);
         fprintf(fH, "%" PRIi64 "\t%" PRIi64 "\t%f\n", stIntTuple_get(aPair, 1), stIntTuple_get(aPair, 2), ((double)stIntTuple_get(aPair, 0))/PAIR_ALIGNMENT_PROB_1);
     }
-    fclose(fH);
 }
 
-stList *scoreAnchorPairs(stList *anchorPairs, stList *alignedPairs) {
+void writePosteriorProbs2(FILE *fH, AlignedPairBuffer *alignedPairs) {
+    /*
+     * As writePosteriorProbs, for the unfiltered posterior match probabilities
+     */
+    for(int64_t i=0;i<alignedPairs->length; i++) {
+        fprintf(fH, "%" PRIi64 "\t%" PRIi64 "\t%f\n", alignedPairs->x[i], alignedPairs->y[i], ((double)alignedPairs->probs[i])/PAIR_ALIGNMENT_PROB_1);
+    }
+}
+
+stList *scoreAnchorPairs(stList *anchorPairs, AlignedPairBuffer *alignedPairs) {
     /*
      * Selects the aligned pairs contained in anchor pairs.
      */
@@ -355,11 +353,10 @@ stList *scoreAnchorPairs(stList *anchorPairs, stList *alignedPairs) {
     assert(stList_length(anchorPairs) == stSortedSet_size(anchorPairsSet));
     stList *scoredAnchorPairs = stList_construct3(0, (void (*)(void *))stIntTuple_destruct);
 
-    for(int64_t i=0; i<stList_length(alignedPairs); i++) {
-        stIntTuple *aPair = stList_get(alignedPairs, i);
-        stIntTuple *j = stIntTuple_construct2(stIntTuple_get(aPair, 1), stIntTuple_get(aPair, 2));
+    for(int64_t i=0; i<alignedPairs->length; i++) {
+        stIntTuple *j = stIntTuple_construct2(alignedPairs->x[i], alignedPairs->y[i]);
         if(stSortedSet_search(anchorPairsSet, j) != NULL) {
-            stList_append(scoredAnchorPairs, stIntTuple_construct3(stIntTuple_get(aPair, 0), stIntTuple_get(aPair, 1), stIntTuple_get(aPair, 2)));
+            stList_append(scoredAnchorPairs, stIntTuple_construct3(alignedPairs->probs[i], alignedPairs->x[i], alignedPairs->y[i]));
             stSortedSet_remove(anchorPairsSet, j);
         }
         stIntTuple_destruct(j);
@@ -379,11 +376,215 @@ stList *scoreAnchorPairs(stList *anchorPairs, stList *alignedPairs) {
     return scoredAnchorPairs;
 }
 
+// the settings shared by the realignments
+typedef struct _realignOptions {
+    StateMachine *sM;
+    PairwiseAlignmentParameters *p;
+    float matchGamma;
+    bool rescoreOriginalAlignment;
+    bool rescoreByIdentity;
+    bool rescoreByPosteriorProbability;
+    bool rescoreByIdentityIgnoringGaps;
+    bool rescoreByPosteriorProbabilityIgnoringGaps;
+    int64_t splitIndelsLongerThanThis;
+    char *posteriorProbsFile;
+    char *allPosteriorProbsFile;
+    FILE *fileHandleOut;
+    ReorderBuffer *output;
+    // each alignment collects expectations in its own HMM, they are added to this one in input order so the sums
+    // don't depend on the number of threads
+    Hmm *hmmExpectations;
+} RealignOptions;
+
+typedef struct _realignJob {
+    int64_t index; // position in the input
+    struct PairwiseAlignment *pA;
+} RealignJob;
+
+// the output of a realignment, formatted by the worker, NULL when there is nothing to write
+typedef struct _realignResult {
+    char *cigars;
+    size_t cigarsLength;
+    char *posteriorProbs;
+    size_t posteriorProbsLength;
+    char *allPosteriorProbs;
+    size_t allPosteriorProbsLength;
+    Hmm *hmmExpectations; // NULL unless getting expectations, without the pseudocounts of the shared HMM
+} RealignResult;
+
+typedef struct _realignWorkspace {
+    RealignOptions *options;
+} RealignWorkspace;
+
+static void *realignWorkspace_construct(void *arg) {
+    RealignWorkspace *workspace = st_malloc(sizeof(RealignWorkspace));
+    workspace->options = arg;
+    return workspace;
+}
+
+static void realignWorkspace_destruct(void *arg) {
+    free(arg);
+}
+
+static void writeBuffer(FILE *fH, char *buffer, size_t length) {
+    if (length > 0 && fwrite(buffer, sizeof(char), length, fH) != length) {
+        st_errAbort("Failed to write %" PRIi64 " bytes of output\n", (int64_t) length);
+    }
+}
+
+// called in input order, the expectations are summed in that order and the posterior probs files hold those of the
+// last alignment, as they did before the alignments were realigned in parallel
+static void writeRealignResult(void *arg, void *extraArg) {
+    RealignResult *result = arg;
+    RealignOptions *options = extraArg;
+    if (result->cigars != NULL) {
+        writeBuffer(options->fileHandleOut, result->cigars, result->cigarsLength);
+        free(result->cigars);
+    }
+    if (result->posteriorProbs != NULL) {
+        FILE *fH = fopen(options->posteriorProbsFile, "w");
+        writeBuffer(fH, result->posteriorProbs, result->posteriorProbsLength);
+        fclose(fH);
+        free(result->posteriorProbs);
+    }
+    if (result->allPosteriorProbs != NULL) {
+        FILE *fH = fopen(options->allPosteriorProbsFile, "w");
+        writeBuffer(fH, result->allPosteriorProbs, result->allPosteriorProbsLength);
+        fclose(fH);
+        free(result->allPosteriorProbs);
+    }
+    if (result->hmmExpectations != NULL) {
+        hmmDiscrete_addExpectations(options->hmmExpectations, result->hmmExpectations);
+        hmmDiscrete_destruct(result->hmmExpectations);
+    }
+    free(result);
+}
+
+static void realign(void *arg, void *jobArg) {
+    RealignWorkspace *workspace = arg;
+    RealignOptions *options = workspace->options;
+    RealignJob *job = jobArg;
+    struct PairwiseAlignment *pA = job->pA;
+    StateMachine *sM = options->sM;
+    PairwiseAlignmentParameters *pairwiseAlignmentBandingParameters = options->p;
+    RealignResult *result = st_calloc(1, sizeof(RealignResult));
+
+    st_logInfo("Processing alignment for sequences: %s and %s\n", pA->contig1, pA->contig2);
+    //Convert to an alignment on the forward strand starting at 0
+    bool flipStrand1 = !pA->strand1, flipStrand2 = !pA->strand2;
+    int64_t coordinateShift1 = (pA->strand1 ? pA->start1 : pA->end1);
+    int64_t coordinateShift2 = (pA->strand2 ? pA->start2 : pA->end2);
+
+    // Make sequence objects, slice 'em up
+    char *subSeqX = getSubSequence(pA->contig1, pA->start1, pA->end1, pA->strand1);
+    char *subSeqY = getSubSequence(pA->contig2, pA->start2, pA->end2, pA->strand2);
+    Sequence *SsubSeqX = sequence_construct2((pA->end1 - pA->start1), subSeqX, sequence_getBase,
+                                             sequence_sliceNucleotideSequence2);
+    Sequence *SsubSeqY = sequence_construct2((pA->end2 - pA->start2), subSeqY, sequence_getBase,
+                                             sequence_sliceNucleotideSequence2);
+
+    rebasePairwiseAlignmentCoordinates(&(pA->start1), &(pA->end1), &(pA->strand1), -coordinateShift1, flipStrand1);
+    rebasePairwiseAlignmentCoordinates(&(pA->start2), &(pA->end2), &(pA->strand2), -coordinateShift2, flipStrand2);
+    checkPairwiseAlignment(pA);
+    //Convert input alignment into anchor pairs
+    stList *anchorPairs = convertPairwiseForwardStrandAlignmentToAnchorPairs(pA,
+            pairwiseAlignmentBandingParameters->constraintDiagonalTrim);
+    //Filter anchorPairs to remove anchor pairs that include mismatches
+    char *seqs[2] = { subSeqX, subSeqY };
+    stList *filteredAnchoredPairs = stList_filter2(anchorPairs, matchFn, seqs);
+    if(options->hmmExpectations != NULL) {
+        st_logInfo("Computing expectations\n");
+        result->hmmExpectations = hmmDiscrete_getEmptyClone(options->hmmExpectations);
+        getExpectationsUsingAnchors(sM, result->hmmExpectations, SsubSeqX, SsubSeqY, filteredAnchoredPairs,
+                                    pairwiseAlignmentBandingParameters, diagonalCalculation_Expectations, 1, 1);
+    }
+    else {
+        //Get posterior prob pairs
+        AlignedPairBuffer *alignedPairBuffer = getAlignedPairBufferUsingAnchors(sM, SsubSeqX, SsubSeqY,
+                                                                                filteredAnchoredPairs,
+                                                                                pairwiseAlignmentBandingParameters,
+                                                                                diagonalCalculationPosteriorMatchProbs,
+                                                                                1, 1);
+        //Output all the posterior match probs, if needed
+        if(options->allPosteriorProbsFile != NULL) {
+            FILE *fH = open_memstream(&result->allPosteriorProbs, &result->allPosteriorProbsLength);
+            writePosteriorProbs2(fH, alignedPairBuffer);
+            fclose(fH);
+        }
+        //Convert to partial ordered set of pairs
+        stList *alignedPairs;
+        if (options->rescoreOriginalAlignment) {
+            alignedPairs = scoreAnchorPairs(anchorPairs, alignedPairBuffer);
+        } else { //Shouldn't be needed if we only take pairs with > 50% posterior prob
+            //Modify to account for gaps
+            alignedPairBuffer_reweight(alignedPairBuffer, strlen(subSeqX), strlen(subSeqY), pairwiseAlignmentBandingParameters->gapGamma); //gapGamma);
+            alignedPairs = filterPairwiseAlignmentToMakePairsOrdered(alignedPairBuffer_toList(alignedPairBuffer), subSeqX, subSeqY, options->matchGamma); //gapGamma);
+        }
+        alignedPairBuffer_destruct(alignedPairBuffer);
+        //Rescore
+        if (options->rescoreByPosteriorProbability) {
+            pA->score = scoreByPosteriorProbability(strlen(subSeqX), strlen(subSeqY), alignedPairs);
+        } else if (options->rescoreByPosteriorProbabilityIgnoringGaps) {
+            pA->score = scoreByPosteriorProbabilityIgnoringGaps(alignedPairs);
+        } else if (options->rescoreByIdentity) {
+            pA->score = scoreByIdentity(subSeqX, subSeqY, strlen(subSeqX), strlen(subSeqY), alignedPairs);
+        } else if (options->rescoreByIdentityIgnoringGaps) {
+            pA->score = scoreByIdentityIgnoringGaps(subSeqX, subSeqY, alignedPairs);
+        }
+        //Output the posterior match probs, if needed
+        if(options->posteriorProbsFile != NULL) {
+            FILE *fH = open_memstream(&result->posteriorProbs, &result->posteriorProbsLength);
+            writePosteriorProbs(fH, alignedPairs);
+            fclose(fH);
+        }
+        //Convert to ordered list of sequence coordinate pairs
+        stList_mapReplace(alignedPairs, convertToAnchorPair, NULL);
+        stList_sort(alignedPairs, (int (*)(const void *, const void *)) stIntTuple_cmpFn); //Ensure we have an monotonically increasing ordering
+        //Convert back to cigar
+        struct PairwiseAlignment *rPA = convertAlignedPairsToPairwiseAlignment(pA->contig1, pA->contig2, pA->score,
+                pA->end1, pA->end2, alignedPairs);
+        //Rebase realigned-pA.
+        rebasePairwiseAlignmentCoordinates(&(rPA->start1), &(rPA->end1), &(rPA->strand1), coordinateShift1,
+                flipStrand1);
+        rebasePairwiseAlignmentCoordinates(&(rPA->start2), &(rPA->end2), &(rPA->strand2), coordinateShift2,
+                flipStrand2);
+        checkPairwiseAlignment(rPA);
+        //Write out alignment
+        FILE *fileHandleOut = open_memstream(&result->cigars, &result->cigarsLength);
+        if (options->splitIndelsLongerThanThis != -1) {
+            // Write multiple split alignments
+            stList *pAs = splitPairwiseAlignment(rPA, options->splitIndelsLongerThanThis);
+            for (int64_t i = 0; i < stList_length(pAs); i++) {
+                cigarWrite(fileHandleOut, stList_get(pAs, i), 0);
+            }
+            stList_destruct(pAs);
+        } else {
+            // Write just one unsplit alignment
+            cigarWrite(fileHandleOut, rPA, 0);
+        }
+        fclose(fileHandleOut);
+
+        //Clean up
+        stList_destruct(alignedPairs);
+        destructPairwiseAlignment(rPA);
+    }
+    destructPairwiseAlignment(pA);
+    stList_destruct(filteredAnchoredPairs);
+    stList_destruct(anchorPairs);
+    sequence_sequenceDestroy(SsubSeqX);
+    sequence_sequenceDestroy(SsubSeqY);
+    free(subSeqX);
+    free(subSeqY);
+    reorderBuffer_push(options->output, job->index, result);
+    free(job);
+}
+
 int main(int argc, char *argv[]) {
     char * logLevelString = NULL;
     float matchGamma = 0.85;
     int64_t i, j;
     PairwiseAlignmentParameters *pairwiseAlignmentBandingParameters = pairwiseAlignmentBandingParameters_construct();
+    pairwiseAlignmentBandingParameters->expectationsThreshold = EXPECTATIONS_THRESHOLD;
     pairwiseAlignmentBandingParameters->constraintDiagonalTrim = 0;
     pairwiseAlignmentBandingParameters->splitMatrixBiggerThanThis = 10;
     pairwiseAlignmentBandingParameters->diagonalExpansion = 4;
@@ -399,6 +600,7 @@ int main(int argc, char *argv[]) {
     char *expectationsFile = NULL;
     char *hmmFile = NULL;
     Hmm *hmmExpectations = NULL;
+    int64_t nbThreads = 1;
     /*
      * Parse the options.
      */
@@ -418,11 +620,12 @@ int main(int argc, char *argv[]) {
                 { "outputAllPosteriorProbs", required_argument, 0, 'z' },
                 { "outputExpectations", required_argument, 0, 'v' },
                 { "loadHmm", required_argument, 0, 'y' },
+                { "threads", required_argument, 0, 'n' },
                 { 0, 0, 0, 0 } };
 
         int option_index = 0;
 
-        int key = getopt_long(argc, argv, "a:hl:o:r:t:s:wxijkmuv:y:z:L:", long_options, &option_index);
+        int key = getopt_long(argc, argv, "a:hl:o:r:t:s:wxijkmuv:y:z:L:n:", long_options, &option_index);
 
         if (key == -1) {
             break;
@@ -498,6 +701,11 @@ int main(int argc, char *argv[]) {
         case 'z':
             allPosteriorProbsFile = stString_copy(optarg);
             break;
+        case 'n':
+            i = sscanf(optarg, "%" PRIi64, &nbThreads);
+            assert(i == 1);
+            assert(nbThreads >= 1);
+            break;
         default:
             usage();
             return 1;
@@ -541,121 +749,44 @@ int main(int argc, char *argv[]) {
     }
 
     //Read in input sequences
-    sequences = stHash_construct3(stHash_stringKey, stHash_stringEqualKey, free, free);
+    sequenceFiles = stList_construct3(0, (void (*)(void *)) indexedFasta_destruct);
     assert(optind < argc);
     while (optind < argc) {
-        FILE *seqFileHandle = fopen(argv[optind++], "r");
-        fastaReadToFunction(seqFileHandle, addToSequencesHash);
-        fclose(seqFileHandle);
+        stList_append(sequenceFiles, indexedFasta_construct(argv[optind++]));
     }
 
-    //Now do the business of processing the sequences.
+    //Now do the business of processing the sequences, the main thread reads the alignments and hands them to
+    //the workers, the reorder buffer writes the results back in the input order
+    RealignOptions options;
+    options.sM = sM;
+    options.p = pairwiseAlignmentBandingParameters;
+    options.matchGamma = matchGamma;
+    options.rescoreOriginalAlignment = rescoreOriginalAlignment;
+    options.rescoreByIdentity = rescoreByIdentity;
+    options.rescoreByPosteriorProbability = rescoreByPosteriorProbability;
+    options.rescoreByIdentityIgnoringGaps = rescoreByIdentityIgnoringGaps;
+    options.rescoreByPosteriorProbabilityIgnoringGaps = rescoreByPosteriorProbabilityIgnoringGaps;
+    options.splitIndelsLongerThanThis = splitIndelsLongerThanThis;
+    options.posteriorProbsFile = posteriorProbsFile;
+    options.allPosteriorProbsFile = allPosteriorProbsFile;
+    options.hmmExpectations = hmmExpectations;
+    options.fileHandleOut = stdout;
+    options.output = reorderBuffer_construct(4 * nbThreads, writeRealignResult, &options);
+
+    ThreadPool *pool = threadPool_construct(nbThreads, 2 * nbThreads, realignWorkspace_construct,
+                                            realignWorkspace_destruct, &options);
     struct PairwiseAlignment *pA;
     FILE *fileHandleIn = stdin;
-    FILE *fileHandleOut = stdout;
+    int64_t nbAlignments = 0;
     while ((pA = cigarRead(fileHandleIn)) != NULL) {
-        st_logInfo("Processing alignment for sequences: %s and %s\n", pA->contig1, pA->contig2);
-        //Get sequences
-        char *seqX = stHash_search(sequences, pA->contig1);
-        char *seqY = stHash_search(sequences, pA->contig2);
-        assert(seqX != NULL && seqY != NULL);
-        //Convert to an alignment on the forward strand starting at 0
-        bool flipStrand1 = !pA->strand1, flipStrand2 = !pA->strand2;
-        int64_t coordinateShift1 = (pA->strand1 ? pA->start1 : pA->end1);
-        int64_t coordinateShift2 = (pA->strand2 ? pA->start2 : pA->end2);
-
-        // Make sequence objects, slice 'em up
-        char *subSeqX = getSubSequence(seqX, pA->start1, pA->end1, pA->strand1);
-        char *subSeqY = getSubSequence(seqY, pA->start2, pA->end2, pA->strand2);
-        Sequence *SsubSeqX = sequence_construct2((pA->end1 - pA->start1), subSeqX, sequence_getBase,
-                                                 sequence_sliceNucleotideSequence2);
-        Sequence *SsubSeqY = sequence_construct2((pA->end2 - pA->start2), subSeqY, sequence_getBase,
-                                                 sequence_sliceNucleotideSequence2);
-
-        rebasePairwiseAlignmentCoordinates(&(pA->start1), &(pA->end1), &(pA->strand1), -coordinateShift1, flipStrand1);
-        rebasePairwiseAlignmentCoordinates(&(pA->start2), &(pA->end2), &(pA->strand2), -coordinateShift2, flipStrand2);
-        checkPairwiseAlignment(pA);
-        //Convert input alignment into anchor pairs
-        stList *anchorPairs = convertPairwiseForwardStrandAlignmentToAnchorPairs(pA,
-                pairwiseAlignmentBandingParameters->constraintDiagonalTrim);
-        //Filter anchorPairs to remove anchor pairs that include mismatches
-        char *seqs[2] = { subSeqX, subSeqY };
-        stList *filteredAnchoredPairs = stList_filter2(anchorPairs, matchFn, seqs);
-        if(expectationsFile != NULL) {
-            st_logInfo("Computing expectations\n");
-            getExpectationsUsingAnchors(sM, hmmExpectations, SsubSeqX, SsubSeqY, filteredAnchoredPairs,
-                                        pairwiseAlignmentBandingParameters, diagonalCalculation_Expectations, 1, 1);
-        }
-        else {
-            //Get posterior prob pairs
-            stList *alignedPairs = getAlignedPairsUsingAnchors(sM, SsubSeqX, SsubSeqY, filteredAnchoredPairs,
-                                                               pairwiseAlignmentBandingParameters,
-                                                               diagonalCalculationPosteriorMatchProbs,
-                                                               1, 1);
-            //Output all the posterior match probs, if needed
-            if(allPosteriorProbsFile != NULL) {
-                writePosteriorProbs(allPosteriorProbsFile, alignedPairs);
-            }
-            //Convert to partial ordered set of pairs
-            if (rescoreOriginalAlignment) {
-                stList *rescoredPairs = scoreAnchorPairs(anchorPairs, alignedPairs);
-                stList_destruct(alignedPairs);
-                alignedPairs = rescoredPairs;
-            } else { //Shouldn't be needed if we only take pairs with > 50% posterior prob
-                //Modify to account for gaps
-                alignedPairs = reweightAlignedPairs2(alignedPairs, strlen(subSeqX), strlen(subSeqY), pairwiseAlignmentBandingParameters->gapGamma); //gapGamma);
-                alignedPairs = filterPairwiseAlignmentToMakePairsOrdered(alignedPairs, subSeqX, subSeqY, matchGamma); //gapGamma);
-            }
-            //Rescore
-            if (rescoreByPosteriorProbability) {
-                pA->score = scoreByPosteriorProbability(strlen(subSeqX), strlen(subSeqY), alignedPairs);
-            } else if (rescoreByPosteriorProbabilityIgnoringGaps) {
-                pA->score = scoreByPosteriorProbabilityIgnoringGaps(alignedPairs);
-            } else if (rescoreByIdentity) {
-                pA->score = scoreByIdentity(subSeqX, subSeqY, strlen(subSeqX), strlen(subSeqY), alignedPairs);
-            } else if (rescoreByIdentityIgnoringGaps) {
-                pA->score = scoreByIdentityIgnoringGaps(subSeqX, subSeqY, alignedPairs);
-            }
-            //Output the posterior match probs, if needed
-            if(posteriorProbsFile != NULL) {
-                writePosteriorProbs(posteriorProbsFile, alignedPairs);
-            }
-            //Convert to ordered list of sequence coordinate pairs
-            stList_mapReplace(alignedPairs, convertToAnchorPair, NULL);
-            stList_sort(alignedPairs, (int (*)(const void *, const void *)) stIntTuple_cmpFn); //Ensure we have an monotonically increasing ordering
-            //Convert back to cigar
-            struct PairwiseAlignment *rPA = convertAlignedPairsToPairwiseAlignment(pA->contig1, pA->contig2, pA->score,
-                    pA->end1, pA->end2, alignedPairs);
-            //Rebase realigned-pA.
-            rebasePairwiseAlignmentCoordinates(&(rPA->start1), &(rPA->end1), &(rPA->strand1), coordinateShift1,
-                    flipStrand1);
-            rebasePairwiseAlignmentCoordinates(&(rPA->start2), &(rPA->end2), &(rPA->strand2), coordinateShift2,
-                    flipStrand2);
-            checkPairwiseAlignment(rPA);
-            //Write out alignment
-            if (splitIndelsLongerThanThis != -1) {
-                // Write multiple split alignments
-                stList *pAs = splitPairwiseAlignment(rPA, splitIndelsLongerThanThis);
-                for (i = 0; i < stList_length(pAs); i++) {
-                    cigarWrite(fileHandleOut, stList_get(pAs, i), 0);
-                }
-                stList_destruct(pAs);
-            } else {
-                // Write just one unsplit alignment
-                cigarWrite(fileHandleOut, rPA, 0);
-            }
-
-            //Clean up
-            stList_destruct(alignedPairs);
-            destructPairwiseAlignment(rPA);
-        }
-        destructPairwiseAlignment(pA);
-        stList_destruct(filteredAnchoredPairs);
-        stList_destruct(anchorPairs);
-        free(subSeqX);
-        free(subSeqY);
+        RealignJob *job = st_malloc(sizeof(RealignJob));
+        job->index = nbAlignments++;
+        job->pA = pA;
+        threadPool_push(pool, realign, job);
     }
-    stHash_destruct(sequences);
+    threadPool_destruct(pool);
+    reorderBuffer_destruct(options.output);
+    stList_destruct(sequenceFiles);
 
     if(expectationsFile != NULL) {
         st_logInfo("Writing out expectations to file %s\n", expectationsFile);
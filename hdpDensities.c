@@ -0,0 +1,31 @@
+// Write the finalized densities of a NanoporeHDP to a file that any number of vanillaAlign processes can map
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include "sonLib.h"
+#include "hdp.h"
+#include "nanopore_hdp.h"
+
+void usage() {
+    fprintf(stderr, "hdpDensities nhdpFile densitiesFile\n");
+    fprintf(stderr, "Writes only the finalized densities of the HDP (no data or Gibbs state) in the binary layout.\n");
+    fprintf(stderr, "vanillaAlign -v/-w take it like any HDP file, processes loading the same file share one copy of "
+            "the densities\n");
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 3) {
+        usage();
+        return 1;
+    }
+    NanoporeHDP *nHdp = deserialize_nhdp(argv[1]);
+    if (!is_sampling_finalized(nHdp->hdp)) {
+        st_errAbort("hdpDensities - the distributions of %s are not finalized\n", argv[1]);
+    }
+    serialize_nhdp_densities_binary(nHdp, argv[2]);
+    fprintf(stderr, "hdpDensities - wrote densities of %" PRIi64 " Dirichlet processes to %s\n",
+            get_num_dir_proc(nHdp->hdp), argv[2]);
+    destroy_nanopore_hdp(nHdp);
+    return 0;
+}
@@ -2,6 +2,7 @@
 #include <inttypes.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include "hdp_math_utils.h"
 #include "discreteHmm.h"
@@ -9,6 +10,7 @@
 #include "stateMachine.h"
 #include "pairwiseAligner.h"
 #include "continuousHmm.h"
+#include "nanopore.h"
 
 
 static HmmContinuous *hmmContinuous_constructEmpty(
@@ -57,7 +59,13 @@ static bool hmmContinuous_checkTransitions(double *transitions, int64_t nbTransi
     return TRUE;
 }
 
-static inline Hmm *hmmContinuous_loadSignalHmmFromFile(const char *fileName, StateMachineType type) {
+static bool hmmContinuous_isBinaryFile(const char *fileName);
+
+static Hmm *hmmContinuous_loadFromBinaryFile(const char *fileName, StateMachineType type);
+
+static void *hmmContinuous_realloc(void *array, int64_t size);
+
+Hmm *hmmContinuous_loadSignalHmmFromFile(const char *fileName, StateMachineType type) {
     if (type == vanilla) {
         Hmm *hmm = vanillaHmm_loadFromFile(fileName);
         return hmm;
@@ -73,7 +81,7 @@ static inline Hmm *hmmContinuous_loadSignalHmmFromFile(const char *fileName, Sta
     return 0;
 }
 
-static inline void hmmContinuous_loadExpectations(StateMachine *sM, Hmm *hmm, StateMachineType type) { // todo rename this function
+void hmmContinuous_loadExpectations(StateMachine *sM, Hmm *hmm, StateMachineType type) { // todo rename this function
 
     if (type == vanilla) {
         vanillaHmm_loadKmerSkipBinExpectations(sM, hmm);
@@ -271,6 +279,9 @@ void continuousPairHmm_writeToFile(Hmm *hmm, FILE *fileHandle) {
 }
 
 Hmm *continuousPairHmm_loadFromFile(const char *fileName) {
+    if (hmmContinuous_isBinaryFile(fileName)) {
+        return hmmContinuous_loadFromBinaryFile(fileName, threeState);
+    }
     // open file
     FILE *fH = fopen(fileName, "r");
 
@@ -517,7 +528,9 @@ void vanillaHmm_writeToFile(Hmm *hmm, FILE *fileHandle) {
 }
 
 Hmm *vanillaHmm_loadFromFile(const char *fileName) {
-
+    if (hmmContinuous_isBinaryFile(fileName)) {
+        return hmmContinuous_loadFromBinaryFile(fileName, vanilla);
+    }
     // open file
     FILE *fH = fopen(fileName, "r");
 
@@ -628,19 +641,38 @@ Hmm *vanillaHmm_loadFromFile(const char *fileName) {
     return (Hmm *)vHmm;
 }
 /////////////////////////////////////////////////// HDP HMM  //////////////////////////////////////////////////////////
+// makes room for nbAssignments more assignments
+static void hdpHmm_reserveAssignments(HdpHmm *hdpHmm, int64_t nbAssignments) {
+    if (hdpHmm->numberOfAssignments + nbAssignments <= hdpHmm->maxAssignments) {
+        return;
+    }
+    int64_t maxAssignments = hdpHmm->maxAssignments < 1024 ? 1024 : 2 * hdpHmm->maxAssignments;
+    if (maxAssignments < hdpHmm->numberOfAssignments + nbAssignments) {
+        maxAssignments = hdpHmm->numberOfAssignments + nbAssignments;
+    }
+    hdpHmm->eventAssignments = hmmContinuous_realloc(hdpHmm->eventAssignments, sizeof(float) * maxAssignments);
+    hdpHmm->kmerAssignments = hmmContinuous_realloc(hdpHmm->kmerAssignments,
+                                                    sizeof(char) * maxAssignments * KMER_LENGTH);
+    hdpHmm->maxAssignments = maxAssignments;
+}
+
+// appends nbAssignments events means and kmers (KMER_LENGTH characters each) to the assignments
+static void hdpHmm_appendAssignments(HdpHmm *hdpHmm, const float *events, const char *kmers, int64_t nbAssignments) {
+    hdpHmm_reserveAssignments(hdpHmm, nbAssignments);
+    memcpy(hdpHmm->eventAssignments + hdpHmm->numberOfAssignments, events, sizeof(float) * nbAssignments);
+    memcpy(hdpHmm->kmerAssignments + hdpHmm->numberOfAssignments * KMER_LENGTH, kmers,
+           sizeof(char) * nbAssignments * KMER_LENGTH);
+    hdpHmm->numberOfAssignments += nbAssignments;
+}
+
 static void hdpHmm_addToAssignment(Hmm *self, void *kmer, void *event) {
     HdpHmm *hdpHmm = (HdpHmm *)self;
-    stList_append(hdpHmm->kmerAssignments, kmer);
-    stList_append(hdpHmm->eventAssignments, event);
+    hdpHmm_reserveAssignments(hdpHmm, 1);
+    hdpHmm->eventAssignments[hdpHmm->numberOfAssignments] = (float) nanopore_getEventMean(event);
+    memcpy(hdpHmm->kmerAssignments + hdpHmm->numberOfAssignments * KMER_LENGTH, kmer, KMER_LENGTH);
     hdpHmm->numberOfAssignments += 1;
 }
 
-static bool hdpHmm_checkAssignments(HdpHmm *hdpHmm) {
-    int64_t nb_kmerAssignmebts = stList_length(hdpHmm->kmerAssignments);
-    int64_t nb_eventAssignmebts = stList_length(hdpHmm->kmerAssignments);
-    return nb_eventAssignmebts == nb_kmerAssignmebts ? TRUE : FALSE;
-}
-
 Hmm *hdpHmm_constructEmpty(double pseudocount, int64_t stateNumber, StateMachineType type, double threshold,
                            void (*addToTransitionExpFcn)(Hmm *hmm, int64_t from, int64_t to, double p),
                            void (*setTransitionFcn)(Hmm *hmm, int64_t from, int64_t to, double p),
@@ -668,9 +700,10 @@ Hmm *hdpHmm_constructEmpty(double pseudocount, int64_t stateNumber, StateMachine
     // HDP specific stuff
     hmm->threshold = threshold;  // threshold for assignments (must be >= threshold to be an assignment)
     hmm->addToAssignments = hdpHmm_addToAssignment;  // function to add to assignment tally
-    hmm->kmerAssignments = stList_construct3(0, &free);  // list of kmers that are assigned
-    hmm->eventAssignments = stList_construct3(0, &free);  // to the list of events
+    hmm->kmerAssignments = NULL;  // kmers that are assigned
+    hmm->eventAssignments = NULL;  // to the event means
     hmm->numberOfAssignments = 0;  // total number of assignments
+    hmm->maxAssignments = 0;  // allocated with the first assignment
     hmm->nhdp = NULL;  // initialized to NULL
 
     return (Hmm *)hmm;
@@ -716,8 +749,7 @@ void hdpHmm_writeToFile(Hmm *hmm, FILE *fileHandle) {
     int64_t nb_transitions = (hdpHmm->baseHmm.stateNumber * hdpHmm->baseHmm.stateNumber);
 
     bool transitionCheck = hmmContinuous_checkTransitions(hdpHmm->transitions, nb_transitions);
-    bool assignmentCheck = hdpHmm_checkAssignments(hdpHmm);
-    if (transitionCheck && assignmentCheck) {
+    if (transitionCheck) {
         // write out transitions
         for (int64_t i = 0; i < nb_transitions; i++) {
             // transitions 1:(0-9)
@@ -729,15 +761,14 @@ void hdpHmm_writeToFile(Hmm *hmm, FILE *fileHandle) {
 
         // write out the assignment events
         for (int64_t i = 0; i < hdpHmm->numberOfAssignments; i++) {
-            double *meanCurrent = stList_get(hdpHmm->eventAssignments, i);
-            fprintf(fileHandle, "%lf\t", *meanCurrent);
+            fprintf(fileHandle, "%lf\t", hdpHmm->eventAssignments[i]);
         }
         fprintf(fileHandle, "\n"); // newLine
 
         // write out the assignment kmers
         for (int64_t i = 0; i < hdpHmm->numberOfAssignments; i++) {
             // get the starting position in the kmer sequence
-            char *kmer = stList_get(hdpHmm->kmerAssignments, i);
+            char *kmer = hdpHmm->kmerAssignments + i * KMER_LENGTH;
             for (int64_t n = 0; n < KMER_LENGTH; n++) {
                 fprintf(fileHandle, "%c", kmer[n]);
             }
@@ -748,7 +779,29 @@ void hdpHmm_writeToFile(Hmm *hmm, FILE *fileHandle) {
     }
 }
 
+// replaces the data of the HDP with the assignments
+void hdpHmm_passAssignmentsToHdp(Hmm *hmm, NanoporeHDP *nHdp) {
+    HdpHmm *hdpHmm = (HdpHmm *)hmm;
+    double *signal = st_malloc(sizeof(double) * hdpHmm->numberOfAssignments);
+    int64_t *dp_ids = st_malloc(sizeof(int64_t) * hdpHmm->numberOfAssignments);
+    for (int64_t i = 0; i < hdpHmm->numberOfAssignments; i++) {
+        signal[i] = hdpHmm->eventAssignments[i];
+        dp_ids[i] = kmer_id(hdpHmm->kmerAssignments + i * KMER_LENGTH, nHdp->alphabet, nHdp->alphabet_size,
+                            nHdp->kmer_length);
+    }
+    reset_hdp_data(nHdp->hdp);
+    pass_data_to_hdp(nHdp->hdp, signal, dp_ids, hdpHmm->numberOfAssignments);
+}
+
 Hmm *hdpHmm_loadFromFile(const char *fileName, NanoporeHDP *nHdp) {
+    if (hmmContinuous_isBinaryFile(fileName)) {
+        HdpHmm *hdpHmm = (HdpHmm *)hmmContinuous_loadFromBinaryFile(fileName, threeStateHdp);
+        hdpHmm->nhdp = nHdp;
+        if (nHdp != NULL) {
+            hdpHmm_passAssignmentsToHdp((Hmm *)hdpHmm, nHdp);
+        }
+        return (Hmm *)hdpHmm;
+    }
     // open file
     FILE *fH = fopen(fileName, "r");
 
@@ -793,7 +846,6 @@ Hmm *hdpHmm_loadFromFile(const char *fileName, NanoporeHDP *nHdp) {
                                      continuousPairHmm_getTransitionExpectation);
 
     HdpHmm *hdpHmm = (HdpHmm *)hmm;  // downcast
-    hdpHmm->numberOfAssignments = numberOfAssignments;
     hdpHmm->nhdp = nHdp;
 
     // cleanup
@@ -832,59 +884,44 @@ Hmm *hdpHmm_loadFromFile(const char *fileName, NanoporeHDP *nHdp) {
     free(string);
     stList_destruct(tokens);
 
-    // load the assignments into the Nanopore HDP [this is basically the same as Jordan's code for updating from
-    // an alignment]
-    if (nHdp != NULL) {
-        // make stLists to hold things temporarily
-        stList *signalList = stList_construct3(0, &free);
-
+    // load the assignments, then into the Nanopore HDP
+    hdpHmm_reserveAssignments(hdpHmm, numberOfAssignments);
+    if (numberOfAssignments > 0) {
         // parse the events (current means)
         string = stFile_getLineFromFile(fH);
         tokens = stString_split(string);
-
-        // check to make sure everything is there
-        if (stList_length(tokens) != hdpHmm->numberOfAssignments) {
+        if (stList_length(tokens) != numberOfAssignments) {
             st_errAbort("Incorrect number of events got %lld, should be %lld\n",
-                        stList_length(tokens), hdpHmm->numberOfAssignments);
+                        stList_length(tokens), numberOfAssignments);
         }
-
-        // parse the events into a list
-        char *signal_str;
-        for (int64_t i = 0; i < hdpHmm->numberOfAssignments; i++) {
-            signal_str = (char *)stList_get(tokens, i);
-            double *signal_ptr = (double *)st_malloc(sizeof(double));
-            sscanf(signal_str, "%lf", signal_ptr);
-            stList_append(signalList, signal_ptr);
+        for (int64_t i = 0; i < numberOfAssignments; i++) {
+            if (sscanf(stList_get(tokens, i), "%f", &(hdpHmm->eventAssignments[i])) != 1) {
+                st_errAbort("Failed to parse event mean (float) from string: %s\n", (char *)stList_get(tokens, i));
+            }
         }
-
-        // cleanup event line
         free(string);
         stList_destruct(tokens);
 
         // parse the kmer assignment line
-
         string = stFile_getLineFromFile(fH);
         tokens = stString_split(string);
-        if (stList_length(tokens) != hdpHmm->numberOfAssignments) {
-            st_errAbort("Incorrect number of events got %lld, should be %lld\n",
-                        stList_length(tokens), hdpHmm->numberOfAssignments);
+        if (stList_length(tokens) != numberOfAssignments) {
+            st_errAbort("Incorrect number of kmers got %lld, should be %lld\n",
+                        stList_length(tokens), numberOfAssignments);
         }
-        char *assignedKmer;
-        int64_t *dp_ids = st_malloc(sizeof(int64_t) * hdpHmm->numberOfAssignments);
-        for (int64_t i = 0; i < hdpHmm->numberOfAssignments; i++) {
-            assignedKmer = (char *)stList_get(tokens, i);
-            dp_ids[i] = kmer_id(assignedKmer, nHdp->alphabet, nHdp->alphabet_size, nHdp->kmer_length);
+        for (int64_t i = 0; i < numberOfAssignments; i++) {
+            char *assignedKmer = stList_get(tokens, i);
+            if (strlen(assignedKmer) != KMER_LENGTH) {
+                st_errAbort("Failed to parse kmer from string: %s\n", assignedKmer);
+            }
+            memcpy(hdpHmm->kmerAssignments + i * KMER_LENGTH, assignedKmer, KMER_LENGTH);
         }
-        // cleanup
         free(string);
         stList_destruct(tokens);
-
-        // convert to arrays
-        int64_t dataLength;
-        double *signal = stList_toDoublePtr(signalList, &dataLength);
-        stList_destruct(signalList);
-        reset_hdp_data(nHdp->hdp);
-        pass_data_to_hdp(nHdp->hdp, signal, dp_ids, dataLength);
+    }
+    hdpHmm->numberOfAssignments = numberOfAssignments;
+    if (nHdp != NULL) {
+        hdpHmm_passAssignmentsToHdp((Hmm *)hdpHmm, nHdp);
     }
     // close file
     fclose(fH);
@@ -950,13 +987,204 @@ int64_t hmmContinuous_howManyAssignments(Hmm *hmm) {
 }
 
 void hmmContinuous_normalize(Hmm *hmm, StateMachineType type) {
-    assert((type == vanilla) || (type == threeState));
+    assert((type == vanilla) || (type == threeState) || (type == threeStateHdp));
     if (type == vanilla) {
         vanillaHmm_normalizeKmerSkipBins(hmm);
     }
     if (type == threeState) {
         continuousPairHmm_normalize(hmm);
     }
+    if (type == threeStateHdp) {
+        // only the transitions, the assignments are data for the HDP
+        hmmDiscrete_normalize2(hmm, FALSE);
+    }
+}
+
+void hmmContinuous_addExpectations(Hmm *hmm, Hmm *other, StateMachineType type) {
+    if (hmm->type != type || other->type != type || hmm->stateNumber != other->stateNumber
+        || hmm->symbolSetSize != other->symbolSetSize) {
+        st_errAbort("hmmContinuous_addExpectations - ERROR: can't add expectations of a different HMM\n");
+    }
+    hmm->likelihood += other->likelihood;
+    int64_t nb_transitions = hmm->stateNumber * hmm->stateNumber;
+    if (type == threeState) {
+        ContinuousPairHmm *cpHmm = (ContinuousPairHmm *)hmm, *cpOther = (ContinuousPairHmm *)other;
+        for (int64_t i = 0; i < nb_transitions; i++) {
+            cpHmm->transitions[i] += cpOther->transitions[i];
+        }
+        for (int64_t i = 0; i < hmm->symbolSetSize; i++) {
+            cpHmm->individualKmerGapProbs[i] += cpOther->individualKmerGapProbs[i];
+        }
+    }
+    if (type == vanilla) {
+        VanillaHmm *vHmm = (VanillaHmm *)hmm, *vOther = (VanillaHmm *)other;
+        for (int64_t i = 0; i < 60; i++) {
+            vHmm->kmerSkipBins[i] += vOther->kmerSkipBins[i];
+        }
+        int64_t nb_matchModelBuckets = 1 + (hmm->symbolSetSize * MODEL_PARAMS);
+        memcpy(vHmm->matchModel, vOther->matchModel, sizeof(double) * nb_matchModelBuckets);
+        memcpy(vHmm->scaledMatchModel, vOther->scaledMatchModel, sizeof(double) * nb_matchModelBuckets);
+    }
+    if (type == threeStateHdp) {
+        HdpHmm *hdpHmm = (HdpHmm *)hmm, *hdpOther = (HdpHmm *)other;
+        for (int64_t i = 0; i < nb_transitions; i++) {
+            hdpHmm->transitions[i] += hdpOther->transitions[i];
+        }
+        hdpHmm_appendAssignments(hdpHmm, hdpOther->eventAssignments, hdpOther->kmerAssignments,
+                                 hdpOther->numberOfAssignments);
+    }
+}
+
+void hmmContinuous_maximize(Hmm *hmm, StateMachineType type) {
+    if (type != vanilla) {
+        hmmContinuous_normalize(hmm, type);
+        return;
+    }
+    for (int64_t half = 0; half < 2; half++) {
+        double total = 0.0;
+        for (int64_t i = half * 30; i < (half + 1) * 30; i++) {
+            total += hmm->getTransitionsExpFcn(hmm, i, 0);
+        }
+        for (int64_t i = half * 30; i < (half + 1) * 30; i++) {
+            hmm->setTransitionFcn(hmm, i, 0, hmm->getTransitionsExpFcn(hmm, i, 0) / total);
+        }
+    }
+}
+
+// the trained parameters of a normalized HMM as (at most two) arrays, the vanilla match models and the HDP
+// assignments aren't trained by the M-step
+static int64_t hmmContinuous_getParameterArrays(Hmm *hmm, StateMachineType type, double **arrays, int64_t *lengths) {
+    if (hmm->type != type) {
+        st_errAbort("hmmContinuous - ERROR: got HMM of type %i instead of %i\n", hmm->type, type);
+    }
+    if (type == threeState) {
+        ContinuousPairHmm *cpHmm = (ContinuousPairHmm *)hmm;
+        arrays[0] = cpHmm->transitions;
+        lengths[0] = hmm->stateNumber * hmm->stateNumber;
+        arrays[1] = cpHmm->individualKmerGapProbs;
+        lengths[1] = hmm->symbolSetSize;
+        return 2;
+    }
+    if (type == vanilla) {
+        arrays[0] = ((VanillaHmm *)hmm)->kmerSkipBins;
+        lengths[0] = 60;
+        return 1;
+    }
+    if (type == threeStateHdp) {
+        arrays[0] = ((HdpHmm *)hmm)->transitions;
+        lengths[0] = hmm->stateNumber * hmm->stateNumber;
+        return 1;
+    }
+    st_errAbort("hmmContinuous - ERROR: got unsupported HMM type %i\n", type);
+    return 0;
+}
+
+double hmmContinuous_squaremExtrapolate(Hmm *hmm0, Hmm *hmm1, Hmm *hmm2, Hmm *out, StateMachineType type) {
+    Hmm *hmms[4] = { hmm0, hmm1, hmm2, out };
+    double *arrays[4][2];
+    double **parameters[4];
+    int64_t lengths[2];
+    int64_t nbArrays = 0;
+    for (int64_t h = 0; h < 4; h++) {
+        if (hmms[h]->stateNumber != hmm0->stateNumber || hmms[h]->symbolSetSize != hmm0->symbolSetSize) {
+            st_errAbort("hmmContinuous_squaremExtrapolate - ERROR: got HMMs of different shapes\n");
+        }
+        nbArrays = hmmContinuous_getParameterArrays(hmms[h], type, arrays[h], lengths);
+        parameters[h] = arrays[h];
+    }
+    double alpha = hmm_squaremExtrapolate(parameters, lengths, nbArrays);
+    hmmContinuous_maximize(out, type);
+    out->likelihood = 0.0;
+    return alpha;
+}
+
+static Hmm *hmmContinuous_copy(Hmm *hmm, StateMachineType type) {
+    Hmm *copy = hmmContinuous_getEmptyHmm(type, 0.0, 0.0);
+    hmmContinuous_addExpectations(copy, hmm, type);
+    return copy;
+}
+
+void hmmContinuous_squaremStart(HmmSquaremCycle *cycle, Hmm *hmm0, StateMachineType type) {
+    if (type == threeStateHdp) {
+        st_errAbort("hmmContinuous_squaremStart - ERROR: can't extrapolate the EM steps of the HDP models\n");
+    }
+    cycle->hmms[0] = hmmContinuous_copy(hmm0, type);
+    cycle->hmms[1] = NULL;
+    cycle->hmms[2] = NULL;
+    cycle->alpha = 0.0;
+    cycle->rejected = FALSE;
+    cycle->step = 1;
+}
+
+Hmm *hmmContinuous_squaremStep(HmmSquaremCycle *cycle, Hmm *hmm, double likelihood, StateMachineType type) {
+    if (cycle->step == 1) {
+        cycle->hmms[1] = hmmContinuous_copy(hmm, type);
+        cycle->step = 2;
+        return hmm;
+    }
+    if (cycle->step == 2) {
+        // the next EM step runs from the extrapolation
+        cycle->hmms[2] = hmm;
+        cycle->likelihood = likelihood;
+        Hmm *extrapolated = hmmContinuous_copy(hmm, type);
+        cycle->alpha = hmmContinuous_squaremExtrapolate(cycle->hmms[0], cycle->hmms[1], cycle->hmms[2],
+                                                        extrapolated, type);
+        cycle->step = 3;
+        return extrapolated;
+    }
+    if (cycle->step != 3) {
+        st_errAbort("hmmContinuous_squaremStep - ERROR: no SQUAREM cycle to go on with\n");
+    }
+    cycle->rejected = likelihood < cycle->likelihood;
+    if (cycle->rejected) {
+        hmmContinuous_destruct(hmm, type);
+        hmm = cycle->hmms[2];
+    } else {
+        hmmContinuous_destruct(cycle->hmms[2], type);
+    }
+    hmmContinuous_destruct(cycle->hmms[0], type);
+    hmmContinuous_destruct(cycle->hmms[1], type);
+    cycle->hmms[0] = cycle->hmms[1] = cycle->hmms[2] = NULL;
+    cycle->step = 0;
+    return hmm;
+}
+
+void hmmContinuous_blendExpectations(Hmm *hmm, Hmm *other, double stepSize, double scale, StateMachineType type) {
+    if (hmm->stateNumber != other->stateNumber || hmm->symbolSetSize != other->symbolSetSize) {
+        st_errAbort("hmmContinuous_blendExpectations - ERROR: can't blend expectations of a different HMM\n");
+    }
+    double *arrays[2], *otherArrays[2];
+    int64_t lengths[2];
+    int64_t nbArrays = hmmContinuous_getParameterArrays(hmm, type, arrays, lengths);
+    hmmContinuous_getParameterArrays(other, type, otherArrays, lengths);
+    for (int64_t a = 0; a < nbArrays; a++) {
+        for (int64_t i = 0; i < lengths[a]; i++) {
+            arrays[a][i] = (1 - stepSize) * arrays[a][i] + stepSize * scale * otherArrays[a][i];
+        }
+    }
+    hmm->likelihood = (1 - stepSize) * hmm->likelihood + stepSize * scale * other->likelihood;
+    if (type == vanilla) {
+        VanillaHmm *vHmm = (VanillaHmm *)hmm, *vOther = (VanillaHmm *)other;
+        int64_t nb_matchModelBuckets = 1 + (hmm->symbolSetSize * MODEL_PARAMS);
+        memcpy(vHmm->matchModel, vOther->matchModel, sizeof(double) * nb_matchModelBuckets);
+        memcpy(vHmm->scaledMatchModel, vOther->scaledMatchModel, sizeof(double) * nb_matchModelBuckets);
+    }
+}
+
+Hmm *hmmContinuous_stepwiseEmUpdate(Hmm *running, Hmm *expectations, int64_t nbReads, int64_t update,
+                                    double stepSizeDecay, StateMachineType type) {
+    if (type == threeStateHdp) {
+        st_errAbort("hmmContinuous_stepwiseEmUpdate - ERROR: no stepwise EM for the HDP models, they are sampled\n");
+    }
+    if (nbReads < 1) {
+        st_errAbort("hmmContinuous_stepwiseEmUpdate - ERROR: got a mini-batch of %" PRIi64 " reads\n", nbReads);
+    }
+    hmmContinuous_blendExpectations(running, expectations, hmm_stepwiseEmStepSize(update, stepSizeDecay),
+                                    1.0 / nbReads, type);
+    // M-step from a copy, the running expectations go on
+    Hmm *hmm = hmmContinuous_copy(running, type);
+    hmmContinuous_maximize(hmm, type);
+    return hmm;
 }
 
 void hmmContinuous_writeToFile(const char *outFile, Hmm *hmm, StateMachineType type) {
@@ -985,4 +1213,317 @@ void hmmContinuous_destruct(Hmm *hmm, StateMachineType type) {
     if (type == threeStateHdp) {
         hdpHmm_destruct(hmm);
     }
-}
\ No newline at end of file
+}
+////////////////////////////////////////////// BINARY EXPECTATIONS ////////////////////////////////////////////////////
+// size of the header of the binary layout, magic, version, type, kmer length, five lengths, threshold and likelihood
+#define HMM_EXPECTATIONS_BINARY_HEADER_LENGTH (4 + 3 * sizeof(int32_t) + 5 * sizeof(int64_t) + 2 * sizeof(double))
+
+typedef struct _binaryExpectationsHeader {
+    int32_t type;
+    int32_t kmerLength;
+    int64_t stateNumber;
+    int64_t symbolSetSize;
+    int64_t nbExpectations;
+    int64_t nbParameters;
+    int64_t nbAssignments;
+    double threshold;
+    double likelihood;
+} BinaryExpectationsHeader;
+
+// expectations summed over a contiguous slice of the files being merged
+typedef struct _expectationsSlice {
+    double likelihood;
+    double *expectations;
+    int64_t nbAssignments;
+    int64_t maxAssignments;
+    float *events;
+    char *kmers;
+} ExpectationsSlice;
+
+// blocks are zero padded to a multiple of 8 bytes
+static int64_t hmmContinuous_binaryBlockLength(int64_t length) {
+    return ((length + 7) / 8) * 8;
+}
+
+static void hmmContinuous_checkLittleEndian() {
+    uint16_t one = 1;
+    if (*((uint8_t *) &one) != 1) {
+        st_errAbort("binary expectation files are little-endian, not supported on this machine\n");
+    }
+}
+
+static int64_t hmmContinuous_binaryNumberOfExpectations(int64_t type, int64_t stateNumber, int64_t symbolSetSize) {
+    if (type == threeState) {
+        return stateNumber * stateNumber + symbolSetSize;
+    }
+    if (type == vanilla) {
+        return 60;
+    }
+    if (type == threeStateHdp) {
+        return stateNumber * stateNumber;
+    }
+    st_errAbort("hmmContinuous - ERROR: no binary expectations for HMM type %" PRIi64 "\n", type);
+    return 0;
+}
+
+static int64_t hmmContinuous_binaryNumberOfParameters(int64_t type, int64_t symbolSetSize) {
+    return type == vanilla ? 2 * (1 + (symbolSetSize * MODEL_PARAMS)) : 0;
+}
+
+static void *hmmContinuous_realloc(void *array, int64_t size) {
+    void *newArray = realloc(array, size);
+    if (newArray == NULL && size > 0) {
+        st_errAbort("hmmContinuous: failed to allocate %" PRIi64 " bytes\n", size);
+    }
+    return newArray;
+}
+
+static void hmmContinuous_fwrite(const void *data, size_t size, int64_t n, FILE *fH, const char *file) {
+    if (n > 0 && fwrite(data, size, n, fH) != (size_t) n) {
+        st_errAbort("error writing binary expectations file %s\n", file);
+    }
+}
+
+// writes the array followed by the zero padding of its block
+static void hmmContinuous_fwriteBlock(const void *data, int64_t length, FILE *fH, const char *file) {
+    static const char padding[8] = { 0 };
+    hmmContinuous_fwrite(data, sizeof(char), length, fH, file);
+    hmmContinuous_fwrite(padding, sizeof(char), hmmContinuous_binaryBlockLength(length) - length, fH, file);
+}
+
+static void hmmContinuous_fread(void *data, size_t size, int64_t n, FILE *fH, const char *file) {
+    if (n > 0 && fread(data, size, n, fH) != (size_t) n) {
+        st_errAbort("binary expectations file %s is truncated\n", file);
+    }
+}
+
+static void hmmContinuous_fskip(int64_t length, FILE *fH, const char *file) {
+    if (length > 0 && fseek(fH, length, SEEK_CUR) != 0) {
+        st_errAbort("binary expectations file %s is truncated\n", file);
+    }
+}
+
+static bool hmmContinuous_isBinaryFile(const char *fileName) {
+    // binary files start with the magic, the text formats start with the type
+    FILE *fH = fopen(fileName, "rb");
+    if (fH == NULL) {
+        st_errAbort("hmmContinuous - ERROR: couldn't open %s\n", fileName);
+    }
+    char magic[4];
+    bool binary = fread(magic, sizeof(char), 4, fH) == 4
+                  && memcmp(magic, HMM_EXPECTATIONS_BINARY_MAGIC, 4) == 0;
+    fclose(fH);
+    return binary;
+}
+
+void hmmContinuous_writeToBinaryFile(const char *outFile, Hmm *hmm, StateMachineType type) {
+    if ((type != threeStateHdp) && (type != threeState) && (type != vanilla)) {
+        st_errAbort("hmmContinuous_writeToBinaryFile - ERROR: got unsupported HMM type %i\n", type);
+    }
+    hmmContinuous_checkLittleEndian();
+    FILE *fH = fopen(outFile, "wb");
+    if (fH == NULL) {
+        st_errAbort("hmmContinuous_writeToBinaryFile - ERROR: couldn't open %s for writing\n", outFile);
+    }
+    HdpHmm *hdpHmm = type == threeStateHdp ? (HdpHmm *)hmm : NULL;
+    int64_t nbAssignments = hdpHmm != NULL ? hdpHmm->numberOfAssignments : 0;
+    int32_t fields[3] = { HMM_EXPECTATIONS_BINARY_VERSION, type, KMER_LENGTH };
+    int64_t lengths[5] = { hmm->stateNumber, hmm->symbolSetSize,
+                           hmmContinuous_binaryNumberOfExpectations(type, hmm->stateNumber, hmm->symbolSetSize),
+                           hmmContinuous_binaryNumberOfParameters(type, hmm->symbolSetSize),
+                           nbAssignments };
+    double values[2] = { hdpHmm != NULL ? hdpHmm->threshold : 0.0, hmm->likelihood };
+    hmmContinuous_fwrite(HMM_EXPECTATIONS_BINARY_MAGIC, sizeof(char), 4, fH, outFile);
+    hmmContinuous_fwrite(fields, sizeof(int32_t), 3, fH, outFile);
+    hmmContinuous_fwrite(lengths, sizeof(int64_t), 5, fH, outFile);
+    hmmContinuous_fwrite(values, sizeof(double), 2, fH, outFile);
+
+    int64_t nb_transitions = hmm->stateNumber * hmm->stateNumber;
+    if (type == threeState) {
+        ContinuousPairHmm *cpHmm = (ContinuousPairHmm *)hmm;
+        hmmContinuous_fwrite(cpHmm->transitions, sizeof(double), nb_transitions, fH, outFile);
+        hmmContinuous_fwrite(cpHmm->individualKmerGapProbs, sizeof(double), hmm->symbolSetSize, fH, outFile);
+    }
+    if (type == vanilla) {
+        VanillaHmm *vHmm = (VanillaHmm *)hmm;
+        int64_t nb_matchModelBuckets = 1 + (hmm->symbolSetSize * MODEL_PARAMS);
+        hmmContinuous_fwrite(vHmm->kmerSkipBins, sizeof(double), 60, fH, outFile);
+        hmmContinuous_fwrite(vHmm->matchModel, sizeof(double), nb_matchModelBuckets, fH, outFile);
+        hmmContinuous_fwrite(vHmm->scaledMatchModel, sizeof(double), nb_matchModelBuckets, fH, outFile);
+    }
+    if (type == threeStateHdp) {
+        hmmContinuous_fwrite(hdpHmm->transitions, sizeof(double), nb_transitions, fH, outFile);
+        hmmContinuous_fwriteBlock(hdpHmm->eventAssignments, nbAssignments * sizeof(float), fH, outFile);
+        hmmContinuous_fwriteBlock(hdpHmm->kmerAssignments, nbAssignments * KMER_LENGTH, fH, outFile);
+    }
+    if (fclose(fH) != 0) {
+        st_errAbort("error writing binary expectations file %s\n", outFile);
+    }
+}
+
+static void hmmContinuous_readBinaryHeader(FILE *fH, const char *file, BinaryExpectationsHeader *header) {
+    char magic[4];
+    int32_t fields[3];
+    int64_t lengths[5];
+    double values[2];
+    if (fread(magic, sizeof(char), 4, fH) != 4 || memcmp(magic, HMM_EXPECTATIONS_BINARY_MAGIC, 4) != 0) {
+        st_errAbort("%s is not a binary expectations file\n", file);
+    }
+    hmmContinuous_fread(fields, sizeof(int32_t), 3, fH, file);
+    hmmContinuous_fread(lengths, sizeof(int64_t), 5, fH, file);
+    hmmContinuous_fread(values, sizeof(double), 2, fH, file);
+    if (fields[0] != HMM_EXPECTATIONS_BINARY_VERSION) {
+        st_errAbort("binary expectations file %s has version %" PRIi32 ", expected %d\n", file, fields[0],
+                    HMM_EXPECTATIONS_BINARY_VERSION);
+    }
+    header->type = fields[1];
+    header->kmerLength = fields[2];
+    header->stateNumber = lengths[0];
+    header->symbolSetSize = lengths[1];
+    header->nbExpectations = lengths[2];
+    header->nbParameters = lengths[3];
+    header->nbAssignments = lengths[4];
+    header->threshold = values[0];
+    header->likelihood = values[1];
+    if (header->stateNumber < 0 || header->symbolSetSize < 0 || header->nbAssignments < 0
+        || header->kmerLength != KMER_LENGTH
+        || header->nbExpectations != hmmContinuous_binaryNumberOfExpectations(header->type, header->stateNumber,
+                                                                               header->symbolSetSize)
+        || header->nbParameters != hmmContinuous_binaryNumberOfParameters(header->type, header->symbolSetSize)) {
+        st_errAbort("binary expectations file %s has an invalid header\n", file);
+    }
+}
+
+// adds the expectations of the file to the slice, the file has to have the same shape as the first file
+static void hmmContinuous_addBinaryExpectations(ExpectationsSlice *slice, const char *file,
+                                                BinaryExpectationsHeader *shape, double *buffer) {
+    FILE *fH = fopen(file, "rb");
+    if (fH == NULL) {
+        st_errAbort("hmmContinuous - ERROR: couldn't open %s\n", file);
+    }
+    BinaryExpectationsHeader header;
+    hmmContinuous_readBinaryHeader(fH, file, &header);
+    if (header.type != shape->type || header.stateNumber != shape->stateNumber
+        || header.symbolSetSize != shape->symbolSetSize || header.threshold != shape->threshold) {
+        st_errAbort("binary expectations file %s doesn't match the other expectation files\n", file);
+    }
+    hmmContinuous_fread(buffer, sizeof(double), header.nbExpectations, fH, file);
+    if (!hmmContinuous_checkTransitions(buffer, header.nbExpectations)) {
+        fprintf(stderr, "hmmContinuous - skipping %s, it has NaN expectations\n", file);
+        fclose(fH);
+        return;
+    }
+    for (int64_t i = 0; i < header.nbExpectations; i++) {
+        slice->expectations[i] += buffer[i];
+    }
+    slice->likelihood += header.likelihood;
+
+    hmmContinuous_fskip(header.nbParameters * sizeof(double), fH, file);
+    if (header.nbAssignments > 0) {
+        if (slice->nbAssignments + header.nbAssignments > slice->maxAssignments) {
+            slice->maxAssignments = 2 * (slice->nbAssignments + header.nbAssignments);
+            slice->events = hmmContinuous_realloc(slice->events, sizeof(float) * slice->maxAssignments);
+            slice->kmers = hmmContinuous_realloc(slice->kmers, sizeof(char) * slice->maxAssignments * KMER_LENGTH);
+        }
+        int64_t eventsLength = header.nbAssignments * sizeof(float);
+        hmmContinuous_fread(slice->events + slice->nbAssignments, sizeof(float), header.nbAssignments, fH, file);
+        hmmContinuous_fskip(hmmContinuous_binaryBlockLength(eventsLength) - eventsLength, fH, file);
+        hmmContinuous_fread(slice->kmers + slice->nbAssignments * KMER_LENGTH, sizeof(char),
+                            header.nbAssignments * KMER_LENGTH, fH, file);
+        slice->nbAssignments += header.nbAssignments;
+    }
+    fclose(fH);
+}
+
+Hmm *hmmContinuous_mergeBinaryExpectations(char **files, int64_t nbFiles, int64_t nbThreads) {
+    if (nbFiles < 1) {
+        st_errAbort("hmmContinuous_mergeBinaryExpectations - ERROR: need at least one expectations file\n");
+    }
+    hmmContinuous_checkLittleEndian();
+
+    // the first file gives the type, the shape and the parameters of the merged expectations
+    FILE *fH = fopen(files[0], "rb");
+    if (fH == NULL) {
+        st_errAbort("hmmContinuous - ERROR: couldn't open %s\n", files[0]);
+    }
+    BinaryExpectationsHeader shape;
+    hmmContinuous_readBinaryHeader(fH, files[0], &shape);
+    double *parameters = st_malloc(sizeof(double) * (shape.nbParameters + 1));
+    hmmContinuous_fskip(shape.nbExpectations * sizeof(double), fH, files[0]);
+    hmmContinuous_fread(parameters, sizeof(double), shape.nbParameters, fH, files[0]);
+    fclose(fH);
+
+    // each thread sums a contiguous slice of the files
+    int64_t nbSlices = nbThreads < 1 ? 1 : (nbThreads > nbFiles ? nbFiles : nbThreads);
+    ExpectationsSlice *slices = st_calloc(nbSlices, sizeof(ExpectationsSlice));
+    #pragma omp parallel for schedule(static, 1) num_threads(nbSlices)
+    for (int64_t s = 0; s < nbSlices; s++) {
+        ExpectationsSlice *slice = &slices[s];
+        slice->expectations = st_calloc(shape.nbExpectations, sizeof(double));
+        double *buffer = st_malloc(sizeof(double) * shape.nbExpectations);
+        for (int64_t f = s * nbFiles / nbSlices; f < (s + 1) * nbFiles / nbSlices; f++) {
+            hmmContinuous_addBinaryExpectations(slice, files[f], &shape, buffer);
+        }
+        free(buffer);
+    }
+
+    // add up the slices in file order
+    double *expectations = st_calloc(shape.nbExpectations, sizeof(double));
+    double likelihood = 0.0;
+    int64_t nbAssignments = 0;
+    for (int64_t s = 0; s < nbSlices; s++) {
+        for (int64_t i = 0; i < shape.nbExpectations; i++) {
+            expectations[i] += slices[s].expectations[i];
+        }
+        likelihood += slices[s].likelihood;
+        nbAssignments += slices[s].nbAssignments;
+    }
+
+    Hmm *hmm = hmmContinuous_getEmptyHmm(shape.type, 0.0, shape.threshold);
+    hmm->likelihood = likelihood;
+    int64_t nb_transitions = shape.stateNumber * shape.stateNumber;
+    if (hmm->stateNumber != shape.stateNumber || hmm->symbolSetSize != shape.symbolSetSize) {
+        st_errAbort("hmmContinuous_mergeBinaryExpectations - ERROR: %s has %" PRIi64 " states and %" PRIi64 " "
+                    "symbols, expected %" PRIi64 " and %" PRIi64 "\n", files[0], shape.stateNumber,
+                    shape.symbolSetSize, hmm->stateNumber, hmm->symbolSetSize);
+    }
+    if (shape.type == threeState) {
+        ContinuousPairHmm *cpHmm = (ContinuousPairHmm *)hmm;
+        memcpy(cpHmm->transitions, expectations, sizeof(double) * nb_transitions);
+        memcpy(cpHmm->individualKmerGapProbs, expectations + nb_transitions, sizeof(double) * shape.symbolSetSize);
+    }
+    if (shape.type == vanilla) {
+        VanillaHmm *vHmm = (VanillaHmm *)hmm;
+        int64_t nb_matchModelBuckets = shape.nbParameters / 2;
+        memcpy(vHmm->kmerSkipBins, expectations, sizeof(double) * 60);
+        memcpy(vHmm->matchModel, parameters, sizeof(double) * nb_matchModelBuckets);
+        memcpy(vHmm->scaledMatchModel, parameters + nb_matchModelBuckets, sizeof(double) * nb_matchModelBuckets);
+    }
+    if (shape.type == threeStateHdp) {
+        HdpHmm *hdpHmm = (HdpHmm *)hmm;
+        memcpy(hdpHmm->transitions, expectations, sizeof(double) * nb_transitions);
+        hdpHmm_reserveAssignments(hdpHmm, nbAssignments);
+        for (int64_t s = 0; s < nbSlices; s++) {
+            hdpHmm_appendAssignments(hdpHmm, slices[s].events, slices[s].kmers, slices[s].nbAssignments);
+        }
+    }
+
+    for (int64_t s = 0; s < nbSlices; s++) {
+        free(slices[s].expectations);
+        free(slices[s].events);
+        free(slices[s].kmers);
+    }
+    free(slices);
+    free(expectations);
+    free(parameters);
+    return hmm;
+}
+
+static Hmm *hmmContinuous_loadFromBinaryFile(const char *fileName, StateMachineType type) {
+    char *files[1] = { (char *) fileName };
+    Hmm *hmm = hmmContinuous_mergeBinaryExpectations(files, 1, 1);
+    if (hmm->type != type) {
+        st_errAbort("hmmContinuous - ERROR: %s holds HMM type %i, expected %i\n", fileName, hmm->type, type);
+    }
+    return hmm;
+}
@@ -1,5 +1,7 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <inttypes.h>
+#include <math.h>
 #include <stateMachine.h>
 #include "bioioC.h"
 #include "pairwiseAligner.h"
@@ -88,6 +90,30 @@ double hmmDiscrete_getEmissionExpectation(Hmm *hmm, int64_t state, int64_t x, in
     return hmmD->emissions[(state * hmmD->baseHmm.matrixSize) + tableIndex];
 }
 
+// Merging
+Hmm *hmmDiscrete_getEmptyClone(Hmm *hmm) {
+    return hmmDiscrete_constructEmpty(0.0, hmm->stateNumber, hmm->symbolSetSize, hmm->type,
+                                      hmm->addToTransitionExpectationFcn, hmm->setTransitionFcn,
+                                      hmm->getTransitionsExpFcn, hmm->addToEmissionExpectationFcn,
+                                      hmm->setEmissionExpectationFcn, hmm->getEmissionExpFcn,
+                                      hmm->getElementIndexFcn);
+}
+
+void hmmDiscrete_addExpectations(Hmm *hmm, Hmm *other) {
+    HmmDiscrete *hmmD = (HmmDiscrete *) hmm;
+    HmmDiscrete *otherD = (HmmDiscrete *) other;
+    if ((hmm->stateNumber != other->stateNumber) || (hmm->symbolSetSize != other->symbolSetSize)) {
+        st_errAbort("hmmDiscrete_addExpectations: HMMs have different dimensions\n");
+    }
+    for (int64_t i = 0; i < hmm->stateNumber * hmm->stateNumber; i++) {
+        hmmD->transitions[i] += otherD->transitions[i];
+    }
+    for (int64_t i = 0; i < hmm->stateNumber * hmm->matrixSize; i++) {
+        hmmD->emissions[i] += otherD->emissions[i];
+    }
+    hmm->likelihood += other->likelihood;
+}
+
 // Randomize/Normalize
 void hmmDiscrete_randomizeTransitions(Hmm *hmm) {
     for (int64_t from = 0; from < hmm->stateNumber; from++) {
@@ -152,6 +178,72 @@ void hmmDiscrete_normalize2(Hmm *hmm, bool normalizeEmissions) {
     }
 }
 
+double hmm_squaremExtrapolate(double **parameters[4], int64_t *lengths, int64_t nbArrays) {
+    double rNorm = 0.0, vNorm = 0.0;
+    for (int64_t a = 0; a < nbArrays; a++) {
+        for (int64_t i = 0; i < lengths[a]; i++) {
+            double r = parameters[1][a][i] - parameters[0][a][i];
+            double v = parameters[2][a][i] - 2 * parameters[1][a][i] + parameters[0][a][i];
+            rNorm += r * r;
+            vNorm += v * v;
+        }
+    }
+    double alpha = vNorm > 0.0 ? -sqrt(rNorm / vNorm) : -1.0;
+    if (alpha > -1.0) {
+        alpha = -1.0;
+    }
+    for (int64_t a = 0; a < nbArrays; a++) {
+        for (int64_t i = 0; i < lengths[a]; i++) {
+            double r = parameters[1][a][i] - parameters[0][a][i];
+            double v = parameters[2][a][i] - 2 * parameters[1][a][i] + parameters[0][a][i];
+            double x = parameters[0][a][i] - 2 * alpha * r + alpha * alpha * v;
+            parameters[3][a][i] = x > HMM_SQUAREM_MIN_PARAMETER ? x : HMM_SQUAREM_MIN_PARAMETER;
+        }
+    }
+    return alpha;
+}
+
+double hmm_stepwiseEmStepSize(int64_t k, double decay) {
+    if (k < 0 || decay <= 0.5 || decay > 1.0) {
+        st_errAbort("hmm_stepwiseEmStepSize - ERROR: invalid update %" PRIi64 " or decay %f\n", k, decay);
+    }
+    return pow(k + 2.0, -decay);
+}
+
+double hmmDiscrete_squaremExtrapolate(Hmm *hmm0, Hmm *hmm1, Hmm *hmm2, Hmm *out) {
+    Hmm *hmms[4] = { hmm0, hmm1, hmm2, out };
+    double *arrays[4][2];
+    double **parameters[4];
+    int64_t lengths[2] = { hmm0->stateNumber * hmm0->stateNumber,
+                           hmm0->stateNumber * hmm0->matrixSize };
+    for (int64_t h = 0; h < 4; h++) {
+        if (hmms[h]->stateNumber != hmm0->stateNumber || hmms[h]->symbolSetSize != hmm0->symbolSetSize) {
+            st_errAbort("hmmDiscrete_squaremExtrapolate - ERROR: got HMMs of different shapes\n");
+        }
+        arrays[h][0] = ((HmmDiscrete *) hmms[h])->transitions;
+        arrays[h][1] = ((HmmDiscrete *) hmms[h])->emissions;
+        parameters[h] = arrays[h];
+    }
+    double alpha = hmm_squaremExtrapolate(parameters, lengths, 2);
+    hmmDiscrete_normalize2(out, TRUE);
+    out->likelihood = 0.0;
+    return alpha;
+}
+
+void hmmDiscrete_blendExpectations(Hmm *hmm, Hmm *other, double stepSize, double scale) {
+    if (hmm->stateNumber != other->stateNumber || hmm->symbolSetSize != other->symbolSetSize) {
+        st_errAbort("hmmDiscrete_blendExpectations - ERROR: can't blend expectations of a different HMM\n");
+    }
+    HmmDiscrete *hmmD = (HmmDiscrete *) hmm, *otherD = (HmmDiscrete *) other;
+    for (int64_t i = 0; i < hmm->stateNumber * hmm->stateNumber; i++) {
+        hmmD->transitions[i] = (1 - stepSize) * hmmD->transitions[i] + stepSize * scale * otherD->transitions[i];
+    }
+    for (int64_t i = 0; i < hmm->stateNumber * hmm->matrixSize; i++) {
+        hmmD->emissions[i] = (1 - stepSize) * hmmD->emissions[i] + stepSize * scale * otherD->emissions[i];
+    }
+    hmm->likelihood = (1 - stepSize) * hmm->likelihood + stepSize * scale * other->likelihood;
+}
+
 // writers
 void hmmDiscrete_write(Hmm *hmm, FILE *fileHandle) {
     /*
@@ -3,6 +3,11 @@
 #include <stdlib.h>
 #include <float.h>
 #include <inttypes.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "hdp.h"
 #include "hdp_math_utils.h"
 #include "sonLib.h"
@@ -93,6 +98,12 @@ struct HierarchicalDirichletProcess {
     bool* s_aux_vector;
 
     stSet* distr_metric_memos;
+
+    // binary HDP file the posterior predictives and spline slopes point into (see deserialize_hdp_binary)
+    char* mapped_file;
+    int64_t mapped_file_length;
+    // data and factor records in the mapped file, only parsed once the Gibbs state is needed
+    char* unloaded_gibbs_state;
 };
 
 struct DistributionMetricMemo {
@@ -103,6 +114,10 @@ struct DistributionMetricMemo {
     double (*metric_func) (HierarchicalDirichletProcess*, int64_t, int64_t);
 };
 
+// binary serialization, defined with the other serialization functions at the end of the file
+static void load_hdp_gibbs_state(HierarchicalDirichletProcess* hdp);
+static void unmap_hdp_file(HierarchicalDirichletProcess* hdp);
+
 bool is_structure_finalized(HierarchicalDirichletProcess* hdp) {
     return hdp->finalized;
 }
@@ -128,6 +143,7 @@ int64_t get_num_data(HierarchicalDirichletProcess* hdp) {
 }
 
 double* get_data_copy(HierarchicalDirichletProcess* hdp) {
+    load_hdp_gibbs_state(hdp);
     int64_t data_length = hdp->data_length;
     double* data = (double*) malloc(sizeof(double) * data_length);
     for (int64_t i = 0; i < data_length; i++) {
@@ -137,6 +153,7 @@ double* get_data_copy(HierarchicalDirichletProcess* hdp) {
 }
 
 int64_t* get_data_pt_dp_ids_copy(HierarchicalDirichletProcess* hdp) {
+    load_hdp_gibbs_state(hdp);
     int64_t data_length = hdp->data_length;
     int64_t* dp_ids = (int64_t*) malloc(sizeof(int64_t) * data_length);
     for (int64_t i = 0; i < data_length; i++) {
@@ -215,6 +232,7 @@ int64_t get_dir_proc_num_factors(HierarchicalDirichletProcess* hdp, int64_t dp_i
         exit(EXIT_FAILURE);
     }
     
+    load_hdp_gibbs_state(hdp);
     DirichletProcess* dp = hdp->dps[dp_id];
     return stSet_size(dp->factors);
 }
@@ -953,6 +971,10 @@ HierarchicalDirichletProcess* new_hier_dir_proc(int64_t num_dps, int64_t depth,
     
     hdp->distr_metric_memos = stSet_construct2(&destroy_distr_metric_memo);
     
+    hdp->mapped_file = NULL;
+    hdp->mapped_file_length = 0;
+    hdp->unloaded_gibbs_state = NULL;
+    
     return hdp;
 }
 
@@ -1003,6 +1025,7 @@ HierarchicalDirichletProcess* new_hier_dir_proc_2(int64_t num_dps, int64_t depth
 }
 
 void destroy_hier_dir_proc(HierarchicalDirichletProcess* hdp) {
+    unmap_hdp_file(hdp);
     destroy_dir_proc(hdp->base_dp);
     free(hdp->gamma);
     free(hdp->data);
@@ -1564,6 +1587,7 @@ void set_dir_proc_parent(HierarchicalDirichletProcess* hdp, int64_t child_id, in
 }
 
 void pass_data_to_hdp(HierarchicalDirichletProcess* hdp, double* data, int64_t* dp_ids, int64_t length) {
+    load_hdp_gibbs_state(hdp);
     if (hdp->data != NULL) {
         fprintf(stderr, "Hierarchical Dirichlet process must be reset before passing new data.\n");
         exit(EXIT_FAILURE);
@@ -1601,7 +1625,11 @@ void reset_distr_metric_memo(DistributionMetricMemo* memo) {
 }
 
 void reset_hdp_data(HierarchicalDirichletProcess* hdp) {
-    if (hdp->data == NULL && hdp->data_pt_dp_id == NULL) {
+    // no need to parse Gibbs state that is about to be thrown away
+    bool has_unloaded_data = hdp->unloaded_gibbs_state != NULL;
+    unmap_hdp_file(hdp);
+    
+    if (hdp->data == NULL && hdp->data_pt_dp_id == NULL && !has_unloaded_data) {
         return;
     }
     
@@ -2470,6 +2498,7 @@ void take_snapshot(HierarchicalDirichletProcess* hdp, int64_t** num_dp_fctrs_out
                    double** gamma_params_out, int64_t* num_gamma_params_out, double* log_likelihood_out,
                    double* log_density_out) {
     
+    load_hdp_gibbs_state(hdp);
     *num_dp_fctrs_out = snapshot_num_factors(hdp, num_dps_out);
     *gamma_params_out = snapshot_gamma_params(hdp, num_gamma_params_out);
     *log_likelihood_out = snapshot_log_likelihood(hdp);
@@ -2486,6 +2515,7 @@ void execute_gibbs_sampling(HierarchicalDirichletProcess* hdp, int64_t num_sampl
 void execute_gibbs_sampling_with_snapshots(HierarchicalDirichletProcess* hdp, int64_t num_samples, int64_t burn_in, int64_t thinning,
                                            void (*snapshot_func)(HierarchicalDirichletProcess*, void*),
                                            void* snapshot_func_args, bool verbose) {
+    load_hdp_gibbs_state(hdp);
     if (hdp->data == NULL || hdp->data_pt_dp_id == NULL) {
         fprintf(stderr, "Cannot perform Gibbs sampling before passing data to HDP.\n");
         exit(EXIT_FAILURE);
@@ -2875,6 +2905,8 @@ void serialize_factor_tree_internal(FILE* out, Factor* fctr, int64_t parent_id,
 
 void serialize_hdp(HierarchicalDirichletProcess* hdp, FILE* out) {
     
+    load_hdp_gibbs_state(hdp);
+    
     int64_t num_dps = hdp->num_dps;
     int64_t num_data = hdp->data_length;
     double* data = hdp->data;
@@ -3276,3 +3308,430 @@ HierarchicalDirichletProcess* deserialize_hdp(FILE* in) {
     return hdp;
 }
 
+
+// binary serialization
+
+#define HDP_BINARY_HEADER_LENGTH (8 + 7 * sizeof(int64_t) + 6 * sizeof(double))
+
+static void hdp_fwrite(const void* data, size_t size, int64_t n, FILE* out) {
+    if (n > 0 && fwrite(data, size, n, out) != (size_t) n) {
+        fprintf(stderr, "Error writing binary HierarchicalDirichletProcess.\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void hdp_fwrite_int64(int64_t value, FILE* out) {
+    hdp_fwrite(&value, sizeof(int64_t), 1, out);
+}
+
+static void hdp_fwrite_double(double value, FILE* out) {
+    hdp_fwrite(&value, sizeof(double), 1, out);
+}
+
+// returns the next length bytes of the mapped file and moves the cursor past them
+static char* hdp_binary_take(char** cursor, char* end, int64_t length) {
+    if (length < 0 || end - *cursor < length) {
+        fprintf(stderr, "Binary HierarchicalDirichletProcess is truncated.\n");
+        exit(EXIT_FAILURE);
+    }
+    char* block = *cursor;
+    *cursor += length;
+    return block;
+}
+
+static int64_t hdp_binary_take_int64(char** cursor, char* end) {
+    int64_t value;
+    memcpy(&value, hdp_binary_take(cursor, end, sizeof(int64_t)), sizeof(int64_t));
+    return value;
+}
+
+static double* hdp_binary_take_double_copy(char** cursor, char* end, int64_t length) {
+    double* copy = (double*) malloc(sizeof(double) * length);
+    memcpy(copy, hdp_binary_take(cursor, end, sizeof(double) * length), sizeof(double) * length);
+    return copy;
+}
+
+static double* hdp_double_array_copy(double* array, int64_t length) {
+    double* copy = (double*) malloc(sizeof(double) * length);
+    memcpy(copy, array, sizeof(double) * length);
+    return copy;
+}
+
+static int64_t count_factor_tree_internal(Factor* fctr) {
+    int64_t num_factors = 1;
+    if (fctr->children != NULL) {
+        stSetIterator* iter = stSet_getIterator(fctr->children);
+        Factor* child_fctr = (Factor*) stSet_getNext(iter);
+        while (child_fctr != NULL) {
+            num_factors += count_factor_tree_internal(child_fctr);
+            child_fctr = (Factor*) stSet_getNext(iter);
+        }
+        stSet_destructIterator(iter);
+    }
+    return num_factors;
+}
+
+// same pre-order as serialize_factor_tree_internal
+static void serialize_factor_tree_binary_internal(FILE* out, Factor* fctr, int64_t parent_id, int64_t* next_fctr_id,
+                                                  double* data_start) {
+    int64_t id = *next_fctr_id;
+    (*next_fctr_id)++;
+    
+    if (fctr->factor_type == BASE) {
+        hdp_fwrite_int64(0, out);
+        hdp_fwrite_int64(-1, out);
+        hdp_fwrite(fctr->factor_data, sizeof(double), N_IG_NUM_PARAMS + 1, out);
+    }
+    else if (fctr->factor_type == MIDDLE) {
+        hdp_fwrite_int64(1, out);
+        hdp_fwrite_int64(parent_id, out);
+        hdp_fwrite_int64(fctr->dp->id, out);
+    }
+    else {
+        hdp_fwrite_int64(2, out);
+        hdp_fwrite_int64(parent_id, out);
+        hdp_fwrite_int64((int64_t) (fctr->factor_data - data_start), out);
+    }
+    
+    if (fctr->children != NULL) {
+        stSetIterator* iter = stSet_getIterator(fctr->children);
+        Factor* child_fctr = (Factor*) stSet_getNext(iter);
+        while (child_fctr != NULL) {
+            serialize_factor_tree_binary_internal(out, child_fctr, id, next_fctr_id, data_start);
+            child_fctr = (Factor*) stSet_getNext(iter);
+        }
+        stSet_destructIterator(iter);
+    }
+}
+
+static void serialize_hdp_binary_internal(HierarchicalDirichletProcess* hdp, FILE* out, bool with_gibbs_state) {
+    if (!hdp->finalized) {
+        fprintf(stderr, "Can only serialize HierarchicalDirichletProcess with finalized structure");
+        exit(EXIT_FAILURE);
+    }
+    
+    if (with_gibbs_state) {
+        load_hdp_gibbs_state(hdp);
+    }
+    
+    int64_t num_dps = hdp->num_dps;
+    int64_t grid_length = hdp->grid_length;
+    int64_t depth = hdp->depth;
+    DirichletProcess** dps = hdp->dps;
+    bool has_data = with_gibbs_state && hdp->data != NULL;
+    
+    int32_t version = HDP_BINARY_VERSION;
+    hdp_fwrite(HDP_BINARY_MAGIC, sizeof(char), 4, out);
+    hdp_fwrite(&version, sizeof(int32_t), 1, out);
+    hdp_fwrite_int64((int64_t) hdp->splines_finalized, out);
+    hdp_fwrite_int64((int64_t) has_data, out);
+    hdp_fwrite_int64((int64_t) hdp->sample_gamma, out);
+    hdp_fwrite_int64(num_dps, out);
+    hdp_fwrite_int64(depth, out);
+    hdp_fwrite_int64(grid_length, out);
+    hdp_fwrite_int64(has_data ? hdp->data_length : 0, out);
+    hdp_fwrite_double(hdp->mu, out);
+    hdp_fwrite_double(hdp->nu, out);
+    hdp_fwrite_double(hdp->two_alpha / 2.0, out);
+    hdp_fwrite_double(hdp->beta, out);
+    hdp_fwrite_double(hdp->sampling_grid[0], out);
+    hdp_fwrite_double(hdp->sampling_grid[grid_length - 1], out);
+    
+    hdp_fwrite(hdp->gamma, sizeof(double), depth, out);
+    if (hdp->sample_gamma) {
+        hdp_fwrite(hdp->gamma_alpha, sizeof(double), depth, out);
+        hdp_fwrite(hdp->gamma_beta, sizeof(double), depth, out);
+        hdp_fwrite(hdp->w_aux_vector, sizeof(double), num_dps, out);
+        for (int64_t i = 0; i < num_dps; i++) {
+            hdp_fwrite_int64((int64_t) hdp->s_aux_vector[i], out);
+        }
+    }
+    
+    for (int64_t i = 0; i < num_dps; i++) {
+        hdp_fwrite_int64(dps[i]->parent == NULL ? -1 : dps[i]->parent->id, out);
+    }
+    for (int64_t i = 0; i < num_dps; i++) {
+        hdp_fwrite_int64(dps[i]->num_factor_children, out);
+    }
+    for (int64_t i = 0; i < num_dps; i++) {
+        hdp_fwrite_int64((int64_t) dps[i]->observed, out);
+    }
+    
+    // densities, only observed DPs have them
+    for (int64_t i = 0; i < num_dps; i++) {
+        if (dps[i]->observed) {
+            hdp_fwrite(dps[i]->posterior_predictive, sizeof(double), grid_length, out);
+        }
+    }
+    if (hdp->splines_finalized) {
+        for (int64_t i = 0; i < num_dps; i++) {
+            if (dps[i]->observed) {
+                hdp_fwrite(dps[i]->spline_slopes, sizeof(double), grid_length, out);
+            }
+        }
+    }
+    
+    // Gibbs state
+    if (has_data) {
+        hdp_fwrite(hdp->data, sizeof(double), hdp->data_length, out);
+        hdp_fwrite(hdp->data_pt_dp_id, sizeof(int64_t), hdp->data_length, out);
+        
+        int64_t num_factors = 0;
+        stSetIterator* iter = stSet_getIterator(hdp->base_dp->factors);
+        Factor* fctr = (Factor*) stSet_getNext(iter);
+        while (fctr != NULL) {
+            num_factors += count_factor_tree_internal(fctr);
+            fctr = (Factor*) stSet_getNext(iter);
+        }
+        stSet_destructIterator(iter);
+        hdp_fwrite_int64(num_factors, out);
+        
+        int64_t next_fctr_id = 0;
+        iter = stSet_getIterator(hdp->base_dp->factors);
+        fctr = (Factor*) stSet_getNext(iter);
+        while (fctr != NULL) {
+            serialize_factor_tree_binary_internal(out, fctr, -1, &next_fctr_id, hdp->data);
+            fctr = (Factor*) stSet_getNext(iter);
+        }
+        stSet_destructIterator(iter);
+    }
+}
+
+void serialize_hdp_binary(HierarchicalDirichletProcess* hdp, FILE* out) {
+    serialize_hdp_binary_internal(hdp, out, true);
+}
+
+void serialize_hdp_densities_binary(HierarchicalDirichletProcess* hdp, FILE* out) {
+    if (!hdp->splines_finalized) {
+        fprintf(stderr, "Must finalize distributions before serializing densities.\n");
+        exit(EXIT_FAILURE);
+    }
+    serialize_hdp_binary_internal(hdp, out, false);
+}
+
+HierarchicalDirichletProcess* deserialize_hdp_binary(const char* filepath, int64_t offset) {
+    uint16_t one = 1;
+    if (*((uint8_t*) &one) != 1) {
+        fprintf(stderr, "Binary HierarchicalDirichletProcess files are little-endian, not supported on this machine.\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    int fd = open(filepath, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Couldn't open %s.\n", filepath);
+        exit(EXIT_FAILURE);
+    }
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0) {
+        fprintf(stderr, "Couldn't stat %s.\n", filepath);
+        exit(EXIT_FAILURE);
+    }
+    int64_t file_length = (int64_t) file_stat.st_size;
+    if (offset % 8 != 0 || file_length < offset + (int64_t) HDP_BINARY_HEADER_LENGTH) {
+        fprintf(stderr, "%s does not contain a binary HierarchicalDirichletProcess at offset %"PRId64".\n",
+                filepath, offset);
+        exit(EXIT_FAILURE);
+    }
+    // read only and shared, so processes loading the same file share its pages
+    char* mapped_file = mmap(NULL, file_length, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped_file == MAP_FAILED) {
+        fprintf(stderr, "Couldn't mmap %s.\n", filepath);
+        exit(EXIT_FAILURE);
+    }
+    
+    char* end = mapped_file + file_length;
+    char* cursor = mapped_file + offset;
+    
+    int32_t version;
+    if (memcmp(hdp_binary_take(&cursor, end, 4), HDP_BINARY_MAGIC, 4) != 0) {
+        fprintf(stderr, "%s is not a binary HierarchicalDirichletProcess.\n", filepath);
+        exit(EXIT_FAILURE);
+    }
+    memcpy(&version, hdp_binary_take(&cursor, end, sizeof(int32_t)), sizeof(int32_t));
+    if (version != HDP_BINARY_VERSION) {
+        fprintf(stderr, "%s is binary HierarchicalDirichletProcess version %"PRId32", expected version %d.\n",
+                filepath, version, HDP_BINARY_VERSION);
+        exit(EXIT_FAILURE);
+    }
+    bool splines_finalized = (bool) hdp_binary_take_int64(&cursor, end);
+    bool has_data = (bool) hdp_binary_take_int64(&cursor, end);
+    bool sample_gamma = (bool) hdp_binary_take_int64(&cursor, end);
+    int64_t num_dps = hdp_binary_take_int64(&cursor, end);
+    int64_t depth = hdp_binary_take_int64(&cursor, end);
+    int64_t grid_length = hdp_binary_take_int64(&cursor, end);
+    int64_t data_length = hdp_binary_take_int64(&cursor, end);
+    double mu, nu, alpha, beta, grid_start, grid_stop;
+    memcpy(&mu, hdp_binary_take(&cursor, end, sizeof(double)), sizeof(double));
+    memcpy(&nu, hdp_binary_take(&cursor, end, sizeof(double)), sizeof(double));
+    memcpy(&alpha, hdp_binary_take(&cursor, end, sizeof(double)), sizeof(double));
+    memcpy(&beta, hdp_binary_take(&cursor, end, sizeof(double)), sizeof(double));
+    memcpy(&grid_start, hdp_binary_take(&cursor, end, sizeof(double)), sizeof(double));
+    memcpy(&grid_stop, hdp_binary_take(&cursor, end, sizeof(double)), sizeof(double));
+    
+    // construct hdp
+    HierarchicalDirichletProcess* hdp;
+    double* gamma_params = hdp_binary_take_double_copy(&cursor, end, depth);
+    if (sample_gamma) {
+        double* gamma_alpha = hdp_binary_take_double_copy(&cursor, end, depth);
+        double* gamma_beta = hdp_binary_take_double_copy(&cursor, end, depth);
+        hdp = new_hier_dir_proc_2(num_dps, depth, gamma_alpha, gamma_beta, grid_start,
+                                  grid_stop, grid_length, mu, nu, alpha, beta);
+        memcpy(hdp->gamma, gamma_params, sizeof(double) * depth);
+        free(gamma_params);
+        memcpy(hdp->w_aux_vector, hdp_binary_take(&cursor, end, sizeof(double) * num_dps), sizeof(double) * num_dps);
+        for (int64_t i = 0; i < num_dps; i++) {
+            hdp->s_aux_vector[i] = (bool) hdp_binary_take_int64(&cursor, end);
+        }
+    }
+    else {
+        hdp = new_hier_dir_proc(num_dps, depth, gamma_params, grid_start, grid_stop,
+                                grid_length, mu, nu, alpha, beta);
+    }
+    
+    DirichletProcess** dps = hdp->dps;
+    
+    // dp parents and num children
+    int64_t parent_id;
+    for (int64_t id = 0; id < num_dps; id++) {
+        parent_id = hdp_binary_take_int64(&cursor, end);
+        if (parent_id >= 0) {
+            set_dir_proc_parent(hdp, id, parent_id);
+        }
+    }
+    for (int64_t id = 0; id < num_dps; id++) {
+        dps[id]->num_factor_children = hdp_binary_take_int64(&cursor, end);
+    }
+    
+    finalize_hdp_structure(hdp);
+    
+    for (int64_t id = 0; id < num_dps; id++) {
+        dps[id]->observed = (bool) hdp_binary_take_int64(&cursor, end);
+    }
+    
+    // densities stay in the mapped file
+    for (int64_t id = 0; id < num_dps; id++) {
+        if (dps[id]->observed) {
+            dps[id]->posterior_predictive = (double*) hdp_binary_take(&cursor, end, sizeof(double) * grid_length);
+        }
+    }
+    if (splines_finalized) {
+        hdp->splines_finalized = true;
+        for (int64_t id = 0; id < num_dps; id++) {
+            if (dps[id]->observed) {
+                dps[id]->spline_slopes = (double*) hdp_binary_take(&cursor, end, sizeof(double) * grid_length);
+            }
+        }
+    }
+    
+    hdp->mapped_file = mapped_file;
+    hdp->mapped_file_length = file_length;
+    if (has_data) {
+        hdp->data_length = data_length;
+        hdp->unloaded_gibbs_state = cursor;
+    }
+    
+    return hdp;
+}
+
+// copies the densities out of the mapped file, parses the data and factors if the file had them, then unmaps it
+static void load_hdp_gibbs_state(HierarchicalDirichletProcess* hdp) {
+    if (hdp->mapped_file == NULL) {
+        return;
+    }
+    
+    int64_t num_dps = hdp->num_dps;
+    int64_t grid_length = hdp->grid_length;
+    DirichletProcess** dps = hdp->dps;
+    DirichletProcess* dp;
+    for (int64_t id = 0; id < num_dps; id++) {
+        dp = dps[id];
+        if (dp->posterior_predictive != NULL) {
+            dp->posterior_predictive = hdp_double_array_copy(dp->posterior_predictive, grid_length);
+        }
+        if (dp->spline_slopes != NULL) {
+            dp->spline_slopes = hdp_double_array_copy(dp->spline_slopes, grid_length);
+        }
+    }
+    
+    if (hdp->unloaded_gibbs_state != NULL) {
+        char* cursor = hdp->unloaded_gibbs_state;
+        char* end = hdp->mapped_file + hdp->mapped_file_length;
+        int64_t data_length = hdp->data_length;
+        
+        // note: don't use pass_hdp_data because want to manually init factors
+        hdp->data = hdp_binary_take_double_copy(&cursor, end, data_length);
+        hdp->data_pt_dp_id = (int64_t*) malloc(sizeof(int64_t) * data_length);
+        memcpy(hdp->data_pt_dp_id, hdp_binary_take(&cursor, end, sizeof(int64_t) * data_length),
+               sizeof(int64_t) * data_length);
+        verify_valid_dp_assignments(hdp);
+        
+        int64_t num_factors = hdp_binary_take_int64(&cursor, end);
+        Factor** fctrs = (Factor**) malloc(sizeof(Factor*) * num_factors);
+        
+        int64_t type_int;
+        int64_t parent_idx;
+        int64_t value;
+        Factor* fctr;
+        Factor* parent_fctr;
+        for (int64_t i = 0; i < num_factors; i++) {
+            type_int = hdp_binary_take_int64(&cursor, end);
+            parent_idx = hdp_binary_take_int64(&cursor, end);
+            if (type_int == 0) {
+                fctr = new_base_factor(hdp);
+                memcpy(fctr->factor_data, hdp_binary_take(&cursor, end, sizeof(double) * (N_IG_NUM_PARAMS + 1)),
+                       sizeof(double) * (N_IG_NUM_PARAMS + 1));
+            }
+            else {
+                value = hdp_binary_take_int64(&cursor, end);
+                if (type_int == 1 && value >= 0 && value < num_dps) {
+                    fctr = new_middle_factor(dps[value]);
+                }
+                else if (type_int == 2 && value >= 0 && value < data_length) {
+                    fctr = new_data_pt_factor(hdp, value);
+                }
+                else {
+                    fprintf(stderr, "Deserialization error");
+                    exit(EXIT_FAILURE);
+                }
+            }
+            fctrs[i] = fctr;
+            
+            // set parent if appicable
+            if (parent_idx >= 0) {
+                if (parent_idx >= i) {
+                    fprintf(stderr, "Deserialization error");
+                    exit(EXIT_FAILURE);
+                }
+                parent_fctr = fctrs[parent_idx];
+                
+                fctr->parent = parent_fctr;
+                stSet_insert(parent_fctr->children, (void*) fctr);
+            }
+        }
+        free(fctrs);
+        hdp->unloaded_gibbs_state = NULL;
+    }
+    
+    munmap(hdp->mapped_file, hdp->mapped_file_length);
+    hdp->mapped_file = NULL;
+    hdp->mapped_file_length = 0;
+}
+
+// drops the mapped file along with the densities and Gibbs state that were still in it
+static void unmap_hdp_file(HierarchicalDirichletProcess* hdp) {
+    if (hdp->mapped_file == NULL) {
+        return;
+    }
+    
+    // all densities point into the mapped file until load_hdp_gibbs_state copies them
+    for (int64_t id = 0; id < hdp->num_dps; id++) {
+        hdp->dps[id]->posterior_predictive = NULL;
+        hdp->dps[id]->spline_slopes = NULL;
+    }
+    
+    munmap(hdp->mapped_file, hdp->mapped_file_length);
+    hdp->mapped_file = NULL;
+    hdp->mapped_file_length = 0;
+    hdp->unloaded_gibbs_state = NULL;
+}
@@ -0,0 +1,343 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "sonLib.h"
+#include "indexedFasta.h"
+
+typedef struct _fastaRecord {
+    char *name;
+    int64_t length;
+    int64_t offset;     // of the first base in the file
+    int64_t lineBases;  // 0 when the lines of the sequence are not all the same length
+    int64_t lineWidth;  // bases and line break
+} FastaRecord;
+
+struct _indexedFasta {
+    char *data;
+    int64_t dataLength;
+    int64_t nbRecords;
+    int64_t maxRecords;
+    FastaRecord *records;
+    stHash *recordsByName;
+};
+
+static FastaRecord *indexedFasta_addRecord(IndexedFasta *fasta, const char *name, int64_t nameLength) {
+    if (fasta->nbRecords == fasta->maxRecords) {
+        fasta->maxRecords = fasta->maxRecords == 0 ? 16 : 2 * fasta->maxRecords;
+        fasta->records = realloc(fasta->records, sizeof(FastaRecord) * fasta->maxRecords);
+        if (fasta->records == NULL) {
+            st_errAbort("indexedFasta: failed to allocate the index\n");
+        }
+    }
+    FastaRecord *record = &fasta->records[fasta->nbRecords++];
+    record->name = st_malloc(nameLength + 1);
+    memcpy(record->name, name, nameLength);
+    record->name[nameLength] = '\0';
+    record->length = 0;
+    record->offset = 0;
+    record->lineBases = 0;
+    record->lineWidth = 0;
+    return record;
+}
+
+// reads the sequence lines starting at position until the next header, returns the position of the next header
+static int64_t indexedFasta_scanSequence(IndexedFasta *fasta, FastaRecord *record, int64_t position) {
+    record->offset = position;
+    bool regular = TRUE;
+    bool lastLine = FALSE; // seen a line shorter than the first one, only empty lines may follow
+    int64_t nbLines = 0;
+    while (position < fasta->dataLength && fasta->data[position] != '>') {
+        char *lineEnd = memchr(fasta->data + position, '\n', fasta->dataLength - position);
+        int64_t end = lineEnd == NULL ? fasta->dataLength : lineEnd - fasta->data;
+        int64_t width = (lineEnd == NULL ? end : end + 1) - position;
+        int64_t bases = end - position;
+        if (bases > 0 && fasta->data[end - 1] == '\r') {
+            bases--;
+        }
+        if (nbLines == 0) {
+            record->lineBases = bases;
+            record->lineWidth = width;
+        } else if (bases > 0 && (lastLine || bases > record->lineBases)) {
+            regular = FALSE;
+        }
+        if (bases < record->lineBases || (lineEnd != NULL && width != record->lineWidth)) {
+            lastLine = TRUE;
+        }
+        record->length += bases;
+        nbLines++;
+        position += width;
+    }
+    if (!regular || (record->lineBases == 0 && record->length > 0)) {
+        record->lineBases = 0;
+        record->lineWidth = 0;
+    }
+    return position;
+}
+
+static void indexedFasta_buildIndex(IndexedFasta *fasta) {
+    int64_t position = 0;
+    if (fasta->dataLength > 0 && fasta->data[0] != '>') {
+        FastaRecord *record = indexedFasta_addRecord(fasta, "", 0);
+        position = indexedFasta_scanSequence(fasta, record, 0);
+    }
+    while (position < fasta->dataLength) {
+        // header, the name is the first word
+        char *header = fasta->data + position + 1;
+        char *lineEnd = memchr(header, '\n', fasta->dataLength - position - 1);
+        int64_t headerLength = lineEnd == NULL ? fasta->data + fasta->dataLength - header : lineEnd - header;
+        int64_t nameLength = 0;
+        while (nameLength < headerLength && !isspace((unsigned char) header[nameLength])) {
+            nameLength++;
+        }
+        FastaRecord *record = indexedFasta_addRecord(fasta, header, nameLength);
+        position = lineEnd == NULL ? fasta->dataLength : lineEnd - fasta->data + 1;
+        position = indexedFasta_scanSequence(fasta, record, position);
+    }
+}
+
+// position after the last base of the sequences, only line breaks may follow in a file the index describes
+static int64_t indexedFasta_getIndexedEnd(IndexedFasta *fasta) {
+    int64_t end = 0;
+    for (int64_t i = 0; i < fasta->nbRecords; i++) {
+        FastaRecord *record = &fasta->records[i];
+        int64_t recordEnd = record->length == 0 ? record->offset
+                                                : record->offset + ((record->length - 1) / record->lineBases)
+                                                                   * record->lineWidth
+                                                  + (record->length - 1) % record->lineBases + 1;
+        if (recordEnd > end) {
+            end = recordEnd;
+        }
+    }
+    return end;
+}
+
+// loads a faidx index, returns FALSE if it doesn't describe the mapped file
+static bool indexedFasta_loadIndex(IndexedFasta *fasta, const char *indexFile) {
+    FILE *fH = fopen(indexFile, "r");
+    if (fH == NULL) {
+        return FALSE;
+    }
+    bool valid = TRUE;
+    char *line;
+    while (valid && (line = stFile_getLineFromFile(fH)) != NULL) {
+        char *tab = strchr(line, '\t');
+        if (tab == NULL) {
+            valid = strlen(line) == 0;
+            free(line);
+            continue;
+        }
+        FastaRecord *record = indexedFasta_addRecord(fasta, line, tab - line);
+        valid = sscanf(tab + 1, "%" SCNi64 "\t%" SCNi64 "\t%" SCNi64 "\t%" SCNi64, &record->length, &record->offset,
+                       &record->lineBases, &record->lineWidth) == 4
+                && record->length >= 0 && record->offset >= 0 && record->offset <= fasta->dataLength
+                && (record->length == 0 || (record->lineBases > 0 && record->lineWidth > record->lineBases
+                    && record->offset + ((record->length - 1) / record->lineBases) * record->lineWidth
+                       + (record->length - 1) % record->lineBases < fasta->dataLength));
+        free(line);
+    }
+    fclose(fH);
+    // the sequences have to fit in the file and reach its end, an index of a file that was replaced by a longer or
+    // shorter one with an older mtime doesn't
+    if (valid) {
+        for (int64_t position = indexedFasta_getIndexedEnd(fasta); position < fasta->dataLength; position++) {
+            if (fasta->data[position] != '\n' && fasta->data[position] != '\r') {
+                return FALSE;
+            }
+        }
+    }
+    return valid;
+}
+
+static void indexedFasta_clearIndex(IndexedFasta *fasta) {
+    for (int64_t i = 0; i < fasta->nbRecords; i++) {
+        free(fasta->records[i].name);
+    }
+    fasta->nbRecords = 0;
+}
+
+static bool indexedFasta_isRegular(IndexedFasta *fasta) {
+    for (int64_t i = 0; i < fasta->nbRecords; i++) {
+        if (fasta->records[i].lineBases == 0 && fasta->records[i].length > 0) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+static void indexedFasta_writeIndexToFile(IndexedFasta *fasta, FILE *fH) {
+    for (int64_t i = 0; i < fasta->nbRecords; i++) {
+        FastaRecord *record = &fasta->records[i];
+        fprintf(fH, "%s\t%" PRIi64 "\t%" PRIi64 "\t%" PRIi64 "\t%" PRIi64 "\n", record->name, record->length,
+                record->offset, record->lineBases, record->lineWidth);
+    }
+}
+
+IndexedFasta *indexedFasta_construct(const char *fastaFile) {
+    IndexedFasta *fasta = st_calloc(1, sizeof(IndexedFasta));
+    int fd = open(fastaFile, O_RDONLY);
+    if (fd < 0) {
+        st_errAbort("indexedFasta: couldn't open %s\n", fastaFile);
+    }
+    struct stat fastaStat;
+    if (fstat(fd, &fastaStat) != 0) {
+        st_errAbort("indexedFasta: couldn't stat %s\n", fastaFile);
+    }
+    fasta->dataLength = (int64_t) fastaStat.st_size;
+    if (fasta->dataLength > 0) {
+        fasta->data = mmap(NULL, fasta->dataLength, PROT_READ, MAP_SHARED, fd, 0);
+        if (fasta->data == MAP_FAILED) {
+            st_errAbort("indexedFasta: couldn't mmap %s\n", fastaFile);
+        }
+    }
+    close(fd);
+
+    // use the index unless it is older than the file or doesn't match it, only for regular files (the size of
+    // anything else says nothing about its contents)
+    char *indexFile = stString_print("%s.fai", fastaFile);
+    bool regularFile = S_ISREG(fastaStat.st_mode);
+    struct stat indexStat;
+    bool haveIndex = regularFile && stat(indexFile, &indexStat) == 0 && indexStat.st_mtime >= fastaStat.st_mtime
+                     && indexedFasta_loadIndex(fasta, indexFile);
+    if (!haveIndex) {
+        indexedFasta_clearIndex(fasta);
+        indexedFasta_buildIndex(fasta);
+        if (regularFile && indexedFasta_isRegular(fasta)) {
+            // write then rename so processes starting at the same time never see half an index
+            // (not being able to save it, e.g. in a read only directory, is fine)
+            char *tempFile = stString_print("%s.%" PRIi64 ".tmp", indexFile, (int64_t) getpid());
+            FILE *fH = fopen(tempFile, "w");
+            if (fH != NULL) {
+                indexedFasta_writeIndexToFile(fasta, fH);
+                if (fclose(fH) != 0 || rename(tempFile, indexFile) != 0) {
+                    remove(tempFile);
+                }
+            }
+            free(tempFile);
+        }
+    }
+    free(indexFile);
+
+    // the first of the sequences with the same name is replaced by the longest one
+    fasta->recordsByName = stHash_construct3(stHash_stringKey, stHash_stringEqualKey, NULL, NULL);
+    for (int64_t i = 0; i < fasta->nbRecords; i++) {
+        FastaRecord *record = &fasta->records[i];
+        FastaRecord *existing = stHash_search(fasta->recordsByName, record->name);
+        if (existing == NULL) {
+            stHash_insert(fasta->recordsByName, record->name, record);
+        } else if (record->length > existing->length) {
+            stHash_remove(fasta->recordsByName, existing->name);
+            stHash_insert(fasta->recordsByName, record->name, record);
+        }
+    }
+    return fasta;
+}
+
+void indexedFasta_destruct(IndexedFasta *fasta) {
+    stHash_destruct(fasta->recordsByName);
+    indexedFasta_clearIndex(fasta);
+    free(fasta->records);
+    if (fasta->data != NULL) {
+        munmap(fasta->data, fasta->dataLength);
+    }
+    free(fasta);
+}
+
+void indexedFasta_writeIndex(IndexedFasta *fasta, const char *indexFile) {
+    if (!indexedFasta_isRegular(fasta)) {
+        st_errAbort("indexedFasta: can't write %s, a sequence has lines of different lengths\n", indexFile);
+    }
+    FILE *fH = fopen(indexFile, "w");
+    if (fH == NULL) {
+        st_errAbort("indexedFasta: couldn't open %s for writing\n", indexFile);
+    }
+    indexedFasta_writeIndexToFile(fasta, fH);
+    if (fclose(fH) != 0) {
+        st_errAbort("indexedFasta: error writing %s\n", indexFile);
+    }
+}
+
+int64_t indexedFasta_getNumberOfSequences(IndexedFasta *fasta) {
+    return fasta->nbRecords;
+}
+
+static FastaRecord *indexedFasta_getRecord(IndexedFasta *fasta, int64_t ordinal) {
+    if (ordinal < 0 || ordinal >= fasta->nbRecords) {
+        st_errAbort("indexedFasta: no sequence %" PRIi64 ", there are %" PRIi64 "\n", ordinal, fasta->nbRecords);
+    }
+    return &fasta->records[ordinal];
+}
+
+const char *indexedFasta_getSequenceName(IndexedFasta *fasta, int64_t ordinal) {
+    return indexedFasta_getRecord(fasta, ordinal)->name;
+}
+
+int64_t indexedFasta_getOrdinal(IndexedFasta *fasta, const char *name) {
+    FastaRecord *record = stHash_search(fasta->recordsByName, (void *) name);
+    return record == NULL ? -1 : record - fasta->records;
+}
+
+int64_t indexedFasta_getSequenceLength(IndexedFasta *fasta, int64_t ordinal) {
+    return indexedFasta_getRecord(fasta, ordinal)->length;
+}
+
+static FastaRecord *indexedFasta_getRegion(IndexedFasta *fasta, int64_t ordinal, int64_t start, int64_t end) {
+    FastaRecord *record = indexedFasta_getRecord(fasta, ordinal);
+    if (start < 0 || start > end || end > record->length) {
+        st_errAbort("indexedFasta: region %" PRIi64 "-%" PRIi64 " is outside of %s (length %" PRIi64 ")\n",
+                    start, end, record->name, record->length);
+    }
+    return record;
+}
+
+char *indexedFasta_getSubSequence(IndexedFasta *fasta, int64_t ordinal, int64_t start, int64_t end, bool strand,
+                                  bool upperCase) {
+    if (!strand) {
+        int64_t i = start;
+        start = end;
+        end = i;
+    }
+    FastaRecord *record = indexedFasta_getRegion(fasta, ordinal, start, end);
+    char *seq = st_malloc(end - start + 1);
+    if (record->lineBases > 0) {
+        // copy line by line
+        for (int64_t i = start; i < end;) {
+            int64_t column = i % record->lineBases;
+            int64_t n = record->lineBases - column < end - i ? record->lineBases - column : end - i;
+            memcpy(seq + i - start, fasta->data + record->offset + (i / record->lineBases) * record->lineWidth
+                                    + column, n);
+            i += n;
+        }
+    } else {
+        // lines of different lengths, walk the lines from the start of the sequence
+        int64_t base = 0;
+        for (int64_t position = record->offset; base < end; position++) {
+            char c = fasta->data[position];
+            if (c == '\n' || c == '\r') {
+                continue;
+            }
+            if (base >= start) {
+                seq[base - start] = c;
+            }
+            base++;
+        }
+    }
+    seq[end - start] = '\0';
+    if (upperCase) {
+        for (int64_t i = 0; i < end - start; i++) {
+            seq[i] = toupper((unsigned char) seq[i]);
+        }
+    }
+    if (!strand) {
+        char *rSeq = stString_reverseComplementString(seq);
+        free(seq);
+        return rSeq;
+    }
+    return seq;
+}
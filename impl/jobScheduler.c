@@ -0,0 +1,208 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <inttypes.h>
+#include "sonLib.h"
+#include "jobScheduler.h"
+
+typedef struct _scheduledJob {
+    void (*fn)(void *workspace, void *arg);
+    void *arg;
+    int64_t cost;
+} ScheduledJob;
+
+// the jobs dealt to a thread, sorted most expensive first, the owner takes from first, thieves from last
+typedef struct _jobDeque {
+    pthread_mutex_t lock;
+    ScheduledJob *jobs;
+    int64_t first;
+    int64_t last; // one past the last job
+    int64_t cost; // total cost of the jobs left
+} JobDeque;
+
+struct _jobScheduler {
+    ScheduledJob *jobs;
+    int64_t length;
+    int64_t maxLength;
+
+    // state of a run
+    int64_t nbThreads;
+    JobDeque *deques;
+    int64_t steals;
+    pthread_mutex_t stealsLock;
+    void *(*workspaceConstructFn)(void *workspaceArg);
+    void (*workspaceDestructFn)(void *workspace);
+    void *workspaceArg;
+};
+
+typedef struct _schedulerWorker {
+    JobScheduler *scheduler;
+    int64_t index;
+} SchedulerWorker;
+
+JobScheduler *jobScheduler_construct(void) {
+    JobScheduler *scheduler = st_malloc(sizeof(JobScheduler));
+    scheduler->length = 0;
+    scheduler->maxLength = 16;
+    scheduler->jobs = st_malloc(scheduler->maxLength * sizeof(ScheduledJob));
+    scheduler->nbThreads = 0;
+    scheduler->deques = NULL;
+    scheduler->steals = 0;
+    pthread_mutex_init(&scheduler->stealsLock, NULL);
+    return scheduler;
+}
+
+void jobScheduler_add(JobScheduler *scheduler, void (*fn)(void *workspace, void *arg), void *arg, int64_t cost) {
+    if (scheduler->length == scheduler->maxLength) {
+        scheduler->maxLength *= 2;
+        scheduler->jobs = realloc(scheduler->jobs, scheduler->maxLength * sizeof(ScheduledJob));
+        if (scheduler->jobs == NULL) {
+            st_errAbort("jobScheduler: failed to grow the batch to %" PRIi64 " jobs\n", scheduler->maxLength);
+        }
+    }
+    ScheduledJob *job = &scheduler->jobs[scheduler->length++];
+    job->fn = fn;
+    job->arg = arg;
+    job->cost = cost;
+}
+
+int64_t jobScheduler_getNumberOfJobs(JobScheduler *scheduler) {
+    return scheduler->length;
+}
+
+int64_t jobScheduler_getNumberOfSteals(JobScheduler *scheduler) {
+    return scheduler->steals;
+}
+
+static int jobScheduler_cmpByDecreasingCost(const void *a, const void *b) {
+    int64_t i = ((ScheduledJob *) a)->cost, j = ((ScheduledJob *) b)->cost;
+    return i > j ? -1 : (i < j ? 1 : 0);
+}
+
+static bool jobDeque_popFirst(JobDeque *deque, ScheduledJob *job) {
+    pthread_mutex_lock(&deque->lock);
+    bool found = deque->first < deque->last;
+    if (found) {
+        *job = deque->jobs[deque->first++];
+        deque->cost -= job->cost;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+static bool jobDeque_popLast(JobDeque *deque, ScheduledJob *job) {
+    pthread_mutex_lock(&deque->lock);
+    bool found = deque->first < deque->last;
+    if (found) {
+        *job = deque->jobs[--deque->last];
+        deque->cost -= job->cost;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+// takes a job from the back of the deque with the most cost left, FALSE once all the deques are empty
+static bool jobScheduler_steal(JobScheduler *scheduler, int64_t thief, ScheduledJob *job) {
+    while (1) {
+        int64_t victim = -1, victimCost = -1, jobsLeft = 0;
+        for (int64_t i = 0; i < scheduler->nbThreads; i++) {
+            if (i == thief) {
+                continue;
+            }
+            JobDeque *deque = &scheduler->deques[i];
+            pthread_mutex_lock(&deque->lock);
+            int64_t n = deque->last - deque->first;
+            if (n > 0 && deque->cost > victimCost) {
+                victim = i;
+                victimCost = deque->cost;
+            }
+            jobsLeft += n;
+            pthread_mutex_unlock(&deque->lock);
+        }
+        if (jobsLeft == 0) {
+            return FALSE;
+        }
+        // the victim may have emptied its deque since, look again
+        if (victim >= 0 && jobDeque_popLast(&scheduler->deques[victim], job)) {
+            pthread_mutex_lock(&scheduler->stealsLock);
+            scheduler->steals++;
+            pthread_mutex_unlock(&scheduler->stealsLock);
+            return TRUE;
+        }
+    }
+}
+
+static void *jobScheduler_worker(void *arg) {
+    SchedulerWorker *worker = arg;
+    JobScheduler *scheduler = worker->scheduler;
+    void *workspace = scheduler->workspaceConstructFn == NULL ? NULL :
+                      scheduler->workspaceConstructFn(scheduler->workspaceArg);
+    ScheduledJob job;
+    while (jobDeque_popFirst(&scheduler->deques[worker->index], &job) ||
+           jobScheduler_steal(scheduler, worker->index, &job)) {
+        job.fn(workspace, job.arg);
+    }
+    if (scheduler->workspaceDestructFn != NULL) {
+        scheduler->workspaceDestructFn(workspace);
+    }
+    return NULL;
+}
+
+void jobScheduler_run(JobScheduler *scheduler, int64_t nbThreads,
+                      void *(*workspaceConstructFn)(void *workspaceArg),
+                      void (*workspaceDestructFn)(void *workspace), void *workspaceArg) {
+    if (nbThreads < 1) {
+        st_errAbort("jobScheduler: need at least one thread, got %" PRIi64 "\n", nbThreads);
+    }
+    // most expensive first, dealt round-robin so every deque starts with a share of the big jobs
+    qsort(scheduler->jobs, scheduler->length, sizeof(ScheduledJob), jobScheduler_cmpByDecreasingCost);
+    scheduler->nbThreads = nbThreads;
+    scheduler->steals = 0;
+    scheduler->workspaceConstructFn = workspaceConstructFn;
+    scheduler->workspaceDestructFn = workspaceDestructFn;
+    scheduler->workspaceArg = workspaceArg;
+    scheduler->deques = st_malloc(nbThreads * sizeof(JobDeque));
+    for (int64_t i = 0; i < nbThreads; i++) {
+        JobDeque *deque = &scheduler->deques[i];
+        pthread_mutex_init(&deque->lock, NULL);
+        deque->jobs = st_malloc((scheduler->length / nbThreads + 1) * sizeof(ScheduledJob));
+        deque->first = 0;
+        deque->last = 0;
+        deque->cost = 0;
+    }
+    for (int64_t i = 0; i < scheduler->length; i++) {
+        JobDeque *deque = &scheduler->deques[i % nbThreads];
+        deque->jobs[deque->last++] = scheduler->jobs[i];
+        deque->cost += scheduler->jobs[i].cost;
+    }
+
+    pthread_t *threads = st_malloc(nbThreads * sizeof(pthread_t));
+    SchedulerWorker *workers = st_malloc(nbThreads * sizeof(SchedulerWorker));
+    for (int64_t i = 0; i < nbThreads; i++) {
+        workers[i].scheduler = scheduler;
+        workers[i].index = i;
+        if (pthread_create(&threads[i], NULL, jobScheduler_worker, &workers[i]) != 0) {
+            st_errAbort("jobScheduler: couldn't start worker thread %" PRIi64 "\n", i);
+        }
+    }
+    for (int64_t i = 0; i < nbThreads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    for (int64_t i = 0; i < nbThreads; i++) {
+        pthread_mutex_destroy(&scheduler->deques[i].lock);
+        free(scheduler->deques[i].jobs);
+    }
+    free(scheduler->deques);
+    scheduler->deques = NULL;
+    free(threads);
+    free(workers);
+    scheduler->length = 0;
+}
+
+void jobScheduler_destruct(JobScheduler *scheduler) {
+    pthread_mutex_destroy(&scheduler->stealsLock);
+    free(scheduler->jobs);
+    free(scheduler);
+}
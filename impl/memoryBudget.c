@@ -0,0 +1,95 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <inttypes.h>
+#include "sonLib.h"
+#include "memoryBudget.h"
+
+struct _memoryBudget {
+    pthread_mutex_t lock;
+    pthread_cond_t released;
+    int64_t budget;
+    int64_t reserved;
+    int64_t peakReserved;
+    // tickets of the reservations, the one at nextServed is the only one that may be granted
+    int64_t nextTicket;
+    int64_t nextServed;
+};
+
+MemoryBudget *memoryBudget_construct(int64_t budget) {
+    if (budget < 1) {
+        st_errAbort("memoryBudget: need a budget of at least one byte, got %" PRIi64 "\n", budget);
+    }
+    MemoryBudget *memoryBudget = st_malloc(sizeof(MemoryBudget));
+    pthread_mutex_init(&memoryBudget->lock, NULL);
+    pthread_cond_init(&memoryBudget->released, NULL);
+    memoryBudget->budget = budget;
+    memoryBudget->reserved = 0;
+    memoryBudget->peakReserved = 0;
+    memoryBudget->nextTicket = 0;
+    memoryBudget->nextServed = 0;
+    return memoryBudget;
+}
+
+int64_t memoryBudget_reserve(MemoryBudget *budget, int64_t bytes) {
+    if (bytes < 0) {
+        st_errAbort("memoryBudget: can't reserve %" PRIi64 " bytes\n", bytes);
+    }
+    // too big to ever fit, it takes the whole budget
+    if (bytes > budget->budget) {
+        bytes = budget->budget;
+    }
+    pthread_mutex_lock(&budget->lock);
+    int64_t ticket = budget->nextTicket++;
+    while (ticket != budget->nextServed || budget->reserved + bytes > budget->budget) {
+        pthread_cond_wait(&budget->released, &budget->lock);
+    }
+    budget->nextServed++;
+    budget->reserved += bytes;
+    if (budget->reserved > budget->peakReserved) {
+        budget->peakReserved = budget->reserved;
+    }
+    // the next in line may fit too
+    pthread_cond_broadcast(&budget->released);
+    pthread_mutex_unlock(&budget->lock);
+    return bytes;
+}
+
+void memoryBudget_release(MemoryBudget *budget, int64_t bytes) {
+    pthread_mutex_lock(&budget->lock);
+    if (bytes < 0 || bytes > budget->reserved) {
+        st_errAbort("memoryBudget: releasing %" PRIi64 " bytes but only %" PRIi64 " are reserved\n", bytes,
+                    budget->reserved);
+    }
+    budget->reserved -= bytes;
+    pthread_cond_broadcast(&budget->released);
+    pthread_mutex_unlock(&budget->lock);
+}
+
+int64_t memoryBudget_getBudget(MemoryBudget *budget) {
+    return budget->budget;
+}
+
+int64_t memoryBudget_getReserved(MemoryBudget *budget) {
+    pthread_mutex_lock(&budget->lock);
+    int64_t reserved = budget->reserved;
+    pthread_mutex_unlock(&budget->lock);
+    return reserved;
+}
+
+int64_t memoryBudget_getPeakReserved(MemoryBudget *budget) {
+    pthread_mutex_lock(&budget->lock);
+    int64_t peakReserved = budget->peakReserved;
+    pthread_mutex_unlock(&budget->lock);
+    return peakReserved;
+}
+
+void memoryBudget_destruct(MemoryBudget *budget) {
+    if (budget->reserved != 0) {
+        st_errAbort("memoryBudget: %" PRIi64 " bytes are still reserved\n", budget->reserved);
+    }
+    pthread_mutex_destroy(&budget->lock);
+    pthread_cond_destroy(&budget->released);
+    free(budget);
+}
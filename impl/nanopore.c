@@ -2,6 +2,11 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <inttypes.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "nanopore.h"
 #include "pairwiseAligner.h"
 
@@ -15,29 +20,31 @@ static NanoporeRead *nanopore_nanoporeReadConstruct(int64_t readLength,
     npRead->nbTemplateEvents = nbTemplateEvents;
     npRead->nbComplementEvents = nbComplementEvents;
 
-    npRead->twoDread = st_malloc(npRead->readLength * sizeof(char));
+    npRead->twoDread = st_malloc((npRead->readLength + 1) * sizeof(char));
 
     // the map contains the index of the event corresponding to each kmer in the read sequence so
     // the length of the map has to be the same as the read sequence, not the number of events
     // there can be events that aren't mapped to a kmer
-    npRead->templateEventMap = st_malloc(npRead->readLength * sizeof(int64_t));
-    npRead->templateEvents = st_malloc(npRead->nbTemplateEvents * NB_EVENT_PARAMS * sizeof(double));
+    npRead->templateEventMap = st_malloc(npRead->readLength * sizeof(int32_t));
+    npRead->templateEvents = st_malloc(npRead->nbTemplateEvents * NB_EVENT_PARAMS * sizeof(float));
 
-    npRead->complementEventMap = st_malloc(npRead->readLength * sizeof(int64_t));
-    npRead->complementEvents = st_malloc(npRead->nbComplementEvents * NB_EVENT_PARAMS * sizeof(double));
+    npRead->complementEventMap = st_malloc(npRead->readLength * sizeof(int32_t));
+    npRead->complementEvents = st_malloc(npRead->nbComplementEvents * NB_EVENT_PARAMS * sizeof(float));
 
     npRead->scaled = TRUE;
+    npRead->mappedFile = NULL;
+    npRead->mappedFileLength = 0;
     // return
     return npRead;
 }
 
-static void nanopore_descaleEvents(int64_t nb_events, double *events, double scale, double shift) {
+static void nanopore_descaleEvents(int64_t nb_events, float *events, double scale, double shift) {
     for (int64_t i = 0; i < nb_events; i += NB_EVENT_PARAMS) {
         events[i] = (events[i] - shift) / scale;
     }
 }
 
-NanoporeRead *nanopore_loadNanoporeReadFromFile(const char *nanoporeReadFile) {
+static NanoporeRead *nanopore_loadNanoporeReadFromTextFile(const char *nanoporeReadFile) {
     FILE *fH = fopen(nanoporeReadFile, "r");
 
     // line 1 [2D read length] [# of template events] [# of complement events]
@@ -130,7 +137,7 @@ NanoporeRead *nanopore_loadNanoporeReadFromFile(const char *nanoporeReadFile) {
                 stList_length(tokens));
     }
     for (int64_t i = 0; i < npRead->readLength; i++) {
-        j = sscanf(stList_get(tokens, i), "%lld", &(npRead->templateEventMap[i]));
+        j = sscanf(stList_get(tokens, i), "%" SCNd32, &(npRead->templateEventMap[i]));
         if (j != 1) {
             st_errAbort("error loading in template eventMap\n");
         }
@@ -149,7 +156,7 @@ NanoporeRead *nanopore_loadNanoporeReadFromFile(const char *nanoporeReadFile) {
                 stList_length(tokens));
     }
     for (int64_t i = 0; i < (npRead->nbTemplateEvents * NB_EVENT_PARAMS); i++) {
-        j = sscanf(stList_get(tokens, i), "%lf", &(npRead->templateEvents[i]));
+        j = sscanf(stList_get(tokens, i), "%f", &(npRead->templateEvents[i]));
         if (j != 1) {
             st_errAbort("error loading in template events\n");
         }
@@ -168,7 +175,7 @@ NanoporeRead *nanopore_loadNanoporeReadFromFile(const char *nanoporeReadFile) {
                 stList_length(tokens));
     }
     for (int64_t i = 0; i < npRead->readLength; i++) {
-        j = sscanf(stList_get(tokens, i), "%lld", &(npRead->complementEventMap[i]));
+        j = sscanf(stList_get(tokens, i), "%" SCNd32, &(npRead->complementEventMap[i]));
         if (j != 1) {
             st_errAbort("error loading in complement eventMap\n");
         }
@@ -187,7 +194,7 @@ NanoporeRead *nanopore_loadNanoporeReadFromFile(const char *nanoporeReadFile) {
                 stList_length(tokens));
     }
     for (int64_t i = 0; i < (npRead->nbComplementEvents * NB_EVENT_PARAMS); i++) {
-        j = sscanf(stList_get(tokens, i), "%lf", &(npRead->complementEvents[i]));
+        j = sscanf(stList_get(tokens, i), "%f", &(npRead->complementEvents[i]));
         if (j != 1) {
             st_errAbort("error loading in complement events\n");
         }
@@ -199,7 +206,377 @@ NanoporeRead *nanopore_loadNanoporeReadFromFile(const char *nanoporeReadFile) {
     return npRead;
 }
 
-stList *nanopore_remapAnchorPairs(stList *anchorPairs, int64_t *eventMap) {
+// size of the header of the binary layout, magic, version, three lengths and the ten adjustment parameters
+#define NANOPORE_READ_BINARY_HEADER_LENGTH (4 + sizeof(int32_t) + 3 * sizeof(int64_t) + 10 * sizeof(double))
+
+// blocks are zero padded to a multiple of 8 bytes
+static int64_t nanopore_binaryBlockLength(int64_t length) {
+    return ((length + 7) / 8) * 8;
+}
+
+static int64_t nanopore_binaryRecordLength(NanoporeRead *npRead) {
+    return NANOPORE_READ_BINARY_HEADER_LENGTH
+           + nanopore_binaryBlockLength(npRead->readLength + 1)
+           + 2 * nanopore_binaryBlockLength(npRead->readLength * sizeof(int32_t))
+           + nanopore_binaryBlockLength(npRead->nbTemplateEvents * NB_EVENT_PARAMS * sizeof(float))
+           + nanopore_binaryBlockLength(npRead->nbComplementEvents * NB_EVENT_PARAMS * sizeof(float));
+}
+
+static void nanopore_checkLittleEndian() {
+    uint16_t one = 1;
+    if (*((uint8_t *) &one) != 1) {
+        st_errAbort("binary npRead files are little-endian, not supported on this machine\n");
+    }
+}
+
+// maps the whole file, private mappings can be written to without changing the file
+static char *nanopore_mapFile(const char *file, int64_t *fileLength, bool private) {
+    int fd = open(file, O_RDONLY);
+    if (fd < 0) {
+        st_errAbort("couldn't open %s\n", file);
+    }
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) != 0) {
+        st_errAbort("couldn't stat %s\n", file);
+    }
+    *fileLength = (int64_t) fileStat.st_size;
+    if (*fileLength == 0) {
+        st_errAbort("%s is empty\n", file);
+    }
+    char *data = private ? mmap(NULL, *fileLength, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0)
+                         : mmap(NULL, *fileLength, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        st_errAbort("couldn't mmap %s\n", file);
+    }
+    return data;
+}
+
+// makes a read whose arrays point into a binary npRead record, the record has to outlive the read and the read
+// must not be destructed with nanopore_nanoporeReadDestruct unless mappedFile is set
+static NanoporeRead *nanopore_nanoporeReadFromBinaryRecord(char *data, int64_t length, const char *source) {
+    nanopore_checkLittleEndian();
+    if (length < (int64_t) NANOPORE_READ_BINARY_HEADER_LENGTH
+        || memcmp(data, NANOPORE_READ_BINARY_MAGIC, 4) != 0) {
+        st_errAbort("%s is not a binary npRead\n", source);
+    }
+    int32_t version;
+    memcpy(&version, data + 4, sizeof(int32_t));
+    if (version != NANOPORE_READ_BINARY_VERSION) {
+        st_errAbort("binary npRead %s has version %" PRIi32 ", expected %d\n", source, version,
+                    NANOPORE_READ_BINARY_VERSION);
+    }
+    int64_t *lengths = (int64_t *) (data + 8);
+    double *params = (double *) (data + 8 + 3 * sizeof(int64_t));
+
+    NanoporeRead *npRead = st_malloc(sizeof(NanoporeRead));
+    npRead->readLength = lengths[0];
+    npRead->nbTemplateEvents = lengths[1];
+    npRead->nbComplementEvents = lengths[2];
+    if (npRead->readLength < 0 || npRead->nbTemplateEvents < 0 || npRead->nbComplementEvents < 0) {
+        st_errAbort("binary npRead %s has negative lengths\n", source);
+    }
+    int64_t expectedLength = nanopore_binaryRecordLength(npRead);
+    if (length != expectedLength) {
+        st_errAbort("binary npRead %s should be %" PRIi64 " bytes, got %" PRIi64 "\n", source,
+                    expectedLength, length);
+    }
+
+    npRead->templateParams.scale = params[0];
+    npRead->templateParams.shift = params[1];
+    npRead->templateParams.var = params[2];
+    npRead->templateParams.scale_sd = params[3];
+    npRead->templateParams.var_sd = params[4];
+    npRead->complementParams.scale = params[5];
+    npRead->complementParams.shift = params[6];
+    npRead->complementParams.var = params[7];
+    npRead->complementParams.scale_sd = params[8];
+    npRead->complementParams.var_sd = params[9];
+
+    // the arrays point straight into the record
+    char *block = data + NANOPORE_READ_BINARY_HEADER_LENGTH;
+    npRead->twoDread = block;
+    block += nanopore_binaryBlockLength(npRead->readLength + 1);
+    npRead->templateEventMap = (int32_t *) block;
+    block += nanopore_binaryBlockLength(npRead->readLength * sizeof(int32_t));
+    npRead->templateEvents = (float *) block;
+    block += nanopore_binaryBlockLength(npRead->nbTemplateEvents * NB_EVENT_PARAMS * sizeof(float));
+    npRead->complementEventMap = (int32_t *) block;
+    block += nanopore_binaryBlockLength(npRead->readLength * sizeof(int32_t));
+    npRead->complementEvents = (float *) block;
+
+    npRead->scaled = TRUE;
+    npRead->mappedFile = NULL;
+    npRead->mappedFileLength = 0;
+    return npRead;
+}
+
+static NanoporeRead *nanopore_loadNanoporeReadFromBinaryFile(const char *nanoporeReadFile) {
+    int64_t fileLength;
+    // private mapping so that descaling the events doesn't change the file
+    char *data = nanopore_mapFile(nanoporeReadFile, &fileLength, TRUE);
+    NanoporeRead *npRead = nanopore_nanoporeReadFromBinaryRecord(data, fileLength, nanoporeReadFile);
+    npRead->mappedFile = data;
+    npRead->mappedFileLength = fileLength;
+    return npRead;
+}
+
+// copies a read into freshly allocated arrays
+static NanoporeRead *nanopore_nanoporeReadCopy(NanoporeRead *npRead) {
+    NanoporeRead *copy = nanopore_nanoporeReadConstruct(npRead->readLength, npRead->nbTemplateEvents,
+                                                        npRead->nbComplementEvents);
+    copy->templateParams = npRead->templateParams;
+    copy->complementParams = npRead->complementParams;
+    memcpy(copy->twoDread, npRead->twoDread, npRead->readLength * sizeof(char));
+    copy->twoDread[npRead->readLength] = '\0';
+    memcpy(copy->templateEventMap, npRead->templateEventMap, npRead->readLength * sizeof(int32_t));
+    memcpy(copy->templateEvents, npRead->templateEvents,
+           npRead->nbTemplateEvents * NB_EVENT_PARAMS * sizeof(float));
+    memcpy(copy->complementEventMap, npRead->complementEventMap, npRead->readLength * sizeof(int32_t));
+    memcpy(copy->complementEvents, npRead->complementEvents,
+           npRead->nbComplementEvents * NB_EVENT_PARAMS * sizeof(float));
+    copy->scaled = npRead->scaled;
+    return copy;
+}
+
+static void nanopore_fwrite(const void *data, size_t size, int64_t n, FILE *fH) {
+    if (n > 0 && fwrite(data, size, n, fH) != (size_t) n) {
+        st_errAbort("error writing binary npRead file\n");
+    }
+}
+
+// writes the array followed by the zero padding of its block
+static void nanopore_fwriteBlock(const void *data, int64_t length, FILE *fH) {
+    static const char padding[8] = { 0 };
+    nanopore_fwrite(data, sizeof(char), length, fH);
+    nanopore_fwrite(padding, sizeof(char), nanopore_binaryBlockLength(length) - length, fH);
+}
+
+// writes the read as one binary npRead record, returns the number of bytes written (a multiple of 8)
+static int64_t nanopore_writeNanoporeReadBinaryRecord(NanoporeRead *npRead, FILE *fH) {
+    nanopore_checkLittleEndian();
+    if (!npRead->scaled) {
+        st_errAbort("can only write binary npRead files of scaled reads\n");
+    }
+    int32_t version = NANOPORE_READ_BINARY_VERSION;
+    int64_t lengths[3] = { npRead->readLength, npRead->nbTemplateEvents, npRead->nbComplementEvents };
+    double params[10] = { npRead->templateParams.scale, npRead->templateParams.shift, npRead->templateParams.var,
+                          npRead->templateParams.scale_sd, npRead->templateParams.var_sd,
+                          npRead->complementParams.scale, npRead->complementParams.shift,
+                          npRead->complementParams.var, npRead->complementParams.scale_sd,
+                          npRead->complementParams.var_sd };
+    nanopore_fwrite(NANOPORE_READ_BINARY_MAGIC, sizeof(char), 4, fH);
+    nanopore_fwrite(&version, sizeof(int32_t), 1, fH);
+    nanopore_fwrite(lengths, sizeof(int64_t), 3, fH);
+    nanopore_fwrite(params, sizeof(double), 10, fH);
+
+    // the 2D read is written with its terminator (the first byte of the padding)
+    static const char padding[8] = { 0 };
+    nanopore_fwrite(npRead->twoDread, sizeof(char), npRead->readLength, fH);
+    nanopore_fwrite(padding, sizeof(char), nanopore_binaryBlockLength(npRead->readLength + 1) - npRead->readLength,
+                    fH);
+
+    nanopore_fwriteBlock(npRead->templateEventMap, npRead->readLength * sizeof(int32_t), fH);
+    nanopore_fwriteBlock(npRead->templateEvents, npRead->nbTemplateEvents * NB_EVENT_PARAMS * sizeof(float), fH);
+    nanopore_fwriteBlock(npRead->complementEventMap, npRead->readLength * sizeof(int32_t), fH);
+    nanopore_fwriteBlock(npRead->complementEvents, npRead->nbComplementEvents * NB_EVENT_PARAMS * sizeof(float),
+                         fH);
+    return nanopore_binaryRecordLength(npRead);
+}
+
+void nanopore_writeNanoporeReadToBinaryFile(NanoporeRead *npRead, const char *binaryNanoporeReadFile) {
+    FILE *fH = fopen(binaryNanoporeReadFile, "wb");
+    if (fH == NULL) {
+        st_errAbort("couldn't open %s for writing\n", binaryNanoporeReadFile);
+    }
+    nanopore_writeNanoporeReadBinaryRecord(npRead, fH);
+    if (fclose(fH) != 0) {
+        st_errAbort("error writing binary npRead file %s\n", binaryNanoporeReadFile);
+    }
+}
+
+NanoporeRead *nanopore_loadNanoporeReadFromFile(const char *nanoporeReadFile) {
+    // binary files start with the magic, the text format starts with the read length
+    FILE *fH = fopen(nanoporeReadFile, "rb");
+    if (fH == NULL) {
+        st_errAbort("couldn't open npRead file %s\n", nanoporeReadFile);
+    }
+    char magic[4];
+    bool binary = fread(magic, sizeof(char), 4, fH) == 4 && memcmp(magic, NANOPORE_READ_BINARY_MAGIC, 4) == 0;
+    fclose(fH);
+    return binary ? nanopore_loadNanoporeReadFromBinaryFile(nanoporeReadFile)
+                  : nanopore_loadNanoporeReadFromTextFile(nanoporeReadFile);
+}
+
+// archive header, magic, version, number of reads and the offset of the index
+#define NANOPORE_READ_ARCHIVE_HEADER_LENGTH (4 + sizeof(int32_t) + 2 * sizeof(int64_t))
+
+static int64_t nanopore_archiveNameBlockLength(int64_t nameLength) {
+    return ((nameLength + 1 + 7) / 8) * 8;
+}
+
+struct _nanoporeReadArchiveWriter {
+    FILE *fH;
+    int64_t offset; // where the next record goes
+    stList *names;
+    stList *records; // stIntTuple (offset, length)
+    stHash *namesSeen;
+};
+
+NanoporeReadArchiveWriter *nanoporeReadArchiveWriter_construct(const char *archiveFile) {
+    nanopore_checkLittleEndian();
+    NanoporeReadArchiveWriter *writer = st_malloc(sizeof(NanoporeReadArchiveWriter));
+    writer->fH = fopen(archiveFile, "wb");
+    if (writer->fH == NULL) {
+        st_errAbort("couldn't open %s for writing\n", archiveFile);
+    }
+    // the header is written again with the final values once the index is written
+    char header[NANOPORE_READ_ARCHIVE_HEADER_LENGTH];
+    memset(header, 0, NANOPORE_READ_ARCHIVE_HEADER_LENGTH);
+    nanopore_fwrite(header, sizeof(char), NANOPORE_READ_ARCHIVE_HEADER_LENGTH, writer->fH);
+    writer->offset = NANOPORE_READ_ARCHIVE_HEADER_LENGTH;
+    writer->names = stList_construct3(0, free);
+    writer->records = stList_construct3(0, (void (*)(void *)) stIntTuple_destruct);
+    writer->namesSeen = stHash_construct3(stHash_stringKey, stHash_stringEqualKey, NULL, NULL);
+    return writer;
+}
+
+void nanoporeReadArchiveWriter_add(NanoporeReadArchiveWriter *writer, const char *readName, NanoporeRead *npRead) {
+    if (stHash_search(writer->namesSeen, (void *) readName) != NULL) {
+        st_errAbort("read %s is already in the archive\n", readName);
+    }
+    int64_t length = nanopore_writeNanoporeReadBinaryRecord(npRead, writer->fH);
+    char *name = stString_copy(readName);
+    stList_append(writer->names, name);
+    stHash_insert(writer->namesSeen, name, name);
+    stList_append(writer->records, stIntTuple_construct2(writer->offset, length));
+    writer->offset += length;
+}
+
+void nanoporeReadArchiveWriter_destruct(NanoporeReadArchiveWriter *writer) {
+    // index, (offset, length, name length, name) for each read
+    int64_t indexOffset = writer->offset;
+    for (int64_t i = 0; i < stList_length(writer->names); i++) {
+        char *name = stList_get(writer->names, i);
+        stIntTuple *record = stList_get(writer->records, i);
+        int64_t entry[3] = { stIntTuple_get(record, 0), stIntTuple_get(record, 1), (int64_t) strlen(name) };
+        nanopore_fwrite(entry, sizeof(int64_t), 3, writer->fH);
+        int64_t nameBlockLength = nanopore_archiveNameBlockLength(entry[2]);
+        char *nameBlock = st_calloc(nameBlockLength, sizeof(char));
+        memcpy(nameBlock, name, entry[2] * sizeof(char));
+        nanopore_fwrite(nameBlock, sizeof(char), nameBlockLength, writer->fH);
+        free(nameBlock);
+    }
+    int32_t version = NANOPORE_READ_ARCHIVE_VERSION;
+    int64_t counts[2] = { stList_length(writer->names), indexOffset };
+    if (fseek(writer->fH, 0, SEEK_SET) != 0) {
+        st_errAbort("error writing npRead archive header\n");
+    }
+    nanopore_fwrite(NANOPORE_READ_ARCHIVE_MAGIC, sizeof(char), 4, writer->fH);
+    nanopore_fwrite(&version, sizeof(int32_t), 1, writer->fH);
+    nanopore_fwrite(counts, sizeof(int64_t), 2, writer->fH);
+    if (fclose(writer->fH) != 0) {
+        st_errAbort("error writing npRead archive\n");
+    }
+    stHash_destruct(writer->namesSeen);
+    stList_destruct(writer->names);
+    stList_destruct(writer->records);
+    free(writer);
+}
+
+struct _nanoporeReadArchive {
+    char *data;
+    int64_t length;
+    int64_t nbReads;
+    int64_t *offsets;
+    int64_t *lengths;
+    char **names; // point into the mapping
+    stHash *nameToIndex; // read name to stIntTuple index
+};
+
+NanoporeReadArchive *nanoporeReadArchive_construct(const char *archiveFile) {
+    nanopore_checkLittleEndian();
+    NanoporeReadArchive *archive = st_malloc(sizeof(NanoporeReadArchive));
+    archive->data = nanopore_mapFile(archiveFile, &archive->length, FALSE);
+    if (archive->length < (int64_t) NANOPORE_READ_ARCHIVE_HEADER_LENGTH
+        || memcmp(archive->data, NANOPORE_READ_ARCHIVE_MAGIC, 4) != 0) {
+        st_errAbort("%s is not a npRead archive\n", archiveFile);
+    }
+    int32_t version;
+    memcpy(&version, archive->data + 4, sizeof(int32_t));
+    if (version != NANOPORE_READ_ARCHIVE_VERSION) {
+        st_errAbort("npRead archive %s has version %" PRIi32 ", expected %d\n", archiveFile, version,
+                    NANOPORE_READ_ARCHIVE_VERSION);
+    }
+    int64_t *counts = (int64_t *) (archive->data + 8);
+    archive->nbReads = counts[0];
+    int64_t indexOffset = counts[1];
+    if (archive->nbReads < 0 || indexOffset < (int64_t) NANOPORE_READ_ARCHIVE_HEADER_LENGTH
+        || indexOffset > archive->length) {
+        st_errAbort("npRead archive %s has a corrupt header\n", archiveFile);
+    }
+
+    archive->offsets = st_malloc(archive->nbReads * sizeof(int64_t));
+    archive->lengths = st_malloc(archive->nbReads * sizeof(int64_t));
+    archive->names = st_malloc(archive->nbReads * sizeof(char *));
+    archive->nameToIndex = stHash_construct3(stHash_stringKey, stHash_stringEqualKey, NULL,
+                                             (void (*)(void *)) stIntTuple_destruct);
+    int64_t position = indexOffset;
+    for (int64_t i = 0; i < archive->nbReads; i++) {
+        if (position + 3 * (int64_t) sizeof(int64_t) > archive->length) {
+            st_errAbort("npRead archive %s has a truncated index\n", archiveFile);
+        }
+        int64_t *entry = (int64_t *) (archive->data + position);
+        archive->offsets[i] = entry[0];
+        archive->lengths[i] = entry[1];
+        position += 3 * sizeof(int64_t);
+        archive->names[i] = archive->data + position;
+        position += nanopore_archiveNameBlockLength(entry[2]);
+        if (position > archive->length || entry[0] < (int64_t) NANOPORE_READ_ARCHIVE_HEADER_LENGTH
+            || entry[0] + entry[1] > indexOffset) {
+            st_errAbort("npRead archive %s has a corrupt index\n", archiveFile);
+        }
+        stHash_insert(archive->nameToIndex, archive->names[i], stIntTuple_construct1(i));
+    }
+    return archive;
+}
+
+void nanoporeReadArchive_destruct(NanoporeReadArchive *archive) {
+    stHash_destruct(archive->nameToIndex);
+    munmap(archive->data, archive->length);
+    free(archive->offsets);
+    free(archive->lengths);
+    free(archive->names);
+    free(archive);
+}
+
+int64_t nanoporeReadArchive_getNumberOfReads(NanoporeReadArchive *archive) {
+    return archive->nbReads;
+}
+
+const char *nanoporeReadArchive_getReadName(NanoporeReadArchive *archive, int64_t ordinal) {
+    if (ordinal < 0 || ordinal >= archive->nbReads) {
+        st_errAbort("npRead archive has %" PRIi64 " reads, asked for read %" PRIi64 "\n", archive->nbReads, ordinal);
+    }
+    return archive->names[ordinal];
+}
+
+NanoporeRead *nanoporeReadArchive_getRead(NanoporeReadArchive *archive, int64_t ordinal) {
+    const char *name = nanoporeReadArchive_getReadName(archive, ordinal);
+    NanoporeRead *record = nanopore_nanoporeReadFromBinaryRecord(archive->data + archive->offsets[ordinal],
+                                                                 archive->lengths[ordinal], name);
+    // the archive is mapped read only and shared between reads, so each read gets its own arrays
+    NanoporeRead *npRead = nanopore_nanoporeReadCopy(record);
+    free(record);
+    return npRead;
+}
+
+NanoporeRead *nanoporeReadArchive_getReadByName(NanoporeReadArchive *archive, const char *readName) {
+    stIntTuple *index = stHash_search(archive->nameToIndex, (void *) readName);
+    return index == NULL ? NULL : nanoporeReadArchive_getRead(archive, stIntTuple_get(index, 0));
+}
+
+stList *nanopore_remapAnchorPairs(stList *anchorPairs, int32_t *eventMap) {
     stList *mappedPairs = stList_construct3(0, (void (*)(void *)) stIntTuple_destruct);
 
     for (int64_t i = 0; i < stList_length(anchorPairs); i++) {
@@ -211,7 +588,7 @@ stList *nanopore_remapAnchorPairs(stList *anchorPairs, int64_t *eventMap) {
     return mappedPairs;
 }
 
-stList *nanopore_remapAnchorPairsWithOffset(stList *unmappedPairs, int64_t *eventMap, int64_t mapOffset) {
+stList *nanopore_remapAnchorPairsWithOffset(stList *unmappedPairs, int32_t *eventMap, int64_t mapOffset) {
     stList *mappedPairs = stList_construct3(0, (void (*)(void *)) stIntTuple_destruct);
 
     for (int64_t i = 0; i < stList_length(unmappedPairs); i++) {
@@ -236,6 +613,11 @@ void nanopore_descaleNanoporeRead(NanoporeRead *npRead) {
 }
 
 void nanopore_nanoporeReadDestruct(NanoporeRead *npRead) {
+    if (npRead->mappedFile != NULL) {
+        munmap(npRead->mappedFile, npRead->mappedFileLength);
+        free(npRead);
+        return;
+    }
     free(npRead->twoDread);
     free(npRead->templateEventMap);
     free(npRead->templateEvents);
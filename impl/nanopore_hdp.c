@@ -22,11 +22,16 @@
 #include <stdlib.h>
 #include <string.h>
 #include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "pairwiseAligner.h"
 #include "emissionMatrix.h"
 #include "hdp.h"
 #include "hdp_math_utils.h"
 #include "nanopore_hdp.h"
+#include "nanopore.h"
 #include "fastCMaths.h"
 #include "sonLib.h"
 
@@ -185,76 +190,240 @@ void update_nhdp_from_alignment(NanoporeHDP* nhdp, const char* alignment_filepat
     update_nhdp_from_alignment_with_filter(nhdp, alignment_filepath, has_header, NULL);
 }
 
+#define ALIGNMENT_MAX_SIGNAL_LENGTH 64
+#define ALIGNMENT_MAX_ERROR_LENGTH 512
+
+static bool is_alignment_field_separator(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+// same id as kmer_id, without allocating a word, kmer need not be '\0' terminated. Returns -1 if the kmer has a
+// character outside the alphabet
+static int64_t alignment_kmer_id(NanoporeHDP* nhdp, const char* kmer, int64_t kmer_field_length) {
+    int64_t id = 0;
+    for (int64_t i = 0; i < nhdp->kmer_length; i++) {
+        int64_t j = 0;
+        while (i >= kmer_field_length || kmer[i] != nhdp->alphabet[j]) {
+            j++;
+            if (j >= nhdp->alphabet_size) {
+                return -1;
+            }
+        }
+        id = id * nhdp->alphabet_size + j;
+    }
+    return id;
+}
+
+// the chunks are parsed in parallel, so instead of exiting a chunk stops at its first bad line and keeps the
+// message for update_nhdp_from_alignment_in_chunks to report
+static char* alignment_error() {
+    return (char*) malloc(sizeof(char) * ALIGNMENT_MAX_ERROR_LENGTH);
+}
+
+// parses the lines in [start, end) into signal and dp_ids, returns the number of lines that passed the filter,
+// sets *wrong_num_cols if any line does not have NUM_ALIGNMENT_COLS columns and *error (malloced) at the first
+// line that can't be parsed
+static int64_t parse_alignment_chunk(NanoporeHDP* nhdp, const char* start, const char* end, const char* strand_filter,
+                                     double* signal, int64_t* dp_ids, bool* wrong_num_cols, char** error) {
+    int64_t strand_filter_length = strand_filter == NULL ? 0 : (int64_t) strlen(strand_filter);
+    int64_t num_kept = 0;
+    
+    const char* line = start;
+    while (line < end) {
+        const char* line_end = memchr(line, '\n', end - line);
+        if (line_end == NULL) {
+            line_end = end;
+        }
+        
+        // split on runs of whitespace like stString_split, only remembering the columns we need
+        const char* fields[NUM_ALIGNMENT_COLS];
+        int64_t field_lengths[NUM_ALIGNMENT_COLS];
+        int64_t num_cols = 0;
+        const char* p = line;
+        while (p < line_end) {
+            while (p < line_end && is_alignment_field_separator(*p)) {
+                p++;
+            }
+            if (p == line_end) {
+                break;
+            }
+            const char* field = p;
+            while (p < line_end && !is_alignment_field_separator(*p)) {
+                p++;
+            }
+            if (num_cols < NUM_ALIGNMENT_COLS) {
+                fields[num_cols] = field;
+                field_lengths[num_cols] = p - field;
+            }
+            num_cols++;
+        }
+        
+        if (num_cols > 0) {
+            if (num_cols != NUM_ALIGNMENT_COLS) {
+                *wrong_num_cols = true;
+            }
+            if (num_cols <= ALIGNMENT_SIGNAL_COL) {
+                *error = alignment_error();
+                snprintf(*error, ALIGNMENT_MAX_ERROR_LENGTH, "Alignment line has %"PRId64" columns, need at least "
+                         "%d.\n", num_cols, ALIGNMENT_SIGNAL_COL + 1);
+                return num_kept;
+            }
+            
+            if (strand_filter == NULL || (field_lengths[ALIGNMENT_STRAND_COL] == strand_filter_length
+                                          && memcmp(fields[ALIGNMENT_STRAND_COL], strand_filter,
+                                                    strand_filter_length) == 0)) {
+                // the signal may end the mapped file, so copy it before strtod
+                char signal_str[ALIGNMENT_MAX_SIGNAL_LENGTH + 1];
+                int64_t signal_length = field_lengths[ALIGNMENT_SIGNAL_COL];
+                if (signal_length > ALIGNMENT_MAX_SIGNAL_LENGTH) {
+                    signal_length = ALIGNMENT_MAX_SIGNAL_LENGTH;
+                }
+                memcpy(signal_str, fields[ALIGNMENT_SIGNAL_COL], signal_length);
+                signal_str[signal_length] = '\0';
+                char* signal_end;
+                signal[num_kept] = strtod(signal_str, &signal_end);
+                if (signal_end == signal_str) {
+                    *error = alignment_error();
+                    snprintf(*error, ALIGNMENT_MAX_ERROR_LENGTH, "Alignment signal %s is not a number.\n",
+                             signal_str);
+                    return num_kept;
+                }
+                dp_ids[num_kept] = alignment_kmer_id(nhdp, fields[ALIGNMENT_KMER_COL],
+                                                     field_lengths[ALIGNMENT_KMER_COL]);
+                if (dp_ids[num_kept] < 0) {
+                    *error = alignment_error();
+                    snprintf(*error, ALIGNMENT_MAX_ERROR_LENGTH, "vanillaAlign - ERROR: K-mer contains character "
+                             "outside alphabet. Got offending kmer is: %.*s. alphabet is %s\n",
+                             (int) field_lengths[ALIGNMENT_KMER_COL], fields[ALIGNMENT_KMER_COL], nhdp->alphabet);
+                    return num_kept;
+                }
+                num_kept++;
+            }
+        }
+        
+        line = line_end + 1;
+    }
+    return num_kept;
+}
+
 void update_nhdp_from_alignment_with_filter(NanoporeHDP* nhdp, const char* alignment_filepath,
                                             bool has_header, const char* strand_filter) {
+    update_nhdp_from_alignment_in_chunks(nhdp, alignment_filepath, has_header, strand_filter,
+                                         ALIGNMENT_CHUNK_LENGTH);
+}
+
+void update_nhdp_from_alignment_in_chunks(NanoporeHDP* nhdp, const char* alignment_filepath, bool has_header,
+                                          const char* strand_filter, int64_t chunk_length) {
+    if (chunk_length < 1) {
+        fprintf(stderr, "Alignment chunk length must be positive, got %"PRId64".\n", chunk_length);
+        exit(EXIT_FAILURE);
+    }
     
-    stList* signal_list = stList_construct3(0, &free);
-    stList* dp_id_list = stList_construct3(0, &free);
-    
-    FILE* align_file = fopen(alignment_filepath, "r");
-    if (align_file == NULL) {
+    int fd = open(alignment_filepath, O_RDONLY);
+    if (fd < 0) {
         fprintf(stderr, "Alignment %s file does not exist.\n", alignment_filepath);
         exit(EXIT_FAILURE);
     }
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0) {
+        fprintf(stderr, "Couldn't stat alignment file %s.\n", alignment_filepath);
+        exit(EXIT_FAILURE);
+    }
+    int64_t file_length = (int64_t) file_stat.st_size;
+    char* file = NULL;
+    if (file_length > 0) {
+        file = mmap(NULL, file_length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (file == MAP_FAILED) {
+            fprintf(stderr, "Couldn't mmap alignment file %s.\n", alignment_filepath);
+            exit(EXIT_FAILURE);
+        }
+    }
+    close(fd);
     
-    stList* tokens;
-    int64_t line_length;
-    char* kmer;
-    char* strand;
-    char* signal_str;
-    int64_t* dp_id_ptr;
-    double* signal_ptr;
-    bool warned = false;
-    int proceed = 0;
-    
-    char* line = stFile_getLineFromFile(align_file);
-    if (has_header) {
-        line = stFile_getLineFromFile(align_file);
+    const char* file_end = file + file_length;
+    const char* first_line = file;
+    if (has_header && file_length > 0) {
+        first_line = memchr(file, '\n', file_length);
+        first_line = first_line == NULL ? file_end : first_line + 1;
     }
-    while (line != NULL) {
-        tokens = stString_split(line);
-        line_length = stList_length(tokens);
-        
-        if (!warned) {
-            if (line_length != NUM_ALIGNMENT_COLS) {
-                fprintf(stderr, "Input format has changed from design period, HDP may receive incorrect data.\n");
-                warned = true;
-            }
+    
+    // chunks start at line starts, each chunk gets room for as many rows as it has lines
+    int64_t num_chunks = (file_end - first_line) / chunk_length + 1;
+    const char** chunk_starts = (const char**) malloc(sizeof(char*) * (num_chunks + 1));
+    chunk_starts[0] = first_line;
+    for (int64_t c = 1; c < num_chunks; c++) {
+        const char* p = first_line + c * chunk_length;
+        if (p <= chunk_starts[c - 1]) {
+            p = chunk_starts[c - 1];
         }
-        
-        strand = (char*) stList_get(tokens, ALIGNMENT_STRAND_COL);
-        
-        if (strand_filter != NULL) {
-            proceed = strcmp(strand, strand_filter);
+        else {
+            p = memchr(p - 1, '\n', file_end - (p - 1));
+            p = p == NULL ? file_end : p + 1;
         }
-        
-        if (proceed == 0) {
-            signal_str = (char*) stList_get(tokens, ALIGNMENT_SIGNAL_COL);
-            kmer = (char*) stList_get(tokens, ALIGNMENT_KMER_COL);
-            
-            signal_ptr = (double*) malloc(sizeof(double));
-            dp_id_ptr = (int64_t*) malloc(sizeof(int64_t));
-            sscanf(signal_str, "%lf", signal_ptr);
-            *dp_id_ptr = kmer_id(kmer, nhdp->alphabet, nhdp->alphabet_size, nhdp->kmer_length);
-            
-            stList_append(signal_list, signal_ptr);
-            stList_append(dp_id_list, dp_id_ptr);
+        chunk_starts[c] = p;
+    }
+    chunk_starts[num_chunks] = file_end;
+    
+    int64_t* chunk_offsets = (int64_t*) malloc(sizeof(int64_t) * (num_chunks + 1));
+    chunk_offsets[0] = 0;
+    for (int64_t c = 0; c < num_chunks; c++) {
+        int64_t num_lines = 0;
+        const char* p = chunk_starts[c];
+        while (p < chunk_starts[c + 1]) {
+            num_lines++;
+            p = memchr(p, '\n', chunk_starts[c + 1] - p);
+            p = p == NULL ? chunk_starts[c + 1] : p + 1;
         }
-        
-        stList_destruct(tokens);
-        free(line);
-        line = stFile_getLineFromFile(align_file);
+        chunk_offsets[c + 1] = chunk_offsets[c] + num_lines;
     }
     
-    fclose(align_file);
+    int64_t max_data_length = chunk_offsets[num_chunks];
+    double* signal = (double*) malloc(sizeof(double) * (max_data_length > 0 ? max_data_length : 1));
+    int64_t* dp_ids = (int64_t*) malloc(sizeof(int64_t) * (max_data_length > 0 ? max_data_length : 1));
+    int64_t* chunk_num_kept = (int64_t*) malloc(sizeof(int64_t) * num_chunks);
+    bool* chunk_wrong_num_cols = (bool*) calloc(num_chunks, sizeof(bool));
+    char** chunk_errors = (char**) calloc(num_chunks, sizeof(char*));
+    
+#pragma omp parallel for schedule(dynamic)
+    for (int64_t c = 0; c < num_chunks; c++) {
+        chunk_num_kept[c] = parse_alignment_chunk(nhdp, chunk_starts[c], chunk_starts[c + 1], strand_filter,
+                                                  signal + chunk_offsets[c], dp_ids + chunk_offsets[c],
+                                                  &chunk_wrong_num_cols[c], &chunk_errors[c]);
+    }
     
-    int64_t data_length;
+    // the first bad line of the file is reported, as when the lines were parsed one after the other
+    for (int64_t c = 0; c < num_chunks; c++) {
+        if (chunk_errors[c] != NULL) {
+            fprintf(stderr, "%s", chunk_errors[c]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    free(chunk_errors);
     
-    double* signal = stList_toDoublePtr(signal_list, &data_length);
-    int64_t* dp_ids = stList_toIntPtr(dp_id_list, &data_length);
+    // close the gaps left by filtered lines, keeping the file order
+    int64_t data_length = 0;
+    bool warned = false;
+    for (int64_t c = 0; c < num_chunks; c++) {
+        memmove(signal + data_length, signal + chunk_offsets[c], sizeof(double) * chunk_num_kept[c]);
+        memmove(dp_ids + data_length, dp_ids + chunk_offsets[c], sizeof(int64_t) * chunk_num_kept[c]);
+        data_length += chunk_num_kept[c];
+        if (chunk_wrong_num_cols[c] && !warned) {
+            fprintf(stderr, "Input format has changed from design period, HDP may receive incorrect data.\n");
+            warned = true;
+        }
+    }
+    if (data_length > 0) {
+        signal = (double*) realloc(signal, sizeof(double) * data_length);
+        dp_ids = (int64_t*) realloc(dp_ids, sizeof(int64_t) * data_length);
+    }
     
-    stList_destruct(signal_list);
-    stList_destruct(dp_id_list);
+    free(chunk_starts);
+    free(chunk_offsets);
+    free(chunk_num_kept);
+    free(chunk_wrong_num_cols);
+    if (file != NULL) {
+        munmap(file, file_length);
+    }
     
     reset_hdp_data(nhdp->hdp);
     pass_data_to_hdp(nhdp->hdp, signal, dp_ids, data_length);
@@ -388,7 +557,7 @@ int64_t nhdp_kmer_id(NanoporeHDP* nhdp, char* kmer) {
 }
 
 double get_nanopore_kmer_density(NanoporeHDP* nhdp, void *kmer, void *x) {
-    return dir_proc_density(nhdp->hdp, *(double *) x, nhdp_kmer_id(nhdp, (char *)kmer));
+    return dir_proc_density(nhdp->hdp, nanopore_getEventMean(x), nhdp_kmer_id(nhdp, (char *)kmer));
 }
 
 double get_kmer_distr_distance(NanoporeDistributionMetricMemo* memo, char* kmer_1, char* kmer_2) {
@@ -842,9 +1011,100 @@ void serialize_nhdp(NanoporeHDP* nhdp, const char* filepath) {
     fclose(out);
 }
 
+static void serialize_nhdp_binary_internal(NanoporeHDP* nhdp, const char* filepath, bool densities_only) {
+    FILE* out = fopen(filepath, "wb");
+    if (out == NULL) {
+        fprintf(stderr, "Couldn't open %s for writing.\n", filepath);
+        exit(EXIT_FAILURE);
+    }
+    
+    int32_t version = NANOPORE_HDP_BINARY_VERSION;
+    int64_t sizes[2] = { nhdp->alphabet_size, nhdp->kmer_length };
+    // alphabet with its '\0', zero padded to a multiple of 8
+    int64_t alphabet_block_length = ((nhdp->alphabet_size + 1 + 7) / 8) * 8;
+    char* alphabet_block = (char*) calloc(alphabet_block_length, sizeof(char));
+    memcpy(alphabet_block, nhdp->alphabet, nhdp->alphabet_size);
+    
+    if (fwrite(NANOPORE_HDP_BINARY_MAGIC, sizeof(char), 4, out) != 4
+        || fwrite(&version, sizeof(int32_t), 1, out) != 1
+        || fwrite(sizes, sizeof(int64_t), 2, out) != 2
+        || fwrite(alphabet_block, sizeof(char), alphabet_block_length, out) != (size_t) alphabet_block_length) {
+        fprintf(stderr, "Error writing binary NanoporeHDP to %s.\n", filepath);
+        exit(EXIT_FAILURE);
+    }
+    free(alphabet_block);
+    
+    if (densities_only) {
+        serialize_hdp_densities_binary(nhdp->hdp, out);
+    }
+    else {
+        serialize_hdp_binary(nhdp->hdp, out);
+    }
+    
+    if (fclose(out) != 0) {
+        fprintf(stderr, "Error writing binary NanoporeHDP to %s.\n", filepath);
+        exit(EXIT_FAILURE);
+    }
+}
+
+void serialize_nhdp_binary(NanoporeHDP* nhdp, const char* filepath) {
+    serialize_nhdp_binary_internal(nhdp, filepath, false);
+}
+
+void serialize_nhdp_densities_binary(NanoporeHDP* nhdp, const char* filepath) {
+    serialize_nhdp_binary_internal(nhdp, filepath, true);
+}
+
+static NanoporeHDP* deserialize_nhdp_binary(FILE* in, const char* filepath) {
+    int32_t version;
+    int64_t sizes[2];
+    if (fread(&version, sizeof(int32_t), 1, in) != 1 || fread(sizes, sizeof(int64_t), 2, in) != 2) {
+        fprintf(stderr, "Binary NanoporeHDP %s is truncated.\n", filepath);
+        exit(EXIT_FAILURE);
+    }
+    if (version != NANOPORE_HDP_BINARY_VERSION) {
+        fprintf(stderr, "%s is binary NanoporeHDP version %"PRId32", expected version %d.\n",
+                filepath, version, NANOPORE_HDP_BINARY_VERSION);
+        exit(EXIT_FAILURE);
+    }
+    int64_t alphabet_size = sizes[0];
+    int64_t kmer_length = sizes[1];
+    if (alphabet_size <= 0) {
+        fprintf(stderr, "Binary NanoporeHDP %s has an empty alphabet.\n", filepath);
+        exit(EXIT_FAILURE);
+    }
+    
+    int64_t alphabet_block_length = ((alphabet_size + 1 + 7) / 8) * 8;
+    char* alphabet = (char*) malloc(sizeof(char) * alphabet_block_length);
+    if (fread(alphabet, sizeof(char), alphabet_block_length, in) != (size_t) alphabet_block_length) {
+        fprintf(stderr, "Binary NanoporeHDP %s is truncated.\n", filepath);
+        exit(EXIT_FAILURE);
+    }
+    int64_t hdp_offset = ftell(in);
+    fclose(in);
+    
+    HierarchicalDirichletProcess* hdp = deserialize_hdp_binary(filepath, hdp_offset);
+    
+    NanoporeHDP* nhdp = package_nanopore_hdp(hdp, alphabet, alphabet_size, kmer_length);
+    
+    free(alphabet);
+    
+    return nhdp;
+}
+
 NanoporeHDP* deserialize_nhdp(const char* filepath) {
     //st_uglyf("SENTINAL - deserializing HDP from %s\n", filepath);
     FILE* in = fopen(filepath, "r");
+    if (in == NULL) {
+        fprintf(stderr, "Couldn't open %s.\n", filepath);
+        exit(EXIT_FAILURE);
+    }
+    
+    char magic[4];
+    if (fread(magic, sizeof(char), 4, in) == 4 && memcmp(magic, NANOPORE_HDP_BINARY_MAGIC, 4) == 0) {
+        return deserialize_nhdp_binary(in, filepath);
+    }
+    rewind(in);
     
     char* line = stFile_getLineFromFile(in);
     int64_t alphabet_size;
@@ -924,7 +1184,7 @@ void nanoporeHdp_buildNanoporeHdpFromAlignment(NanoporeHdpType type,
         finalize_nhdp_distributions(nHdpT);
 
         fprintf(stderr, "vanillaAlign - Serializing template to %s...\n", templateHDP);
-        serialize_nhdp(nHdpT, templateHDP);
+        serialize_nhdp_binary(nHdpT, templateHDP);
         destroy_nanopore_hdp(nHdpT);
     }
 #pragma omp section
@@ -938,7 +1198,7 @@ void nanoporeHdp_buildNanoporeHdpFromAlignment(NanoporeHdpType type,
         finalize_nhdp_distributions(nHdpC);
 
         fprintf(stderr, "vanillaAlign - Serializing complement to %s...\n", complementHDP);
-        serialize_nhdp(nHdpC, complementHDP);
+        serialize_nhdp_binary(nHdpC, complementHDP);
         destroy_nanopore_hdp(nHdpC);
     }
 }
@@ -0,0 +1,103 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <inttypes.h>
+#include "sonLib.h"
+#include "outputQueue.h"
+
+struct _outputQueue {
+    FILE *fH;
+    pthread_t writerThread;
+    pthread_mutex_t lock;
+    pthread_cond_t notEmpty;
+    pthread_cond_t notFull;
+    bool finished;
+
+    // ring of pending buffers
+    int64_t maxPending;
+    int64_t first;
+    int64_t pending;
+    char **buffers;
+    int64_t *lengths;
+};
+
+static void *outputQueue_writer(void *arg) {
+    OutputQueue *queue = arg;
+    pthread_mutex_lock(&queue->lock);
+    while (1) {
+        while (queue->pending == 0 && !queue->finished) {
+            pthread_cond_wait(&queue->notEmpty, &queue->lock);
+        }
+        if (queue->pending == 0) { // finished and nothing left
+            break;
+        }
+        char *buffer = queue->buffers[queue->first];
+        int64_t length = queue->lengths[queue->first];
+        queue->first = (queue->first + 1) % queue->maxPending;
+        queue->pending--;
+        pthread_cond_signal(&queue->notFull);
+        // write without holding the lock so the alignment threads can keep pushing
+        pthread_mutex_unlock(&queue->lock);
+        if (length > 0 && fwrite(buffer, sizeof(char), length, queue->fH) != (size_t)length) {
+            st_errAbort("outputQueue: failed to write %" PRIi64 " bytes\n", length);
+        }
+        free(buffer);
+        pthread_mutex_lock(&queue->lock);
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return NULL;
+}
+
+OutputQueue *outputQueue_construct(const char *file, bool binary, int64_t maxPending) {
+    if (maxPending < 1) {
+        st_errAbort("outputQueue: need to allow at least one pending buffer, got %" PRIi64 "\n", maxPending);
+    }
+    OutputQueue *queue = st_malloc(sizeof(OutputQueue));
+    queue->fH = fopen(file, binary ? "ab" : "a");
+    if (queue->fH == NULL) {
+        st_errAbort("outputQueue: couldn't open %s for writing\n", file);
+    }
+    queue->finished = FALSE;
+    queue->maxPending = maxPending;
+    queue->first = 0;
+    queue->pending = 0;
+    queue->buffers = st_malloc(maxPending * sizeof(char *));
+    queue->lengths = st_malloc(maxPending * sizeof(int64_t));
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->notEmpty, NULL);
+    pthread_cond_init(&queue->notFull, NULL);
+    if (pthread_create(&queue->writerThread, NULL, outputQueue_writer, queue) != 0) {
+        st_errAbort("outputQueue: couldn't start the writer thread\n");
+    }
+    return queue;
+}
+
+void outputQueue_push(OutputQueue *queue, char *buffer, int64_t length) {
+    pthread_mutex_lock(&queue->lock);
+    while (queue->pending == queue->maxPending) {
+        pthread_cond_wait(&queue->notFull, &queue->lock);
+    }
+    int64_t i = (queue->first + queue->pending) % queue->maxPending;
+    queue->buffers[i] = buffer;
+    queue->lengths[i] = length;
+    queue->pending++;
+    pthread_cond_signal(&queue->notEmpty);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+void outputQueue_destruct(OutputQueue *queue) {
+    pthread_mutex_lock(&queue->lock);
+    queue->finished = TRUE;
+    pthread_cond_signal(&queue->notEmpty);
+    pthread_mutex_unlock(&queue->lock);
+    pthread_join(queue->writerThread, NULL);
+
+    fclose(queue->fH);
+    pthread_mutex_destroy(&queue->lock);
+    pthread_cond_destroy(&queue->notEmpty);
+    pthread_cond_destroy(&queue->notFull);
+    free(queue->buffers);
+    free(queue->lengths);
+    free(queue);
+}
@@ -9,6 +9,7 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
 #include <ctype.h>
 #include <assert.h>
@@ -188,6 +189,21 @@ void band_destruct(Band *band) {
     free(band);
 }
 
+int64_t band_getArea(Band *band) {
+    int64_t area = 0;
+    for (int64_t xay = 0; xay <= band->lXalY; xay++) {
+        area += diagonal_getWidth(band->diagonals[xay]);
+    }
+    return area;
+}
+
+int64_t getBandArea(stList *anchorPairs, int64_t lX, int64_t lY, int64_t diagonalExpansion) {
+    Band *band = band_construct(anchorPairs, lX, lY, diagonalExpansion);
+    int64_t area = band_getArea(band);
+    band_destruct(band);
+    return area;
+}
+
 struct _bandIterator {
     Band *band;
     int64_t index;
@@ -258,14 +274,17 @@ double logAdd(double x, double y) {
 //Sequence Object generalized way to represent a sequence of symbols or measurements (events)
 /////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-static double _NULLEVENT[] = {LOG_ZERO, 0};
-static double *NULLEVENT = _NULLEVENT;
+static float _NULLEVENT[] = {LOG_ZERO, 0, 0};
+static float *NULLEVENT = _NULLEVENT;
 
 Sequence *sequence_construct(int64_t length, void *elements, void *(*getFcn)(void *, int64_t)) {
     Sequence *self = malloc(sizeof(Sequence));
     self->length = length;
     self->elements = elements;
     self->get = getFcn;
+    self->sliceFcn = NULL;
+    self->elementIndices = NULL;
+    self->elementIndexFcn = NULL;
     return self;
 }
 
@@ -276,6 +295,8 @@ Sequence *sequence_construct2(int64_t length, void *elements, void *(*getFcn)(vo
     self->elements = elements;
     self->get = getFcn;
     self->sliceFcn = sliceFcn;
+    self->elementIndices = NULL;
+    self->elementIndexFcn = NULL;
     return self;
 }
 
@@ -293,7 +314,7 @@ Sequence *sequence_sliceNucleotideSequence2(Sequence *inputSequence, int64_t sta
 }
 
 Sequence *sequence_sliceEventSequence2(Sequence *inputSequence, int64_t start, int64_t sliceLength) {
-    size_t elementSize = sizeof(double);
+    size_t elementSize = sizeof(float);
     void *elementSlice = (char *)inputSequence->elements + ((start * NB_EVENT_PARAMS) * elementSize);
     Sequence *newSequence = sequence_construct2(sliceLength, elementSlice,
                                                 inputSequence->get, inputSequence->sliceFcn);
@@ -302,9 +323,26 @@ Sequence *sequence_sliceEventSequence2(Sequence *inputSequence, int64_t start, i
 
 void sequence_sequenceDestroy(Sequence *seq) {
     //assert(seq != NULL);
+    free(seq->elementIndices);
     free(seq);
 }
 
+static int64_t *sequence_getElementIndices(Sequence *seq, int64_t (*elementIndexFcn)(void *)) {
+    // filled lazily by the expectation functions, -1 is not computed yet. The indices of one getElementIndexFcn are
+    // no good to another, so the cache starts over when the expectations of a different hmm are taken
+    if (seq->elementIndices == NULL) {
+        seq->elementIndices = st_malloc((seq->length + 1) * sizeof(int64_t));
+        seq->elementIndexFcn = NULL;
+    }
+    if (seq->elementIndexFcn != elementIndexFcn) {
+        for (int64_t i = 0; i <= seq->length; i++) {
+            seq->elementIndices[i] = -1;
+        }
+        seq->elementIndexFcn = elementIndexFcn;
+    }
+    return seq->elementIndices;
+}
+
 void *sequence_getBase(void *elements, int64_t index) {
     char* n;
     n = "n";
@@ -332,8 +370,8 @@ void *sequence_getKmer3(void *elements, int64_t index) {
 
 void *sequence_getEvent(void *elements, int64_t index) {
     index = index * NB_EVENT_PARAMS;
-    //return index >= 0 ? &(((double *)elements)[index]) : NULL;
-    return index >= 0 ? &(((double *)elements)[index]) : NULLEVENT;
+    //return index >= 0 ? &(((float *)elements)[index]) : NULL;
+    return index >= 0 ? &(((float *)elements)[index]) : NULLEVENT;
 }
 
 int64_t sequence_correctSeqLength(int64_t length, SequenceType type) {
@@ -404,20 +442,44 @@ double cell_dotProduct2(double *cell, StateMachine *sM, double (*getStateValue)(
     return totalProb;
 }
 
+/*
+ * The expectation functions get extraArgs = { &totalProbability, hmmExpectations, cX, cY, cachedIndexX, cachedIndexY,
+ * &logThreshold }, the cached indices point into the elementIndices of the sequences and are only computed (once per
+ * sequence position) by the functions that use them.
+ */
+static inline bool cell_getPosteriorProbability(double *fromCells, double *toCells, int64_t from, int64_t to,
+                                                double eP, double tP, void *extraArgs, double *p) {
+    double totalProbability = *((double *) ((void **) extraArgs)[0]);
+    double logThreshold = *((double *) ((void **) extraArgs)[6]);
+    double logP = fromCells[from] + toCells[to] + (eP + tP) - totalProbability;
+    if (logP < logThreshold) {
+        return 0;
+    }
+    *p = exp(logP);
+    return 1;
+}
+
+static inline int64_t cell_getElementIndex(Hmm *hmm, int64_t *cachedIndex, void *element) {
+    if (*cachedIndex < 0) {
+        *cachedIndex = hmm->getElementIndexFcn(element);
+    }
+    return *cachedIndex;
+}
+
 void cell_updateExpectations(double *fromCells, double *toCells, int64_t from, int64_t to, double eP, double tP,
                              void *extraArgs) {
-
-    //void *extraArgs2[2] = { &totalProbability, hmmExpectations };
-    double totalProbability = *((double *) ((void **) extraArgs)[0]);
     Hmm *hmmExpectations = ((void **) extraArgs)[1];
 
-    int64_t x = hmmExpectations->getElementIndexFcn(((void **) extraArgs)[2]); // this gives you the base/kmer index
-    int64_t y = hmmExpectations->getElementIndexFcn(((void **) extraArgs)[3]);
-
     //Calculate posterior probability of the transition/emission pair
-    double p = exp(fromCells[from] + toCells[to] + (eP + tP) - totalProbability);
+    double p;
+    if (!cell_getPosteriorProbability(fromCells, toCells, from, to, eP, tP, extraArgs, &p)) {
+        return;
+    }
     hmmExpectations->addToTransitionExpectationFcn(hmmExpectations, from, to, p);
 
+    // the base/kmer indices
+    int64_t x = cell_getElementIndex(hmmExpectations, ((void **) extraArgs)[4], ((void **) extraArgs)[2]);
+    int64_t y = cell_getElementIndex(hmmExpectations, ((void **) extraArgs)[5], ((void **) extraArgs)[3]);
     if(x < hmmExpectations->symbolSetSize && y < hmmExpectations->symbolSetSize) { //Ignore gaps involving Ns.
         hmmExpectations->addToEmissionExpectationFcn(hmmExpectations, to, x, y, p);
     }
@@ -425,40 +487,38 @@ void cell_updateExpectations(double *fromCells, double *toCells, int64_t from, i
 
 void cell_signal_updateTransAndKmerSkipExpectations(double *fromCells, double *toCells, int64_t from, int64_t to,
                                                     double eP, double tP, void *extraArgs) {
-    //void *extraArgs2[2] = { &totalProbability, hmmExpectations };
-    double totalProbability = *((double *) ((void **) extraArgs)[0]);
     Hmm *hmmExpectations = ((void **) extraArgs)[1];
 
-    int64_t x = hmmExpectations->getElementIndexFcn(((void **) extraArgs)[2]); // this gives you the kmer index
-
     // Calculate posterior probability of the transition/emission pair
-    double p = exp(fromCells[from] + toCells[to] + (eP + tP) - totalProbability);
+    double p;
+    if (!cell_getPosteriorProbability(fromCells, toCells, from, to, eP, tP, extraArgs, &p)) {
+        return;
+    }
 
     // update transitions expectation
     hmmExpectations->addToTransitionExpectationFcn(hmmExpectations, from, to, p);
     //
     if (to == shortGapX) {
+        // the kmer index, the y elements are events
+        int64_t x = cell_getElementIndex(hmmExpectations, ((void **) extraArgs)[4], ((void **) extraArgs)[2]);
         hmmExpectations->addToEmissionExpectationFcn(hmmExpectations, 0, x, 0, p);
     }
 }
 
 void cell_signal_updateTransAndKmerSkipExpectations2(double *fromCells, double *toCells, int64_t from, int64_t to,
                                                     double eP, double tP, void *extraArgs) {
-    //void *extraArgs2[2] = { &totalProbability, hmmExpectations };
     // unpack the extraArgs thing
-    double totalProbability = *((double *) ((void **) extraArgs)[0]);
     HdpHmm *hmmExpectations = ((void **) extraArgs)[1];
 
     char *kmer = (char *)((void **) extraArgs)[2];  // pointer to the position in the sequence (kmer)
 
-    double *event = (double *)((void **) extraArgs)[3];  // pointer to the event mean
-
-    // kmer index
-    //int64_t kmerIdx = hmmExpectations->baseContinuousPairHmm.baseContinuousHmm.baseHmm.getElementIndexFcn(
-    //        ((void **) extraArgs)[2]); // this gives you the kmer index
+    float *event = (float *)((void **) extraArgs)[3];  // pointer to the event mean
 
     // Calculate posterior probability of the transition/emission pair
-    double p = exp(fromCells[from] + toCells[to] + (eP + tP) - totalProbability);
+    double p;
+    if (!cell_getPosteriorProbability(fromCells, toCells, from, to, eP, tP, extraArgs, &p)) {
+        return;
+    }
 
     // update transitions expectation
     hmmExpectations->baseHmm.addToTransitionExpectationFcn((Hmm *)hmmExpectations, from, to, p);
@@ -477,40 +537,33 @@ void cell_signal_updateTransAndKmerSkipExpectations2(double *fromCells, double *
 
 void cell_signal_updateBetaAndAlphaProb(double *fromCells, double *toCells, int64_t from, int64_t to, double eP,
                                         double tP, void *extraArgs) {
-    //void *extraArgs2[2] = { &totalProbability, hmmExpectations };
-    double totalProbability = *((double *) ((void **) extraArgs)[0]);
+    // only the match to kmer skip and the kmer skip to kmer skip transitions are counted
+    bool beta = from == match && to == shortGapX;
+    bool alpha = from == shortGapX && to == shortGapX;
+    if (!beta && !alpha) {
+        return;
+    }
     VanillaHmm *hmmExpectations = ((void **) extraArgs)[1];
 
+    // Calculate posterior probability of the transition/emission pair
+    double p;
+    if (!cell_getPosteriorProbability(fromCells, toCells, from, to, eP, tP, extraArgs, &p)) {
+        return;
+    }
+
     // you want this to give you the skip bin
     int64_t x = hmmExpectations->getKmerSkipBin(hmmExpectations->matchModel, (((void **) extraArgs)[2]));
-
-    // Calculate posterior probability of the transition/emission pair
-    double p = exp(fromCells[from] + toCells[to] + (eP + tP) - totalProbability);
     // update beta
-    if (from == match && to == shortGapX) {
+    if (beta) {
         hmmExpectations->baseContinuousHmm.baseHmm.addToTransitionExpectationFcn((Hmm *)hmmExpectations, x, 0, p);
     }
     // update alpha
-    if (from == shortGapX && to == shortGapX) {
+    if (alpha) {
         hmmExpectations->baseContinuousHmm.baseHmm.addToTransitionExpectationFcn((Hmm *)hmmExpectations,
                                                                                  (x + 30), 0, p);
     }
 }
 
-static void cell_calculateUpdateExpectation(StateMachine *sM,
-                                            double *current, double *lower, double *middle, double *upper,
-                                            void *cX, void *cY,
-                                            void *extraArgs) {
-    void *extraArgs2[4] = { ((void **)extraArgs)[0], // &totalProbabability
-                            ((void **)extraArgs)[1], // hmmExpectations
-                            cX,   // pointer to char in sequence
-                            cY }; // pointer to event array, can remove..?
-    sM->cellCalculate(sM, current, lower, middle, upper, cX, cY,
-                      sM->cellCalculateUpdateExpectations,
-                      extraArgs2);
-}
-
-
 /////////////////////////////////////////////////////////////////////////////////////////////////////////
 //DpDiagonal
 //
@@ -658,6 +711,146 @@ void dpMatrix_deleteDiagonal(DpMatrix *dpMatrix, int64_t xay) {
     }
 }
 
+/////////////////////////////////////////////////////////////////////////////////////////////////////////
+//AlignedPairBuffer
+//
+//Growable struct-of-arrays store for the posterior match probabilities (prob, x, y), used through the
+//posterior pipeline instead of allocating an stIntTuple for every cell above threshold
+/////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void *alignedPairBuffer_realloc(void *array, int64_t size) {
+    void *newArray = realloc(array, size);
+    if (newArray == NULL && size > 0) {
+        st_errAbort("alignedPairBuffer: failed to allocate %lld bytes\n", size);
+    }
+    return newArray;
+}
+
+static void alignedPairBuffer_reserve(AlignedPairBuffer *alignedPairs, int64_t length) {
+    if (length <= alignedPairs->maxLength) {
+        return;
+    }
+    int64_t maxLength = alignedPairs->maxLength > 0 ? alignedPairs->maxLength : 16;
+    while (maxLength < length) {
+        maxLength *= 2;
+    }
+    alignedPairs->probs = alignedPairBuffer_realloc(alignedPairs->probs, maxLength * sizeof(int64_t));
+    alignedPairs->x = alignedPairBuffer_realloc(alignedPairs->x, maxLength * sizeof(int64_t));
+    alignedPairs->y = alignedPairBuffer_realloc(alignedPairs->y, maxLength * sizeof(int64_t));
+    alignedPairs->maxLength = maxLength;
+}
+
+AlignedPairBuffer *alignedPairBuffer_construct(int64_t initialLength) {
+    assert(initialLength >= 0);
+    AlignedPairBuffer *alignedPairs = st_malloc(sizeof(AlignedPairBuffer));
+    alignedPairs->length = 0;
+    alignedPairs->maxLength = 0;
+    alignedPairs->probs = NULL;
+    alignedPairs->x = NULL;
+    alignedPairs->y = NULL;
+    alignedPairBuffer_reserve(alignedPairs, initialLength);
+    return alignedPairs;
+}
+
+void alignedPairBuffer_destruct(AlignedPairBuffer *alignedPairs) {
+    free(alignedPairs->probs);
+    free(alignedPairs->x);
+    free(alignedPairs->y);
+    free(alignedPairs);
+}
+
+void alignedPairBuffer_clear(AlignedPairBuffer *alignedPairs) {
+    alignedPairs->length = 0;
+}
+
+void alignedPairBuffer_add(AlignedPairBuffer *alignedPairs, int64_t prob, int64_t x, int64_t y) {
+    if (alignedPairs->length == alignedPairs->maxLength) {
+        alignedPairBuffer_reserve(alignedPairs, alignedPairs->length + 1);
+    }
+    alignedPairs->probs[alignedPairs->length] = prob;
+    alignedPairs->x[alignedPairs->length] = x;
+    alignedPairs->y[alignedPairs->length] = y;
+    alignedPairs->length++;
+}
+
+void alignedPairBuffer_appendWithOffset(AlignedPairBuffer *alignedPairs, AlignedPairBuffer *otherAlignedPairs,
+                                        int64_t offsetX, int64_t offsetY) {
+    alignedPairBuffer_reserve(alignedPairs, alignedPairs->length + otherAlignedPairs->length);
+    for (int64_t i = 0; i < otherAlignedPairs->length; i++) {
+        alignedPairs->probs[alignedPairs->length + i] = otherAlignedPairs->probs[i];
+        alignedPairs->x[alignedPairs->length + i] = otherAlignedPairs->x[i] + offsetX;
+        alignedPairs->y[alignedPairs->length + i] = otherAlignedPairs->y[i] + offsetY;
+    }
+    alignedPairs->length += otherAlignedPairs->length;
+}
+
+typedef struct _alignedPairSortKey {
+    int64_t key;
+    int64_t index;
+} AlignedPairSortKey;
+
+static int alignedPairSortKey_cmp(const void *i, const void *j) {
+    const AlignedPairSortKey *k = i, *l = j;
+    if (k->key != l->key) {
+        return k->key > l->key ? 1 : -1;
+    }
+    // ties are broken by the original position so the order is deterministic
+    return k->index > l->index ? 1 : (k->index < l->index ? -1 : 0);
+}
+
+static void alignedPairBuffer_permute(int64_t *array, AlignedPairSortKey *keys, int64_t length, int64_t *scratch) {
+    for (int64_t i = 0; i < length; i++) {
+        scratch[i] = array[keys[i].index];
+    }
+    memcpy(array, scratch, length * sizeof(int64_t));
+}
+
+void alignedPairBuffer_sortByXPlusYCoordinate(AlignedPairBuffer *alignedPairs) {
+    int64_t length = alignedPairs->length;
+    if (length < 2) {
+        return;
+    }
+    AlignedPairSortKey *keys = st_malloc(length * sizeof(AlignedPairSortKey));
+    for (int64_t i = 0; i < length; i++) {
+        keys[i].key = alignedPairs->x[i] + alignedPairs->y[i];
+        keys[i].index = i;
+    }
+    qsort(keys, length, sizeof(AlignedPairSortKey), alignedPairSortKey_cmp);
+    int64_t *scratch = st_malloc(length * sizeof(int64_t));
+    alignedPairBuffer_permute(alignedPairs->probs, keys, length, scratch);
+    alignedPairBuffer_permute(alignedPairs->x, keys, length, scratch);
+    alignedPairBuffer_permute(alignedPairs->y, keys, length, scratch);
+    free(scratch);
+    free(keys);
+}
+
+double alignedPairBuffer_totalScore(AlignedPairBuffer *alignedPairs) {
+    double score = 0.0;
+    for (int64_t i = 0; i < alignedPairs->length; i++) {
+        score += alignedPairs->probs[i];
+    }
+    return score;
+}
+
+stList *alignedPairBuffer_toList(AlignedPairBuffer *alignedPairs) {
+    stList *alignedPairsList = stList_construct3(0, (void (*)(void *)) stIntTuple_destruct);
+    for (int64_t i = 0; i < alignedPairs->length; i++) {
+        stList_append(alignedPairsList, stIntTuple_construct3(alignedPairs->probs[i],
+                                                              alignedPairs->x[i], alignedPairs->y[i]));
+    }
+    return alignedPairsList;
+}
+
+AlignedPairBuffer *alignedPairBuffer_fromList(stList *alignedPairsList) {
+    AlignedPairBuffer *alignedPairs = alignedPairBuffer_construct(stList_length(alignedPairsList));
+    for (int64_t i = 0; i < stList_length(alignedPairsList); i++) {
+        stIntTuple *aPair = stList_get(alignedPairsList, i);
+        alignedPairBuffer_add(alignedPairs, stIntTuple_get(aPair, 0), stIntTuple_get(aPair, 1),
+                              stIntTuple_get(aPair, 2));
+    }
+    return alignedPairs;
+}
+
 
 /////////////////////////////////////////////////////////////////////////////////////////////////////////
 //Diagonal DP Calculations
@@ -758,7 +951,7 @@ void diagonalCalculationPosteriorMatchProbs(StateMachine *sM, int64_t xay, DpMat
                                             double totalProbability, PairwiseAlignmentParameters *p, void *extraArgs) {
     assert(p->threshold >= 0.0);
     assert(p->threshold <= 1.0);
-    stList *alignedPairs = ((void **) extraArgs)[0];
+    AlignedPairBuffer *alignedPairs = ((void **) extraArgs)[0];
     DpDiagonal *forwardDiagonal = dpMatrix_getDiagonal(forwardDpMatrix, xay);
     DpDiagonal *backDiagonal = dpMatrix_getDiagonal(backwardDpMatrix, xay);
     Diagonal diagonal = forwardDiagonal->diagonal;
@@ -783,7 +976,7 @@ void diagonalCalculationPosteriorMatchProbs(StateMachine *sM, int64_t xay, DpMat
                 //st_uglyf("Adding to alignedPairs! posteriorProb: %f, X: %lld (%s), Y: %lld (%f)\n", posteriorProbability, x - 1, sX->get(sX->elements, x-1), y - 1, *(double *)sY->get(sY->elements, y-1));
                 //st_uglyf("Adding to alignedPairs! posteriorProb: %f, X: %lld, Y: %lld (%f)\n", posteriorProbability, x - 1, y - 1, *(double *)sY->get(sY->elements, y-1));
                 posteriorProbability = floor(posteriorProbability * PAIR_ALIGNMENT_PROB_1);
-                stList_append(alignedPairs, stIntTuple_construct3((int64_t) posteriorProbability, x - 1, y - 1));
+                alignedPairBuffer_add(alignedPairs, (int64_t) posteriorProbability, x - 1, y - 1);
             }
             //if (posteriorProbability <= p->threshold) {
             //    //st_uglyf("NOT Adding to alignedPairs! posteriorProb: %f, X: %lld, Y: %lld (%f)\n", posteriorProbability, x - 1, y - 1, *(double *)sY->get(sY->elements, y-1));
@@ -791,7 +984,7 @@ void diagonalCalculationPosteriorMatchProbs(StateMachine *sM, int64_t xay, DpMat
         }
         xmy += 2;
     }
-    //st_uglyf("final length for alignedPairs: %lld\n", stList_length(alignedPairs));
+    //st_uglyf("final length for alignedPairs: %lld\n", alignedPairs->length);
 }
 
 void diagonalCalculationMultiPosteriorMatchProbs(StateMachine *sM, int64_t xay, DpMatrix *forwardDpMatrix,
@@ -800,7 +993,7 @@ void diagonalCalculationMultiPosteriorMatchProbs(StateMachine *sM, int64_t xay,
                                                  void *extraArgs) {
     assert(p->threshold >= 0.0);
     assert(p->threshold <= 1.0);
-    stList *alignedPairs = ((void **) extraArgs)[0];
+    AlignedPairBuffer *alignedPairs = ((void **) extraArgs)[0];
     DpDiagonal *forwardDiagonal = dpMatrix_getDiagonal(forwardDpMatrix, xay);
     DpDiagonal *backDiagonal = dpMatrix_getDiagonal(backwardDpMatrix, xay);
     Diagonal diagonal = forwardDiagonal->diagonal;
@@ -825,7 +1018,7 @@ void diagonalCalculationMultiPosteriorMatchProbs(StateMachine *sM, int64_t xay,
                     posteriorProbability = floor(posteriorProbability * PAIR_ALIGNMENT_PROB_1);
                     for (int64_t n = 0; n < s; n++) {
                         //st_uglyf("Adding to alignedPairs! posteriorProb: %f, X: %lld, Y: %lld (%f), state:%lld \n", posteriorProbability/PAIR_ALIGNMENT_PROB_1, (x + n) - 1, y - 1, *(double *)sY->get(sY->elements, y-1), s);
-                        stList_append(alignedPairs, stIntTuple_construct3((int64_t) posteriorProbability, (x + n) - 1, y - 1));
+                        alignedPairBuffer_add(alignedPairs, (int64_t) posteriorProbability, (x + n) - 1, y - 1);
                     }
                 }
                 //if (posteriorProbability <= p->threshold) {
@@ -835,7 +1028,7 @@ void diagonalCalculationMultiPosteriorMatchProbs(StateMachine *sM, int64_t xay,
         }
         xmy += 2;
     }
-    //st_uglyf("final length for alignedPairs: %lld\n", stList_length(alignedPairs));
+    //st_uglyf("final length for alignedPairs: %lld\n", alignedPairs->length);
 }
 
 void diagonalCalculation_Expectations(StateMachine *sM, int64_t xay,
@@ -847,7 +1040,11 @@ void diagonalCalculation_Expectations(StateMachine *sM, int64_t xay,
      * Updates the expectations of the transitions/emissions for the given diagonal.
      */
     Hmm *hmmExpectations = extraArgs;
-    void *extraArgs2[2] = { &totalProbability, hmmExpectations }; // this is where you pack in totalprob
+    assert(p->expectationsThreshold >= 0.0);
+    assert(p->expectationsThreshold <= 1.0);
+    double logThreshold = p->expectationsThreshold > 0.0 ? log(p->expectationsThreshold) : LOG_ZERO;
+    int64_t *elementIndicesX = sequence_getElementIndices(sX, hmmExpectations->getElementIndexFcn);
+    int64_t *elementIndicesY = sequence_getElementIndices(sY, hmmExpectations->getElementIndexFcn);
 
     // update likelihood
     hmmExpectations->likelihood += totalProbability;
@@ -855,11 +1052,60 @@ void diagonalCalculation_Expectations(StateMachine *sM, int64_t xay,
     // We do this once per diagonal, which is a hack, rather than for the
     // whole matrix. The correction factor is approximately 1/number of
     // diagonals.
-    diagonalCalculation(sM,
-                        dpMatrix_getDiagonal(backwardDpMatrix, xay),
-                        dpMatrix_getDiagonal(forwardDpMatrix, xay - 1),
-                        dpMatrix_getDiagonal(forwardDpMatrix, xay - 2),
-                        sX, sY, cell_calculateUpdateExpectation, extraArgs2);
+    DpDiagonal *dpDiagonal = dpMatrix_getDiagonal(backwardDpMatrix, xay);
+    DpDiagonal *dpDiagonalM1 = dpMatrix_getDiagonal(forwardDpMatrix, xay - 1);
+    DpDiagonal *dpDiagonalM2 = dpMatrix_getDiagonal(forwardDpMatrix, xay - 2);
+    Diagonal diagonal = dpDiagonal->diagonal;
+
+    // the posterior of a cell is the sum of the posteriors of the transitions into it, when pruning the cells far
+    // below the best one of the diagonal are skipped and the transitions of the others scaled up by the mass of the
+    // diagonal over the mass kept (through the total probability), so the diagonal adds the same expected counts
+    double *cellPosteriors = NULL;
+    double logPruningBound = LOG_ZERO;
+    double cellTotalProbability = totalProbability;
+    assert(p->expectationsPruning >= 0.0);
+    assert(p->expectationsPruning < 1.0);
+    if (p->expectationsPruning > 0.0) {
+        DpDiagonal *forwardDiagonal = dpMatrix_getDiagonal(forwardDpMatrix, xay);
+        cellPosteriors = st_malloc(diagonal_getWidth(diagonal) * sizeof(double));
+        double maxPosterior = LOG_ZERO;
+        for (int64_t xmy = diagonal_getMinXmy(diagonal), i = 0; xmy <= diagonal_getMaxXmy(diagonal); xmy += 2, i++) {
+            cellPosteriors[i] = cell_dotProduct(dpDiagonal_getCell(forwardDiagonal, xmy),
+                                                dpDiagonal_getCell(dpDiagonal, xmy), sM->stateNumber);
+            maxPosterior = cellPosteriors[i] > maxPosterior ? cellPosteriors[i] : maxPosterior;
+        }
+        logPruningBound = maxPosterior + log(p->expectationsPruning);
+        double totalMass = LOG_ZERO;
+        double keptMass = LOG_ZERO;
+        for (int64_t i = 0; i < diagonal_getWidth(diagonal); i++) {
+            totalMass = logAdd(totalMass, cellPosteriors[i]);
+            if (cellPosteriors[i] >= logPruningBound) {
+                keptMass = logAdd(keptMass, cellPosteriors[i]);
+            }
+        }
+        if (keptMass > LOG_ZERO) {
+            cellTotalProbability = totalProbability + (keptMass - totalMass);
+        }
+    }
+
+    for (int64_t xmy = diagonal_getMinXmy(diagonal), i = 0; xmy <= diagonal_getMaxXmy(diagonal); xmy += 2, i++) {
+        if (cellPosteriors != NULL && cellPosteriors[i] < logPruningBound) {
+            continue;
+        }
+        int64_t indexX = getXposition(sX, xay, xmy) - 1;
+        int64_t indexY = getYposition(sY, xay, xmy) - 1;
+        void *x = sX->get(sX->elements, indexX);
+        void *y = sY->get(sY->elements, indexY);
+        void *extraArgs2[7] = { &cellTotalProbability, hmmExpectations, x, y,
+                                &elementIndicesX[indexX + 1], &elementIndicesY[indexY + 1], &logThreshold };
+
+        double *current = dpDiagonal_getCell(dpDiagonal, xmy);
+        double *lower = dpDiagonalM1 == NULL ? NULL : dpDiagonal_getCell(dpDiagonalM1, xmy - 1);
+        double *middle = dpDiagonalM2 == NULL ? NULL : dpDiagonal_getCell(dpDiagonalM2, xmy);
+        double *upper = dpDiagonalM1 == NULL ? NULL : dpDiagonal_getCell(dpDiagonalM1, xmy + 1);
+        sM->cellCalculate(sM, current, lower, middle, upper, x, y, sM->cellCalculateUpdateExpectations, extraArgs2);
+    }
+    free(cellPosteriors);
 }
 
 
@@ -867,15 +1113,18 @@ void diagonalCalculation_Expectations(StateMachine *sM, int64_t xay,
 //Banded alignment routine to calculate posterior match probs
 /////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-void getPosteriorProbsWithBanding(StateMachine *sM,
-                                  stList *anchorPairs,
-                                  Sequence *sX, Sequence *sY,
-                                  PairwiseAlignmentParameters *p,
-                                  bool alignmentHasRaggedLeftEnd, bool alignmentHasRaggedRightEnd,
-                                  void (*diagonalPosteriorProbFn)(StateMachine *, int64_t, DpMatrix *, DpMatrix *,
-                                                                  Sequence*, Sequence*,
-                                                                  double, PairwiseAlignmentParameters *, void *),
-                                  void *extraArgs) {
+static void getPosteriorProbsWithBanding2(StateMachine *sM,
+                                          stList *anchorPairs,
+                                          Sequence *sX, Sequence *sY,
+                                          PairwiseAlignmentParameters *p,
+                                          bool alignmentHasRaggedLeftEnd, bool alignmentHasRaggedRightEnd,
+                                          void (*diagonalPosteriorProbFn)(StateMachine *, int64_t, DpMatrix *,
+                                                                          DpMatrix *, Sequence*, Sequence*,
+                                                                          double, PairwiseAlignmentParameters *,
+                                                                          void *),
+                                          void (*tracebackFn)(int64_t, int64_t, int64_t, void *),
+                                          int64_t offsetX, int64_t offsetY,
+                                          void *extraArgs) {
     //Prerequisites
     assert(p->traceBackDiagonals >= 1);
     assert(p->diagonalExpansion >= 0);
@@ -989,6 +1238,10 @@ void getPosteriorProbsWithBanding(StateMachine *sM,
             if (!atEnd) {
                 assert(dpMatrix_getActiveDiagonalNumber(forwardDpMatrix) == p->traceBackDiagonals + 2);
             }
+            //The posteriors for the diagonals of this traceback window (up to tracedBackTo) are final
+            if (tracebackFn != NULL) {
+                tracebackFn(offsetX, offsetY, tracedBackTo, extraArgs);
+            }
         }
         if (atEnd) {
             break;
@@ -1005,6 +1258,19 @@ void getPosteriorProbsWithBanding(StateMachine *sM,
     band_destruct(band);
 }
 
+void getPosteriorProbsWithBanding(StateMachine *sM,
+                                  stList *anchorPairs,
+                                  Sequence *sX, Sequence *sY,
+                                  PairwiseAlignmentParameters *p,
+                                  bool alignmentHasRaggedLeftEnd, bool alignmentHasRaggedRightEnd,
+                                  void (*diagonalPosteriorProbFn)(StateMachine *, int64_t, DpMatrix *, DpMatrix *,
+                                                                  Sequence*, Sequence*,
+                                                                  double, PairwiseAlignmentParameters *, void *),
+                                  void *extraArgs) {
+    getPosteriorProbsWithBanding2(sM, anchorPairs, sX, sY, p, alignmentHasRaggedLeftEnd, alignmentHasRaggedRightEnd,
+                                  diagonalPosteriorProbFn, NULL, 0, 0, extraArgs);
+}
+
 /////////////////////////////////////////////////////////////////////////////////////////////////////////
 //Blast anchoring functions
 //Use lastz to get sets of anchors
@@ -1339,28 +1605,15 @@ stList *getSplitPoints(stList *anchorPairs, int64_t lX, int64_t lY, int64_t spli
     return splitPoints;
 }
 
-static void convertAlignedPairs(stList *alignedPairs2, int64_t offsetX, int64_t offsetY) {
-    /*
-     * Convert the coordinates of the computed pairs.
-     */
-    for (int64_t k = 0; k < stList_length(alignedPairs2); k++) {
-        stIntTuple *i = stList_get(alignedPairs2, k);
-        assert(stIntTuple_length(i) == 3);
-        stList_set(alignedPairs2, k,
-                stIntTuple_construct3(stIntTuple_get(i, 0), stIntTuple_get(i, 1) + offsetX,
-                        stIntTuple_get(i, 2) + offsetY));
-        stIntTuple_destruct(i);
-    }
-}
-
-void getPosteriorProbsWithBandingSplittingAlignmentsByLargeGaps(
+static void getPosteriorProbsWithBandingSplittingAlignmentsByLargeGaps2(
         StateMachine *sM, stList *anchorPairs, Sequence *SsX, Sequence *SsY,
         PairwiseAlignmentParameters *p,
         bool alignmentHasRaggedLeftEnd, bool alignmentHasRaggedRightEnd,
         void (*diagonalPosteriorProbFn)(StateMachine *, int64_t, DpMatrix *,
                                         DpMatrix *, Sequence*, Sequence*, double,
                                         PairwiseAlignmentParameters *, void *),
-        void (*coordinateCorrectionFn)(), void *extraArgs) {
+        void (*coordinateCorrectionFn)(), void (*tracebackFn)(int64_t, int64_t, int64_t, void *),
+        void *extraArgs) {
     // you are going to cut the sequences into subSequences anyways, so not having the correct
     // number of elements in length, ie having it reflect the number of nucleotides might be ok?
     int64_t lX = SsX->length; // so here you want the total number of elements
@@ -1403,10 +1656,10 @@ void getPosteriorProbsWithBandingSplittingAlignmentsByLargeGaps(
 
         //Make the alignments
 
-        getPosteriorProbsWithBanding(sM, subListOfAnchorPoints, sX3, sY3, p,
-                                     (alignmentHasRaggedLeftEnd || i > 0),
-                                     (alignmentHasRaggedRightEnd || i < stList_length(splitPoints) - 1),
-                                     diagonalPosteriorProbFn, extraArgs);
+        getPosteriorProbsWithBanding2(sM, subListOfAnchorPoints, sX3, sY3, p,
+                                      (alignmentHasRaggedLeftEnd || i > 0),
+                                      (alignmentHasRaggedRightEnd || i < stList_length(splitPoints) - 1),
+                                      diagonalPosteriorProbFn, tracebackFn, x1, y1, extraArgs);
 
         if (coordinateCorrectionFn != NULL) {
             coordinateCorrectionFn(x1, y1, extraArgs);
@@ -1421,6 +1674,168 @@ void getPosteriorProbsWithBandingSplittingAlignmentsByLargeGaps(
     stList_destruct(splitPoints);
 }
 
+void getPosteriorProbsWithBandingSplittingAlignmentsByLargeGaps(
+        StateMachine *sM, stList *anchorPairs, Sequence *SsX, Sequence *SsY,
+        PairwiseAlignmentParameters *p,
+        bool alignmentHasRaggedLeftEnd, bool alignmentHasRaggedRightEnd,
+        void (*diagonalPosteriorProbFn)(StateMachine *, int64_t, DpMatrix *,
+                                        DpMatrix *, Sequence*, Sequence*, double,
+                                        PairwiseAlignmentParameters *, void *),
+        void (*coordinateCorrectionFn)(), void *extraArgs) {
+    getPosteriorProbsWithBandingSplittingAlignmentsByLargeGaps2(sM, anchorPairs, SsX, SsY, p,
+                                                                alignmentHasRaggedLeftEnd, alignmentHasRaggedRightEnd,
+                                                                diagonalPosteriorProbFn, coordinateCorrectionFn, NULL,
+                                                                extraArgs);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////
+//Memory estimates
+//Peak memory of the banded posterior computation, worked out from the band and the traceback schedule
+//without filling any matrix
+/////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// the posteriors of a window are above threshold in at most 1/threshold cells per diagonal of the window (each
+// diagonal crosses a path of the HMM at most once, so its match posteriors sum to at most one)
+static int64_t getAlignedPairsInWindowBound(int64_t windowArea, int64_t windowDiagonals, double threshold) {
+    if (threshold <= 0.0 || windowArea <= windowDiagonals / threshold) {
+        return windowArea;
+    }
+    return (int64_t) (windowDiagonals / threshold);
+}
+
+// bytes held by an AlignedPairBuffer of that many pairs, its arrays double from 16
+static int64_t alignedPairBuffer_getMemory(int64_t length) {
+    if (length == 0) {
+        return sizeof(AlignedPairBuffer);
+    }
+    int64_t maxLength = 16;
+    while (maxLength < length) {
+        maxLength *= 2;
+    }
+    return sizeof(AlignedPairBuffer) + maxLength * 3 * sizeof(int64_t);
+}
+
+// what the posterior computation holds at its peak: the DP matrices (in bytes, with the band and the two diagonal
+// arrays) and the most aligned pairs held by one traceback window, by one split region and in all
+typedef struct _peakMemory {
+    int64_t dp;
+    int64_t windowPairs;
+    int64_t regionPairs;
+    int64_t totalPairs;
+} PeakMemory;
+
+// replays the traceback schedule of getPosteriorProbsWithBanding2 over the band. The forward diagonals since the
+// last traceback are all live when a traceback starts and the walk back adds at most four backward ones, so the DP
+// peak is the largest of those totals
+static void band_getPeakMemory(Band *band, int64_t stateNumber, PairwiseAlignmentParameters *p,
+                               PeakMemory *peak) {
+    int64_t diagonalNumber = band->lXalY;
+    peak->dp = 0;
+    peak->windowPairs = 0;
+    peak->regionPairs = 0;
+    peak->totalPairs = 0;
+    if (diagonalNumber == 0) {
+        return;
+    }
+    int64_t tracedBackTo = 0;
+    int64_t forwardCells = diagonal_getWidth(band->diagonals[0]);
+    int64_t dpPeakCells = 0, dpPeakDiagonals = 0;
+    for (int64_t xay = 1; xay <= diagonalNumber; xay++) {
+        int64_t width = diagonal_getWidth(band->diagonals[xay]);
+        forwardCells += width;
+        bool atEnd = xay == diagonalNumber;
+        bool tracebackPoint = xay >= tracedBackTo + p->minDiagsBetweenTraceBack
+                && width <= p->diagonalExpansion * 2 + 1;
+        if (!(atEnd || tracebackPoint)) {
+            continue;
+        }
+        int64_t tracedBackFrom = xay - (atEnd ? 0 : p->traceBackDiagonals + 1);
+        int64_t maxWidth = 0, windowArea = 0;
+        for (int64_t i = tracedBackTo; i <= xay; i++) {
+            int64_t w = diagonal_getWidth(band->diagonals[i]);
+            maxWidth = w > maxWidth ? w : maxWidth;
+            if (i > tracedBackTo && i <= tracedBackFrom) {
+                windowArea += w;
+            }
+        }
+        if (forwardCells + 4 * maxWidth > dpPeakCells) {
+            dpPeakCells = forwardCells + 4 * maxWidth;
+            dpPeakDiagonals = xay - tracedBackTo + 1 + 4;
+        }
+        int64_t windowPairs = getAlignedPairsInWindowBound(windowArea, tracedBackFrom - tracedBackTo, p->threshold);
+        peak->windowPairs = windowPairs > peak->windowPairs ? windowPairs : peak->windowPairs;
+        peak->totalPairs += windowPairs;
+        // the diagonals from tracedBackFrom on stay live for the next traceback
+        forwardCells = 0;
+        for (int64_t i = tracedBackFrom; i <= xay; i++) {
+            forwardCells += diagonal_getWidth(band->diagonals[i]);
+        }
+        tracedBackTo = tracedBackFrom;
+    }
+    peak->dp = dpPeakCells * stateNumber * sizeof(double) + dpPeakDiagonals * sizeof(DpDiagonal)
+               + (diagonalNumber + 1) * (sizeof(Diagonal) + 2 * sizeof(DpDiagonal *));
+    peak->regionPairs = peak->totalPairs;
+}
+
+// runs band_getPeakMemory over the regions getPosteriorProbsWithBandingSplittingAlignmentsByLargeGaps aligns one
+// after the other, the DP peak is the largest of the regions and the pairs add up
+static void getPeakMemory(stList *anchorPairs, int64_t lX, int64_t lY, int64_t stateNumber,
+                          PairwiseAlignmentParameters *p, PeakMemory *peak) {
+    peak->dp = 0;
+    peak->windowPairs = 0;
+    peak->regionPairs = 0;
+    peak->totalPairs = 0;
+    stList *splitPoints = getSplitPoints(anchorPairs, lX, lY, p->splitMatrixBiggerThanThis, 0, 0);
+    int64_t j = 0;
+    for (int64_t i = 0; i < stList_length(splitPoints); i++) {
+        stIntTuple *subRegion = stList_get(splitPoints, i);
+        int64_t x1 = stIntTuple_get(subRegion, 0);
+        int64_t y1 = stIntTuple_get(subRegion, 1);
+        int64_t x2 = stIntTuple_get(subRegion, 2);
+        int64_t y2 = stIntTuple_get(subRegion, 3);
+        stList *subListOfAnchorPoints = stList_construct3(0, (void (*)(void *)) stIntTuple_destruct);
+        while (j < stList_length(anchorPairs)) {
+            stIntTuple *anchorPair = stList_get(anchorPairs, j);
+            int64_t x = stIntTuple_get(anchorPair, 0);
+            int64_t y = stIntTuple_get(anchorPair, 1);
+            if (x + y >= x2 + y2) {
+                break;
+            }
+            stList_append(subListOfAnchorPoints, stIntTuple_construct2(x - x1, y - y1));
+            j++;
+        }
+        Band *band = band_construct(subListOfAnchorPoints, x2 - x1, y2 - y1, p->diagonalExpansion);
+        PeakMemory regionPeak;
+        band_getPeakMemory(band, stateNumber, p, &regionPeak);
+        peak->dp = regionPeak.dp > peak->dp ? regionPeak.dp : peak->dp;
+        peak->windowPairs = regionPeak.windowPairs > peak->windowPairs ? regionPeak.windowPairs : peak->windowPairs;
+        peak->regionPairs = regionPeak.regionPairs > peak->regionPairs ? regionPeak.regionPairs : peak->regionPairs;
+        peak->totalPairs += regionPeak.totalPairs;
+        band_destruct(band);
+        stList_destruct(subListOfAnchorPoints);
+    }
+    stList_destruct(splitPoints);
+}
+
+int64_t getPosteriorProbsWithBandingPeakMemory(stList *anchorPairs, int64_t lX, int64_t lY, int64_t stateNumber,
+                                               PairwiseAlignmentParameters *p) {
+    PeakMemory peak;
+    getPeakMemory(anchorPairs, lX, lY, stateNumber, p, &peak);
+    return peak.dp;
+}
+
+int64_t getAlignedPairsUsingAnchorsPeakMemory(stList *anchorPairs, int64_t lX, int64_t lY, int64_t stateNumber,
+                                              PairwiseAlignmentParameters *p, bool streamed) {
+    PeakMemory peak;
+    getPeakMemory(anchorPairs, lX, lY, stateNumber, p, &peak);
+    if (streamed) {
+        // one buffer, reused for every window
+        return peak.dp + alignedPairBuffer_getMemory(peak.windowPairs);
+    }
+    // the pairs of the region being computed, then appended to all the pairs so far
+    return peak.dp + alignedPairBuffer_getMemory(peak.regionPairs) + alignedPairBuffer_getMemory(peak.totalPairs);
+}
+
 /////////////////////////////////////////////////////////////////////////////////////////////////////////
 //Core public functions
 /////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -1437,6 +1852,8 @@ PairwiseAlignmentParameters *pairwiseAlignmentBandingParameters_construct() {
     p->splitMatrixBiggerThanThis = (int64_t) 3000 * 3000;
     p->alignAmbiguityCharacters = 0;
     p->gapGamma = 0.5;
+    p->expectationsThreshold = 0.0;
+    p->expectationsPruning = 0.0;
     return p;
 }
 
@@ -1445,27 +1862,28 @@ void pairwiseAlignmentBandingParameters_destruct(PairwiseAlignmentParameters *p)
 }
 
 static void alignedPairCoordinateCorrectionFn(int64_t offsetX, int64_t offsetY, void *extraArgs) {
-    stList *subListOfAlignedPairs = ((void **) extraArgs)[0];
-    stList *alignedPairs = ((void **) extraArgs)[1];
-    convertAlignedPairs(subListOfAlignedPairs, offsetX, offsetY); //Shift back the aligned pairs to the appropriate coordinates
-    while (stList_length(subListOfAlignedPairs) > 0) {
-        stList_append(alignedPairs, stList_pop(subListOfAlignedPairs));
-    }
-}
-
-stList *getAlignedPairsUsingAnchors(StateMachine *sM,
-                                    Sequence *SsX, Sequence *SsY,
-                                    stList *anchorPairs,
-                                    PairwiseAlignmentParameters *p,
-                                    void (*diagonalPosteriorProbFn)(StateMachine *, int64_t, DpMatrix *,
-                                                                    DpMatrix *, Sequence *, Sequence *, double,
-                                                                    PairwiseAlignmentParameters *, void *),
-                                    bool alignmentHasRaggedLeftEnd,
-                                    bool alignmentHasRaggedRightEnd) {
-
-    //This list of pairs to be returned. Not in any order, but points must be unique
-    stList *subListOfAlignedPairs = stList_construct();
-    stList *alignedPairs = stList_construct3(0, (void (*)(void *)) stIntTuple_destruct);
+    AlignedPairBuffer *subListOfAlignedPairs = ((void **) extraArgs)[0];
+    AlignedPairBuffer *alignedPairs = ((void **) extraArgs)[1];
+    //Shift back the aligned pairs to the appropriate coordinates
+    alignedPairBuffer_appendWithOffset(alignedPairs, subListOfAlignedPairs, offsetX, offsetY);
+    alignedPairBuffer_clear(subListOfAlignedPairs);
+}
+
+AlignedPairBuffer *getAlignedPairBufferUsingAnchors(StateMachine *sM,
+                                                    Sequence *SsX, Sequence *SsY,
+                                                    stList *anchorPairs,
+                                                    PairwiseAlignmentParameters *p,
+                                                    void (*diagonalPosteriorProbFn)(StateMachine *, int64_t,
+                                                                                    DpMatrix *, DpMatrix *,
+                                                                                    Sequence *, Sequence *, double,
+                                                                                    PairwiseAlignmentParameters *,
+                                                                                    void *),
+                                                    bool alignmentHasRaggedLeftEnd,
+                                                    bool alignmentHasRaggedRightEnd) {
+
+    //This set of pairs to be returned. Not in any order, but points must be unique
+    AlignedPairBuffer *subListOfAlignedPairs = alignedPairBuffer_construct(0);
+    AlignedPairBuffer *alignedPairs = alignedPairBuffer_construct(0);
     void *extraArgs[2] = { subListOfAlignedPairs, alignedPairs };
 
     getPosteriorProbsWithBandingSplittingAlignmentsByLargeGaps(sM, anchorPairs,
@@ -1477,12 +1895,103 @@ stList *getAlignedPairsUsingAnchors(StateMachine *sM,
                                                                alignedPairCoordinateCorrectionFn,
                                                                extraArgs);
 
-    assert(stList_length(subListOfAlignedPairs) == 0);
-    stList_destruct(subListOfAlignedPairs);
+    assert(subListOfAlignedPairs->length == 0);
+    alignedPairBuffer_destruct(subListOfAlignedPairs);
 
     return alignedPairs;
 }
 
+stList *getAlignedPairsUsingAnchors(StateMachine *sM,
+                                    Sequence *SsX, Sequence *SsY,
+                                    stList *anchorPairs,
+                                    PairwiseAlignmentParameters *p,
+                                    void (*diagonalPosteriorProbFn)(StateMachine *, int64_t, DpMatrix *,
+                                                                    DpMatrix *, Sequence *, Sequence *, double,
+                                                                    PairwiseAlignmentParameters *, void *),
+                                    bool alignmentHasRaggedLeftEnd,
+                                    bool alignmentHasRaggedRightEnd) {
+    AlignedPairBuffer *alignedPairBuffer = getAlignedPairBufferUsingAnchors(sM, SsX, SsY, anchorPairs, p,
+                                                                            diagonalPosteriorProbFn,
+                                                                            alignmentHasRaggedLeftEnd,
+                                                                            alignmentHasRaggedRightEnd);
+    stList *alignedPairs = alignedPairBuffer_toList(alignedPairBuffer);
+    alignedPairBuffer_destruct(alignedPairBuffer);
+    return alignedPairs;
+}
+
+typedef struct _alignedPairSink {
+    void (*sinkFn)(AlignedPairBuffer *alignedPairs, void *sinkArgs);
+    void *sinkArgs;
+    AlignedPairBuffer *heldBackPairs; // pairs a later window can still come before, in insertion order
+    AlignedPairBuffer *finalPairs;    // what is handed to sinkFn
+} AlignedPairSink;
+
+// hands the pairs with x + y <= maxXay to the sink, sorted by x + y, and keeps the others
+static void alignedPairSink_flush(AlignedPairSink *sink, int64_t maxXay) {
+    AlignedPairBuffer *heldBackPairs = sink->heldBackPairs;
+    alignedPairBuffer_sortByXPlusYCoordinate(heldBackPairs);
+    int64_t i = 0;
+    while (i < heldBackPairs->length && heldBackPairs->x[i] + heldBackPairs->y[i] <= maxXay) {
+        alignedPairBuffer_add(sink->finalPairs, heldBackPairs->probs[i], heldBackPairs->x[i], heldBackPairs->y[i]);
+        i++;
+    }
+    if (sink->finalPairs->length > 0) {
+        sink->sinkFn(sink->finalPairs, sink->sinkArgs);
+        alignedPairBuffer_clear(sink->finalPairs);
+    }
+    //Shift the pairs that are left to the front
+    int64_t left = heldBackPairs->length - i;
+    memmove(heldBackPairs->probs, heldBackPairs->probs + i, left * sizeof(int64_t));
+    memmove(heldBackPairs->x, heldBackPairs->x + i, left * sizeof(int64_t));
+    memmove(heldBackPairs->y, heldBackPairs->y + i, left * sizeof(int64_t));
+    heldBackPairs->length = left;
+}
+
+static void alignedPairSinkFn(int64_t offsetX, int64_t offsetY, int64_t tracedBackTo, void *extraArgs) {
+    AlignedPairBuffer *alignedPairs = ((void **) extraArgs)[0];
+    AlignedPairSink *sink = ((void **) extraArgs)[1];
+    //Shift the window's pairs to the coordinates of the whole sequences, after the ones held back, so ties keep
+    //the order they were computed in
+    alignedPairBuffer_appendWithOffset(sink->heldBackPairs, alignedPairs, offsetX, offsetY);
+    alignedPairBuffer_clear(alignedPairs);
+    //The later windows are on diagonals after tracedBackTo, the pair of the cell (x, y) is (x - 1, y - 1) (or
+    //(x - 1 + n, y - 1) for the echelon posteriors), so they can't come before x + y = tracedBackTo - 1
+    alignedPairSink_flush(sink, offsetX + offsetY + tracedBackTo - 2);
+}
+
+void getAlignedPairsUsingAnchorsWithSink(StateMachine *sM,
+                                         Sequence *SsX, Sequence *SsY,
+                                         stList *anchorPairs,
+                                         PairwiseAlignmentParameters *p,
+                                         void (*diagonalPosteriorProbFn)(StateMachine *, int64_t, DpMatrix *,
+                                                                         DpMatrix *, Sequence *, Sequence *, double,
+                                                                         PairwiseAlignmentParameters *, void *),
+                                         bool alignmentHasRaggedLeftEnd,
+                                         bool alignmentHasRaggedRightEnd,
+                                         void (*sinkFn)(AlignedPairBuffer *alignedPairs, void *sinkArgs),
+                                         void *sinkArgs) {
+    //Only holds the pairs of the current traceback window
+    AlignedPairBuffer *alignedPairs = alignedPairBuffer_construct(0);
+    AlignedPairSink sink = { sinkFn, sinkArgs, alignedPairBuffer_construct(0), alignedPairBuffer_construct(0) };
+    void *extraArgs[2] = { alignedPairs, &sink };
+
+    getPosteriorProbsWithBandingSplittingAlignmentsByLargeGaps2(sM, anchorPairs,
+                                                                SsX, SsY,
+                                                                p,
+                                                                alignmentHasRaggedLeftEnd,
+                                                                alignmentHasRaggedRightEnd,
+                                                                diagonalPosteriorProbFn,
+                                                                NULL, alignedPairSinkFn,
+                                                                extraArgs);
+
+    alignedPairSink_flush(&sink, INT64_MAX);
+    assert(alignedPairs->length == 0);
+    assert(sink.heldBackPairs->length == 0);
+    alignedPairBuffer_destruct(alignedPairs);
+    alignedPairBuffer_destruct(sink.heldBackPairs);
+    alignedPairBuffer_destruct(sink.finalPairs);
+}
+
 stList *getAlignedPairs(StateMachine *sM, void *cX, void *cY, int64_t lX, int64_t lY,
                         PairwiseAlignmentParameters *p,
                         void *(*getXFcn)(void *, int64_t),
@@ -1509,14 +2018,17 @@ stList *getAlignedPairs(StateMachine *sM, void *cX, void *cY, int64_t lX, int64_
     return alignedPairs;
 }
 
-stList *getAlignedPairsWithoutBanding(StateMachine *sM, void *cX, void *cY, int64_t lX, int64_t lY,
-                                      PairwiseAlignmentParameters *p,
-                                      void *(*getXFcn)(void *, int64_t),
-                                      void *(*getYFcn)(void *, int64_t),
-                                      void (*diagonalPosteriorProbFn)(StateMachine *, int64_t, DpMatrix *,
-                                                                      DpMatrix *, Sequence *, Sequence *, double,
-                                                                      PairwiseAlignmentParameters *, void *),
-                                      bool alignmentHasRaggedLeftEnd, bool alignmentHasRaggedRightEnd) {
+AlignedPairBuffer *getAlignedPairBufferWithoutBanding(StateMachine *sM, void *cX, void *cY, int64_t lX, int64_t lY,
+                                                      PairwiseAlignmentParameters *p,
+                                                      void *(*getXFcn)(void *, int64_t),
+                                                      void *(*getYFcn)(void *, int64_t),
+                                                      void (*diagonalPosteriorProbFn)(StateMachine *, int64_t,
+                                                                                      DpMatrix *, DpMatrix *,
+                                                                                      Sequence *, Sequence *, double,
+                                                                                      PairwiseAlignmentParameters *,
+                                                                                      void *),
+                                                      bool alignmentHasRaggedLeftEnd,
+                                                      bool alignmentHasRaggedRightEnd) {
     // make sequence objects
     Sequence *ScX = sequence_construct(lX, cX, getXFcn);
     if (sM->type == echelon) {
@@ -1555,7 +2067,7 @@ stList *getAlignedPairsWithoutBanding(StateMachine *sM, void *cX, void *cY, int6
     // diagoinalCalculationPosteriorMatchProbs
     double totalProbability = diagonalCalculationTotalProbability(sM, diagonalNumber, forwardDpMatrix,
                                                                   backwardDpMatrix, ScX, ScY);
-    stList *alignedPairs = stList_construct3(0, (void (*)(void *)) stIntTuple_destruct);
+    AlignedPairBuffer *alignedPairs = alignedPairBuffer_construct(0);
     void *extraArgs[1] = { alignedPairs };
     for (int64_t i = 0; i <= diagonalNumber; i++) {
         diagonalPosteriorProbFn(sM, i, forwardDpMatrix, backwardDpMatrix, ScX, ScY, totalProbability, p, extraArgs);
@@ -1568,6 +2080,24 @@ stList *getAlignedPairsWithoutBanding(StateMachine *sM, void *cX, void *cY, int6
     return alignedPairs;
 }
 
+stList *getAlignedPairsWithoutBanding(StateMachine *sM, void *cX, void *cY, int64_t lX, int64_t lY,
+                                      PairwiseAlignmentParameters *p,
+                                      void *(*getXFcn)(void *, int64_t),
+                                      void *(*getYFcn)(void *, int64_t),
+                                      void (*diagonalPosteriorProbFn)(StateMachine *, int64_t, DpMatrix *,
+                                                                      DpMatrix *, Sequence *, Sequence *, double,
+                                                                      PairwiseAlignmentParameters *, void *),
+                                      bool alignmentHasRaggedLeftEnd, bool alignmentHasRaggedRightEnd) {
+    AlignedPairBuffer *alignedPairBuffer = getAlignedPairBufferWithoutBanding(sM, cX, cY, lX, lY, p,
+                                                                              getXFcn, getYFcn,
+                                                                              diagonalPosteriorProbFn,
+                                                                              alignmentHasRaggedLeftEnd,
+                                                                              alignmentHasRaggedRightEnd);
+    stList *alignedPairs = alignedPairBuffer_toList(alignedPairBuffer);
+    alignedPairBuffer_destruct(alignedPairBuffer);
+    return alignedPairs;
+}
+
 void getExpectationsUsingAnchors(StateMachine *sM, Hmm *hmmExpectations,
                                  Sequence *SsX, Sequence *SsY,
                                  stList *anchorPairs,
@@ -1661,3 +2191,37 @@ stList *reweightAlignedPairs2(stList *alignedPairs,
     free(indelProbsY);
     return alignedPairs;
 }
+
+int64_t *alignedPairBuffer_getIndelProbabilities(AlignedPairBuffer *alignedPairs, int64_t seqLength,
+                                                 bool xIfTrueElseY) {
+    int64_t *indelProbs = st_malloc(seqLength * sizeof(int64_t));
+    for(int64_t i=0; i<seqLength; i++) {
+        indelProbs[i] = PAIR_ALIGNMENT_PROB_1;
+    }
+    int64_t *coordinates = xIfTrueElseY ? alignedPairs->x : alignedPairs->y;
+    for(int64_t i=0; i<alignedPairs->length; i++) {
+        indelProbs[coordinates[i]] -= alignedPairs->probs[i];
+    }
+    for(int64_t i=0; i<seqLength; i++) {
+        if(indelProbs[i] < 0) {
+            indelProbs[i] = 0;
+        }
+    }
+    return indelProbs;
+}
+
+void alignedPairBuffer_reweight(AlignedPairBuffer *alignedPairs,
+                                int64_t seqLengthX, int64_t seqLengthY,
+                                double gapGamma) {
+    if(gapGamma <= 0.0) {
+        return;
+    }
+    int64_t *indelProbsX = alignedPairBuffer_getIndelProbabilities(alignedPairs, seqLengthX, 1);
+    int64_t *indelProbsY = alignedPairBuffer_getIndelProbabilities(alignedPairs, seqLengthY, 0);
+    for(int64_t i=0; i<alignedPairs->length; i++) {
+        alignedPairs->probs[i] = alignedPairs->probs[i] - gapGamma * (indelProbsX[alignedPairs->x[i]] +
+                                                                      indelProbsY[alignedPairs->y[i]]);
+    }
+    free(indelProbsX);
+    free(indelProbsY);
+}
@@ -0,0 +1,315 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "sonLib.h"
+#include "posteriorProbs.h"
+
+static void *posteriorProbsChunk_realloc(void *array, int64_t size) {
+    void *newArray = realloc(array, size);
+    if (newArray == NULL && size > 0) {
+        st_errAbort("posteriorProbs: failed to allocate %" PRIi64 " bytes\n", size);
+    }
+    return newArray;
+}
+
+static void posteriorProbsChunk_reserve(PosteriorProbsChunk *chunk, int64_t length) {
+    if (length <= chunk->maxLength) {
+        return;
+    }
+    int64_t maxLength = chunk->maxLength > 0 ? chunk->maxLength : 1024;
+    while (maxLength < length) {
+        maxLength *= 2;
+    }
+    chunk->refPositions = posteriorProbsChunk_realloc(chunk->refPositions, maxLength * sizeof(int64_t));
+    chunk->eventIndices = posteriorProbsChunk_realloc(chunk->eventIndices, maxLength * sizeof(int64_t));
+    chunk->kmerCodesColumn = posteriorProbsChunk_realloc(chunk->kmerCodesColumn, maxLength * sizeof(int32_t));
+    chunk->eventMeans = posteriorProbsChunk_realloc(chunk->eventMeans, maxLength * sizeof(double));
+    chunk->eventNoises = posteriorProbsChunk_realloc(chunk->eventNoises, maxLength * sizeof(double));
+    chunk->eventDurations = posteriorProbsChunk_realloc(chunk->eventDurations, maxLength * sizeof(double));
+    chunk->expectedLevelMeans = posteriorProbsChunk_realloc(chunk->expectedLevelMeans, maxLength * sizeof(double));
+    chunk->expectedNoiseMeans = posteriorProbsChunk_realloc(chunk->expectedNoiseMeans, maxLength * sizeof(double));
+    chunk->posteriors = posteriorProbsChunk_realloc(chunk->posteriors, maxLength * sizeof(double));
+    chunk->maxLength = maxLength;
+}
+
+static void posteriorProbsChunk_clearKmers(PosteriorProbsChunk *chunk) {
+    if (chunk->kmerCodes != NULL) {
+        stHash_destruct(chunk->kmerCodes);
+        stList_destruct(chunk->kmers);
+    }
+    // the hash owns the kmer strings, the list shares them
+    chunk->kmerCodes = stHash_construct3(stHash_stringKey, stHash_stringEqualKey, free,
+                                         (void (*)(void *)) stIntTuple_destruct);
+    chunk->kmers = stList_construct();
+}
+
+PosteriorProbsChunk *posteriorProbsChunk_construct(const char *contig, const char *readLabel, char strand,
+                                                   bool refKmerIsReverseComplement, double scale, double shift,
+                                                   int64_t kmerLength) {
+    PosteriorProbsChunk *chunk = st_calloc(1, sizeof(PosteriorProbsChunk));
+    chunk->contig = stString_copy(contig);
+    chunk->readLabel = stString_copy(readLabel);
+    chunk->strand = strand;
+    chunk->refKmerIsReverseComplement = refKmerIsReverseComplement;
+    chunk->scale = scale;
+    chunk->shift = shift;
+    chunk->kmerLength = kmerLength;
+    chunk->kmerBuffer = st_malloc((kmerLength + 1) * sizeof(char));
+    chunk->length = 0;
+    chunk->maxLength = 0;
+    posteriorProbsChunk_clearKmers(chunk);
+    return chunk;
+}
+
+void posteriorProbsChunk_destruct(PosteriorProbsChunk *chunk) {
+    stHash_destruct(chunk->kmerCodes);
+    stList_destruct(chunk->kmers);
+    free(chunk->contig);
+    free(chunk->readLabel);
+    free(chunk->kmerBuffer);
+    free(chunk->refPositions);
+    free(chunk->eventIndices);
+    free(chunk->kmerCodesColumn);
+    free(chunk->eventMeans);
+    free(chunk->eventNoises);
+    free(chunk->eventDurations);
+    free(chunk->expectedLevelMeans);
+    free(chunk->expectedNoiseMeans);
+    free(chunk->posteriors);
+    free(chunk);
+}
+
+static int32_t posteriorProbsChunk_getKmerCode(PosteriorProbsChunk *chunk, const char *kmer) {
+    // looked up in the chunk's buffer, only kmers new to the dictionary are copied
+    memcpy(chunk->kmerBuffer, kmer, chunk->kmerLength * sizeof(char));
+    chunk->kmerBuffer[chunk->kmerLength] = '\0';
+    stIntTuple *code = stHash_search(chunk->kmerCodes, chunk->kmerBuffer);
+    if (code != NULL) {
+        return (int32_t) stIntTuple_get(code, 0);
+    }
+    char *kmerString = stString_copy(chunk->kmerBuffer);
+    int32_t newCode = (int32_t) stList_length(chunk->kmers);
+    stList_append(chunk->kmers, kmerString);
+    stHash_insert(chunk->kmerCodes, kmerString, stIntTuple_construct1(newCode));
+    return newCode;
+}
+
+void posteriorProbsChunk_add(PosteriorProbsChunk *chunk, int64_t refPosition, int64_t eventIndex, const char *kmer,
+                             double eventMean, double eventNoise, double eventDuration,
+                             double expectedLevelMean, double expectedNoiseMean, double posterior) {
+    posteriorProbsChunk_reserve(chunk, chunk->length + 1);
+    int64_t i = chunk->length++;
+    chunk->refPositions[i] = refPosition;
+    chunk->eventIndices[i] = eventIndex;
+    chunk->kmerCodesColumn[i] = posteriorProbsChunk_getKmerCode(chunk, kmer);
+    chunk->eventMeans[i] = eventMean;
+    chunk->eventNoises[i] = eventNoise;
+    chunk->eventDurations[i] = eventDuration;
+    chunk->expectedLevelMeans[i] = expectedLevelMean;
+    chunk->expectedNoiseMeans[i] = expectedNoiseMean;
+    chunk->posteriors[i] = posterior;
+}
+
+static void posteriorProbs_checkLittleEndian() {
+    uint16_t one = 1;
+    if (*((uint8_t *) &one) != 1) {
+        st_errAbort("binary posteriors files are little-endian, not supported on this machine\n");
+    }
+}
+
+static void posteriorProbs_write(const void *data, int64_t size, int64_t n, FILE *fH) {
+    if (n > 0 && fwrite(data, size, n, fH) != (size_t) n) {
+        st_errAbort("posteriorProbs: error writing binary posteriors\n");
+    }
+}
+
+static void posteriorProbs_writeString(const char *string, FILE *fH) {
+    int64_t length = strlen(string);
+    posteriorProbs_write(&length, sizeof(int64_t), 1, fH);
+    posteriorProbs_write(string, sizeof(char), length, fH);
+}
+
+void posteriorProbsChunk_write(PosteriorProbsChunk *chunk, FILE *fH) {
+    if (chunk->length == 0) {
+        return;
+    }
+    posteriorProbs_checkLittleEndian();
+    int32_t version = POSTERIOR_PROBS_VERSION;
+    char refKmerIsReverseComplement = chunk->refKmerIsReverseComplement;
+    int64_t nbKmers = stList_length(chunk->kmers);
+    int64_t n = chunk->length;
+
+    // header
+    posteriorProbs_write(POSTERIOR_PROBS_MAGIC, sizeof(char), 4, fH);
+    posteriorProbs_write(&version, sizeof(int32_t), 1, fH);
+    posteriorProbs_write(&n, sizeof(int64_t), 1, fH);
+    posteriorProbs_write(&chunk->kmerLength, sizeof(int64_t), 1, fH);
+    posteriorProbs_writeString(chunk->contig, fH);
+    posteriorProbs_writeString(chunk->readLabel, fH);
+    posteriorProbs_write(&chunk->strand, sizeof(char), 1, fH);
+    posteriorProbs_write(&refKmerIsReverseComplement, sizeof(char), 1, fH);
+    posteriorProbs_write(&chunk->scale, sizeof(double), 1, fH);
+    posteriorProbs_write(&chunk->shift, sizeof(double), 1, fH);
+
+    // kmer dictionary
+    posteriorProbs_write(&nbKmers, sizeof(int64_t), 1, fH);
+    for (int64_t i = 0; i < nbKmers; i++) {
+        posteriorProbs_write(stList_get(chunk->kmers, i), sizeof(char), chunk->kmerLength, fH);
+    }
+
+    // columns
+    posteriorProbs_write(chunk->refPositions, sizeof(int64_t), n, fH);
+    posteriorProbs_write(chunk->eventIndices, sizeof(int64_t), n, fH);
+    posteriorProbs_write(chunk->kmerCodesColumn, sizeof(int32_t), n, fH);
+    posteriorProbs_write(chunk->eventMeans, sizeof(double), n, fH);
+    posteriorProbs_write(chunk->eventNoises, sizeof(double), n, fH);
+    posteriorProbs_write(chunk->eventDurations, sizeof(double), n, fH);
+    posteriorProbs_write(chunk->expectedLevelMeans, sizeof(double), n, fH);
+    posteriorProbs_write(chunk->expectedNoiseMeans, sizeof(double), n, fH);
+    posteriorProbs_write(chunk->posteriors, sizeof(double), n, fH);
+
+    chunk->length = 0;
+    posteriorProbsChunk_clearKmers(chunk);
+}
+
+static void posteriorProbs_read(void *data, int64_t size, int64_t n, FILE *fH) {
+    if (n > 0 && fread(data, size, n, fH) != (size_t) n) {
+        st_errAbort("posteriorProbs: binary posteriors file is truncated\n");
+    }
+}
+
+static char *posteriorProbs_readString(FILE *fH) {
+    int64_t length;
+    posteriorProbs_read(&length, sizeof(int64_t), 1, fH);
+    if (length < 0) {
+        st_errAbort("posteriorProbs: got a string of negative length, file is corrupted\n");
+    }
+    char *string = st_malloc((length + 1) * sizeof(char));
+    posteriorProbs_read(string, sizeof(char), length, fH);
+    string[length] = '\0';
+    return string;
+}
+
+PosteriorProbsChunk *posteriorProbsChunk_read(FILE *fH) {
+    posteriorProbs_checkLittleEndian();
+    char magic[4];
+    size_t got = fread(magic, sizeof(char), 4, fH);
+    if (got == 0 && feof(fH)) {
+        return NULL;
+    }
+    if (got != 4 || memcmp(magic, POSTERIOR_PROBS_MAGIC, 4) != 0) {
+        st_errAbort("posteriorProbs: not a binary posteriors file\n");
+    }
+    int32_t version;
+    posteriorProbs_read(&version, sizeof(int32_t), 1, fH);
+    if (version != POSTERIOR_PROBS_VERSION) {
+        st_errAbort("posteriorProbs: unsupported binary posteriors version %d\n", version);
+    }
+    int64_t n, kmerLength, nbKmers;
+    char strand, refKmerIsReverseComplement;
+    double scale, shift;
+    posteriorProbs_read(&n, sizeof(int64_t), 1, fH);
+    posteriorProbs_read(&kmerLength, sizeof(int64_t), 1, fH);
+    if (n < 0 || kmerLength <= 0) {
+        st_errAbort("posteriorProbs: corrupted binary posteriors chunk header\n");
+    }
+    char *contig = posteriorProbs_readString(fH);
+    char *readLabel = posteriorProbs_readString(fH);
+    posteriorProbs_read(&strand, sizeof(char), 1, fH);
+    posteriorProbs_read(&refKmerIsReverseComplement, sizeof(char), 1, fH);
+    posteriorProbs_read(&scale, sizeof(double), 1, fH);
+    posteriorProbs_read(&shift, sizeof(double), 1, fH);
+
+    PosteriorProbsChunk *chunk = posteriorProbsChunk_construct(contig, readLabel, strand,
+                                                               refKmerIsReverseComplement, scale, shift, kmerLength);
+    free(contig);
+    free(readLabel);
+
+    posteriorProbs_read(&nbKmers, sizeof(int64_t), 1, fH);
+    for (int64_t i = 0; i < nbKmers; i++) {
+        char *kmer = st_malloc((kmerLength + 1) * sizeof(char));
+        posteriorProbs_read(kmer, sizeof(char), kmerLength, fH);
+        kmer[kmerLength] = '\0';
+        stList_append(chunk->kmers, kmer);
+        stHash_insert(chunk->kmerCodes, kmer, stIntTuple_construct1(i));
+    }
+
+    posteriorProbsChunk_reserve(chunk, n);
+    posteriorProbs_read(chunk->refPositions, sizeof(int64_t), n, fH);
+    posteriorProbs_read(chunk->eventIndices, sizeof(int64_t), n, fH);
+    posteriorProbs_read(chunk->kmerCodesColumn, sizeof(int32_t), n, fH);
+    posteriorProbs_read(chunk->eventMeans, sizeof(double), n, fH);
+    posteriorProbs_read(chunk->eventNoises, sizeof(double), n, fH);
+    posteriorProbs_read(chunk->eventDurations, sizeof(double), n, fH);
+    posteriorProbs_read(chunk->expectedLevelMeans, sizeof(double), n, fH);
+    posteriorProbs_read(chunk->expectedNoiseMeans, sizeof(double), n, fH);
+    posteriorProbs_read(chunk->posteriors, sizeof(double), n, fH);
+    chunk->length = n;
+    for (int64_t i = 0; i < n; i++) {
+        if (chunk->kmerCodesColumn[i] < 0 || chunk->kmerCodesColumn[i] >= nbKmers) {
+            st_errAbort("posteriorProbs: kmer code out of range, file is corrupted\n");
+        }
+    }
+    return chunk;
+}
+
+void posteriorProbs_writeTsvRow(FILE *fH, const char *contig, int64_t refPosition, const char *refKmer,
+                                const char *readLabel, char strand, int64_t eventIndex,
+                                double eventMean, double eventNoise, double eventDuration,
+                                const char *kmer, int64_t kmerLength,
+                                double expectedLevelMean, double expectedNoiseMean, double posterior,
+                                double scale, double shift) {
+    double descaledMean = (eventMean - shift) / scale;
+    double deScaledExpectedLevelMean = (expectedLevelMean - shift) / scale;
+    int kmerWidth = (int) kmerLength;
+    fprintf(fH, "%s\t%" PRIi64 "\t%.*s\t%s\t%c\t%" PRIi64 "\t%f\t%f\t%f\t%.*s\t%f\t%f\t%f\t%f\t%f\n",
+            contig, refPosition, kmerWidth, refKmer, readLabel, strand, eventIndex, eventMean, eventNoise,
+            eventDuration, kmerWidth, kmer, expectedLevelMean, expectedNoiseMean, posterior, descaledMean,
+            deScaledExpectedLevelMean);
+}
+
+void posteriorProbsChunk_writeTsv(PosteriorProbsChunk *chunk, FILE *fH) {
+    // reference kmers for each dictionary entry
+    int64_t nbKmers = stList_length(chunk->kmers);
+    char **refKmers = st_malloc(nbKmers * sizeof(char *));
+    for (int64_t i = 0; i < nbKmers; i++) {
+        char *kmer = stList_get(chunk->kmers, i);
+        refKmers[i] = chunk->refKmerIsReverseComplement ? stString_reverseComplementString(kmer)
+                                                        : stString_copy(kmer);
+    }
+    for (int64_t i = 0; i < chunk->length; i++) {
+        int32_t code = chunk->kmerCodesColumn[i];
+        posteriorProbs_writeTsvRow(fH, chunk->contig, chunk->refPositions[i], refKmers[code], chunk->readLabel,
+                                   chunk->strand, chunk->eventIndices[i], chunk->eventMeans[i],
+                                   chunk->eventNoises[i], chunk->eventDurations[i], stList_get(chunk->kmers, code),
+                                   chunk->kmerLength, chunk->expectedLevelMeans[i], chunk->expectedNoiseMeans[i],
+                                   chunk->posteriors[i], chunk->scale, chunk->shift);
+    }
+    for (int64_t i = 0; i < nbKmers; i++) {
+        free(refKmers[i]);
+    }
+    free(refKmers);
+}
+
+int64_t posteriorProbs_convertToTsv(const char *binaryFile, const char *tsvFile) {
+    FILE *inH = fopen(binaryFile, "rb");
+    if (inH == NULL) {
+        st_errAbort("posteriorProbs: couldn't open %s\n", binaryFile);
+    }
+    FILE *outH = fopen(tsvFile, "w");
+    if (outH == NULL) {
+        st_errAbort("posteriorProbs: couldn't open %s for writing\n", tsvFile);
+    }
+    int64_t rows = 0;
+    PosteriorProbsChunk *chunk;
+    while ((chunk = posteriorProbsChunk_read(inH)) != NULL) {
+        posteriorProbsChunk_writeTsv(chunk, outH);
+        rows += chunk->length;
+        posteriorProbsChunk_destruct(chunk);
+    }
+    fclose(inH);
+    fclose(outH);
+    return rows;
+}
@@ -0,0 +1,98 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <inttypes.h>
+#include "sonLib.h"
+#include "reorderBuffer.h"
+
+struct _reorderBuffer {
+    pthread_mutex_t lock;
+    pthread_cond_t advanced;
+    void (*writeFn)(void *result, void *extraArg);
+    void *extraArg;
+    bool writing; // a thread is writing the run of results starting at next
+
+    // results of the jobs next to next + window - 1, slot index % window
+    int64_t window;
+    int64_t next;
+    int64_t waiting;
+    void **results;
+    bool *filled;
+};
+
+ReorderBuffer *reorderBuffer_construct(int64_t window, void (*writeFn)(void *result, void *extraArg),
+                                       void *extraArg) {
+    if (window < 1) {
+        st_errAbort("reorderBuffer: need a window of at least one result, got %" PRIi64 "\n", window);
+    }
+    ReorderBuffer *buffer = st_malloc(sizeof(ReorderBuffer));
+    pthread_mutex_init(&buffer->lock, NULL);
+    pthread_cond_init(&buffer->advanced, NULL);
+    buffer->writeFn = writeFn;
+    buffer->extraArg = extraArg;
+    buffer->writing = FALSE;
+    buffer->window = window;
+    buffer->next = 0;
+    buffer->waiting = 0;
+    buffer->results = st_calloc(window, sizeof(void *));
+    buffer->filled = st_calloc(window, sizeof(bool));
+    return buffer;
+}
+
+void reorderBuffer_push(ReorderBuffer *buffer, int64_t index, void *result) {
+    pthread_mutex_lock(&buffer->lock);
+    if (index < buffer->next) {
+        st_errAbort("reorderBuffer: result %" PRIi64 " was already written\n", index);
+    }
+    // the job at next has been taken by a worker that isn't waiting here, so this can't deadlock
+    while (index >= buffer->next + buffer->window) {
+        pthread_cond_wait(&buffer->advanced, &buffer->lock);
+    }
+    int64_t slot = index % buffer->window;
+    if (buffer->filled[slot]) {
+        st_errAbort("reorderBuffer: result %" PRIi64 " was pushed twice\n", index);
+    }
+    buffer->results[slot] = result;
+    buffer->filled[slot] = TRUE;
+    buffer->waiting++;
+    if (buffer->writing) { // the thread writing picks it up
+        pthread_mutex_unlock(&buffer->lock);
+        return;
+    }
+    buffer->writing = TRUE;
+    while (buffer->filled[buffer->next % buffer->window]) {
+        slot = buffer->next % buffer->window;
+        void *nextResult = buffer->results[slot];
+        // write without holding the lock so the other threads can keep pushing
+        pthread_mutex_unlock(&buffer->lock);
+        buffer->writeFn(nextResult, buffer->extraArg);
+        pthread_mutex_lock(&buffer->lock);
+        buffer->results[slot] = NULL;
+        buffer->filled[slot] = FALSE;
+        buffer->waiting--;
+        buffer->next++;
+        pthread_cond_broadcast(&buffer->advanced);
+    }
+    buffer->writing = FALSE;
+    pthread_mutex_unlock(&buffer->lock);
+}
+
+int64_t reorderBuffer_getNumberWritten(ReorderBuffer *buffer) {
+    pthread_mutex_lock(&buffer->lock);
+    int64_t written = buffer->next;
+    pthread_mutex_unlock(&buffer->lock);
+    return written;
+}
+
+void reorderBuffer_destruct(ReorderBuffer *buffer) {
+    if (buffer->waiting > 0) {
+        st_errAbort("reorderBuffer: %" PRIi64 " results are waiting for result %" PRIi64 "\n", buffer->waiting,
+                    buffer->next);
+    }
+    pthread_mutex_destroy(&buffer->lock);
+    pthread_cond_destroy(&buffer->advanced);
+    free(buffer->results);
+    free(buffer->filled);
+    free(buffer);
+}
@@ -0,0 +1,375 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <inttypes.h>
+#include "emissionMatrix.h"
+#include "nanopore.h"
+#include "pairwiseAligner.h"
+#include "signalSeeding.h"
+
+typedef struct _kmerLevel {
+    double levelMean;
+    int64_t kmerIndex;
+} KmerLevel;
+
+typedef struct _signalSeeder {
+    const double *eventModel;
+    KmerLevel *sortedLevels; // all kmers sorted by level mean, for nearest-level lookups
+    double maxLevelSd;
+    int64_t lX; // number of reference kmers
+    int64_t *refKmers; // kmer index at each reference position, -1 if the kmer has a non-ACGT base
+    int64_t *kmerStarts; // kmerPositions[kmerStarts[k]] to kmerPositions[kmerStarts[k + 1]] are the positions of k
+    int64_t *kmerPositions;
+} SignalSeeder;
+
+static inline double signalSeeding_getLevelMean(const double *eventModel, int64_t kmerIndex) {
+    // 1 + i*MODEL_PARAMS because the first element is the correlation parameter
+    return eventModel[1 + (kmerIndex * MODEL_PARAMS)];
+}
+
+static inline double signalSeeding_getLevelSd(const double *eventModel, int64_t kmerIndex) {
+    return eventModel[1 + (kmerIndex * MODEL_PARAMS + 1)];
+}
+
+static inline double signalSeeding_getEventMean(float *events, int64_t y) {
+    return nanopore_getEventMean(events + y * NB_EVENT_PARAMS);
+}
+
+static inline double signalSeeding_getDeviation(const double *eventModel, int64_t kmerIndex, double eventMean) {
+    return fabs(eventMean - signalSeeding_getLevelMean(eventModel, kmerIndex)) /
+           signalSeeding_getLevelSd(eventModel, kmerIndex);
+}
+
+static int signalSeeding_kmerLevelCmp(const void *a, const void *b) {
+    double la = ((KmerLevel *) a)->levelMean;
+    double lb = ((KmerLevel *) b)->levelMean;
+    return la < lb ? -1 : (la > lb ? 1 : 0);
+}
+
+static KmerLevel *signalSeeding_sortKmersByLevel(const double *eventModel, double *maxLevelSd) {
+    KmerLevel *sortedLevels = st_malloc(NUM_OF_KMERS * sizeof(KmerLevel));
+    *maxLevelSd = 0.0;
+    for (int64_t k = 0; k < NUM_OF_KMERS; k++) {
+        sortedLevels[k].levelMean = signalSeeding_getLevelMean(eventModel, k);
+        sortedLevels[k].kmerIndex = k;
+        double sd = signalSeeding_getLevelSd(eventModel, k);
+        *maxLevelSd = sd > *maxLevelSd ? sd : *maxLevelSd;
+    }
+    qsort(sortedLevels, NUM_OF_KMERS, sizeof(KmerLevel), signalSeeding_kmerLevelCmp);
+    return sortedLevels;
+}
+
+// index of the first kmer with a level mean >= eventMean
+static int64_t signalSeeding_lowerBound(KmerLevel *sortedLevels, double eventMean) {
+    int64_t lo = 0, hi = NUM_OF_KMERS;
+    while (lo < hi) {
+        int64_t mid = (lo + hi) / 2;
+        if (sortedLevels[mid].levelMean < eventMean) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// walks outwards from the event mean in the sorted levels, nearest level first. Stops when the level is too far
+// away to be within maxDeviation of any kmer. Fills candidates and returns how many were found
+static int64_t signalSeeding_getCandidateKmers(const double *eventModel, KmerLevel *sortedLevels,
+                                               double maxLevelSd, double eventMean, double maxDeviation,
+                                               int64_t maxCandidates, int64_t *candidates) {
+    int64_t nbCandidates = 0;
+    int64_t hi = signalSeeding_lowerBound(sortedLevels, eventMean);
+    int64_t lo = hi - 1;
+    double maxDistance = maxDeviation * maxLevelSd;
+    while ((nbCandidates < maxCandidates) && ((lo >= 0) || (hi < NUM_OF_KMERS))) {
+        double dLo = lo >= 0 ? eventMean - sortedLevels[lo].levelMean : INFINITY;
+        double dHi = hi < NUM_OF_KMERS ? sortedLevels[hi].levelMean - eventMean : INFINITY;
+        int64_t i = dLo <= dHi ? lo-- : hi++;
+        if ((dLo <= dHi ? dLo : dHi) > maxDistance) {
+            break;
+        }
+        int64_t kmerIndex = sortedLevels[i].kmerIndex;
+        if (signalSeeding_getDeviation(eventModel, kmerIndex, eventMean) <= maxDeviation) {
+            candidates[nbCandidates++] = kmerIndex;
+        }
+    }
+    return nbCandidates;
+}
+
+static int64_t signalSeeding_getRefKmerIndex(const char *kmer) {
+    int64_t kmerIndex = 0;
+    for (int64_t i = 0; i < KMER_LENGTH; i++) {
+        int64_t baseIndex = emissions_discrete_getBaseIndex((void *) (kmer + i));
+        if (baseIndex >= SYMBOL_NUMBER_NO_N) {
+            return -1;
+        }
+        kmerIndex = kmerIndex * SYMBOL_NUMBER_NO_N + baseIndex;
+    }
+    return kmerIndex;
+}
+
+static SignalSeeder *signalSeeder_construct(const double *eventModel, const char *reference) {
+    SignalSeeder *seeder = st_malloc(sizeof(SignalSeeder));
+    seeder->eventModel = eventModel;
+    seeder->sortedLevels = signalSeeding_sortKmersByLevel(eventModel, &seeder->maxLevelSd);
+    seeder->lX = sequence_correctSeqLength(strlen(reference), event);
+
+    // index the reference kmers, counting sort into kmerPositions
+    seeder->refKmers = st_malloc((seeder->lX + 1) * sizeof(int64_t));
+    seeder->kmerStarts = st_calloc(NUM_OF_KMERS + 1, sizeof(int64_t));
+    for (int64_t x = 0; x < seeder->lX; x++) {
+        seeder->refKmers[x] = signalSeeding_getRefKmerIndex(reference + x);
+        if (seeder->refKmers[x] >= 0) {
+            seeder->kmerStarts[seeder->refKmers[x] + 1]++;
+        }
+    }
+    for (int64_t k = 0; k < NUM_OF_KMERS; k++) {
+        seeder->kmerStarts[k + 1] += seeder->kmerStarts[k];
+    }
+    seeder->kmerPositions = st_malloc((seeder->kmerStarts[NUM_OF_KMERS] + 1) * sizeof(int64_t));
+    int64_t *next = st_malloc(NUM_OF_KMERS * sizeof(int64_t));
+    memcpy(next, seeder->kmerStarts, NUM_OF_KMERS * sizeof(int64_t));
+    for (int64_t x = 0; x < seeder->lX; x++) {
+        if (seeder->refKmers[x] >= 0) {
+            seeder->kmerPositions[next[seeder->refKmers[x]]++] = x;
+        }
+    }
+    free(next);
+    return seeder;
+}
+
+static void signalSeeder_destruct(SignalSeeder *seeder) {
+    free(seeder->sortedLevels);
+    free(seeder->refKmers);
+    free(seeder->kmerStarts);
+    free(seeder->kmerPositions);
+    free(seeder);
+}
+
+static inline double signalSeeder_getDeviation(SignalSeeder *seeder, int64_t x, double eventMean) {
+    if ((x >= seeder->lX) || (seeder->refKmers[x] < 0)) {
+        return INFINITY;
+    }
+    return signalSeeding_getDeviation(seeder->eventModel, seeder->refKmers[x], eventMean);
+}
+
+// extends a seed starting at reference kmer x and event y. Each following event can stay in the current kmer, step
+// to the next one or skip one kmer, whichever fits the event best, otherwise it counts as a mismatch. Returns the
+// number of reference kmers covered, if anchors isn't NULL the first event of each covered kmer is appended to it
+// as an (x, y) pair
+static int64_t signalSeeder_extendSeed(SignalSeeder *seeder, float *events, int64_t nbEvents,
+                                       int64_t x, int64_t y, SignalSeedingParameters *sp,
+                                       int64_t *xEnd, int64_t *yEnd, stList *anchors) {
+    int64_t nbKmers = 1, mismatches = 0;
+    *xEnd = x;
+    *yEnd = y;
+    if (anchors != NULL) {
+        stList_append(anchors, stIntTuple_construct2(x, y));
+    }
+    while (y + 1 < nbEvents) {
+        double eventMean = signalSeeding_getEventMean(events, ++y);
+        int64_t step = -1;
+        double bestDeviation = sp->maxDeviation;
+        for (int64_t s = 0; s < 3; s++) {
+            double d = signalSeeder_getDeviation(seeder, x + s, eventMean);
+            if (d <= bestDeviation) {
+                bestDeviation = d;
+                step = s;
+            }
+        }
+        if (step == -1) {
+            if (++mismatches > sp->maxMismatches) {
+                break;
+            }
+            continue;
+        }
+        if (step > 0) {
+            x += step;
+            nbKmers++;
+            *xEnd = x;
+            *yEnd = y;
+            if (anchors != NULL) {
+                stList_append(anchors, stIntTuple_construct2(x, y));
+            }
+        }
+    }
+    return nbKmers;
+}
+
+SignalSeedingParameters *signalSeedingParameters_construct() {
+    SignalSeedingParameters *sp = st_malloc(sizeof(SignalSeedingParameters));
+    sp->maxDeviation = 1.5;
+    sp->maxCandidatesPerEvent = 8;
+    sp->minSeedLength = 6;
+    sp->maxMismatches = 1;
+    sp->maxKmerOccurrences = 100;
+    sp->seedTrim = 1;
+    sp->chainGapPenalty = 0.2;
+    return sp;
+}
+
+void signalSeedingParameters_destruct(SignalSeedingParameters *sp) {
+    free(sp);
+}
+
+int64_t *signalSeeding_discretizeEvents(const double *eventModel, float *events, int64_t nbEvents) {
+    double maxLevelSd;
+    KmerLevel *sortedLevels = signalSeeding_sortKmersByLevel(eventModel, &maxLevelSd);
+    int64_t *kmers = st_malloc(nbEvents * sizeof(int64_t));
+
+    for (int64_t y = 0; y < nbEvents; y++) {
+        double eventMean = signalSeeding_getEventMean(events, y);
+        int64_t hi = signalSeeding_lowerBound(sortedLevels, eventMean);
+        int64_t lo = hi - 1;
+        double bestDeviation = INFINITY;
+        int64_t best = -1;
+        // any kmer further than bestDeviation * maxLevelSd away can't be better than the best so far
+        while ((lo >= 0) && (eventMean - sortedLevels[lo].levelMean <= bestDeviation * maxLevelSd)) {
+            double d = signalSeeding_getDeviation(eventModel, sortedLevels[lo].kmerIndex, eventMean);
+            if (d < bestDeviation) {
+                bestDeviation = d;
+                best = sortedLevels[lo].kmerIndex;
+            }
+            lo--;
+        }
+        while ((hi < NUM_OF_KMERS) && (sortedLevels[hi].levelMean - eventMean <= bestDeviation * maxLevelSd)) {
+            double d = signalSeeding_getDeviation(eventModel, sortedLevels[hi].kmerIndex, eventMean);
+            if (d < bestDeviation) {
+                bestDeviation = d;
+                best = sortedLevels[hi].kmerIndex;
+            }
+            hi++;
+        }
+        kmers[y] = best;
+    }
+    free(sortedLevels);
+    return kmers;
+}
+
+static stList *signalSeeder_getSeedHits(SignalSeeder *seeder, float *events, int64_t nbEvents,
+                                       SignalSeedingParameters *sp) {
+    const double *eventModel = seeder->eventModel;
+    stList *seedHits = stList_construct3(0, (void (*)(void *)) stIntTuple_destruct);
+    int64_t *candidates = st_malloc(sp->maxCandidatesPerEvent * sizeof(int64_t));
+
+    for (int64_t y = 0; y < nbEvents; y++) {
+        double eventMean = signalSeeding_getEventMean(events, y);
+        double previousMean = y > 0 ? signalSeeding_getEventMean(events, y - 1) : 0.0;
+        int64_t nbCandidates = signalSeeding_getCandidateKmers(eventModel, seeder->sortedLevels,
+                                                               seeder->maxLevelSd, eventMean, sp->maxDeviation,
+                                                               sp->maxCandidatesPerEvent, candidates);
+        for (int64_t c = 0; c < nbCandidates; c++) {
+            int64_t kmerIndex = candidates[c];
+            int64_t start = seeder->kmerStarts[kmerIndex];
+            int64_t end = seeder->kmerStarts[kmerIndex + 1];
+            if (end - start > sp->maxKmerOccurrences) {
+                continue;
+            }
+            for (int64_t i = start; i < end; i++) {
+                int64_t x = seeder->kmerPositions[i];
+                // only start seeds that can't be extended to the left, the others are part of an earlier seed
+                if ((y > 0) && ((signalSeeder_getDeviation(seeder, x, previousMean) <= sp->maxDeviation) ||
+                                ((x > 0) && (signalSeeder_getDeviation(seeder, x - 1, previousMean) <=
+                                             sp->maxDeviation)))) {
+                    continue;
+                }
+                int64_t xEnd, yEnd;
+                int64_t nbKmers = signalSeeder_extendSeed(seeder, events, nbEvents, x, y, sp, &xEnd, &yEnd, NULL);
+                if (nbKmers >= sp->minSeedLength) {
+                    stList_append(seedHits, stIntTuple_construct5(x, y, xEnd, yEnd, nbKmers));
+                }
+            }
+        }
+    }
+    free(candidates);
+
+    stList_sort(seedHits, (int (*)(const void *, const void *)) stIntTuple_cmpFn);
+    return seedHits;
+}
+
+stList *signalSeeding_getSeedHits(const double *eventModel, const char *reference, float *events,
+                                  int64_t nbEvents, SignalSeedingParameters *sp) {
+    SignalSeeder *seeder = signalSeeder_construct(eventModel, reference);
+    stList *seedHits = signalSeeder_getSeedHits(seeder, events, nbEvents, sp);
+    signalSeeder_destruct(seeder);
+    return seedHits;
+}
+
+stList *signalSeeding_chainSeedHits(stList *seedHits, SignalSeedingParameters *sp) {
+    int64_t nbSeeds = stList_length(seedHits);
+    stList *chain = stList_construct();
+    if (nbSeeds == 0) {
+        return chain;
+    }
+    double *scores = st_malloc(nbSeeds * sizeof(double));
+    int64_t *previous = st_malloc(nbSeeds * sizeof(int64_t));
+    int64_t best = 0;
+
+    // seeds are sorted by xStart, so only earlier seeds can precede a seed in the chain. Moving between
+    // seeds off the diagonal costs chainGapPenalty per unit of |dx - dy|
+    for (int64_t j = 0; j < nbSeeds; j++) {
+        stIntTuple *seedJ = stList_get(seedHits, j);
+        int64_t xJ = stIntTuple_get(seedJ, 0), yJ = stIntTuple_get(seedJ, 1);
+        scores[j] = stIntTuple_get(seedJ, 4);
+        previous[j] = -1;
+        for (int64_t i = 0; i < j; i++) {
+            stIntTuple *seedI = stList_get(seedHits, i);
+            int64_t xI = stIntTuple_get(seedI, 2), yI = stIntTuple_get(seedI, 3);
+            if ((xI >= xJ) || (yI >= yJ)) {
+                continue;
+            }
+            double score = scores[i] + stIntTuple_get(seedJ, 4) - sp->chainGapPenalty * llabs((xJ - xI) - (yJ - yI));
+            if (score > scores[j]) {
+                scores[j] = score;
+                previous[j] = i;
+            }
+        }
+        if (scores[j] > scores[best]) {
+            best = j;
+        }
+    }
+    for (int64_t i = best; i != -1; i = previous[i]) {
+        stList_append(chain, stList_get(seedHits, i));
+    }
+    stList_reverse(chain);
+
+    free(scores);
+    free(previous);
+    return chain;
+}
+
+stList *signalSeeding_getAnchorPairs(const double *eventModel, const char *reference, float *events,
+                                     int64_t nbEvents, SignalSeedingParameters *sp) {
+    SignalSeeder *seeder = signalSeeder_construct(eventModel, reference);
+    stList *seedHits = signalSeeder_getSeedHits(seeder, events, nbEvents, sp);
+    stList *chain = signalSeeding_chainSeedHits(seedHits, sp);
+
+    stList *unfilteredAnchorPairs = stList_construct3(0, (void (*)(void *)) stIntTuple_destruct);
+    for (int64_t i = 0; i < stList_length(chain); i++) {
+        stIntTuple *seed = stList_get(chain, i);
+        stList *seedAnchors = stList_construct3(0, (void (*)(void *)) stIntTuple_destruct);
+        int64_t xEnd, yEnd;
+        signalSeeder_extendSeed(seeder, events, nbEvents, stIntTuple_get(seed, 0), stIntTuple_get(seed, 1), sp,
+                                &xEnd, &yEnd, seedAnchors);
+        // trim the ends of the seed, they are the least reliable part
+        for (int64_t j = sp->seedTrim; j < stList_length(seedAnchors) - sp->seedTrim; j++) {
+            stIntTuple *pair = stList_get(seedAnchors, j);
+            stList_append(unfilteredAnchorPairs,
+                          stIntTuple_construct2(stIntTuple_get(pair, 0), stIntTuple_get(pair, 1)));
+        }
+        stList_destruct(seedAnchors);
+    }
+    signalSeeder_destruct(seeder);
+
+    stList_sort(unfilteredAnchorPairs, (int (*)(const void *, const void *)) stIntTuple_cmpFn);
+    stList *anchorPairs = filterToRemoveOverlap(unfilteredAnchorPairs);
+
+    // cleanup
+    stList_destruct(unfilteredAnchorPairs);
+    stList_destruct(chain);
+    stList_destruct(seedHits);
+    return anchorPairs;
+}
@@ -140,7 +140,7 @@ int64_t emissions_discrete_getKmerIndex(void *kmer) {
 
 int64_t emissions_discrete_getKmerIndexFromKmer(void *kmer) {
     // make temp kmer meant to work with getKmer
-    char *kmer_i = malloc((KMER_LENGTH) * sizeof(char));
+    char kmer_i[KMER_LENGTH + 1];
     for (int64_t x = 0; x < KMER_LENGTH; x++) {
         kmer_i[x] = *((char *)kmer+x);
     }
@@ -148,7 +148,6 @@ int64_t emissions_discrete_getKmerIndexFromKmer(void *kmer) {
 
     int64_t i = emissions_discrete_getKmerIndex(kmer_i);
     //index_check(i);
-    free(kmer_i);
     return i;
 }
 
@@ -206,8 +205,8 @@ static inline void emissions_vanilla_initializeEmissionsMatrices(StateMachine *s
     sM->EMISSION_GAP_X_PROBS = st_malloc(nbSkipParams * sizeof(double));
 
     // both the Iy and M - type states use the event/kmer match model so the matrices need to be the same size
-    sM->EMISSION_GAP_Y_PROBS = st_malloc(1 + (sM->parameterSetSize * MODEL_PARAMS) * sizeof(double));
-    sM->EMISSION_MATCH_PROBS = st_malloc(1 + (sM->parameterSetSize * MODEL_PARAMS) * sizeof(double));
+    sM->EMISSION_GAP_Y_PROBS = st_malloc((1 + (sM->parameterSetSize * MODEL_PARAMS)) * sizeof(double));
+    sM->EMISSION_MATCH_PROBS = st_malloc((1 + (sM->parameterSetSize * MODEL_PARAMS)) * sizeof(double));
 }
 
 static inline void emissions_signal_initMatchMatrixToZero(double *matchModel, int64_t parameterSetSize) {
@@ -479,7 +478,7 @@ double emissions_signal_logGaussMatchProb(const double *eventModel, void *kmer,
     kmer_i[KMER_LENGTH] = '\0';
 
     // get event mean, and kmer index
-    double eventMean = *(double *) event;
+    double eventMean = nanopore_getEventMean(event);
     int64_t kmerIndex = emissions_discrete_getKmerIndex(kmer_i);
     double l_inv_sqrt_2pi = log(0.3989422804014327); // constant
     double modelMean = emissions_signal_getModelLevelMean(eventModel, kmerIndex);
@@ -505,8 +504,8 @@ double emissions_signal_getEventMatchProbWithTwoDists(const double *eventModel,
     kmer_i[KMER_LENGTH] = '\0';
 
     // get event mean, and noise
-    double eventMean = *(double *) event;
-    double eventNoise = *(double *) ((char *)event + sizeof(double));
+    double eventMean = nanopore_getEventMean(event);
+    double eventNoise = nanopore_getEventNoise(event);
 
     // get the kmer index
     int64_t kmerIndex = emissions_discrete_getKmerIndex(kmer_i);
@@ -549,15 +548,15 @@ double emissions_signal_multipleKmerMatchProb(const double *eventModel, void *km
 }
 
 double emissions_signal_getDurationProb(void *event, int64_t n) {
-    double duration = *(double *) ((char *)event + (2 * sizeof(double)));
+    double duration = nanopore_getEventDuration(event);
     return emissions_signal_poissonPosteriorProb(n, duration);
 }
 
 double emissions_signal_getBivariateGaussPdfMatchProb(const double *eventModel, void *kmer, void *event) {
     // this is meant to work with getKmer2
     // wrangle event data
-    double eventMean = *(double *) event;
-    double eventNoise = *(double *) ((char*)event + sizeof(double)); // aaah pointers
+    double eventMean = nanopore_getEventMean(event);
+    double eventNoise = nanopore_getEventNoise(event);
 
     // correlation coefficient is the 0th member of the event model
     double p = eventModel[0];
@@ -595,8 +594,8 @@ double emissions_signal_getBivariateGaussPdfMatchProb(const double *eventModel,
 double emissions_signal_strawManGetKmerEventMatchProb(const double *eventModel, void *kmer, void *event) {
     // this is meant to work with getKmer (NOT getKmer2)
     // wrangle event data
-    double eventMean = *(double *) event;
-    double eventNoise = *(double *) ((char *)event + sizeof(double)); // aaah pointers
+    double eventMean = nanopore_getEventMean(event);
+    double eventNoise = nanopore_getEventNoise(event);
 
     // make temp kmer
     char *kmer_i = malloc((KMER_LENGTH) * sizeof(char));
@@ -1784,6 +1783,9 @@ StateMachine *getStateMachineEchelon(const char *modelFile) {
 }
 
 void stateMachine_destruct(StateMachine *stateMachine) {
+    free(stateMachine->EMISSION_MATCH_PROBS);
+    free(stateMachine->EMISSION_GAP_X_PROBS);
+    free(stateMachine->EMISSION_GAP_Y_PROBS);
     free(stateMachine);
 }
 
@@ -0,0 +1,138 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <inttypes.h>
+#include "sonLib.h"
+#include "threadPool.h"
+
+typedef struct _threadPoolJob {
+    void (*fn)(void *workspace, void *arg);
+    void *arg;
+} ThreadPoolJob;
+
+struct _threadPool {
+    int64_t nbThreads;
+    pthread_t *threads;
+    pthread_mutex_t lock;
+    pthread_cond_t notEmpty;
+    pthread_cond_t notFull;
+    pthread_cond_t idle;
+    bool finished;
+    int64_t running; // jobs taken by a worker and not finished yet
+
+    void *(*workspaceConstructFn)(void *workspaceArg);
+    void (*workspaceDestructFn)(void *workspace);
+    void *workspaceArg;
+
+    // ring of pending jobs
+    int64_t maxPending;
+    int64_t first;
+    int64_t pending;
+    ThreadPoolJob *jobs;
+};
+
+static void *threadPool_worker(void *arg) {
+    ThreadPool *pool = arg;
+    void *workspace = pool->workspaceConstructFn == NULL ? NULL : pool->workspaceConstructFn(pool->workspaceArg);
+    pthread_mutex_lock(&pool->lock);
+    while (1) {
+        while (pool->pending == 0 && !pool->finished) {
+            pthread_cond_wait(&pool->notEmpty, &pool->lock);
+        }
+        if (pool->pending == 0) { // finished and nothing left
+            break;
+        }
+        ThreadPoolJob job = pool->jobs[pool->first];
+        pool->first = (pool->first + 1) % pool->maxPending;
+        pool->pending--;
+        pool->running++;
+        pthread_cond_signal(&pool->notFull);
+        pthread_mutex_unlock(&pool->lock);
+        job.fn(workspace, job.arg);
+        pthread_mutex_lock(&pool->lock);
+        pool->running--;
+        if (pool->pending == 0 && pool->running == 0) {
+            pthread_cond_broadcast(&pool->idle);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    if (pool->workspaceDestructFn != NULL) {
+        pool->workspaceDestructFn(workspace);
+    }
+    return NULL;
+}
+
+ThreadPool *threadPool_construct(int64_t nbThreads, int64_t maxPending,
+                                 void *(*workspaceConstructFn)(void *workspaceArg),
+                                 void (*workspaceDestructFn)(void *workspace), void *workspaceArg) {
+    if (nbThreads < 1 || maxPending < 1) {
+        st_errAbort("threadPool: need at least one thread and one pending job, got %" PRIi64 " and %" PRIi64 "\n",
+                    nbThreads, maxPending);
+    }
+    ThreadPool *pool = st_malloc(sizeof(ThreadPool));
+    pool->nbThreads = nbThreads;
+    pool->finished = FALSE;
+    pool->running = 0;
+    pool->workspaceConstructFn = workspaceConstructFn;
+    pool->workspaceDestructFn = workspaceDestructFn;
+    pool->workspaceArg = workspaceArg;
+    pool->maxPending = maxPending;
+    pool->first = 0;
+    pool->pending = 0;
+    pool->jobs = st_malloc(maxPending * sizeof(ThreadPoolJob));
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->notEmpty, NULL);
+    pthread_cond_init(&pool->notFull, NULL);
+    pthread_cond_init(&pool->idle, NULL);
+    pool->threads = st_malloc(nbThreads * sizeof(pthread_t));
+    for (int64_t i = 0; i < nbThreads; i++) {
+        if (pthread_create(&pool->threads[i], NULL, threadPool_worker, pool) != 0) {
+            st_errAbort("threadPool: couldn't start worker thread %" PRIi64 "\n", i);
+        }
+    }
+    return pool;
+}
+
+void threadPool_push(ThreadPool *pool, void (*fn)(void *workspace, void *arg), void *arg) {
+    pthread_mutex_lock(&pool->lock);
+    while (pool->pending == pool->maxPending) {
+        pthread_cond_wait(&pool->notFull, &pool->lock);
+    }
+    int64_t i = (pool->first + pool->pending) % pool->maxPending;
+    pool->jobs[i].fn = fn;
+    pool->jobs[i].arg = arg;
+    pool->pending++;
+    pthread_cond_signal(&pool->notEmpty);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void threadPool_wait(ThreadPool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    while (pool->pending > 0 || pool->running > 0) {
+        pthread_cond_wait(&pool->idle, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void threadPool_destruct(ThreadPool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->finished = TRUE;
+    pthread_cond_broadcast(&pool->notEmpty);
+    pthread_mutex_unlock(&pool->lock);
+    for (int64_t i = 0; i < pool->nbThreads; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->notEmpty);
+    pthread_cond_destroy(&pool->notFull);
+    pthread_cond_destroy(&pool->idle);
+    free(pool->threads);
+    free(pool->jobs);
+    free(pool);
+}
+
+int64_t threadPool_getNumberOfThreads(ThreadPool *pool) {
+    return pool->nbThreads;
+}
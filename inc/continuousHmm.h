@@ -30,12 +30,28 @@ typedef struct _hdpHmm {
     double *transitions;
     double threshold;
     void (*addToAssignments)(Hmm *, void *, void *);
-    stList *eventAssignments;
-    stList *kmerAssignments;
+    // the assignments are copied into arrays that grow by doubling, so they don't depend on the memory of the reads
+    float *eventAssignments; // event mean of each assignment
+    char *kmerAssignments;   // KMER_LENGTH characters per assignment, not '\0' terminated
     int64_t numberOfAssignments;
+    int64_t maxAssignments;
     NanoporeHDP *nhdp;
 } HdpHmm;
 
+// Binary expectations layout, all little-endian and every block starting at a multiple of 8 bytes
+//     char magic[4] "cPEX", int32 version, int32 type, int32 kmer length,
+//     int64 stateNumber, int64 symbolSetSize, int64 # of expectations, int64 # of parameters,
+//     int64 # of assignments, double threshold, double likelihood,
+//     double expectations[# of expectations] (summed when files are merged),
+//         threeState: transitions then individual kmer gap probs, vanilla: kmer skip bins,
+//         threeStateHdp: transitions
+//     double parameters[# of parameters] (taken from the first file when files are merged),
+//         vanilla: match model then scaled match model, none for the other types
+//     float assignment events[# of assignments] (zero padded to a multiple of 8),
+//     char assignment kmers[# of assignments * kmer length] (zero padded to a multiple of 8)
+#define HMM_EXPECTATIONS_BINARY_MAGIC "cPEX"
+#define HMM_EXPECTATIONS_BINARY_VERSION 1
+
 Hmm *continuousPairHmm_constructEmpty(
         double pseudocount, int64_t stateNumber, int64_t symbolSetSize, StateMachineType type,
         void (*addToTransitionExpFcn)(Hmm *hmm, int64_t from, int64_t to, double p),
@@ -108,19 +124,77 @@ void hdpHmm_writeToFile(Hmm *hmm, FILE *fileHandle);
 Hmm *hdpHmm_loadFromFile(const char *fileName, NanoporeHDP *ndhp);
 Hmm *hdpHmm_loadFromFile2(const char *fileName, NanoporeHDP *nHdp);
 
+// replaces the data of the HDP with the assignments (event means and kmers) of the HMM
+void hdpHmm_passAssignmentsToHdp(Hmm *hmm, NanoporeHDP *nHdp);
+
 void hdpHmm_destruct(Hmm *hmm);
 
 // CORE
 void hmmContinuous_loadSignalHmm(const char *hmmFile, StateMachine *sM, StateMachineType type);
 
+// the two halves of hmmContinuous_loadSignalHmm, so an HMM can be read once and loaded into many stateMachines
+Hmm *hmmContinuous_loadSignalHmmFromFile(const char *fileName, StateMachineType type);
+
+void hmmContinuous_loadExpectations(StateMachine *sM, Hmm *hmm, StateMachineType type);
+
 void hmmContinuous_destruct(Hmm *hmm, StateMachineType type);
 
 Hmm *hmmContinuous_getEmptyHmm(StateMachineType type, double pseudocount, double threshold);
 
 void hmmContinuous_normalize(Hmm *hmm, StateMachineType type);
 
+// adds the expectations and the likelihood of other to hmm (the vanilla match models are copied), for the HDP HMM
+// the assignments of other are appended
+void hmmContinuous_addExpectations(Hmm *hmm, Hmm *other, StateMachineType type);
+
+// M-step of the training, normalizes summed expectations the way the training scripts always have: the vanilla kmer
+// skip bins are normalized per half (alpha and beta), the other HMMs with hmmContinuous_normalize
+void hmmContinuous_maximize(Hmm *hmm, StateMachineType type);
+
+// hmm_squaremExtrapolate of the trained parameters of hmm0, hmm1 = EM(hmm0) and hmm2 = EM(hmm1) into out, which is
+// then maximized (the vanilla match models and HDP assignments of out are left as they are). The extrapolated HMM
+// can have a lower likelihood than hmm2, callers check it before keeping it. Returns alpha
+double hmmContinuous_squaremExtrapolate(Hmm *hmm0, Hmm *hmm1, Hmm *hmm2, Hmm *out, StateMachineType type);
+
+// a SQUAREM cycle of in-process training: two EM steps hmm0 -> hmm1 -> hmm2, then an EM step from their
+// extrapolation, which is kept if its likelihood is at least the one of hmm1 (otherwise training goes on from hmm2)
+typedef struct _hmmSquaremCycle {
+    int64_t step; // the EM steps of the cycle done, 0 when there is no cycle
+    Hmm *hmms[3];
+    double likelihood; // of hmm1
+    double alpha; // of the extrapolation, once there is one
+    bool rejected; // the extrapolation lowered the likelihood, set by the last step
+} HmmSquaremCycle;
+
+// starts a cycle from (a copy of) hmm0
+void hmmContinuous_squaremStart(HmmSquaremCycle *cycle, Hmm *hmm0, StateMachineType type);
+
+// goes on with the cycle after an EM step, hmm the HMM it trained and likelihood the one of the HMM it started
+// from. Takes hmm and returns the HMM the next EM step starts from: hmm after the first step, the extrapolation
+// after the second and hmm or hmm2 after the third, which ends the cycle. Not for the HDP models
+Hmm *hmmContinuous_squaremStep(HmmSquaremCycle *cycle, Hmm *hmm, double likelihood, StateMachineType type);
+
+// stepwise EM update of running expectations: hmm = (1 - stepSize) hmm + stepSize * scale * other for the trained
+// expectations and the likelihood, scale brings the expectations of a mini-batch to the unit of the running ones
+// (e.g. 1 / number of reads). The vanilla match models of other are copied, the HDP assignments are left alone
+void hmmContinuous_blendExpectations(Hmm *hmm, Hmm *other, double stepSize, double scale, StateMachineType type);
+
+// the update-th (from 0) update of stepwise EM: blends the expectations of a mini-batch of nbReads reads, per read,
+// into the running ones with step size hmm_stepwiseEmStepSize(update, stepSizeDecay), then returns a new HMM
+// maximized from a copy of them. Not for the HDP models
+Hmm *hmmContinuous_stepwiseEmUpdate(Hmm *running, Hmm *expectations, int64_t nbReads, int64_t update,
+                                    double stepSizeDecay, StateMachineType type);
+
 void hmmContinuous_writeToFile(const char *outFile, Hmm *hmm, StateMachineType type);
 
+// writes the expectations in the binary layout, the loaders above take either layout
+void hmmContinuous_writeToBinaryFile(const char *outFile, Hmm *hmm, StateMachineType type);
+
+// sums the expectations and likelihoods of binary expectation files and concatenates their assignments in file
+// order, files with NaN expectations are skipped. The files are read by up to nbThreads threads, each summing a
+// contiguous slice, and the slices are added in order so the result only depends on nbThreads
+Hmm *hmmContinuous_mergeBinaryExpectations(char **files, int64_t nbFiles, int64_t nbThreads);
+
 int64_t hmmContinuous_howManyAssignments(Hmm *hmm);
 
 #endif
@@ -31,12 +31,44 @@ void hmmDiscrete_addToEmissionExpectation(Hmm *hmm, int64_t state, int64_t x, in
 void hmmDiscrete_setEmissionExpectation(Hmm *hmm, int64_t state, int64_t x, int64_t y, double p);
 double hmmDiscrete_getEmissionExpectation(Hmm *hmm, int64_t state, int64_t x, int64_t y);
 
+// Merging
+// empty HMM with the dimensions, type and functions of hmm and no pseudocounts, so that each job (or thread) collects
+// expectations in its own HMM, the clones are then added to hmm in a fixed order so the sums don't depend on the
+// scheduling
+Hmm *hmmDiscrete_getEmptyClone(Hmm *hmm);
+
+// adds the expectations and likelihood of other (e.g. collected by another thread) to hmm
+void hmmDiscrete_addExpectations(Hmm *hmm, Hmm *other);
+
 // Randomize/Normalize
 void hmmDiscrete_randomizeTransitions(Hmm *hmm);
 void hmmDiscrete_randomizeEmissions(Hmm *hmm);
 void hmmDiscrete_randomize(Hmm *hmmD);
 void hmmDiscrete_normalize(Hmm *hmmD);
 void hmmDiscrete_normalize2(Hmm *hmm, bool normalizeEmissions);
+
+// extrapolated parameters are floored at this before they are normalized again
+#define HMM_SQUAREM_MIN_PARAMETER 1e-10
+
+// SQUAREM (Varadhan and Roland, 2008) extrapolation of two EM steps over the parameter arrays of an HMM:
+// parameters[1] = EM(parameters[0]), parameters[2] = EM(parameters[1]), each with nbArrays arrays of the given
+// lengths. Writes p0 - 2 alpha r + alpha^2 v into parameters[3] (r = p1 - p0, v = p2 - 2 p1 + p0,
+// alpha = -|r|/|v| and at most -1, so the step is never shorter than p2), floored at HMM_SQUAREM_MIN_PARAMETER.
+// The caller normalizes them. Returns alpha
+double hmm_squaremExtrapolate(double **parameters[4], int64_t *lengths, int64_t nbArrays);
+
+// step size of the k-th (from 0) update of stepwise EM (Liang and Klein, 2009), (k + 2)^-decay with decay in
+// (0.5, 1], smaller decays forget the early mini-batches faster
+double hmm_stepwiseEmStepSize(int64_t k, double decay);
+
+// hmm_squaremExtrapolate of the transitions and emissions of hmm0, hmm1 = EM(hmm0) and hmm2 = EM(hmm1) into out,
+// which is then normalized. Returns alpha
+double hmmDiscrete_squaremExtrapolate(Hmm *hmm0, Hmm *hmm1, Hmm *hmm2, Hmm *out);
+
+// stepwise EM update of running expectations: hmm = (1 - stepSize) hmm + stepSize * scale * other for the
+// transitions, emissions and likelihood, scale brings the expectations of a mini-batch to the unit of the running
+// ones (e.g. 1 / number of pairs)
+void hmmDiscrete_blendExpectations(Hmm *hmm, Hmm *other, double stepSize, double scale);
 // Writers
 void hmmDiscrete_write(Hmm *hmmD, FILE *fileHandle);
 
@@ -105,4 +105,28 @@ double compare_hdp_distrs_hellinger_distance(HierarchicalDirichletProcess* hdp_1
 void serialize_hdp(HierarchicalDirichletProcess* hdp, FILE* out);
 HierarchicalDirichletProcess* deserialize_hdp(FILE* in);
 
+// binary layout, native doubles and int64s (little-endian only), every field 8 bytes apart
+//     char magic[4] "cPHD", int32 version,
+//     int64 splines finalized, has data, sample gamma, # of dps, depth, grid length, data length,
+//     double mu, nu, alpha, beta, grid start, grid stop,
+//     double gamma[depth], if sampling gamma also double gamma alpha[depth], gamma beta[depth], w[# of dps],
+//     int64 s[# of dps],
+//     int64 parent id[# of dps] (-1 for the base dp), int64 # of factor children[# of dps], int64 observed[# of dps],
+//     double posterior predictive[grid length] for each observed dp,
+//     if splines finalized double spline slopes[grid length] for each observed dp,
+//     if has data double data[data length], int64 dp id[data length], int64 # of factors, then factor records
+//     in pre-order, int64 type (0 base, 1 middle, 2 data point), int64 parent record (-1 for base factors) and
+//     double cached params[5] (base), int64 dp id (middle) or int64 data index (data point)
+#define HDP_BINARY_MAGIC "cPHD"
+#define HDP_BINARY_VERSION 1
+
+// note: writes at the current position of out, which has to be a multiple of 8
+void serialize_hdp_binary(HierarchicalDirichletProcess* hdp, FILE* out);
+// same layout without the data and factors, only for querying densities, processes that deserialize the same
+// file share the pages of the densities instead of each holding a copy
+void serialize_hdp_densities_binary(HierarchicalDirichletProcess* hdp, FILE* out);
+// mmaps filepath and reads the HDP starting at offset (a multiple of 8), the densities are used from the mapped
+// file directly and the data and factors are only parsed when something needs them (e.g. Gibbs sampling)
+HierarchicalDirichletProcess* deserialize_hdp_binary(const char* filepath, int64_t offset);
+
 #endif // HDP_H_INCLUDED
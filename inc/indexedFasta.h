@@ -0,0 +1,38 @@
+#ifndef INDEXED_FASTA_H
+#define INDEXED_FASTA_H
+
+#include "sonLib.h"
+#include "sonLibTypes.h"
+
+// Read-only access to the sequences of a FASTA file through a faidx index. The file is mmaped, so only the pages
+// of the regions that are asked for are read. The index is the samtools faidx one (fastaFile.fai): for each
+// sequence its name, length, offset of the first base, bases per line and bytes per line.
+
+typedef struct _indexedFasta IndexedFasta;
+
+// mmaps fastaFile and loads fastaFile.fai, if there is no index (or it is older than the file or its sequences
+// don't end where the file does) the file is scanned once to build it and the index is saved (when possible) for
+// the next process. A file without headers is one sequence named "" (the one line
+// sequence files written by the scripts). Repeated names keep the longest sequence
+IndexedFasta *indexedFasta_construct(const char *fastaFile);
+
+void indexedFasta_destruct(IndexedFasta *fasta);
+
+// writes the index in the faidx layout, aborts if a sequence has lines of different lengths
+void indexedFasta_writeIndex(IndexedFasta *fasta, const char *indexFile);
+
+int64_t indexedFasta_getNumberOfSequences(IndexedFasta *fasta);
+
+const char *indexedFasta_getSequenceName(IndexedFasta *fasta, int64_t ordinal);
+
+// returns -1 if there is no sequence with that name
+int64_t indexedFasta_getOrdinal(IndexedFasta *fasta, const char *name);
+
+int64_t indexedFasta_getSequenceLength(IndexedFasta *fasta, int64_t ordinal);
+
+// copies the bases [start, end) of a sequence, for the reverse strand the region is [end, start) (as in cigars)
+// and the copy is reverse complemented, upperCase normalizes soft-masked bases
+char *indexedFasta_getSubSequence(IndexedFasta *fasta, int64_t ordinal, int64_t start, int64_t end, bool strand,
+                                  bool upperCase);
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef JOB_SCHEDULER_H
+#define JOB_SCHEDULER_H
+
+#include "sonLib.h"
+#include "sonLibTypes.h"
+
+// Runs a batch of jobs of very different sizes on a fixed number of threads. Each job comes with an estimate of its
+// cost (e.g. the band area of an alignment, see getBandArea), the jobs are sorted most expensive first and dealt
+// round-robin to a deque per thread. A thread runs the jobs at the front of its own deque and, once it is empty,
+// steals from the back of the deque with the most cost left, so the expensive jobs start first and the cheap ones
+// fill in at the end instead of a few threads finishing long after the others.
+
+typedef struct _jobScheduler JobScheduler;
+
+JobScheduler *jobScheduler_construct(void);
+
+// adds fn(workspace, arg) to the batch
+void jobScheduler_add(JobScheduler *scheduler, void (*fn)(void *workspace, void *arg), void *arg, int64_t cost);
+
+int64_t jobScheduler_getNumberOfJobs(JobScheduler *scheduler);
+
+// runs the jobs added so far on nbThreads threads and returns once they have all finished, each thread calls
+// workspaceConstructFn(workspaceArg) once (both may be NULL) and workspaceDestructFn on its workspace at the end.
+// The scheduler is empty afterwards
+void jobScheduler_run(JobScheduler *scheduler, int64_t nbThreads,
+                      void *(*workspaceConstructFn)(void *workspaceArg),
+                      void (*workspaceDestructFn)(void *workspace), void *workspaceArg);
+
+// number of jobs the threads took from another thread's deque during the last run
+int64_t jobScheduler_getNumberOfSteals(JobScheduler *scheduler);
+
+void jobScheduler_destruct(JobScheduler *scheduler);
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef MEMORY_BUDGET_H
+#define MEMORY_BUDGET_H
+
+#include "sonLib.h"
+#include "sonLibTypes.h"
+
+// Caps the memory that jobs running at the same time may use. A job reserves its estimated peak (e.g.
+// getAlignedPairsUsingAnchorsPeakMemory) before it starts and releases it once done, a job that doesn't fit waits
+// for running jobs to release theirs. Reservations are granted in the order they were asked for, so a big job isn't
+// starved by a stream of small ones.
+
+typedef struct _memoryBudget MemoryBudget;
+
+// budget in bytes
+MemoryBudget *memoryBudget_construct(int64_t budget);
+
+// blocks until bytes fit in what is left of the budget and reserves them. A request for more than the whole budget
+// waits until nothing else is reserved and then runs alone. Returns the bytes reserved, to hand back to release
+int64_t memoryBudget_reserve(MemoryBudget *budget, int64_t bytes);
+
+void memoryBudget_release(MemoryBudget *budget, int64_t bytes);
+
+int64_t memoryBudget_getBudget(MemoryBudget *budget);
+
+// bytes reserved right now
+int64_t memoryBudget_getReserved(MemoryBudget *budget);
+
+// most bytes reserved at any one time
+int64_t memoryBudget_getPeakReserved(MemoryBudget *budget);
+
+// aborts if bytes are still reserved
+void memoryBudget_destruct(MemoryBudget *budget);
+
+#endif
@@ -3,6 +3,20 @@
 #include "sonLibTypes.h"
 #define NB_EVENT_PARAMS 3
 
+// Events are stored as NB_EVENT_PARAMS consecutive floats (mean, stdev, length) so that an event sequence element
+// is a single pointer (see sequence_getEvent). These read the parameters of the event an element points to.
+static inline double nanopore_getEventMean(const void *event) {
+    return ((const float *) event)[0];
+}
+
+static inline double nanopore_getEventNoise(const void *event) {
+    return ((const float *) event)[1];
+}
+
+static inline double nanopore_getEventDuration(const void *event) {
+    return ((const float *) event)[2];
+}
+
 typedef struct _nanoporeReadAdjustmentParameters {
     double scale;
     double shift;
@@ -20,19 +34,72 @@ typedef struct _nanoporeRead {
 
     char *twoDread; // dread indeed
 
-    int64_t *templateEventMap;
-    double *templateEvents; // mean, stdev, length
+    int32_t *templateEventMap;
+    float *templateEvents; // mean, stdev, length
 
-    int64_t *complementEventMap;
-    double *complementEvents;
+    int32_t *complementEventMap;
+    float *complementEvents;
     bool scaled;
+
+    void *mappedFile; // the arrays above point into this when the read was loaded from a binary npRead file
+    int64_t mappedFileLength;
 } NanoporeRead;
 
+// Binary npRead layout, all little-endian and every block starting at a multiple of 8 bytes
+//     char magic[4] "cPNR", int32 version,
+//     int64 2D read length, int64 # of template events, int64 # of complement events,
+//     double template scale, shift, var, scale_sd, var_sd, double complement scale, shift, var, scale_sd, var_sd,
+//     char 2D read[read length + 1] ('\0' terminated, zero padded to a multiple of 8),
+//     int32 template event map[read length] (zero padded to a multiple of 8),
+//     float template events[# of template events * NB_EVENT_PARAMS] (zero padded to a multiple of 8),
+//     then the same two blocks for the complement
+#define NANOPORE_READ_BINARY_MAGIC "cPNR"
+#define NANOPORE_READ_BINARY_VERSION 2
+
+// loads a text or a binary npRead file, binary files are mmaped and not parsed
 NanoporeRead *nanopore_loadNanoporeReadFromFile(const char *nanoporeReadFile);
 
-stList *nanopore_remapAnchorPairs(stList *anchorPairs, int64_t *eventMap);
+// writes the read in the binary npRead layout, the events have to be scaled (as loaded)
+void nanopore_writeNanoporeReadToBinaryFile(NanoporeRead *npRead, const char *binaryNanoporeReadFile);
+
+// npRead archive, many reads in one file so they can be opened once and fetched by name or ordinal
+//     char magic[4] "cPNA", int32 version, int64 # of reads, int64 offset of the index,
+//     binary npRead records (the layout above) one after the other,
+//     index, for each read int64 offset of the record, int64 length of the record, int64 name length,
+//     char name[name length + 1] ('\0' terminated, zero padded to a multiple of 8)
+#define NANOPORE_READ_ARCHIVE_MAGIC "cPNA"
+#define NANOPORE_READ_ARCHIVE_VERSION 1
+
+typedef struct _nanoporeReadArchiveWriter NanoporeReadArchiveWriter;
+
+NanoporeReadArchiveWriter *nanoporeReadArchiveWriter_construct(const char *archiveFile);
+
+// appends the read, read names have to be unique
+void nanoporeReadArchiveWriter_add(NanoporeReadArchiveWriter *writer, const char *readName, NanoporeRead *npRead);
+
+// writes the index and closes the archive
+void nanoporeReadArchiveWriter_destruct(NanoporeReadArchiveWriter *writer);
+
+typedef struct _nanoporeReadArchive NanoporeReadArchive;
+
+// mmaps the archive and loads the index
+NanoporeReadArchive *nanoporeReadArchive_construct(const char *archiveFile);
+
+void nanoporeReadArchive_destruct(NanoporeReadArchive *archive);
+
+int64_t nanoporeReadArchive_getNumberOfReads(NanoporeReadArchive *archive);
+
+const char *nanoporeReadArchive_getReadName(NanoporeReadArchive *archive, int64_t ordinal);
+
+// returns a copy of the read (destruct with nanopore_nanoporeReadDestruct)
+NanoporeRead *nanoporeReadArchive_getRead(NanoporeReadArchive *archive, int64_t ordinal);
+
+// same, returns NULL if there is no read with that name
+NanoporeRead *nanoporeReadArchive_getReadByName(NanoporeReadArchive *archive, const char *readName);
+
+stList *nanopore_remapAnchorPairs(stList *anchorPairs, int32_t *eventMap);
 
-stList *nanopore_remapAnchorPairsWithOffset(stList *unmappedPairs, int64_t *eventMap, int64_t mapOffset);
+stList *nanopore_remapAnchorPairsWithOffset(stList *unmappedPairs, int32_t *eventMap, int64_t mapOffset);
 
 void nanopore_descaleNanoporeRead(NanoporeRead *npRead);
 
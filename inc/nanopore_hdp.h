@@ -55,6 +55,13 @@ void update_nhdp_from_alignment(NanoporeHDP* nhdp, const char* alignment_filepat
 void update_nhdp_from_alignment_with_filter(NanoporeHDP* nhdp, const char* alignment_filepath,
                                             bool has_header, const char* strand_filter);
 
+// alignments are parsed in chunks of about this many bytes, one chunk per thread at a time
+#define ALIGNMENT_CHUNK_LENGTH (1 << 22)
+
+// update_nhdp_from_alignment_with_filter splitting the file in chunks of about chunk_length bytes at line starts
+void update_nhdp_from_alignment_in_chunks(NanoporeHDP* nhdp, const char* alignment_filepath, bool has_header,
+                                          const char* strand_filter, int64_t chunk_length);
+
 // computing metrics on distributions
 
 double get_kmer_distr_distance(NanoporeDistributionMetricMemo* memo, char* kmer_1, char* kmer_2);
@@ -125,7 +132,18 @@ NanoporeHDP* middle_2_nts_hdp_model_2(const char* alphabet, int64_t alphabet_siz
                                       int64_t sampling_grid_length, const char* model_filepath);
 
 
+// binary layout, char magic[4] "cPNH", int32 version, int64 alphabet size, int64 kmer length,
+// char alphabet[alphabet size + 1] ('\0' terminated, zero padded to a multiple of 8), then the HDP in the
+// binary layout from hdp.h
+#define NANOPORE_HDP_BINARY_MAGIC "cPNH"
+#define NANOPORE_HDP_BINARY_VERSION 1
+
 void serialize_nhdp(NanoporeHDP* nhdp, const char* filepath);
+void serialize_nhdp_binary(NanoporeHDP* nhdp, const char* filepath);
+// only the finalized densities (see serialize_hdp_densities_binary), enough for get_nanopore_kmer_density, any
+// number of processes can map the file and share one copy of the densities
+void serialize_nhdp_densities_binary(NanoporeHDP* nhdp, const char* filepath);
+// reads either layout, binary files are mmaped (see deserialize_hdp_binary)
 NanoporeHDP* deserialize_nhdp(const char* filepath);
 
 void nanoporeHdp_buildNanoporeHdpFromAlignment(NanoporeHdpType type,
@@ -0,0 +1,24 @@
+#ifndef OUTPUT_QUEUE_H
+#define OUTPUT_QUEUE_H
+
+#include <stdio.h>
+#include "sonLib.h"
+#include "sonLibTypes.h"
+
+// Single writer for output shared by several threads. The threads format their output into memory buffers and
+// push them, a dedicated writer thread appends the buffers to the file in the order they were pushed, one
+// fwrite each, so the contents of a buffer are never interleaved with output from another thread.
+
+typedef struct _outputQueue OutputQueue;
+
+// opens file for appending and starts the writer thread, at most maxPending buffers wait to be written
+OutputQueue *outputQueue_construct(const char *file, bool binary, int64_t maxPending);
+
+// hands buffer (malloced, freed by the queue once written) to the writer, only blocks if maxPending buffers
+// are already waiting
+void outputQueue_push(OutputQueue *queue, char *buffer, int64_t length);
+
+// writes the remaining buffers, stops the writer thread and closes the file
+void outputQueue_destruct(OutputQueue *queue);
+
+#endif
@@ -25,6 +25,9 @@ extern const char *PAIRWISE_ALIGNMENT_EXCEPTION_ID;
 //Constant that gives the integer value equal to probability 1. Integer probability zero is always 0.
 #define PAIR_ALIGNMENT_PROB_1 10000000
 
+//The expectationsThreshold the drivers train with, transitions less likely than this add nothing to the expectations
+#define EXPECTATIONS_THRESHOLD 1e-10
+
 //Sequence
 typedef enum {
     nucleotide=0,
@@ -39,6 +42,11 @@ struct _sequence {
     void *elements;
     void *(*get)(void *elements, int64_t index);
     Sequence *(*sliceFcn)(Sequence *, int64_t, int64_t);
+    // element indices (Hmm getElementIndexFcn) cached by the expectation calculation, the index of position i is at
+    // elementIndices[i + 1] so that the -1 position before the sequence has one too. NULL until needed
+    int64_t *elementIndices;
+    // the getElementIndexFcn the elementIndices were computed with, they are reset when another one is used
+    int64_t (*elementIndexFcn)(void *);
 };
 
 /*
@@ -88,12 +96,48 @@ typedef struct _pairwiseAlignmentBandingParameters {
     int64_t splitMatrixBiggerThanThis; //Any matrix in the anchors bigger than this is split into two.
     bool alignAmbiguityCharacters;
     float gapGamma; //The AMAP gap-gamma parameter which controls the degree to which indel probabilities are factored into the alignment.
+    double expectationsThreshold; //Transitions with a smaller posterior probability are left out of the expectations, 0 (the default) keeps all
+    double expectationsPruning; //Cells under this fraction of the best posterior of their diagonal are left out of the expectations, 0 keeps all
 } PairwiseAlignmentParameters;
 
 PairwiseAlignmentParameters *pairwiseAlignmentBandingParameters_construct();
 
 void pairwiseAlignmentBandingParameters_destruct(PairwiseAlignmentParameters *p);
 
+/*
+ * Growable struct-of-arrays store of posterior match probabilities. Entry i is the aligned pair
+ * (probs[i], x[i], y[i]), the same triple as the stIntTuple (prob, x, y) form used by the stList functions.
+ */
+typedef struct _alignedPairBuffer {
+    int64_t length;
+    int64_t maxLength;
+    int64_t *probs;
+    int64_t *x;
+    int64_t *y;
+} AlignedPairBuffer;
+
+AlignedPairBuffer *alignedPairBuffer_construct(int64_t initialLength);
+
+void alignedPairBuffer_destruct(AlignedPairBuffer *alignedPairs);
+
+void alignedPairBuffer_clear(AlignedPairBuffer *alignedPairs);
+
+void alignedPairBuffer_add(AlignedPairBuffer *alignedPairs, int64_t prob, int64_t x, int64_t y);
+
+// appends the pairs in otherAlignedPairs to alignedPairs, shifting their coordinates by the offsets
+void alignedPairBuffer_appendWithOffset(AlignedPairBuffer *alignedPairs, AlignedPairBuffer *otherAlignedPairs,
+                                        int64_t offsetX, int64_t offsetY);
+
+// same order as stList_sort with sortByXPlusYCoordinate2, ties are kept in insertion order
+void alignedPairBuffer_sortByXPlusYCoordinate(AlignedPairBuffer *alignedPairs);
+
+double alignedPairBuffer_totalScore(AlignedPairBuffer *alignedPairs);
+
+// converters to/from the list of stIntTuple (prob, x, y) form
+stList *alignedPairBuffer_toList(AlignedPairBuffer *alignedPairs);
+
+AlignedPairBuffer *alignedPairBuffer_fromList(stList *alignedPairsList);
+
 /*
  * Gets the set of posterior match probabilities under a simple HMM model of alignment for two DNA sequences.
  */
@@ -169,6 +213,13 @@ Band *band_construct(stList *anchorPairs, int64_t lX, int64_t lY,
 
 void band_destruct(Band *band);
 
+// number of cells in the band, the work of a banded alignment grows with it
+int64_t band_getArea(Band *band);
+
+// band area of an alignment of sequences of lengths lX and lY with these anchors, estimates the cost of the
+// alignment before doing it (e.g. to schedule the longest alignments first)
+int64_t getBandArea(stList *anchorPairs, int64_t lX, int64_t lY, int64_t diagonalExpansion);
+
 ////Band iterator.
 
 typedef struct _bandIterator BandIterator;
@@ -285,6 +336,33 @@ stList *getAlignedPairsWithoutBanding(StateMachine *sM, void *cX, void *cY, int6
                                                                       PairwiseAlignmentParameters *, void *),
                                       bool alignmentHasRaggedLeftEnd, bool alignmentHasRaggedRightEnd);
 
+AlignedPairBuffer *getAlignedPairBufferWithoutBanding(StateMachine *sM, void *cX, void *cY, int64_t lX, int64_t lY,
+                                                      PairwiseAlignmentParameters *p,
+                                                      void *(*getXFcn)(void *, int64_t),
+                                                      void *(*getYFcn)(void *, int64_t),
+                                                      void (*diagonalPosteriorProbFn)(StateMachine *, int64_t,
+                                                                                      DpMatrix *, DpMatrix *,
+                                                                                      Sequence *, Sequence *, double,
+                                                                                      PairwiseAlignmentParameters *,
+                                                                                      void *),
+                                                      bool alignmentHasRaggedLeftEnd,
+                                                      bool alignmentHasRaggedRightEnd);
+
+// the posterior callbacks (diagonalCalculationPosteriorMatchProbs and diagonalCalculationMultiPosteriorMatchProbs)
+// add to an AlignedPairBuffer, the stList versions of these functions convert the buffer with
+// alignedPairBuffer_toList
+AlignedPairBuffer *getAlignedPairBufferUsingAnchors(StateMachine *sM,
+                                                    Sequence *SsX, Sequence *SsY,
+                                                    stList *anchorPairs,
+                                                    PairwiseAlignmentParameters *p,
+                                                    void (*diagonalPosteriorProbFn)(StateMachine *, int64_t,
+                                                                                    DpMatrix *, DpMatrix *,
+                                                                                    Sequence *, Sequence *, double,
+                                                                                    PairwiseAlignmentParameters *,
+                                                                                    void *),
+                                                    bool alignmentHasRaggedLeftEnd,
+                                                    bool alignmentHasRaggedRightEnd);
+
 stList *getAlignedPairsUsingAnchors(StateMachine *sM,
                                     Sequence *SsX, Sequence *SsY,
                                     stList *anchorPairs,
@@ -295,6 +373,25 @@ stList *getAlignedPairsUsingAnchors(StateMachine *sM,
                                     bool alignmentHasRaggedLeftEnd,
                                     bool alignmentHasRaggedRightEnd);
 
+/*
+ * Streaming version of getAlignedPairBufferUsingAnchors. Instead of collecting all the aligned pairs, sinkFn is
+ * called after each traceback window with the pairs that are final, in the coordinates of SsX and SsY and sorted
+ * by x + y. The calls make one stream in the order of a stable sort of all the pairs by x + y: the pairs a later
+ * window can still come before (diagonalCalculationMultiPosteriorMatchProbs emits (x + n, y)) are held back until
+ * it can't. The buffer is reused once sinkFn returns, so the sink has to copy anything it wants to keep.
+ */
+void getAlignedPairsUsingAnchorsWithSink(StateMachine *sM,
+                                         Sequence *SsX, Sequence *SsY,
+                                         stList *anchorPairs,
+                                         PairwiseAlignmentParameters *p,
+                                         void (*diagonalPosteriorProbFn)(StateMachine *, int64_t, DpMatrix *,
+                                                                         DpMatrix *, Sequence *, Sequence *, double,
+                                                                         PairwiseAlignmentParameters *, void *),
+                                         bool alignmentHasRaggedLeftEnd,
+                                         bool alignmentHasRaggedRightEnd,
+                                         void (*sinkFn)(AlignedPairBuffer *alignedPairs, void *sinkArgs),
+                                         void *sinkArgs);
+
 // EM stuff
 void getExpectationsUsingAnchors(StateMachine *sM, Hmm *hmmExpectations,
                                  Sequence *SsX, Sequence *SsY,
@@ -337,6 +434,21 @@ void getPosteriorProbsWithBandingSplittingAlignmentsByLargeGaps(
                                         PairwiseAlignmentParameters *, void *),
         void (*coordinateCorrectionFn)(), void *extraArgs);
 
+//Memory estimates
+
+// peak memory, in bytes, of the DP matrices of getPosteriorProbsWithBandingSplittingAlignmentsByLargeGaps (e.g.
+// getExpectationsUsingAnchors) for sequences of lengths lX and lY with these anchors, worked out from the bands and
+// the traceback schedule of p without doing the alignment. Fewer diagonals between tracebacks
+// (p->minDiagsBetweenTraceBack) lower it, except where the band is wider than the diagonal expansion
+int64_t getPosteriorProbsWithBandingPeakMemory(stList *anchorPairs, int64_t lX, int64_t lY, int64_t stateNumber,
+                                               PairwiseAlignmentParameters *p);
+
+// the same plus the aligned pairs of getAlignedPairBufferUsingAnchors, or of getAlignedPairsUsingAnchorsWithSink
+// when streamed (one traceback window at a time). The pairs are an upper bound: at most 1/p->threshold per
+// diagonal of a traceback window
+int64_t getAlignedPairsUsingAnchorsPeakMemory(stList *anchorPairs, int64_t lX, int64_t lY, int64_t stateNumber,
+                                              PairwiseAlignmentParameters *p, bool streamed);
+
 //Calculate posterior probabilities of being aligned to gaps
 
 int64_t *getIndelProbabilities(stList *alignedPairs, int64_t seqLength, bool xIfTrueElseY);
@@ -347,4 +459,11 @@ stList *reweightAlignedPairs(stList *alignedPairs,
 
 stList *reweightAlignedPairs2(stList *alignedPairs, int64_t seqLengthX, int64_t seqLengthY, double gapGamma);
 
+int64_t *alignedPairBuffer_getIndelProbabilities(AlignedPairBuffer *alignedPairs, int64_t seqLength,
+                                                 bool xIfTrueElseY);
+
+//Same as reweightAlignedPairs2, but updates the probabilities in place.
+void alignedPairBuffer_reweight(AlignedPairBuffer *alignedPairs,
+                                int64_t seqLengthX, int64_t seqLengthY, double gapGamma);
+
 #endif /* PAIRWISEALIGNER_H_ */
@@ -0,0 +1,80 @@
+#ifndef POSTERIOR_PROBS_H
+#define POSTERIOR_PROBS_H
+
+#include <stdio.h>
+#include "sonLib.h"
+#include "sonLibTypes.h"
+
+// Binary columnar format for the posterior match probabilities written by vanillaAlign. A file is a sequence of
+// self-contained chunks (so files can be appended to, like the tsv), each chunk is
+//     char magic[4] "cPPB", int32 version, int64 number of rows, int64 kmer length,
+//     int64 length + bytes of the contig and of the read label, char strand label, char refKmerIsReverseComplement,
+//     double scale, double shift,
+//     int64 number of kmers in the dictionary + kmerLength bytes for each of them,
+// followed by the columns, each one stored contiguously
+//     int64 reference position, int64 event index, int32 kmer (index into the dictionary),
+//     double event mean, double event noise, double event duration,
+//     double expected level mean, double expected noise mean, double posterior probability
+// all little-endian.
+
+#define POSTERIOR_PROBS_MAGIC "cPPB"
+#define POSTERIOR_PROBS_VERSION 1
+
+typedef struct _posteriorProbsChunk {
+    char *contig;
+    char *readLabel;
+    char strand; // 't' or 'c'
+    bool refKmerIsReverseComplement; // the reference kmer column is the reverse complement of the kmer
+    double scale;
+    double shift;
+    int64_t kmerLength;
+
+    stList *kmers; // kmer dictionary, the kmer column holds indices into this list
+    stHash *kmerCodes; // kmer string to stIntTuple index
+    char *kmerBuffer; // kmerLength + 1 characters, the kmers of the rows are looked up in it
+
+    int64_t length;
+    int64_t maxLength;
+    int64_t *refPositions;
+    int64_t *eventIndices;
+    int32_t *kmerCodesColumn;
+    double *eventMeans;
+    double *eventNoises;
+    double *eventDurations;
+    double *expectedLevelMeans;
+    double *expectedNoiseMeans;
+    double *posteriors;
+} PosteriorProbsChunk;
+
+PosteriorProbsChunk *posteriorProbsChunk_construct(const char *contig, const char *readLabel, char strand,
+                                                   bool refKmerIsReverseComplement, double scale, double shift,
+                                                   int64_t kmerLength);
+
+void posteriorProbsChunk_destruct(PosteriorProbsChunk *chunk);
+
+// adds a row, kmer is the kmer in the target sequence (kmerLength characters, doesn't need to be terminated)
+void posteriorProbsChunk_add(PosteriorProbsChunk *chunk, int64_t refPosition, int64_t eventIndex, const char *kmer,
+                             double eventMean, double eventNoise, double eventDuration,
+                             double expectedLevelMean, double expectedNoiseMean, double posterior);
+
+// writes the rows as one chunk and empties the chunk (the kmer dictionary is reset too)
+void posteriorProbsChunk_write(PosteriorProbsChunk *chunk, FILE *fH);
+
+// reads the next chunk, returns NULL at the end of the file
+PosteriorProbsChunk *posteriorProbsChunk_read(FILE *fH);
+
+// writes the rows in the vanillaAlign tsv format
+void posteriorProbsChunk_writeTsv(PosteriorProbsChunk *chunk, FILE *fH);
+
+// writes a single row of the vanillaAlign tsv format
+void posteriorProbs_writeTsvRow(FILE *fH, const char *contig, int64_t refPosition, const char *refKmer,
+                                const char *readLabel, char strand, int64_t eventIndex,
+                                double eventMean, double eventNoise, double eventDuration,
+                                const char *kmer, int64_t kmerLength,
+                                double expectedLevelMean, double expectedNoiseMean, double posterior,
+                                double scale, double shift);
+
+// converts a binary posteriors file to the tsv format, returns the number of rows
+int64_t posteriorProbs_convertToTsv(const char *binaryFile, const char *tsvFile);
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef REORDER_BUFFER_H
+#define REORDER_BUFFER_H
+
+#include "sonLib.h"
+#include "sonLibTypes.h"
+
+// Puts the results of jobs that finish out of order back in the order the jobs were submitted. Jobs are numbered
+// 0, 1, 2... as they are submitted, the result of a job is handed to writeFn as soon as the results of all the jobs
+// before it have been written. writeFn is called by whichever thread completes the run of results, one at a time.
+
+typedef struct _reorderBuffer ReorderBuffer;
+
+// at most window results wait for an earlier one, writeFn(result, extraArg) writes and frees a result
+ReorderBuffer *reorderBuffer_construct(int64_t window, void (*writeFn)(void *result, void *extraArg), void *extraArg);
+
+// hands over the result of job index, blocks while index is window or more jobs ahead of the next to write
+void reorderBuffer_push(ReorderBuffer *buffer, int64_t index, void *result);
+
+// number of results written so far
+int64_t reorderBuffer_getNumberWritten(ReorderBuffer *buffer);
+
+// aborts if results are still waiting for an earlier one that was never pushed
+void reorderBuffer_destruct(ReorderBuffer *buffer);
+
+#endif
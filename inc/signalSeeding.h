@@ -0,0 +1,42 @@
+#ifndef SIGNAL_SEEDING_H
+#define SIGNAL_SEEDING_H
+
+#include "sonLib.h"
+#include "sonLibTypes.h"
+
+// Signal-space seeding, builds anchor pairs for band_construct directly from the events and the pore model
+// instead of remapping a guide alignment of the 2D read (nanopore_remapAnchorPairsWithOffset)
+
+typedef struct _signalSeedingParameters {
+    double maxDeviation; // an event matches a kmer if |eventMean - levelMean| / levelSd is below this
+    int64_t maxCandidatesPerEvent; // maximum number of kmers an event is discretized to, nearest first
+    int64_t minSeedLength; // minimum number of consecutive reference kmers a seed has to cover
+    int64_t maxMismatches; // events allowed in a seed that don't match the current or next reference kmer
+    int64_t maxKmerOccurrences; // reference kmers occurring more often than this are not used to start seeds
+    int64_t seedTrim; // number of anchors to remove from each end of a seed, like constraintDiagonalTrim
+    double chainGapPenalty; // cost per unit of |dx - dy| between consecutive seeds in a chain
+} SignalSeedingParameters;
+
+SignalSeedingParameters *signalSeedingParameters_construct();
+
+void signalSeedingParameters_destruct(SignalSeedingParameters *sp);
+
+// returns an array with the index of the nearest kmer (by level mean z-score) for each event,
+// eventModel is a match model (EMISSION_MATCH_PROBS layout), events are [mean, noise, duration] triples
+int64_t *signalSeeding_discretizeEvents(const double *eventModel, float *events, int64_t nbEvents);
+
+// finds seed hits between the reference kmers and the events, returns a list of
+// stIntTuple (xStart, yStart, xEnd, yEnd, number of reference kmers covered) sorted by xStart then yStart
+stList *signalSeeding_getSeedHits(const double *eventModel, const char *reference, float *events,
+                                  int64_t nbEvents, SignalSeedingParameters *sp);
+
+// picks the highest scoring chain of seed hits that are increasing in both x and y, the returned list
+// doesn't own the seed hits
+stList *signalSeeding_chainSeedHits(stList *seedHits, SignalSeedingParameters *sp);
+
+// seeds, chains and expands the chained seeds to a filtered list of (x, y) anchor pairs, x is the reference
+// kmer index, y is the event index. The result can be handed to band_construct/getAlignedPairsUsingAnchors
+stList *signalSeeding_getAnchorPairs(const double *eventModel, const char *reference, float *events,
+                                     int64_t nbEvents, SignalSeedingParameters *sp);
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include "sonLib.h"
+#include "sonLibTypes.h"
+
+// Fixed set of worker threads running the jobs pushed to it, in the order they were pushed. Each worker builds a
+// workspace when it starts (whatever it wants to reuse from one job to the next, e.g. stateMachines) and hands it
+// to every job it runs.
+
+typedef struct _threadPool ThreadPool;
+
+// starts nbThreads workers, each calls workspaceConstructFn(workspaceArg) once (both may be NULL) and
+// workspaceDestructFn on its workspace when it stops. At most maxPending jobs wait for a worker
+ThreadPool *threadPool_construct(int64_t nbThreads, int64_t maxPending,
+                                 void *(*workspaceConstructFn)(void *workspaceArg),
+                                 void (*workspaceDestructFn)(void *workspace), void *workspaceArg);
+
+// queues fn(workspace, arg), only blocks if maxPending jobs are already waiting
+void threadPool_push(ThreadPool *pool, void (*fn)(void *workspace, void *arg), void *arg);
+
+// returns once every job pushed so far has finished
+void threadPool_wait(ThreadPool *pool);
+
+// finishes the queued jobs and stops the workers
+void threadPool_destruct(ThreadPool *pool);
+
+int64_t threadPool_getNumberOfThreads(ThreadPool *pool);
+
+#endif
@@ -0,0 +1,109 @@
+// Sum the binary expectation files written by vanillaAlign and write the normalized HMM for the next EM iteration
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include "sonLib.h"
+#include "pairwiseAligner.h"
+#include "continuousHmm.h"
+#include "discreteHmm.h"
+
+void usage() {
+    fprintf(stderr, "mergeExpectations [options] hmmFile [expectationsFile ...]\n");
+    fprintf(stderr, "Sums the expectations (and likelihoods) of the binary expectation files, concatenates their HDP "
+            "assignments, normalizes and writes the HMM to hmmFile. Prints the summed likelihood\n");
+    fprintf(stderr, "-l listFile: also merge the expectation files listed in listFile, one per line\n");
+    fprintf(stderr, "-j nbThreads: number of threads reading the files, default 1\n");
+    fprintf(stderr, "-b: write hmmFile in the binary layout instead of text\n");
+    fprintf(stderr, "-r: remove the expectation files once merged\n");
+}
+
+int main(int argc, char *argv[]) {
+    int64_t nbThreads = 1;
+    bool binaryOutput = FALSE;
+    bool removeFiles = FALSE;
+    char *listFile = NULL;
+
+    int key;
+    while ((key = getopt(argc, argv, "hl:j:br")) != -1) {
+        switch (key) {
+            case 'l':
+                listFile = stString_copy(optarg);
+                break;
+            case 'j':
+                if (sscanf(optarg, "%" SCNi64, &nbThreads) != 1 || nbThreads < 1) {
+                    st_errAbort("mergeExpectations - ERROR: invalid number of threads %s\n", optarg);
+                }
+                break;
+            case 'b':
+                binaryOutput = TRUE;
+                break;
+            case 'r':
+                removeFiles = TRUE;
+                break;
+            default:
+                usage();
+                return 1;
+        }
+    }
+    if (optind >= argc) {
+        usage();
+        return 1;
+    }
+    char *hmmFile = argv[optind];
+
+    stList *files = stList_construct3(0, &free);
+    for (int64_t i = optind + 1; i < argc; i++) {
+        stList_append(files, stString_copy(argv[i]));
+    }
+    if (listFile != NULL) {
+        FILE *fH = fopen(listFile, "r");
+        if (fH == NULL) {
+            st_errAbort("mergeExpectations - ERROR: couldn't open %s\n", listFile);
+        }
+        char *line;
+        while ((line = stFile_getLineFromFile(fH)) != NULL) {
+            if (strlen(line) > 0) {
+                stList_append(files, line);
+            } else {
+                free(line);
+            }
+        }
+        fclose(fH);
+        free(listFile);
+    }
+    if (stList_length(files) == 0) {
+        st_errAbort("mergeExpectations - ERROR: no expectation files to merge\n");
+    }
+
+    char **fileNames = st_malloc(sizeof(char *) * stList_length(files));
+    for (int64_t i = 0; i < stList_length(files); i++) {
+        fileNames[i] = stList_get(files, i);
+    }
+    Hmm *hmm = hmmContinuous_mergeBinaryExpectations(fileNames, stList_length(files), nbThreads);
+    StateMachineType type = hmm->type;
+
+    // normalize the same way the training scripts did
+    hmmContinuous_maximize(hmm, type);
+
+    if (binaryOutput) {
+        hmmContinuous_writeToBinaryFile(hmmFile, hmm, type);
+    } else {
+        hmmContinuous_writeToFile(hmmFile, hmm, type);
+    }
+    fprintf(stderr, "mergeExpectations - merged %" PRIi64 " expectation files into %s\n", stList_length(files),
+            hmmFile);
+    fprintf(stdout, "%f\n", hmm->likelihood);
+
+    if (removeFiles) {
+        for (int64_t i = 0; i < stList_length(files); i++) {
+            remove(fileNames[i]);
+        }
+    }
+    hmmContinuous_destruct(hmm, type);
+    free(fileNames);
+    stList_destruct(files);
+    return 0;
+}
@@ -0,0 +1,59 @@
+// Pack npRead files (text or binary) into one npRead archive, or list the reads of an archive
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sonLib.h"
+#include "nanopore.h"
+
+void usage() {
+    fprintf(stderr, "npReadArchive archiveFile npReadFile [npReadFile ...]\n");
+    fprintf(stderr, "    packs the npRead files into archiveFile, each read is named after its file name\n");
+    fprintf(stderr, "npReadArchive archiveFile -\n");
+    fprintf(stderr, "    same, with the npRead files read from stdin, one per line\n");
+    fprintf(stderr, "npReadArchive archiveFile\n");
+    fprintf(stderr, "    lists the reads in archiveFile\n");
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        usage();
+        return 1;
+    }
+    if (argc == 2) {
+        NanoporeReadArchive *archive = nanoporeReadArchive_construct(argv[1]);
+        for (int64_t i = 0; i < nanoporeReadArchive_getNumberOfReads(archive); i++) {
+            fprintf(stdout, "%" PRIi64 "\t%s\n", i, nanoporeReadArchive_getReadName(archive, i));
+        }
+        nanoporeReadArchive_destruct(archive);
+        return 0;
+    }
+    stList *npReadFiles = stList_construct3(0, free);
+    if (argc == 3 && stString_eq(argv[2], "-")) {
+        char *line;
+        while ((line = stFile_getLineFromFile(stdin)) != NULL) {
+            if (strlen(line) > 0) {
+                stList_append(npReadFiles, line);
+            } else {
+                free(line);
+            }
+        }
+    } else {
+        for (int64_t i = 2; i < argc; i++) {
+            stList_append(npReadFiles, stString_copy(argv[i]));
+        }
+    }
+    NanoporeReadArchiveWriter *writer = nanoporeReadArchiveWriter_construct(argv[1]);
+    for (int64_t i = 0; i < stList_length(npReadFiles); i++) {
+        const char *npReadFile = stList_get(npReadFiles, i);
+        const char *readName = strrchr(npReadFile, '/') == NULL ? npReadFile : strrchr(npReadFile, '/') + 1;
+        NanoporeRead *npRead = nanopore_loadNanoporeReadFromFile(npReadFile);
+        nanoporeReadArchiveWriter_add(writer, readName, npRead);
+        nanopore_nanoporeReadDestruct(npRead);
+    }
+    nanoporeReadArchiveWriter_destruct(writer);
+    fprintf(stderr, "npReadArchive - wrote %" PRIi64 " reads to %s\n", stList_length(npReadFiles), argv[1]);
+    stList_destruct(npReadFiles);
+    return 0;
+}
@@ -0,0 +1,26 @@
+// Convert a text npRead file to the binary npRead layout that nanopore_loadNanoporeReadFromFile mmaps
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include "sonLib.h"
+#include "nanopore.h"
+
+void usage() {
+    fprintf(stderr, "npReadToBinary npReadFile binaryNpReadFile\n");
+    fprintf(stderr, "Converts a npRead file to the binary npRead layout, vanillaAlign -q takes either\n");
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 3) {
+        usage();
+        return 1;
+    }
+    NanoporeRead *npRead = nanopore_loadNanoporeReadFromFile(argv[1]);
+    nanopore_writeNanoporeReadToBinaryFile(npRead, argv[2]);
+    fprintf(stderr, "npReadToBinary - wrote read of length %" PRIi64 " with %" PRIi64 " template and %" PRIi64
+            " complement events to %s\n", npRead->readLength, npRead->nbTemplateEvents, npRead->nbComplementEvents,
+            argv[2]);
+    nanopore_nanoporeReadDestruct(npRead);
+    return 0;
+}
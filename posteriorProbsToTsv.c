@@ -0,0 +1,22 @@
+// Convert a binary posteriors file written by vanillaAlign --binaryPosteriors to the tsv format
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include "sonLib.h"
+#include "posteriorProbs.h"
+
+void usage() {
+    fprintf(stderr, "posteriorProbsToTsv binaryPosteriorsFile tsvFile\n");
+    fprintf(stderr, "Converts the binary posteriors written by vanillaAlign --binaryPosteriors to the tsv format\n");
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 3) {
+        usage();
+        return 1;
+    }
+    int64_t rows = posteriorProbs_convertToTsv(argv[1], argv[2]);
+    fprintf(stderr, "posteriorProbsToTsv - wrote %" PRIi64 " rows to %s\n", rows, argv[2]);
+    return 0;
+}
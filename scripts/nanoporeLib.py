@@ -51,6 +51,31 @@ def get_bwa_index(reference, dest):
     return bwa_ref_index
 
 
+def publish_hdp_densities(hdp, dest, label):
+    """write only the finalized densities of an HDP, vanillaAlign processes that load the same densities file
+    share one copy of them instead of each holding its own
+    """
+    if hdp is None:
+        return None
+    densities = dest + label + "_densities.nhdp"
+    subprocess.check_call(["./hdpDensities", hdp, densities])
+    return densities
+
+
+def merge_expectations(expectations_files, hmm_file, nb_threads=1):
+    """sum the binary expectation files written by vanillaAlign, then normalize and write the HMM for the next
+    iteration. The expectation files are removed once merged, returns the summed likelihood
+    """
+    list_file = hmm_file + ".expectations_list"
+    with open(list_file, 'w') as fH:
+        for expectations_file in expectations_files:
+            fH.write(expectations_file + "\n")
+    likelihood = subprocess.check_output(["./mergeExpectations", "-r", "-j", str(nb_threads), "-l", list_file,
+                                          hmm_file])
+    os.remove(list_file)
+    return float(likelihood)
+
+
 def get_npRead_2dseq_and_models(fast5, npRead_path, twod_read_path, template_model_path, complement_model_path):
     """process a MinION .fast5 file into a npRead file for use with signalAlign also extracts
     the 2D read into fasta format
@@ -199,31 +224,27 @@ def parse_cigar(cigar_string, ref_start):
     return query_start, query_end, reference_start, reference_end, exonerated_cigar
 
 
-def exonerated_bwa(bwa_index, query, target_regions=None):
-    # align with bwa
-    command = "bwa mem -x ont2d {index} {query}".format(index=bwa_index, query=query)
-
-    # this is a small SAM file that comes from bwa
-    aln = subprocess.check_output(command.split())
-    aln = aln.split("\t")  # split
-
-    query_start, query_end, reference_start, reference_end, cigar_string = parse_cigar(aln[11], int(aln[9]))
+def exonerate_sam_record(record, target_regions=None):
+    """make the exonerate cigar vanillaAlign takes as guide alignment from the tab separated fields of a SAM record
+    """
+    flag = int(record[1])
+    query_start, query_end, reference_start, reference_end, cigar_string = parse_cigar(record[5], int(record[3]))
 
     strand = ""
-    if int(aln[7]) == 16:
+    if flag == 16:
         # todo redo this swap
         strand = "-"
         temp = reference_start
         reference_start = reference_end
         reference_end = temp
-    if int(aln[7]) == 0:
+    if flag == 0:
         strand = "+"
-    elif int(aln[7]) != 0 and int(aln[7]) != 16:
+    elif flag != 0 and flag != 16:
         print("unknown alignment flag, exiting", file=sys.stderr)
         return False, False
 
     completeCigarString = "cigar: %s %i %i + %s %i %i %s 1 %s" % (
-    aln[6].split()[-1], query_start, query_end, aln[8], reference_start, reference_end, strand, cigar_string)
+    record[0], query_start, query_end, record[2], reference_start, reference_end, strand, cigar_string)
 
     if target_regions is not None:
         keep = target_regions.check_aligned_region(reference_start, reference_end)
@@ -235,6 +256,55 @@ def exonerated_bwa(bwa_index, query, target_regions=None):
     return completeCigarString, strand
 
 
+def exonerated_bwa(bwa_index, query, target_regions=None):
+    # align with bwa
+    command = "bwa mem -x ont2d {index} {query}".format(index=bwa_index, query=query)
+
+    # this is a small SAM file that comes from bwa, the alignment follows the header
+    aln = subprocess.check_output(command.split())
+    records = [line.split("\t") for line in aln.splitlines() if line and not line.startswith("@")]
+    if not records:
+        return False, False
+
+    return exonerate_sam_record(records[0], target_regions)
+
+
+def exonerated_bwa_reads(bwa_index, queries, target_regions=None):
+    """guide align all the reads of a multi-FASTA with one bwa run, returns a dict of read name to the (cigar, strand)
+    of its primary alignment, reads that didn't map (or not to the target regions) are left out
+    """
+    command = "bwa mem -x ont2d {index} {query}".format(index=bwa_index, query=queries)
+    aln = subprocess.check_output(command.split())
+
+    guide_alignments = {}
+    for line in aln.splitlines():
+        if not line or line.startswith("@"):
+            continue
+        record = line.split("\t")
+        # skip secondary and supplementary alignments
+        if int(record[1]) & 0x900:
+            continue
+        cigar, strand = exonerate_sam_record(record, target_regions)
+        if cigar is not False:
+            guide_alignments[record[0]] = (cigar, strand)
+    return guide_alignments
+
+
+def state_machine_label_and_flag(stateMachineType):
+    """the label of the posteriors files and the vanillaAlign flag of a stateMachine type
+    """
+    if stateMachineType == "threeState":
+        return ".sm", "-s "
+    elif stateMachineType == "fourState":
+        return ".4s", "--f "
+    elif stateMachineType == "echelon":
+        return ".e", "--e "
+    elif stateMachineType == "threeStateHdp":
+        return ".sm3Hdp", "-d "
+    else:
+        return ".vl", ""
+
+
 def get_proceding_kmers(kmer, alphabet="ACGT"):
     proceding_kmers = []
     suffix = kmer[1:]
@@ -761,11 +831,20 @@ class ComplementModel(NanoporeModel):
         return
 
 
+def pack_npReads(np_reads, archive_path):
+    """packs the npRead files into one npRead archive, each read is named after its file name in it
+    """
+    # the paths go through stdin so the command line doesn't grow with the number of reads
+    archiver = subprocess.Popen(["./npReadArchive", archive_path, "-"], stdin=subprocess.PIPE)
+    archiver.communicate("\n".join(np_reads) + "\n")
+    return archiver.returncode == 0
+
+
 class SignalAlignment(object):
     def __init__(self, in_fast5, reference, destination, stateMachineType, banded, bwa_index,
                  in_templateHmm, in_complementHmm, in_templateHdp, in_complementHdp,
                  threshold, diagonal_expansion,
-                 constraint_trim, target_regions=None, cytosine_substitution=None):
+                 constraint_trim, target_regions=None, cytosine_substitution=None, np_read_archive=None):
         self.in_fast5 = in_fast5  # fast5 file to align
         self.reference = reference  # reference sequence
         self.destination = destination  # place where the alignments go, should already exist
@@ -779,6 +858,8 @@ class SignalAlignment(object):
         self.constraint_trim = constraint_trim
         self.target_regions = target_regions
         self.cytosine_substitution = cytosine_substitution
+        # npRead archive holding the npRead made by prepare(), None to make the npRead in run()
+        self.np_read_archive = np_read_archive
 
         # if we're using an input hmm, make sure it exists
         if (in_templateHmm is not None) and os.path.isfile(in_templateHmm):
@@ -800,6 +881,35 @@ class SignalAlignment(object):
         else:
             self.in_complementHdp = None
 
+    def temp_files(self):
+        """the temporary folder of the read and its npRead, 2D read and model files in it
+        """
+        read_label = self.in_fast5.split("/")[-1]
+        temp_folder = FolderHandler()
+        temp_folder.open_folder(self.destination + "tempFiles_{readLabel}".format(readLabel=read_label))
+
+        # read-specific files, could be removed later but are kept right now to make it easier to rerun commands
+        temp_np_read = temp_folder.add_file_path("temp_{read}.npRead".format(read=read_label))
+        temp_2d_read = temp_folder.add_file_path("temp_2Dseq_{read}.fa".format(read=read_label))
+        temp_t_model = temp_folder.add_file_path("template_model.model")
+        temp_c_model = temp_folder.add_file_path("complement_model.model")
+        return temp_folder, temp_np_read, temp_2d_read, temp_t_model, temp_c_model
+
+    def prepare(self):
+        """makes the npRead, 2D read and models of the read in its temporary folder, returns the npRead or None
+        """
+        if os.path.isfile(self.in_fast5) is False:
+            print("signalAlign - problem with file path {file}".format(file=self.in_fast5))
+            return None
+        temp_folder, temp_np_read, temp_2d_read, temp_t_model, temp_c_model = self.temp_files()
+        prepared = get_npRead_2dseq_and_models(fast5=self.in_fast5, npRead_path=temp_np_read,
+                                               twod_read_path=temp_2d_read, template_model_path=temp_t_model,
+                                               complement_model_path=temp_c_model)
+        if prepared is False or prepared[0] is False:
+            temp_folder.remove_folder()
+            return None
+        return temp_np_read
+
     def run(self, get_expectations=False):
         # file checks
         if os.path.isfile(self.in_fast5) is False:
@@ -812,43 +922,29 @@ class SignalAlignment(object):
         read_label = self.in_fast5.split("/")[-1]      # used in the posteriors file as identifier
         read_name = self.in_fast5.split("/")[-1][:-6]  # get the name without the '.fast5'
 
-        # object for handling temporary files
-        temp_folder = FolderHandler()
-        temp_dir_path = temp_folder.open_folder(self.destination + "tempFiles_{readLabel}".format(readLabel=read_label))
-
-        # read-specific files, could be removed later but are kept right now to make it easier to rerun commands
-        temp_np_read = temp_folder.add_file_path("temp_{read}.npRead".format(read=read_label))
-        temp_2d_read = temp_folder.add_file_path("temp_2Dseq_{read}.fa".format(read=read_label))
-        temp_t_model = temp_folder.add_file_path("template_model.model")
-        temp_c_model = temp_folder.add_file_path("complement_model.model")
-
-        # make the npRead and fasta todo make this assert
-        success, temp_t_model, temp_c_model = get_npRead_2dseq_and_models(fast5=self.in_fast5,
-                                                                          npRead_path=temp_np_read,
-                                                                          twod_read_path=temp_2d_read,
-                                                                          template_model_path=temp_t_model,
-                                                                          complement_model_path=temp_c_model)
-
-        if success is False:
+        if self.np_read_archive is None:
+            if self.prepare() is None:
+                return False
+        temp_folder, temp_np_read, temp_2d_read, temp_t_model, temp_c_model = self.temp_files()
+        if os.path.isfile(temp_2d_read) is False:
+            # prepare() failed on this read
+            temp_folder.remove_folder()
             return False
+        # the default models aren't exported
+        temp_t_model = temp_t_model if os.path.isfile(temp_t_model) else None
+        temp_c_model = temp_c_model if os.path.isfile(temp_c_model) else None
+
+        # the npRead file, or the name npReadArchive gave it in the archive
+        if self.np_read_archive is None:
+            np_read_flag = "-q {npRead}".format(npRead=temp_np_read)
+        else:
+            np_read_flag = "-A {archive} -q {npRead}".format(archive=self.np_read_archive,
+                                                             npRead=os.path.basename(temp_np_read))
 
         # add an indicator for the model being used
-        if self.stateMachineType == "threeState":
-            model_label = ".sm"
-            stateMachineType_flag = "-s "
-        elif self.stateMachineType == "fourState":
-            model_label = ".4s"
-            stateMachineType_flag = "--f "
-        elif self.stateMachineType == "echelon":
-            model_label = ".e"
-            stateMachineType_flag = "--e "
-        elif self.stateMachineType == "threeStateHdp":
-            model_label = ".sm3Hdp"
-            stateMachineType_flag = "-d "
+        model_label, stateMachineType_flag = state_machine_label_and_flag(self.stateMachineType)
+        if self.stateMachineType == "threeStateHdp":
             assert (self.in_templateHdp is not None) and (self.in_complementHdp is not None), "Need to provide HDPs"
-        else:
-            model_label = ".vl"
-            stateMachineType_flag = ""
 
         # get orientation and cigar from BWA this serves as the guide alignment
         cigar_string, strand = exonerated_bwa(bwa_index=self.bwa_index, query=temp_2d_read,
@@ -946,21 +1042,21 @@ class SignalAlignment(object):
             complement_expectations_file_path = self.destination + read_name + ".complement.expectations"
 
             command = \
-                "echo {cigar} | {vA} {banded}{model}-r {ref} -q {npRead} {t_model}{c_model}{t_hmm}{c_hmm}{thresh}" \
+                "echo {cigar} | {vA} {banded}{model}-r {ref} {npRead} {t_model}{c_model}{t_hmm}{c_hmm}{thresh}" \
                 "{expansion}{trim} {hdp}-L {readLabel} -t {templateExpectations} -c {complementExpectations} " \
                 "{cytosine}"\
                 .format(cigar=cigar_string, vA=path_to_vanillaAlign, model=stateMachineType_flag, banded=banded_flag,
-                        ref=self.reference, readLabel=read_label, npRead=temp_np_read, t_model=template_model_flag,
+                        ref=self.reference, readLabel=read_label, npRead=np_read_flag, t_model=template_model_flag,
                         c_model=complement_model_flag, t_hmm=template_hmm_flag, c_hmm=complement_hmm_flag,
                         templateExpectations=template_expectations_file_path, hdp=hdp_flags,
                         complementExpectations=complement_expectations_file_path,
                         thresh=threshold_flag, expansion=diag_expansion_flag, trim=trim_flag, cytosine=cytosine_flag)
         else:
             command = \
-                "echo {cigar} | {vA} {model}{banded}-r {ref} -q {npRead} {t_model}{c_model}{t_hmm}{c_hmm}{thresh}" \
+                "echo {cigar} | {vA} {model}{banded}-r {ref} {npRead} {t_model}{c_model}{t_hmm}{c_hmm}{thresh}" \
                 "{expansion}{trim} -u {posteriors} {hdp}-L {readLabel} {cytosine}"\
                 .format(cigar=cigar_string, vA=path_to_vanillaAlign, model=stateMachineType_flag, banded=banded_flag,
-                        ref=self.reference, readLabel=read_label, npRead=temp_np_read, t_model=template_model_flag,
+                        ref=self.reference, readLabel=read_label, npRead=np_read_flag, t_model=template_model_flag,
                         c_model=complement_model_flag, t_hmm=template_hmm_flag, c_hmm=complement_hmm_flag,
                         posteriors=posteriors_file_path, thresh=threshold_flag, expansion=diag_expansion_flag,
                         trim=trim_flag, cytosine=cytosine_flag, hdp=hdp_flags)
@@ -972,6 +1068,160 @@ class SignalAlignment(object):
         return True
 
 
+class SignalAlignmentBatch(object):
+    """align many reads in one vanillaAlign process, the reads are guide aligned with one bwa run and vanillaAlign
+    aligns them on a pool of nb_threads threads that share the models, HMMs, HDPs and reference
+    """
+    def __init__(self, in_fast5s, reference, destination, stateMachineType, bwa_index,
+                 in_templateHmm, in_complementHmm, in_templateHdp, in_complementHdp,
+                 threshold, diagonal_expansion, constraint_trim, nb_threads,
+                 target_regions=None, cytosine_substitution=None, memory_budget=None):
+        self.in_fast5s = in_fast5s  # fast5 files to align
+        self.reference = reference
+        self.destination = destination  # place where the alignments go, should already exist
+        self.stateMachineType = stateMachineType
+        self.bwa_index = bwa_index
+        self.threshold = threshold
+        self.diagonal_expansion = diagonal_expansion
+        self.constraint_trim = constraint_trim
+        self.nb_threads = nb_threads
+        self.target_regions = target_regions
+        self.cytosine_substitution = cytosine_substitution
+        self.memory_budget = memory_budget  # megabytes the alignments running at the same time may hold, or None
+
+        def existing(path):
+            return path if (path is not None) and os.path.isfile(path) else None
+
+        self.in_templateHmm = existing(in_templateHmm)
+        self.in_complementHmm = existing(in_complementHmm)
+        self.in_templateHdp = existing(in_templateHdp)
+        self.in_complementHdp = existing(in_complementHdp)
+
+    def run(self, get_expectations=False, training_iterations=0, out_templateHmm=None, out_complementHmm=None,
+            squarem=False, mini_batch=None):
+        """returns the number of reads handed to vanillaAlign. With training_iterations vanillaAlign trains the HMMs
+        on the reads in memory, writes them to out_templateHmm and out_complementHmm and updates the HDPs in place,
+        squarem extrapolates the EM steps, mini_batch updates the HMMs every mini_batch reads (stepwise EM) and
+        training_iterations is then the number of passes over the reads
+        """
+        if training_iterations > 0:
+            assert (out_templateHmm is not None) and (out_complementHmm is not None), "Need to provide HMM paths"
+            get_expectations = True
+        model_label, stateMachineType_flag = state_machine_label_and_flag(self.stateMachineType)
+        if self.stateMachineType == "threeStateHdp":
+            assert (self.in_templateHdp is not None) and (self.in_complementHdp is not None), "Need to provide HDPs"
+
+        temp_folder = FolderHandler()
+        temp_folder.open_folder(self.destination + "tempFiles_batch")
+        reads_fasta_path = temp_folder.add_file_path("temp_2Dseqs.fa")
+        batch_path = temp_folder.add_file_path("batch.tsv")
+        np_read_archive_path = temp_folder.add_file_path("npReads.archive")
+
+        # make the npReads and models, the 2D reads all go into one fasta for bwa
+        reads = {}
+        with open(reads_fasta_path, "w") as reads_fasta:
+            for fast5 in self.in_fast5s:
+                if os.path.isfile(fast5) is False:
+                    print("signalAlign - problem with file path {file}".format(file=fast5), file=sys.stderr)
+                    continue
+                read_label = fast5.split("/")[-1]
+                temp_np_read = temp_folder.add_file_path("temp_{read}.npRead".format(read=read_label))
+                temp_2d_read = temp_folder.add_file_path("temp_2Dseq_{read}.fa".format(read=read_label))
+                temp_t_model = temp_folder.add_file_path("{read}.template.model".format(read=read_label))
+                temp_c_model = temp_folder.add_file_path("{read}.complement.model".format(read=read_label))
+
+                prepared = get_npRead_2dseq_and_models(fast5=fast5, npRead_path=temp_np_read,
+                                                       twod_read_path=temp_2d_read,
+                                                       template_model_path=temp_t_model,
+                                                       complement_model_path=temp_c_model)
+                if prepared is False:
+                    continue
+                _, temp_t_model, temp_c_model = prepared
+                with open(temp_2d_read, "r") as twod_read:
+                    reads_fasta.write(twod_read.read())
+                reads[fast5] = (read_label, temp_np_read, temp_t_model, temp_c_model)
+
+        # guide alignments for all the reads at once
+        guide_alignments = exonerated_bwa_reads(bwa_index=self.bwa_index, queries=reads_fasta_path,
+                                                target_regions=self.target_regions)
+
+        # one line per read: label, name of the npRead in the archive, guide alignment, output and the models of
+        # the read (empty for the default ones)
+        nb_reads = 0
+        archived_np_reads = []
+        with open(batch_path, "w") as batch:
+            for fast5, (read_label, np_read, t_model, c_model) in reads.items():
+                if fast5 not in guide_alignments:
+                    print("signalAlign - {} didn't map".format(read_label), file=sys.stderr)
+                    continue
+                cigar_string, strand = guide_alignments[fast5]
+                read_name = read_label[:-6]  # the name without the '.fast5'
+                if get_expectations:
+                    # vanillaAlign adds .template.expectations and .complement.expectations
+                    output = self.destination + read_name
+                elif strand == "+":
+                    output = self.destination + read_name + model_label + ".forward.tsv"
+                else:
+                    output = self.destination + read_name + model_label + ".backward.tsv"
+                # npReadArchive names the reads after their file names
+                fields = [read_label, os.path.basename(np_read), cigar_string, output]
+                if (t_model is not None) or (c_model is not None):
+                    fields += [t_model or "", c_model or ""]
+                print(*fields, sep="\t", file=batch)
+                archived_np_reads.append(np_read)
+                nb_reads += 1
+
+        if nb_reads == 0:
+            temp_folder.remove_folder()
+            return 0
+
+        # pack the npReads into one archive that vanillaAlign maps once
+        if pack_npReads(archived_np_reads, np_read_archive_path) is False:
+            print("signalAlign - couldn't pack the npReads into {}".format(np_read_archive_path), file=sys.stderr)
+            temp_folder.remove_folder()
+            return 0
+
+        # flags shared by all the reads
+        path_to_vanillaAlign = "./vanillaAlign"  # todo could require this in path
+        flags = stateMachineType_flag
+        if self.in_templateHmm is not None:
+            flags += "-y {hmm_loc} ".format(hmm_loc=self.in_templateHmm)
+        if self.in_complementHmm is not None:
+            flags += "-z {hmm_loc} ".format(hmm_loc=self.in_complementHmm)
+        if (self.in_templateHdp is not None) or (self.in_complementHdp is not None):
+            flags += "-v {tHdp_loc} -w {cHdp_loc} ".format(tHdp_loc=self.in_templateHdp,
+                                                           cHdp_loc=self.in_complementHdp)
+        if self.threshold is not None:
+            flags += "-D {threshold} ".format(threshold=self.threshold)
+        if self.diagonal_expansion is not None:
+            flags += "-x {expansion} ".format(expansion=self.diagonal_expansion)
+        if self.constraint_trim is not None:
+            flags += "-m {trim} ".format(trim=self.constraint_trim)
+        if self.cytosine_substitution is not None:
+            flags += "-M {cytosineMod} ".format(cytosineMod=self.cytosine_substitution)
+        if self.memory_budget is not None:
+            flags += "--memoryBudget {budget} ".format(budget=self.memory_budget)
+        if training_iterations > 0:
+            flags += "--train {iterations} --outTemplateHmm {tHmm} --outComplementHmm {cHmm} ".format(
+                iterations=training_iterations, tHmm=out_templateHmm, cHmm=out_complementHmm)
+            if squarem:
+                flags += "--squarem "
+            if mini_batch is not None:
+                flags += "--miniBatch {size} ".format(size=mini_batch)
+        elif get_expectations:
+            flags += "--batchExpectations "
+
+        command = "{vA} {flags}-r {ref} --npReadArchive {archive} --batch {batch} --threads {threads}".format(
+            vA=path_to_vanillaAlign, flags=flags, ref=self.reference, archive=np_read_archive_path,
+            batch=batch_path, threads=self.nb_threads)
+
+        # run
+        print("signalAlign - running command: ", command, end="\n", file=sys.stderr)
+        os.system(command)
+        temp_folder.remove_folder()
+        return nb_reads
+
+
 class SignalHmm(object):
     def __init__(self, model_type, symbol_set_size):
         self.match_model_params = 5
@@ -988,32 +1238,6 @@ class ContinuousPairHmm(SignalHmm):
         self.transitions = np.zeros(self.state_number**2)
         self.kmer_skip_probs = np.zeros(self.symbol_set_size)
 
-    def add_expectations_file(self, expectations_file):
-        fH = open(expectations_file, 'r')
-
-        # line 0: smType stateNumber, symbolSetSize
-        line = map(float, fH.readline().split())
-        assert line[0] == 2
-        assert line[1] == self.state_number
-        assert line[2] == self.symbol_set_size
-
-        # line 1: transitions, likelihood
-        line = map(float, fH.readline().split())
-
-        # check if valid file
-        if len(line) != (len(self.transitions) + 1):
-            print("PYSENTINAL - problem with file {}".format(expectations_file), file=sys.stdout)
-            return
-
-        self.likelihood += line[-1]
-        self.transitions = map(lambda x: sum(x), zip(self.transitions, line[0:-1]))
-
-        # line 2: kmer skip probs
-        line = map(float, fH.readline().split())
-        self.kmer_skip_probs = map(lambda x: sum(x), zip(self.kmer_skip_probs, line))
-
-        fH.close()
-
     def normalize(self):
         # normalize transitions
         for from_state in xrange(self.state_number):
@@ -1063,45 +1287,6 @@ class HdpSignalHmm(SignalHmm):
         self.kmer_assignments = []
         self.event_assignments = []
 
-    def add_expectations_file(self, expectations_file):
-        fH = open(expectations_file, 'r')
-
-        # line 0: smType stateNumber, symbolSetSize
-        line = map(float, fH.readline().split())
-        assert line[0] == 7, "add_expectations_file - ERROR: got incorrect modelType"
-        assert line[1] == self.state_number, "add_expectations_file - ERROR: got incorrect stateNumber"
-        assert line[2] == self.threshold, "add_expectations_file - ERROR: got incorrect threshold"
-        self.number_of_assignments += line[3]
-
-        # line 1: transitions, likelihood
-        line = map(float, fH.readline().split())
-
-        # check if valid file
-        if len(line) != (len(self.transitions) + 1):
-            print("PYSENTINAL - problem with file {}".format(expectations_file), file=sys.stdout)
-            return
-
-        self.likelihood += line[-1]
-        self.transitions = map(lambda x: sum(x), zip(self.transitions, line[0:-1]))
-
-        # line 2: kmer skip probs REMOVED
-        #line = map(float, fH.readline().split())
-        #self.kmer_skip_probs = map(lambda x: sum(x), zip(self.kmer_skip_probs, line))
-
-        # line 3: event assignments
-        line = map(float, fH.readline().split())
-        self.event_assignments += line
-
-        # line 4: kmer assignments
-        line = map(str, fH.readline().split())
-        self.kmer_assignments += line
-
-        fH.close()
-
-        assert (len(self.kmer_assignments) == self.number_of_assignments) and \
-               (len(self.event_assignments) == self.number_of_assignments), \
-            "trainModels - add_expectations_file: invalid number of assignments"
-
     def write(self, out_file):
         # format
         # type \t statenumber \t symbolsetsize \t threshold \t numberofassignments \n
@@ -1163,29 +1348,6 @@ class ConditionalSignalHmm(SignalHmm):
         self.match_model = np.zeros(1 + (symbol_set_size * self.match_model_params))
         self.scaled_match_model = np.zeros(1 + (symbol_set_size * self.match_model_params))
 
-    def add_expectations_file(self, expectations_file):
-        fH = open(expectations_file, 'r')
-
-        # line 0: smType \t stateNumber \t symbol_set_size
-        line = map(float, fH.readline().split())
-        assert line[0] == 4
-        assert line[1] == self.state_number
-        assert line[2] == self.symbol_set_size
-
-        # line 1: kmer skip bins (alpha and beta) \t likelihood
-        line = map(float, fH.readline().split())
-
-        # check if valid file
-        if len(line) != (len(self.kmer_skip_bins) + 1):
-            print("PYSENTINAL - problem with file {}".format(expectations_file), file=sys.stdout)
-            return
-
-        #print("incorperating", line[0:-1], (np.nan in line[0:-1]))
-        self.likelihood = line[-1]
-        self.kmer_skip_bins = map(lambda x: sum(x), zip(self.kmer_skip_bins, line[0:-1]))
-
-        # ignore match models for now
-
     def normalize(self):
         # get totals for alpha and beta probs
         beta_total = sum(self.kmer_skip_bins[:30])
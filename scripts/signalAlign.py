@@ -5,7 +5,6 @@ from __future__ import print_function
 import sys
 sys.path.append("../")
 from nanoporeLib import *
-from multiprocessing import Process, Queue, current_process, Manager
 from serviceCourse.file_handlers import FolderHandler
 from argparse import ArgumentParser
 from random import shuffle
@@ -38,7 +37,10 @@ def parse_args():
     parser.add_argument('---un-banded', '-ub', action='store_false', dest='banded',
                         default=True, help='flag, turn off banding')
     parser.add_argument('--jobs', '-j', action='store', dest='nb_jobs', required=False,
-                        default=4, type=int, help="number of jobs to run concurrently")
+                        default=4, type=int, help="number of reads aligned at the same time")
+    parser.add_argument('--memoryBudget', '-M', action='store', dest='memory_budget', required=False,
+                        default=None, type=int, help="megabytes of alignment matrices the reads aligned at the same "
+                                                     "time may hold, reads wait for memory to be released")
     parser.add_argument('-nb_files', '-n', action='store', dest='nb_files', required=False,
                         default=50, type=int, help="maximum number of reads to align")
     parser.add_argument('--output_location', '-o', action='store', dest='out',
@@ -51,15 +53,6 @@ def parse_args():
     return args
 
 
-def aligner(work_queue, done_queue):
-    try:
-        for f in iter(work_queue.get, 'STOP'):
-            alignment = SignalAlignment(**f)
-            alignment.run()
-    except Exception, e:
-        done_queue.put("%s failed with %s" % (current_process().name, e.message))
-
-
 def main(args):
     # parse args
     args = parse_args()
@@ -94,17 +87,16 @@ def main(args):
     bwa_ref_index = get_bwa_index(args.ref, temp_dir_path)
     print("signalAlign - indexing reference, done", file=sys.stderr)
 
+    # publish the HDP densities once, all the workers map the same files
+    template_hdp = publish_hdp_densities(args.templateHDP, temp_dir_path, "template")
+    complement_hdp = publish_hdp_densities(args.complementHDP, temp_dir_path, "complement")
+
     # parse the target regions, if provided
     if args.target_regions is not None:
         target_regions = TargetRegions(args.target_regions)
     else:
         target_regions = None
 
-    workers = args.nb_jobs
-    work_queue = Manager().Queue()
-    done_queue = Manager().Queue()
-    jobs = []
-
     fast5s = [x for x in os.listdir(args.files_dir) if x.endswith(".fast5")]
 
     nb_files = args.nb_files
@@ -112,38 +104,26 @@ def main(args):
         shuffle(fast5s)
         fast5s = fast5s[:nb_files]
 
-    for fast5 in fast5s:
-        alignment_args = {
-            "reference": reference_seq,
-            "cytosine_substitution": None,
-            "destination": temp_dir_path,
-            "stateMachineType": args.stateMachineType,
-            "bwa_index": bwa_ref_index,
-            "in_templateHmm": args.in_T_Hmm,
-            "in_complementHmm": args.in_C_Hmm,
-            "in_templateHdp": args.templateHDP,
-            "in_complementHdp": args.complementHDP,
-            "banded": args.banded,
-            "in_fast5": args.files_dir + fast5,
-            "threshold": args.threshold,
-            "diagonal_expansion": args.diag_expansion,
-            "constraint_trim": args.constraint_trim,
-            "target_regions": target_regions,
-        }
-        #alignment = SignalAlignment(**alignment_args)
-        #alignment.run()
-        work_queue.put(alignment_args)
-
-    for w in xrange(workers):
-        p = Process(target=aligner, args=(work_queue, done_queue))
-        p.start()
-        jobs.append(p)
-        work_queue.put('STOP')
-
-    for p in jobs:
-        p.join()
-
-    done_queue.put('STOP')
+    # one vanillaAlign process aligns all the reads on a pool of nb_jobs threads
+    batch = SignalAlignmentBatch(in_fast5s=[args.files_dir + fast5 for fast5 in fast5s],
+                                 reference=reference_seq,
+                                 destination=temp_dir_path,
+                                 stateMachineType=args.stateMachineType,
+                                 bwa_index=bwa_ref_index,
+                                 in_templateHmm=args.in_T_Hmm,
+                                 in_complementHmm=args.in_C_Hmm,
+                                 in_templateHdp=template_hdp,
+                                 in_complementHdp=complement_hdp,
+                                 threshold=args.threshold,
+                                 diagonal_expansion=args.diag_expansion,
+                                 constraint_trim=args.constraint_trim,
+                                 nb_threads=args.nb_jobs,
+                                 target_regions=target_regions,
+                                 cytosine_substitution=None,
+                                 memory_budget=args.memory_budget)
+    nb_aligned = batch.run()
+    print("signalAlign - aligned {} of {} reads".format(nb_aligned, len(fast5s)), file=sys.stderr)
+
     print("\n#  signalAlign - finished alignments\n", file=sys.stderr)
     print("\n#  signalAlign - finished alignments\n", file=sys.stdout)
 
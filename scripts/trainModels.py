@@ -57,6 +57,13 @@ def parse_args():
     parser.add_argument('--cytosine_substitution', '-cs', action='append', default=None,
                         dest='cytosine_sub', required=False, type=str,
                         help="mutate cytosines to this letter in the reference")
+    parser.add_argument('--squarem', action='store_true', dest='squarem', default=False,
+                        help="flag, extrapolate the EM steps (SQUAREM), only when training in one process and not "
+                             "for threeStateHdp")
+    parser.add_argument('--mini_batch', action='store', dest='mini_batch', default=None, type=int,
+                        help="stepwise (online) EM, update the HMMs every mini_batch reads, --iterations is then the "
+                             "number of passes over the reads, only when training in one process and not for "
+                             "threeStateHdp")
     args = parser.parse_args()
     return args
 
@@ -123,16 +130,9 @@ def get_model(type, symbol_set_size, threshold):
         return HdpSignalHmm(model_type=type, threshold=threshold)
 
 
-def add_and_norm_expectations(path, files, model, hmm_file):
-    model.likelihood = 0
-    for f in files:
-        model.add_expectations_file(path + f)
-        os.remove(path + f)
-    model.normalize()
-    model.write(hmm_file)
+def add_and_norm_expectations(path, files, model, hmm_file, nb_threads):
+    model.likelihood = merge_expectations([path + f for f in files], hmm_file, nb_threads)
     model.running_likelihoods.append(model.likelihood)
-    if type(model) is HdpSignalHmm:
-        model.reset_assignments()
 
 
 def build_hdp(hdp_type, template_hdp_path, complement_hdp_path, alignments,
@@ -177,6 +177,24 @@ def build_hdp(hdp_type, template_hdp_path, complement_hdp_path, alignments,
         sys.exit(1)
 
 
+def train_in_process(args, training_files_and_subtitutions, reference_seq, working_directory_path, bwa_ref_index,
+                     template_hmm, complement_hmm):
+    """all the iterations in one vanillaAlign process, the expectations are summed in memory on a pool of threads
+    instead of going through expectation files, only for reads that share the cytosine substitution
+    """
+    fast5s = [fast5 for fast5, _ in training_files_and_subtitutions]
+    batch = SignalAlignmentBatch(in_fast5s=fast5s, reference=reference_seq, destination=working_directory_path,
+                                 stateMachineType=args.stateMachineType, bwa_index=bwa_ref_index,
+                                 in_templateHmm=args.in_T_Hmm, in_complementHmm=args.in_C_Hmm,
+                                 in_templateHdp=args.templateHDP, in_complementHdp=args.complementHDP,
+                                 threshold=args.threshold, diagonal_expansion=args.diag_expansion,
+                                 constraint_trim=args.constraint_trim, nb_threads=args.nb_jobs,
+                                 cytosine_substitution=training_files_and_subtitutions[0][1])
+    # vanillaAlign prints the iteration, template and complement likelihoods and their changes
+    batch.run(training_iterations=args.iter, out_templateHmm=template_hmm, out_complementHmm=complement_hmm,
+              squarem=args.squarem, mini_batch=args.mini_batch)
+
+
 def main(argv):
     # parse command line arguments
     args = parse_args()
@@ -241,6 +259,22 @@ def main(argv):
     print("Starting {iterations} iterations.\n\n\t    Running likelihoods\ni\tTempalte\tComplement".format(
         iterations=args.iter), file=sys.stdout)
 
+    # if we're using 'mutated' or non-canonical reference sequences, they come in a list. if we're not then
+    # we make a list of the 'normal' reference sequence
+    if args.cytosine_sub is None:
+        cytosine_substitutions = [None] * len(args.files_dir)
+    else:
+        cytosine_substitutions = args.cytosine_sub
+
+    # with one substitution the reads are culled once and trained on in one process
+    if len(set(cytosine_substitutions)) == 1:
+        training_files_and_subtitutions = cull_training_files(args.files_dir, cytosine_substitutions, args.amount)
+        train_in_process(args, training_files_and_subtitutions, reference_seq, working_directory_path,
+                         bwa_ref_index, template_hmm, complement_hmm)
+        print("trainModels - finished training routine", file=sys.stdout)
+        print("trainModels - finished training routine", file=sys.stderr)
+        return
+
     for i in xrange(args.iter):
         # if we're starting there are no HMMs
         if i == 0:
@@ -250,13 +284,6 @@ def main(argv):
             in_template_hmm = template_hmm
             in_complement_hmm = complement_hmm
 
-        # if we're using 'mutated' or non-canonical reference sequences, they come in a list. if we're not then
-        # we make a list of the 'normal' reference sequence
-        if args.cytosine_sub is None:
-            cytosine_substitutions = [None] * len(args.files_dir)
-        else:
-            cytosine_substitutions = args.cytosine_sub
-
         # first cull a set of files to get expectations on
         training_files_and_subtitutions = cull_training_files(args.files_dir, cytosine_substitutions, args.amount)
 
@@ -310,13 +337,15 @@ def main(argv):
             add_and_norm_expectations(path=working_directory_path,
                                       files=template_expectations_files,
                                       model=template_model,
-                                      hmm_file=template_hmm)
+                                      hmm_file=template_hmm,
+                                      nb_threads=args.nb_jobs)
 
         if len(complement_expectations_files) > 0:
             add_and_norm_expectations(path=working_directory_path,
                                       files=complement_expectations_files,
                                       model=complement_model,
-                                      hmm_file=complement_hmm)
+                                      hmm_file=complement_hmm,
+                                      nb_threads=args.nb_jobs)
 
         # Build HDP from last round of assignments
         if args.stateMachineType == "threeStateHdp":
@@ -15,6 +15,7 @@ CuSuite *pairwiseAlignmentTestSuite(void);
 CuSuite *signalPairwiseTestSuite(void);
 CuSuite *NanoporeHdpTestSuite(void);
 CuSuite *HdpTestSuite(void);
+CuSuite *concurrencyTestSuite(void);
 //CuSuite* multipleAlignerTestSuite(void);
 //CuSuite* pairwiseAlignmentLongTestSuite(void);
 
@@ -26,6 +27,7 @@ int stBaseAlignerRunAllTests(void) {
     CuSuiteAddSuite(suite, signalPairwiseTestSuite());
     CuSuiteAddSuite(suite, NanoporeHdpTestSuite());
     CuSuiteAddSuite(suite, HdpTestSuite());
+    CuSuiteAddSuite(suite, concurrencyTestSuite());
     //CuSuiteAddSuite(suite, multipleAlignerTestSuite());
     //CuSuiteAddSuite(suite, pairwiseAlignmentLongTestSuite());
     CuSuiteRun(suite);
@@ -0,0 +1,228 @@
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include "CuTest.h"
+#include "sonLib.h"
+#include "outputQueue.h"
+#include "threadPool.h"
+#include "reorderBuffer.h"
+#include "jobScheduler.h"
+#include "memoryBudget.h"
+
+static void test_outputQueue(CuTest *testCase) {
+    char *outFile = stString_print("./tempOutputQueue%" PRIi64 ".tsv", st_randomInt(0, INT64_MAX));
+    int64_t nbBuffers = 200, linesPerBuffer = 10;
+    // two threads push through a queue that only holds two buffers at a time
+    OutputQueue *queue = outputQueue_construct(outFile, FALSE, 2);
+    #pragma omp parallel for
+    for (int64_t s = 0; s < 2; s++) {
+        for (int64_t i = 0; i < nbBuffers; i++) {
+            char lines[1024];
+            int64_t length = 0;
+            for (int64_t j = 0; j < linesPerBuffer; j++) {
+                length += sprintf(lines + length, "%" PRIi64 "\t%" PRIi64 "\n", s, i * linesPerBuffer + j);
+            }
+            outputQueue_push(queue, stString_copy(lines), length);
+        }
+    }
+    outputQueue_destruct(queue);
+
+    // every line is intact and the lines of each thread are in the order they were pushed
+    FILE *fH = fopen(outFile, "r");
+    int64_t next[2] = { 0, 0 };
+    int64_t s, n;
+    while (fscanf(fH, "%" SCNi64 "\t%" SCNi64 "\n", &s, &n) == 2) {
+        CuAssertTrue(testCase, s == 0 || s == 1);
+        CuAssertIntEquals(testCase, next[s], n);
+        next[s]++;
+    }
+    CuAssertTrue(testCase, feof(fH));
+    fclose(fH);
+    CuAssertIntEquals(testCase, nbBuffers * linesPerBuffer, next[0]);
+    CuAssertIntEquals(testCase, nbBuffers * linesPerBuffer, next[1]);
+    remove(outFile);
+    free(outFile);
+}
+
+typedef struct _testWorkspace {
+    int64_t jobs;
+    int64_t *totalJobs;
+} TestWorkspace;
+
+static void *testWorkspace_construct(void *totalJobs) {
+    TestWorkspace *workspace = st_calloc(1, sizeof(TestWorkspace));
+    workspace->totalJobs = totalJobs;
+    return workspace;
+}
+
+static void testWorkspace_destruct(void *arg) {
+    TestWorkspace *workspace = arg;
+    #pragma omp atomic
+    *workspace->totalJobs += workspace->jobs;
+    free(workspace);
+}
+
+static void testThreadPoolJob(void *workspace, void *arg) {
+    ((TestWorkspace *) workspace)->jobs++;
+    int64_t *x = arg;
+    *x = *x * *x;
+}
+
+static void test_threadPool(CuTest *testCase) {
+    int64_t nbJobs = 1000, totalJobs = 0;
+    int64_t *results = st_malloc(nbJobs * sizeof(int64_t));
+    // more jobs than the queue holds, so pushing waits on the workers
+    ThreadPool *pool = threadPool_construct(3, 2, testWorkspace_construct, testWorkspace_destruct, &totalJobs);
+    CuAssertIntEquals(testCase, 3, threadPool_getNumberOfThreads(pool));
+    for (int64_t i = 0; i < nbJobs; i++) {
+        results[i] = i;
+        threadPool_push(pool, testThreadPoolJob, &results[i]);
+    }
+    threadPool_wait(pool);
+    for (int64_t i = 0; i < nbJobs; i++) {
+        CuAssertIntEquals(testCase, i * i, results[i]);
+    }
+    // the pool is reused after waiting, destructing it runs the remaining jobs
+    for (int64_t i = 0; i < nbJobs; i++) {
+        threadPool_push(pool, testThreadPoolJob, &results[i]);
+    }
+    threadPool_destruct(pool);
+    for (int64_t i = 0; i < nbJobs; i++) {
+        CuAssertIntEquals(testCase, i * i * i * i, results[i]);
+    }
+    // every job ran once, in a worker's workspace
+    CuAssertIntEquals(testCase, 2 * nbJobs, totalJobs);
+    free(results);
+}
+
+static void testReorderBuffer_write(void *result, void *written) {
+    stList_append(written, result);
+}
+
+static void test_reorderBuffer(CuTest *testCase) {
+    int64_t nbResults = 1000;
+    stList *written = stList_construct3(0, free);
+    // results pushed from several threads, in whatever order they finish, with room for 3 out of order ones
+    ReorderBuffer *buffer = reorderBuffer_construct(3, testReorderBuffer_write, written);
+    #pragma omp parallel for schedule(dynamic, 1) num_threads(4)
+    for (int64_t i = 0; i < nbResults; i++) {
+        int64_t *result = st_malloc(sizeof(int64_t));
+        *result = i;
+        reorderBuffer_push(buffer, i, result);
+    }
+    CuAssertIntEquals(testCase, nbResults, reorderBuffer_getNumberWritten(buffer));
+    reorderBuffer_destruct(buffer);
+    CuAssertIntEquals(testCase, nbResults, stList_length(written));
+    for (int64_t i = 0; i < nbResults; i++) {
+        CuAssertIntEquals(testCase, i, *(int64_t *) stList_get(written, i));
+    }
+    stList_destruct(written);
+}
+
+typedef struct _testScheduledJob {
+    int64_t cost;
+    int64_t runs;
+    int64_t thread;
+} TestScheduledJob;
+
+static void *testSchedulerWorkspace_construct(void *nextThread) {
+    int64_t *thread = st_malloc(sizeof(int64_t));
+    #pragma omp atomic capture
+    *thread = (*(int64_t *) nextThread)++;
+    return thread;
+}
+
+static void testScheduledJob_run(void *workspace, void *arg) {
+    TestScheduledJob *job = arg;
+    job->runs++;
+    job->thread = *(int64_t *) workspace;
+    // work in proportion to the cost
+    volatile double x = 0.0;
+    for (int64_t i = 0; i < job->cost * 1000; i++) {
+        x += i;
+    }
+}
+
+static void test_jobScheduler(CuTest *testCase) {
+    int64_t nbJobs = 200, nbThreads = 4;
+    TestScheduledJob *jobs = st_calloc(nbJobs, sizeof(TestScheduledJob));
+    JobScheduler *scheduler = jobScheduler_construct();
+    for (int64_t i = 0; i < nbJobs; i++) {
+        // a few giant jobs among many small ones
+        jobs[i].cost = i % 50 == 0 ? 1000 : 1 + st_randomInt(0, 10);
+        jobScheduler_add(scheduler, testScheduledJob_run, &jobs[i], jobs[i].cost);
+    }
+    CuAssertIntEquals(testCase, nbJobs, jobScheduler_getNumberOfJobs(scheduler));
+    int64_t nextThread = 0;
+    jobScheduler_run(scheduler, nbThreads, testSchedulerWorkspace_construct, free, &nextThread);
+    CuAssertIntEquals(testCase, nbThreads, nextThread);
+    CuAssertIntEquals(testCase, 0, jobScheduler_getNumberOfJobs(scheduler));
+    // every job ran once, in the workspace of one of the threads
+    for (int64_t i = 0; i < nbJobs; i++) {
+        CuAssertIntEquals(testCase, 1, jobs[i].runs);
+        CuAssertTrue(testCase, jobs[i].thread >= 0 && jobs[i].thread < nbThreads);
+    }
+    // the scheduler can run another batch
+    jobScheduler_add(scheduler, testScheduledJob_run, &jobs[0], 1);
+    jobScheduler_run(scheduler, 1, testSchedulerWorkspace_construct, free, &nextThread);
+    CuAssertIntEquals(testCase, 2, jobs[0].runs);
+    jobScheduler_destruct(scheduler);
+    free(jobs);
+}
+
+typedef struct _testBudgetedJob {
+    MemoryBudget *budget;
+    int64_t bytes;
+    int64_t overBudget;
+} TestBudgetedJob;
+
+static void testBudgetedJob_run(void *workspace, void *arg) {
+    TestBudgetedJob *job = arg;
+    int64_t reserved = memoryBudget_reserve(job->budget, job->bytes);
+    if (memoryBudget_getReserved(job->budget) > memoryBudget_getBudget(job->budget)) {
+        job->overBudget = 1;
+    }
+    volatile double x = 0.0;
+    for (int64_t i = 0; i < 10000; i++) {
+        x += i;
+    }
+    memoryBudget_release(job->budget, reserved);
+}
+
+static void test_memoryBudget(CuTest *testCase) {
+    int64_t nbJobs = 100, nbThreads = 4, budgetBytes = 1000;
+    MemoryBudget *budget = memoryBudget_construct(budgetBytes);
+    CuAssertIntEquals(testCase, budgetBytes, memoryBudget_getBudget(budget));
+    // a request bigger than the budget takes all of it
+    CuAssertIntEquals(testCase, budgetBytes, memoryBudget_reserve(budget, 5000));
+    memoryBudget_release(budget, budgetBytes);
+
+    TestBudgetedJob *jobs = st_calloc(nbJobs, sizeof(TestBudgetedJob));
+    JobScheduler *scheduler = jobScheduler_construct();
+    for (int64_t i = 0; i < nbJobs; i++) {
+        jobs[i].budget = budget;
+        jobs[i].bytes = i % 25 == 0 ? 2 * budgetBytes : st_randomInt(1, 600);
+        jobScheduler_add(scheduler, testBudgetedJob_run, &jobs[i], jobs[i].bytes);
+    }
+    jobScheduler_run(scheduler, nbThreads, NULL, NULL, NULL);
+    // the jobs running at the same time never held more than the budget
+    for (int64_t i = 0; i < nbJobs; i++) {
+        CuAssertIntEquals(testCase, 0, jobs[i].overBudget);
+    }
+    CuAssertTrue(testCase, memoryBudget_getPeakReserved(budget) <= budgetBytes);
+    CuAssertIntEquals(testCase, 0, memoryBudget_getReserved(budget));
+    jobScheduler_destruct(scheduler);
+    memoryBudget_destruct(budget);
+    free(jobs);
+}
+
+CuSuite *concurrencyTestSuite(void) {
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, test_outputQueue);
+    SUITE_ADD_TEST(suite, test_threadPool);
+    SUITE_ADD_TEST(suite, test_reorderBuffer);
+    SUITE_ADD_TEST(suite, test_jobScheduler);
+    SUITE_ADD_TEST(suite, test_memoryBudget);
+    return suite;
+}
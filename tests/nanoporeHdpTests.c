@@ -243,7 +243,7 @@ void add_hdp_copy_tests(CuTest* ct, HierarchicalDirichletProcess* original_hdp,
 }
 
 void test_checkHDPs(CuTest *testCase, NanoporeHDP *nhdp1, NanoporeHDP *nhdp2, double tolerance) {
-    double fakemean[1] = {65.0};
+    float fakemean[1] = {65.0};
     CuAssertDblEquals_Msg(testCase, "nhdp dp density fail",
                           get_nanopore_kmer_density(nhdp1, "AAAAAA", fakemean),
                           get_nanopore_kmer_density(nhdp2, "AAAAAA", fakemean),
@@ -270,6 +270,16 @@ void test_checkHDPs(CuTest *testCase, NanoporeHDP *nhdp1, NanoporeHDP *nhdp2, do
                           tolerance);
 }
 
+static void check_binary_hdp_copy(CuTest* ct, HierarchicalDirichletProcess* original_hdp, char* filepath) {
+    FILE* main_file = fopen(filepath, "wb");
+    serialize_hdp_binary(original_hdp, main_file);
+    fclose(main_file);
+    HierarchicalDirichletProcess* copy_hdp = deserialize_hdp_binary(filepath, 0);
+    add_hdp_copy_tests(ct, original_hdp, copy_hdp);
+    destroy_hier_dir_proc(copy_hdp);
+    remove(filepath);
+}
+
 void test_serialization(CuTest* ct) {
 
     FILE* data_file = fopen("../../cPecan/tests/test_hdp/data.txt","r");
@@ -361,6 +371,7 @@ void test_serialization(CuTest* ct) {
     add_hdp_copy_tests(ct, original_hdp, copy_hdp);
     destroy_hier_dir_proc(copy_hdp);
     remove(copy_filepath);
+    check_binary_hdp_copy(ct, original_hdp, copy_filepath);
 
     pass_data_to_hdp(original_hdp, data, dp_ids, data_length);
     main_file = fopen(filepath, "w");
@@ -375,6 +386,7 @@ void test_serialization(CuTest* ct) {
     add_hdp_copy_tests(ct, original_hdp, copy_hdp);
     destroy_hier_dir_proc(copy_hdp);
     remove(copy_filepath);
+    check_binary_hdp_copy(ct, original_hdp, copy_filepath);
 
     execute_gibbs_sampling(original_hdp, 10, 10, 10, false);
     finalize_distributions(original_hdp);
@@ -390,6 +402,7 @@ void test_serialization(CuTest* ct) {
     add_hdp_copy_tests(ct, original_hdp, copy_hdp);
     destroy_hier_dir_proc(copy_hdp);
     remove(copy_filepath);
+    check_binary_hdp_copy(ct, original_hdp, copy_filepath);
 
     destroy_hier_dir_proc(original_hdp);
 
@@ -427,6 +440,7 @@ void test_serialization(CuTest* ct) {
     add_hdp_copy_tests(ct, original_hdp, copy_hdp);
     destroy_hier_dir_proc(copy_hdp);
     remove(copy_filepath);
+    check_binary_hdp_copy(ct, original_hdp, copy_filepath);
 
     pass_data_to_hdp(original_hdp, data, dp_ids, data_length);
     main_file = fopen(filepath, "w");
@@ -441,6 +455,7 @@ void test_serialization(CuTest* ct) {
     add_hdp_copy_tests(ct, original_hdp, copy_hdp);
     destroy_hier_dir_proc(copy_hdp);
     remove(copy_filepath);
+    check_binary_hdp_copy(ct, original_hdp, copy_filepath);
 
     execute_gibbs_sampling(original_hdp, 10, 10, 10, false);
     finalize_distributions(original_hdp);
@@ -456,6 +471,7 @@ void test_serialization(CuTest* ct) {
     add_hdp_copy_tests(ct, original_hdp, copy_hdp);
     destroy_hier_dir_proc(copy_hdp);
     remove(copy_filepath);
+    check_binary_hdp_copy(ct, original_hdp, copy_filepath);
 
     destroy_hier_dir_proc(original_hdp);
 
@@ -478,6 +494,98 @@ void test_nhdp_serialization(CuTest* ct) {
     remove("../../cPecan/tests/test_hdp/test.nhdp");
 }
 
+void test_nhdp_binarySerialization(CuTest* ct) {
+    NanoporeHDP* nhdp = flat_hdp_model("ACGT", 4, 6, 4.0, 20.0, 0.0, 100.0, 100,
+                                       "../../cPecan/models/template_median68pA.model");
+
+    update_nhdp_from_alignment(nhdp, "../../cPecan/tests/test_alignments/simple_alignment.tsv", false);
+
+    execute_nhdp_gibbs_sampling(nhdp, 10, 0, 1, false);
+    finalize_nhdp_distributions(nhdp);
+
+    serialize_nhdp_binary(nhdp, "../../cPecan/tests/test_hdp/test.nhdp");
+    NanoporeHDP* copy_nhdp = deserialize_nhdp("../../cPecan/tests/test_hdp/test.nhdp");
+    CuAssertIntEquals(ct, get_nanopore_hdp_kmer_length(nhdp), get_nanopore_hdp_kmer_length(copy_nhdp));
+    CuAssertIntEquals(ct, get_nanopore_hdp_alphabet_size(nhdp), get_nanopore_hdp_alphabet_size(copy_nhdp));
+    // densities straight from the mapped file
+    test_checkHDPs(ct, nhdp, copy_nhdp, 0.0);
+    // and after the Gibbs state has been parsed
+    CuAssertIntEquals(ct, get_num_data(nhdp->hdp), get_num_data(copy_nhdp->hdp));
+    for (int64_t id = 0; id < get_num_dir_proc(nhdp->hdp); id++) {
+        CuAssertIntEquals(ct, get_dir_proc_num_factors(nhdp->hdp, id), get_dir_proc_num_factors(copy_nhdp->hdp, id));
+    }
+    test_checkHDPs(ct, nhdp, copy_nhdp, 0.0);
+    destroy_nanopore_hdp(copy_nhdp);
+
+    // densities only
+    serialize_nhdp_densities_binary(nhdp, "../../cPecan/tests/test_hdp/test.nhdp");
+    copy_nhdp = deserialize_nhdp("../../cPecan/tests/test_hdp/test.nhdp");
+    CuAssertTrue(ct, is_sampling_finalized(copy_nhdp->hdp));
+    CuAssertIntEquals(ct, 0, get_num_data(copy_nhdp->hdp));
+    test_checkHDPs(ct, nhdp, copy_nhdp, 0.0);
+
+    destroy_nanopore_hdp(copy_nhdp);
+    destroy_nanopore_hdp(nhdp);
+    remove("../../cPecan/tests/test_hdp/test.nhdp");
+}
+
+static void check_alignment_parsing(CuTest* ct, bool has_header, const char* strand_filter, int64_t chunk_length) {
+    char* alignment_file = "../../cPecan/tests/test_alignments/simple_alignment.tsv";
+    NanoporeHDP* nhdp = flat_hdp_model("ACGT", 4, 6, 4.0, 20.0, 0.0, 100.0, 100,
+                                       "../../cPecan/models/template_median68pA.model");
+    update_nhdp_from_alignment_in_chunks(nhdp, alignment_file, has_header, strand_filter, chunk_length);
+
+    // parse the file the straightforward way
+    stList* signal_list = stList_construct3(0, &free);
+    stList* dp_id_list = stList_construct3(0, &free);
+    FILE* fH = fopen(alignment_file, "r");
+    char* line = stFile_getLineFromFile(fH);
+    if (has_header) {
+        free(line);
+        line = stFile_getLineFromFile(fH);
+    }
+    while (line != NULL) {
+        stList* tokens = stString_split(line);
+        if (strand_filter == NULL || strcmp(stList_get(tokens, 4), strand_filter) == 0) {
+            double* signal = (double*) malloc(sizeof(double));
+            int64_t* dp_id = (int64_t*) malloc(sizeof(int64_t));
+            sscanf(stList_get(tokens, 13), "%lf", signal);
+            *dp_id = standard_kmer_id(stList_get(tokens, 9), 6);
+            stList_append(signal_list, signal);
+            stList_append(dp_id_list, dp_id);
+        }
+        stList_destruct(tokens);
+        free(line);
+        line = stFile_getLineFromFile(fH);
+    }
+    fclose(fH);
+
+    CuAssertIntEquals(ct, stList_length(signal_list), get_num_data(nhdp->hdp));
+    double* data = get_data_copy(nhdp->hdp);
+    int64_t* dp_ids = get_data_pt_dp_ids_copy(nhdp->hdp);
+    for (int64_t i = 0; i < stList_length(signal_list); i++) {
+        CuAssertDblEquals(ct, *(double*) stList_get(signal_list, i), data[i], 0.0);
+        CuAssertIntEquals(ct, *(int64_t*) stList_get(dp_id_list, i), dp_ids[i]);
+    }
+    free(data);
+    free(dp_ids);
+    stList_destruct(signal_list);
+    stList_destruct(dp_id_list);
+    destroy_nanopore_hdp(nhdp);
+}
+
+void test_nhdp_alignmentParsing(CuTest* ct) {
+    // the test alignment fits in one default chunk, the smaller ones put chunk boundaries inside lines (and, at one
+    // byte, chunks with no line start)
+    int64_t chunk_lengths[4] = { ALIGNMENT_CHUNK_LENGTH, 4096, 97, 1 };
+    for (int64_t i = 0; i < 4; i++) {
+        check_alignment_parsing(ct, false, NULL, chunk_lengths[i]);
+        check_alignment_parsing(ct, true, NULL, chunk_lengths[i]);
+        check_alignment_parsing(ct, false, "t", chunk_lengths[i]);
+        check_alignment_parsing(ct, true, "c", chunk_lengths[i]);
+    }
+}
+
 void test_nhdp_buildFromAlignment(CuTest *testCase) {
     char *templateModelFile = stString_print("../../cPecan/models/template_median68pA.model");
     char *complementModelFile = stString_print("../../cPecan/models/complement_median68pA_pop2.model");
@@ -519,7 +627,7 @@ static void test_sm3hdp_cell(CuTest *testCase) {
     }
 
     char *referenceSeq = "ATGACACATT";
-    double fakeEventSeq[15] = {
+    float fakeEventSeq[15] = {
             60.032615, 0.791316, 0.005, //ATGACA
             60.332089, 0.620198, 0.012, //TGACAC
             61.618848, 0.747567, 0.008, //GACACA
@@ -538,7 +646,7 @@ static void test_sm3hdp_cell(CuTest *testCase) {
 
     // test sequence_getEvent
     for (int64_t i = 0; i < testLength; i++) {
-        CuAssertDblEquals(testCase, *(double *)eventSeq->get(eventSeq->elements, i),
+        CuAssertDblEquals(testCase, nanopore_getEventMean(eventSeq->get(eventSeq->elements, i)),
                           fakeEventSeq[i * NB_EVENT_PARAMS], 0.0);
     }
 
@@ -618,7 +726,7 @@ static void test_sm3Hdp_dpDiagonal(CuTest *testCase) {
 static void test_sm3Hdp_diagonalDPCalculations(CuTest *testCase) {
     // make some DNA sequences and fake nanopore read data
     char *sX = "ACGATACGGACAT";
-    double sY[21] = {
+    float sY[21] = {
             58.743435, 0.887833, 0.0571, //ACGATA 0
             53.604965, 0.816836, 0.0571, //CGATAC 1
             58.432015, 0.735143, 0.0571, //GATACG 2
@@ -694,8 +802,8 @@ static void test_sm3Hdp_diagonalDPCalculations(CuTest *testCase) {
     }
 
     // Now do the posterior probabilities, get aligned pairs with posterior match probs above threshold
-    stList *alignedPairs = stList_construct3(0, (void (*)(void *)) stIntTuple_destruct);
-    void *extraArgs[1] = { alignedPairs };
+    AlignedPairBuffer *alignedPairBuffer = alignedPairBuffer_construct(0);
+    void *extraArgs[1] = { alignedPairBuffer };
     for (int64_t i = 1; i <= lX + lY; i++) {
         PairwiseAlignmentParameters *p = pairwiseAlignmentBandingParameters_construct();
         p->threshold = 0.2;
@@ -703,6 +811,8 @@ static void test_sm3Hdp_diagonalDPCalculations(CuTest *testCase) {
                                                totalProbForward, p, extraArgs);
         pairwiseAlignmentBandingParameters_destruct(p);
     }
+    stList *alignedPairs = alignedPairBuffer_toList(alignedPairBuffer);
+    alignedPairBuffer_destruct(alignedPairBuffer);
 
     // Make a list of the correct anchor points
     stSortedSet *alignedPairsSet = stSortedSet_construct3((int (*)(const void *, const void *)) stIntTuple_cmpFn,
@@ -948,6 +1058,10 @@ static void test_hdpHmmWithoutAssignments(CuTest *testCase) {
     stFile_rmrf(tempFile);
 
     CuAssertTrue(testCase, (3 == hdpHmm->numberOfAssignments));  // recheck number of assignments
+    for (int64_t a = 0; a < 3; a++) {
+        CuAssertTrue(testCase, strncmp(sequence + (a * KMER_LENGTH), hdpHmm->kmerAssignments + (a * KMER_LENGTH),
+                                       KMER_LENGTH) == 0);
+    }
 
     // Check the transition expectations
     for (int64_t from = 0; from < nStates; from++) {
@@ -972,6 +1086,152 @@ static void test_hdpHmmWithoutAssignments(CuTest *testCase) {
     hdpHmm_destruct((Hmm *) hdpHmm);
 }
 
+static void test_hdpHmm_binaryExpectations(CuTest *testCase) {
+    char *sequence = "ACGTCATACATGACTATA";
+    float events[4 * NB_EVENT_PARAMS] = { 65.0, 1.0, 0.1, 64.5, 1.0, 0.1, 63.25, 1.0, 0.1, 62.0, 1.0, 0.1 };
+
+    // the first file gets the first two assignments, the second file the other two
+    char *files[2];
+    for (int64_t f = 0; f < 2; f++) {
+        Hmm *hmm = hmmContinuous_getEmptyHmm(threeStateHdp, 0.0, 0.02);
+        HdpHmm *hdpHmm = (HdpHmm *) hmm;
+        for (int64_t from = 0; from < hmm->stateNumber; from++) {
+            for (int64_t to = 0; to < hmm->stateNumber; to++) {
+                hmm->addToTransitionExpectationFcn(hmm, from, to, (f + 1) * (from * hmm->stateNumber + to));
+            }
+        }
+        for (int64_t a = 2 * f; a < 2 * f + 2; a++) {
+            hdpHmm->addToAssignments(hmm, sequence + a * 3, events + a * NB_EVENT_PARAMS);
+        }
+        hmm->likelihood = -1.5;
+        files[f] = stString_print("./temp%" PRIi64 ".expectations", st_randomInt(0, INT64_MAX));
+        CuAssertTrue(testCase, !stFile_exists(files[f]));
+        hmmContinuous_writeToBinaryFile(files[f], hmm, threeStateHdp);
+        hdpHmm_destruct(hmm);
+    }
+
+    // the loader takes the binary layout
+    Hmm *hmm = hdpHmm_loadFromFile(files[1], NULL);
+    HdpHmm *hdpHmm = (HdpHmm *) hmm;
+    CuAssertTrue(testCase, hmm->type == threeStateHdp);
+    CuAssertDblEquals(testCase, 0.02, hdpHmm->threshold, 0.0);
+    CuAssertTrue(testCase, hdpHmm->numberOfAssignments == 2);
+    CuAssertDblEquals(testCase, 63.25, hdpHmm->eventAssignments[0], 0.0);
+    CuAssertTrue(testCase, strncmp(sequence + 6, hdpHmm->kmerAssignments, KMER_LENGTH) == 0);
+    hdpHmm_destruct(hmm);
+
+    // merged, the assignments are in file order
+    hmm = hmmContinuous_mergeBinaryExpectations(files, 2, 2);
+    hdpHmm = (HdpHmm *) hmm;
+    CuAssertDblEquals(testCase, -3.0, hmm->likelihood, 0.0);
+    for (int64_t from = 0; from < hmm->stateNumber; from++) {
+        for (int64_t to = 0; to < hmm->stateNumber; to++) {
+            CuAssertDblEquals(testCase, 3.0 * (from * hmm->stateNumber + to),
+                              hmm->getTransitionsExpFcn(hmm, from, to), 0.0);
+        }
+    }
+    CuAssertTrue(testCase, hdpHmm->numberOfAssignments == 4);
+    CuAssertTrue(testCase, hdpHmm->maxAssignments >= 4);
+    for (int64_t a = 0; a < 4; a++) {
+        CuAssertDblEquals(testCase, events[a * NB_EVENT_PARAMS], hdpHmm->eventAssignments[a], 0.0);
+        CuAssertTrue(testCase,
+                     strncmp(sequence + a * 3, hdpHmm->kmerAssignments + a * KMER_LENGTH, KMER_LENGTH) == 0);
+    }
+    hdpHmm_destruct(hmm);
+
+    for (int64_t f = 0; f < 2; f++) {
+        stFile_rmrf(files[f]);
+        free(files[f]);
+    }
+}
+
+static void test_hdpHmm_addExpectations(CuTest *testCase) {
+    char *sequence = "ACGTCATACATGACTATA";
+    float events[4 * NB_EVENT_PARAMS] = { 65.0, 1.0, 0.1, 64.5, 1.0, 0.1, 63.25, 1.0, 0.1, 62.0, 1.0, 0.1 };
+    char *kmers = stString_copy(sequence);
+
+    // the expectations of two reads, each with two assignments, summed into an empty HMM
+    Hmm *hmm = hmmContinuous_getEmptyHmm(threeStateHdp, 0.0, 0.02);
+    for (int64_t r = 0; r < 2; r++) {
+        Hmm *readHmm = hmmContinuous_getEmptyHmm(threeStateHdp, 0.0, 0.02);
+        for (int64_t from = 0; from < readHmm->stateNumber; from++) {
+            for (int64_t to = 0; to < readHmm->stateNumber; to++) {
+                readHmm->addToTransitionExpectationFcn(readHmm, from, to, (r + 1) * (from * readHmm->stateNumber + to));
+            }
+        }
+        for (int64_t a = 2 * r; a < 2 * r + 2; a++) {
+            ((HdpHmm *) readHmm)->addToAssignments(readHmm, kmers + a * 3, events + a * NB_EVENT_PARAMS);
+        }
+        readHmm->likelihood = -1.5;
+        hmmContinuous_addExpectations(hmm, readHmm, threeStateHdp);
+        hdpHmm_destruct(readHmm);
+    }
+
+    // the assignments are copies, they outlive the events and kmers of the reads
+    float means[4];
+    for (int64_t a = 0; a < 4; a++) {
+        means[a] = events[a * NB_EVENT_PARAMS];
+        events[a * NB_EVENT_PARAMS] = 0.0;
+    }
+    memset(kmers, 'N', strlen(kmers));
+
+    HdpHmm *hdpHmm = (HdpHmm *) hmm;
+    CuAssertDblEquals(testCase, -3.0, hmm->likelihood, 0.0);
+    for (int64_t from = 0; from < hmm->stateNumber; from++) {
+        for (int64_t to = 0; to < hmm->stateNumber; to++) {
+            CuAssertDblEquals(testCase, 3.0 * (from * hmm->stateNumber + to),
+                              hmm->getTransitionsExpFcn(hmm, from, to), 0.0);
+        }
+    }
+    CuAssertTrue(testCase, hdpHmm->numberOfAssignments == 4);
+    CuAssertTrue(testCase, hdpHmm->maxAssignments >= 4);
+    for (int64_t a = 0; a < 4; a++) {
+        CuAssertDblEquals(testCase, means[a], hdpHmm->eventAssignments[a], 0.0);
+        CuAssertTrue(testCase,
+                     strncmp(sequence + a * 3, hdpHmm->kmerAssignments + a * KMER_LENGTH, KMER_LENGTH) == 0);
+    }
+    hdpHmm_destruct(hmm);
+    free(kmers);
+}
+
+static void test_hdpHmm_assignmentStorage(CuTest *testCase) {
+    // more assignments than the first allocation, made from events and kmers that are gone afterwards
+    int64_t nbAssignments = 3000;
+    Hmm *hmm = hmmContinuous_getEmptyHmm(threeStateHdp, 0.0, 0.02);
+    HdpHmm *hdpHmm = (HdpHmm *) hmm;
+    for (int64_t a = 0; a < nbAssignments; a++) {
+        float *event = st_malloc(NB_EVENT_PARAMS * sizeof(float));
+        event[0] = 50.0 + a * 0.01;
+        char *kmer = stString_print("%c%c%c%c%c%c", "ACGT"[a % 4], "ACGT"[(a / 4) % 4], "ACGT"[(a / 16) % 4],
+                                    "ACGT"[(a / 64) % 4], "ACGT"[(a / 256) % 4], "ACGT"[(a / 1024) % 4]);
+        hdpHmm->addToAssignments(hmm, kmer, event);
+        free(event);
+        free(kmer);
+    }
+    CuAssertTrue(testCase, hdpHmm->numberOfAssignments == nbAssignments);
+    CuAssertTrue(testCase, hdpHmm->maxAssignments >= nbAssignments);
+
+    // the same assignments come back from the binary layout
+    char *file = stString_print("./temp%" PRIi64 ".expectations", st_randomInt(0, INT64_MAX));
+    CuAssertTrue(testCase, !stFile_exists(file));
+    hmmContinuous_writeToBinaryFile(file, hmm, threeStateHdp);
+    Hmm *loaded = hdpHmm_loadFromFile(file, NULL);
+    HdpHmm *loadedHdpHmm = (HdpHmm *) loaded;
+    CuAssertTrue(testCase, loadedHdpHmm->numberOfAssignments == nbAssignments);
+    for (int64_t a = 0; a < nbAssignments; a++) {
+        CuAssertDblEquals(testCase, (float) (50.0 + a * 0.01), hdpHmm->eventAssignments[a], 0.0);
+        CuAssertDblEquals(testCase, hdpHmm->eventAssignments[a], loadedHdpHmm->eventAssignments[a], 0.0);
+        CuAssertTrue(testCase, hdpHmm->kmerAssignments[a * KMER_LENGTH] == "ACGT"[a % 4]);
+        CuAssertTrue(testCase, hdpHmm->kmerAssignments[a * KMER_LENGTH + 5] == "ACGT"[(a / 1024) % 4]);
+    }
+    CuAssertTrue(testCase, memcmp(hdpHmm->kmerAssignments, loadedHdpHmm->kmerAssignments,
+                                  nbAssignments * KMER_LENGTH) == 0);
+    hdpHmm_destruct(loaded);
+    hdpHmm_destruct(hmm);
+    stFile_rmrf(file);
+    free(file);
+}
+
 static void test_HdpHmmWithAssignments_flat_model(CuTest *testCase) {
     char *alignmentFile = stString_print("../../cPecan/tests/test_alignments/simple_alignment.tsv");
     char *templateModelFile = "../../cPecan/models/template_median68pA.model";
@@ -1207,12 +1467,17 @@ CuSuite *NanoporeHdpTestSuite(void) {
     SUITE_ADD_TEST(suite, test_kmer_id);
     SUITE_ADD_TEST(suite, test_serialization);
     SUITE_ADD_TEST(suite, test_nhdp_serialization);
+    SUITE_ADD_TEST(suite, test_nhdp_binarySerialization);
+    SUITE_ADD_TEST(suite, test_nhdp_alignmentParsing);
     SUITE_ADD_TEST(suite, test_sm3hdp_cell);
     SUITE_ADD_TEST(suite, test_sm3Hdp_dpDiagonal);
     SUITE_ADD_TEST(suite, test_sm3Hdp_diagonalDPCalculations);
     SUITE_ADD_TEST(suite, test_sm3Hdp_getAlignedPairsWithBanding);
     SUITE_ADD_TEST(suite, test_sm3Hdp_getAlignedPairsWithBanding_withReplacement);
     SUITE_ADD_TEST(suite, test_hdpHmmWithoutAssignments);
+    SUITE_ADD_TEST(suite, test_hdpHmm_binaryExpectations);
+    SUITE_ADD_TEST(suite, test_hdpHmm_addExpectations);
+    SUITE_ADD_TEST(suite, test_hdpHmm_assignmentStorage);
     SUITE_ADD_TEST(suite, test_HdpHmmWithAssignments_flat_model);
     SUITE_ADD_TEST(suite, test_HdpHmmWithAssignments_flat_model2);
     SUITE_ADD_TEST(suite, test_HdpHmmWithAssignments_multiset_model);
@@ -18,6 +18,9 @@
 #include "multipleAligner.h"
 #include "emissionMatrix.h"
 #include "discreteHmm.h"
+#include "indexedFasta.h"
+#include "jobScheduler.h"
+#include "reorderBuffer.h"
 
 static void test_diagonal(CuTest *testCase) {
     //Construct an example diagonal.
@@ -130,6 +133,14 @@ static void test_bands(CuTest *testCase) {
     CuAssertTrue(testCase, testDiagonalsEqual(bandIterator_getPrevious(bandIt), diagonal_construct(1, -1, 1)));
     CuAssertTrue(testCase, testDiagonalsEqual(bandIterator_getPrevious(bandIt), diagonal_construct(0, 0, 0)));
 
+    //The area is the sum of the widths of the diagonals above
+    CuAssertIntEquals(testCase, 33, band_getArea(band));
+    CuAssertIntEquals(testCase, 33, getBandArea(anchorPairs, lX, lY, 2));
+    //Without anchors a wide enough band is the whole matrix
+    stList *noAnchorPairs = stList_construct();
+    CuAssertIntEquals(testCase, (lX + 1) * (lY + 1), getBandArea(noAnchorPairs, lX, lY, 2 * (lX + lY)));
+    stList_destruct(noAnchorPairs);
+
     //Cleanup
     bandIterator_destruct(bandIt);
     band_destruct(band);
@@ -275,6 +286,86 @@ static void test_dpMatrix(CuTest *testCase) {
     dpMatrix_destruct(dpMatrix);
 }
 
+static void test_alignedPairBuffer(CuTest *testCase) {
+    int64_t lX = 50, lY = 60;
+    // make some random aligned pairs, enough to make the buffer grow
+    stList *alignedPairsList = stList_construct3(0, (void (*)(void *)) stIntTuple_destruct);
+    AlignedPairBuffer *alignedPairs = alignedPairBuffer_construct(0);
+    for (int64_t i = 0; i < 1000; i++) {
+        int64_t prob = st_randomInt(0, PAIR_ALIGNMENT_PROB_1 / 50);
+        int64_t x = st_randomInt(0, lX);
+        int64_t y = st_randomInt(0, lY);
+        stList_append(alignedPairsList, stIntTuple_construct3(prob, x, y));
+        alignedPairBuffer_add(alignedPairs, prob, x, y);
+    }
+    CuAssertIntEquals(testCase, 1000, alignedPairs->length);
+    CuAssertTrue(testCase, alignedPairs->maxLength >= alignedPairs->length);
+
+    // round trip to the list form
+    stList *alignedPairsList2 = alignedPairBuffer_toList(alignedPairs);
+    AlignedPairBuffer *alignedPairs2 = alignedPairBuffer_fromList(alignedPairsList2);
+    CuAssertIntEquals(testCase, stList_length(alignedPairsList), stList_length(alignedPairsList2));
+    CuAssertIntEquals(testCase, alignedPairs->length, alignedPairs2->length);
+    for (int64_t i = 0; i < stList_length(alignedPairsList); i++) {
+        CuAssertTrue(testCase, stIntTuple_cmpFn(stList_get(alignedPairsList, i),
+                                                stList_get(alignedPairsList2, i)) == 0);
+        CuAssertIntEquals(testCase, alignedPairs->probs[i], alignedPairs2->probs[i]);
+        CuAssertIntEquals(testCase, alignedPairs->x[i], alignedPairs2->x[i]);
+        CuAssertIntEquals(testCase, alignedPairs->y[i], alignedPairs2->y[i]);
+    }
+
+    // indel probabilities and reweighting match the list versions
+    for (int64_t k = 0; k < 2; k++) {
+        int64_t seqLength = k ? lX : lY;
+        int64_t *indelProbs = getIndelProbabilities(alignedPairsList, seqLength, k);
+        int64_t *indelProbs2 = alignedPairBuffer_getIndelProbabilities(alignedPairs, seqLength, k);
+        for (int64_t i = 0; i < seqLength; i++) {
+            CuAssertIntEquals(testCase, indelProbs[i], indelProbs2[i]);
+        }
+        free(indelProbs);
+        free(indelProbs2);
+    }
+    alignedPairsList = reweightAlignedPairs2(alignedPairsList, lX, lY, 0.5);
+    alignedPairBuffer_reweight(alignedPairs, lX, lY, 0.5);
+    CuAssertIntEquals(testCase, stList_length(alignedPairsList), alignedPairs->length);
+    for (int64_t i = 0; i < alignedPairs->length; i++) {
+        stIntTuple *aPair = stList_get(alignedPairsList, i);
+        CuAssertIntEquals(testCase, stIntTuple_get(aPair, 0), alignedPairs->probs[i]);
+        CuAssertIntEquals(testCase, stIntTuple_get(aPair, 1), alignedPairs->x[i]);
+        CuAssertIntEquals(testCase, stIntTuple_get(aPair, 2), alignedPairs->y[i]);
+    }
+
+    // sorting keeps the triples together and orders them by x + y
+    stSortedSet *pairsSet = stList_getSortedSet(alignedPairsList2, (int (*)(const void *, const void *)) stIntTuple_cmpFn);
+    alignedPairBuffer_sortByXPlusYCoordinate(alignedPairs2);
+    for (int64_t i = 0; i < alignedPairs2->length; i++) {
+        if (i > 0) {
+            CuAssertTrue(testCase, alignedPairs2->x[i - 1] + alignedPairs2->y[i - 1] <=
+                                   alignedPairs2->x[i] + alignedPairs2->y[i]);
+        }
+        stIntTuple *aPair = stIntTuple_construct3(alignedPairs2->probs[i], alignedPairs2->x[i], alignedPairs2->y[i]);
+        CuAssertTrue(testCase, stSortedSet_search(pairsSet, aPair) != NULL);
+        stIntTuple_destruct(aPair);
+    }
+
+    // appending with an offset shifts the coordinates only
+    alignedPairBuffer_clear(alignedPairs);
+    CuAssertIntEquals(testCase, 0, alignedPairs->length);
+    alignedPairBuffer_appendWithOffset(alignedPairs, alignedPairs2, 10, 20);
+    CuAssertIntEquals(testCase, alignedPairs2->length, alignedPairs->length);
+    for (int64_t i = 0; i < alignedPairs->length; i++) {
+        CuAssertIntEquals(testCase, alignedPairs2->probs[i], alignedPairs->probs[i]);
+        CuAssertIntEquals(testCase, alignedPairs2->x[i] + 10, alignedPairs->x[i]);
+        CuAssertIntEquals(testCase, alignedPairs2->y[i] + 20, alignedPairs->y[i]);
+    }
+
+    stSortedSet_destruct(pairsSet);
+    stList_destruct(alignedPairsList);
+    stList_destruct(alignedPairsList2);
+    alignedPairBuffer_destruct(alignedPairs);
+    alignedPairBuffer_destruct(alignedPairs2);
+}
+
 static void test_diagonalDPCalculations(CuTest *testCase) {
     // make some simple DNA sequences
     char *sX = "AGCG";
@@ -342,8 +433,8 @@ static void test_diagonalDPCalculations(CuTest *testCase) {
     }
 
     //Now do the posterior probabilities
-    stList *alignedPairs = stList_construct3(0, (void (*)(void *)) stIntTuple_destruct);
-    void *extraArgs[1] = { alignedPairs };
+    AlignedPairBuffer *alignedPairBuffer = alignedPairBuffer_construct(0);
+    void *extraArgs[1] = { alignedPairBuffer };
     for (int64_t i = 1; i <= lX + lY; i++) {
         PairwiseAlignmentParameters *p = pairwiseAlignmentBandingParameters_construct();
         p->threshold = 0.2;
@@ -351,6 +442,8 @@ static void test_diagonalDPCalculations(CuTest *testCase) {
                                                totalProbForward, p, extraArgs);
         pairwiseAlignmentBandingParameters_destruct(p);
     }
+    stList *alignedPairs = alignedPairBuffer_toList(alignedPairBuffer);
+    alignedPairBuffer_destruct(alignedPairBuffer);
 
     // Make a list of the correct anchor points
     stSortedSet *alignedPairsSet = stSortedSet_construct3((int (*)(const void *, const void *)) stIntTuple_cmpFn,
@@ -444,14 +537,16 @@ static void test_getAlignedPairsWithBanding(CuTest *testCase) {
 
         stList *anchorPairs = getRandomAnchorPairs(lX, lY);
 
-        stList *alignedPairs = stList_construct3(0, (void (*)(void *)) stIntTuple_destruct);
-        void *extraArgs[1] = { alignedPairs };
+        AlignedPairBuffer *alignedPairBuffer = alignedPairBuffer_construct(0);
+        void *extraArgs[1] = { alignedPairBuffer };
         getPosteriorProbsWithBanding(sM,
                                      anchorPairs,
                                      sX2, sY2,
                                      p,
                                      0, 0,
                                      diagonalCalculationPosteriorMatchProbs, extraArgs);
+        stList *alignedPairs = alignedPairBuffer_toList(alignedPairBuffer);
+        alignedPairBuffer_destruct(alignedPairBuffer);
         //Check the aligned pairs.
         checkAlignedPairs(testCase, alignedPairs, lX, lY);
 
@@ -465,6 +560,123 @@ static void test_getAlignedPairsWithBanding(CuTest *testCase) {
     }
 }
 
+typedef struct _testSink {
+    AlignedPairBuffer *alignedPairs;
+    int64_t windows;
+    int64_t maxXay;
+    bool outOfOrder;
+} TestSink;
+
+static void testSink_write(AlignedPairBuffer *alignedPairs, void *extraArgs) {
+    TestSink *sink = extraArgs;
+    for (int64_t i = 0; i < alignedPairs->length; i++) {
+        int64_t xay = alignedPairs->x[i] + alignedPairs->y[i];
+        if (xay < sink->maxXay) {
+            sink->outOfOrder = 1;
+        }
+        sink->maxXay = xay;
+    }
+    sink->windows++;
+    alignedPairBuffer_appendWithOffset(sink->alignedPairs, alignedPairs, 0, 0);
+}
+
+// also emits (x + 1, y) and (x + 2, y) for each pair, like the echelon posteriors, so the pairs of a traceback
+// window reach into the next one
+static void test_diagonalCalculationShiftedPosteriorMatchProbs(StateMachine *sM, int64_t xay,
+                                                               DpMatrix *forwardDpMatrix, DpMatrix *backwardDpMatrix,
+                                                               Sequence *sX, Sequence *sY, double totalProbability,
+                                                               PairwiseAlignmentParameters *p, void *extraArgs) {
+    AlignedPairBuffer *alignedPairs = ((void **) extraArgs)[0];
+    int64_t start = alignedPairs->length;
+    diagonalCalculationPosteriorMatchProbs(sM, xay, forwardDpMatrix, backwardDpMatrix, sX, sY, totalProbability, p,
+                                           extraArgs);
+    int64_t end = alignedPairs->length;
+    for (int64_t i = start; i < end; i++) {
+        for (int64_t n = 1; n < 3; n++) {
+            alignedPairBuffer_add(alignedPairs, alignedPairs->probs[i], alignedPairs->x[i] + n, alignedPairs->y[i]);
+        }
+    }
+}
+
+static void test_getAlignedPairsWithSink(CuTest *testCase) {
+    for (int64_t test = 0; test < 6; test++) {
+        bool shifted = test % 2 == 1;
+        void (*posteriorProbFn)(StateMachine *, int64_t, DpMatrix *, DpMatrix *, Sequence *, Sequence *, double,
+                                PairwiseAlignmentParameters *, void *) =
+                shifted ? test_diagonalCalculationShiftedPosteriorMatchProbs : diagonalCalculationPosteriorMatchProbs;
+
+        //Make a pair of sequences
+        char *sX = getRandomSequence(st_randomInt(0, 300));
+        char *sY = evolveSequence(sX);
+        int64_t lX = strlen(sX);
+        int64_t lY = strlen(sY);
+
+        Sequence* sX2 = sequence_construct2(lX, sX, sequence_getBase, sequence_sliceNucleotideSequence2);
+        Sequence* sY2 = sequence_construct2(lY, sY, sequence_getBase, sequence_sliceNucleotideSequence2);
+
+        //Small traceback windows and split matrices so that the sink gets called many times
+        PairwiseAlignmentParameters *p = pairwiseAlignmentBandingParameters_construct();
+        p->traceBackDiagonals = st_randomInt(1, 10);
+        p->minDiagsBetweenTraceBack = p->traceBackDiagonals + st_randomInt(2, 10);
+        p->diagonalExpansion = st_randomInt(0, 10) * 2;
+        p->splitMatrixBiggerThanThis = st_randomInt(100, 2000);
+
+        StateMachine *sM = stateMachine5_construct(fiveState, SYMBOL_NUMBER_NO_N,
+                                                   emissions_symbol_setEmissionsToDefaults,
+                                                   emissions_symbol_getGapProb,
+                                                   emissions_symbol_getGapProb,
+                                                   emissions_symbol_getMatchProb,
+                                                   cell_updateExpectations);
+
+        stList *anchorPairs = getRandomAnchorPairs(lX, lY);
+
+        TestSink sink = { alignedPairBuffer_construct(0), 0, -1, 0 };
+        getAlignedPairsUsingAnchorsWithSink(sM, sX2, sY2, anchorPairs, p, posteriorProbFn, 1, 1, testSink_write,
+                                            &sink);
+        AlignedPairBuffer *alignedPairs = getAlignedPairBufferUsingAnchors(sM, sX2, sY2, anchorPairs, p,
+                                                                           posteriorProbFn, 1, 1);
+
+        //The pairs are streamed in increasing x + y order
+        CuAssertTrue(testCase, !sink.outOfOrder);
+        if (alignedPairs->length > 0) {
+            CuAssertTrue(testCase, sink.windows > 0);
+        }
+
+        //The streamed pairs are the collected ones, in the order of sorting them all at once
+        CuAssertIntEquals(testCase, alignedPairs->length, sink.alignedPairs->length);
+        alignedPairBuffer_sortByXPlusYCoordinate(alignedPairs);
+        for (int64_t i = 0; i < alignedPairs->length; i++) {
+            CuAssertTrue(testCase, alignedPairs->probs[i] == sink.alignedPairs->probs[i]);
+            CuAssertTrue(testCase, alignedPairs->x[i] == sink.alignedPairs->x[i]);
+            CuAssertTrue(testCase, alignedPairs->y[i] == sink.alignedPairs->y[i]);
+        }
+        stList *alignedPairsList = alignedPairBuffer_toList(alignedPairs);
+        stList *streamedPairsList = alignedPairBuffer_toList(sink.alignedPairs);
+        stSortedSet *alignedPairsSet = stList_getSortedSet(alignedPairsList,
+                                                           (int (*)(const void *, const void *)) stIntTuple_cmpFn);
+        for (int64_t i = 0; i < stList_length(streamedPairsList); i++) {
+            CuAssertTrue(testCase, stSortedSet_search(alignedPairsSet, stList_get(streamedPairsList, i)) != NULL);
+        }
+        if (!shifted) {
+            checkAlignedPairs(testCase, streamedPairsList, lX, lY);
+        }
+
+        //Cleanup
+        stSortedSet_destruct(alignedPairsSet);
+        stList_destruct(alignedPairsList);
+        stList_destruct(streamedPairsList);
+        alignedPairBuffer_destruct(alignedPairs);
+        alignedPairBuffer_destruct(sink.alignedPairs);
+        stList_destruct(anchorPairs);
+        pairwiseAlignmentBandingParameters_destruct(p);
+        stateMachine_destruct(sM);
+        free(sX);
+        free(sY);
+        sequence_sequenceDestroy(sX2);
+        sequence_sequenceDestroy(sY2);
+    }
+}
+
 static void checkBlastPairs(CuTest *testCase, stList *blastPairs, int64_t lX, int64_t lY, bool checkNonOverlapping) {
     //st_logInfo("I got %" PRIi64 " pairs to check\n", stList_length(blastPairs));
     //printf("I got %" PRIi64 " pairs to check\n", stList_length(blastPairs));
@@ -664,6 +876,48 @@ static void test_getSplitPoints(CuTest *testCase) {
     stList_destruct(anchorPairs);
 }
 
+static void test_getPosteriorProbsWithBandingPeakMemory(CuTest *testCase) {
+    PairwiseAlignmentParameters *p = pairwiseAlignmentBandingParameters_construct();
+    int64_t stateNumber = 5, cellSize = stateNumber * sizeof(double);
+
+    //Without anchors and with a band as wide as the matrix the forward matrix is all live at the end
+    int64_t lX = 100, lY = 100;
+    stList *noAnchorPairs = stList_construct();
+    p->diagonalExpansion = 2 * (lX + lY);
+    int64_t memory = getPosteriorProbsWithBandingPeakMemory(noAnchorPairs, lX, lY, stateNumber, p);
+    CuAssertTrue(testCase, memory >= (lX + 1) * (lY + 1) * cellSize);
+    CuAssertTrue(testCase, memory < 2 * (lX + 1) * (lY + 1) * cellSize);
+    stList_destruct(noAnchorPairs);
+
+    //Along a diagonal of anchors only the diagonals since the last traceback are live
+    lX = 10000;
+    lY = 10000;
+    p->diagonalExpansion = 20;
+    stList *anchorPairs = stList_construct3(0, (void (*)(void *)) stIntTuple_destruct);
+    for (int64_t i = 0; i < lX; i += 10) {
+        stList_append(anchorPairs, stIntTuple_construct2(i, i));
+    }
+    memory = getPosteriorProbsWithBandingPeakMemory(anchorPairs, lX, lY, stateNumber, p);
+    CuAssertTrue(testCase, memory >= (p->minDiagsBetweenTraceBack + 1) * cellSize);
+    CuAssertTrue(testCase, memory < getBandArea(anchorPairs, lX, lY, p->diagonalExpansion) * cellSize);
+    //Tracing back more often lowers it
+    p->minDiagsBetweenTraceBack = 100;
+    int64_t lowerMemory = getPosteriorProbsWithBandingPeakMemory(anchorPairs, lX, lY, stateNumber, p);
+    CuAssertTrue(testCase, lowerMemory < memory);
+
+    //The aligned pairs come on top, all of them unless they are streamed
+    int64_t streamedMemory = getAlignedPairsUsingAnchorsPeakMemory(anchorPairs, lX, lY, stateNumber, p, 1);
+    int64_t collectedMemory = getAlignedPairsUsingAnchorsPeakMemory(anchorPairs, lX, lY, stateNumber, p, 0);
+    CuAssertTrue(testCase, streamedMemory > lowerMemory);
+    CuAssertTrue(testCase, collectedMemory > streamedMemory);
+    //At most 1/threshold pairs per diagonal
+    CuAssertTrue(testCase, collectedMemory - lowerMemory <= 2 * 3 * sizeof(int64_t) * (lX + lY) / p->threshold
+                                                          + 1000);
+
+    stList_destruct(anchorPairs);
+    pairwiseAlignmentBandingParameters_destruct(p);
+}
+
 static void test_getAlignedPairs(CuTest *testCase) {
     for (int64_t test = 0; test < 100; test++) {
         //Make a pair of sequences
@@ -941,6 +1195,434 @@ static void test_hmmDiscrete_EM_5State_symbols(CuTest *testCase) {
     test_HmmDiscrete_em(testCase, fiveState, SYMBOL_NUMBER_NO_N);
 }
 
+static double test_totalTransitionExpectation(Hmm *hmm) {
+    double total = 0.0;
+    for (int64_t from = 0; from < hmm->stateNumber; from++) {
+        for (int64_t to = 0; to < hmm->stateNumber; to++) {
+            total += hmm->getTransitionsExpFcn(hmm, from, to);
+        }
+    }
+    return total;
+}
+
+static Hmm *test_hmmDiscrete_constructEmpty() {
+    return hmmDiscrete_constructEmpty(0.0, 5, SYMBOL_NUMBER_NO_N, fiveState,
+                                      hmmDiscrete_addToTransitionExpectation,
+                                      hmmDiscrete_setTransitionExpectation,
+                                      hmmDiscrete_getTransitionExpectation,
+                                      hmmDiscrete_addToEmissionExpectation,
+                                      hmmDiscrete_setEmissionExpectation,
+                                      hmmDiscrete_getEmissionExpectation,
+                                      emissions_discrete_getBaseIndex);
+}
+
+static void test_hmmDiscrete_expectationsThreshold(CuTest *testCase) {
+    Hmm *hmmD = test_hmmDiscrete_constructEmpty();
+    hmmDiscrete_randomize(hmmD);
+    StateMachineFunctions *sMfs = stateMachineFunctions_construct(emissions_symbol_getGapProb,
+                                                                  emissions_symbol_getGapProb,
+                                                                  emissions_symbol_getMatchProb);
+    StateMachine *sM = getStateMachine5(hmmD, sMfs);
+    PairwiseAlignmentParameters *p = pairwiseAlignmentBandingParameters_construct();
+    char *sX = getRandomSequence(st_randomInt(100, 300));
+    char *sY = evolveSequence(sX);
+
+    // by default every transition counts
+    CuAssertDblEquals(testCase, 0.0, p->expectationsThreshold, 0.0);
+
+    // every transition, the threshold of the drivers and a threshold that leaves most of the transitions out
+    double thresholds[3] = { 0.0, EXPECTATIONS_THRESHOLD, 0.5 };
+    Hmm *expectations[3];
+    for (int64_t i = 0; i < 3; i++) {
+        p->expectationsThreshold = thresholds[i];
+        expectations[i] = hmmDiscrete_getEmptyClone(hmmD);
+        getExpectations(sM, expectations[i], sX, sY, strlen(sX), strlen(sY), p, sequence_getBase,
+                        getBlastPairsForPairwiseAlignmentParameters, 0, 0);
+    }
+
+    // the transitions left out by the threshold of the drivers don't change the expectations
+    CuAssertDblEquals(testCase, expectations[0]->likelihood, expectations[1]->likelihood, 0.0);
+    for (int64_t from = 0; from < hmmD->stateNumber; from++) {
+        for (int64_t to = 0; to < hmmD->stateNumber; to++) {
+            CuAssertDblEquals(testCase, expectations[0]->getTransitionsExpFcn(expectations[0], from, to),
+                              expectations[1]->getTransitionsExpFcn(expectations[1], from, to), 1e-6);
+        }
+    }
+    for (int64_t x = 0; x < hmmD->symbolSetSize; x++) {
+        for (int64_t y = 0; y < hmmD->symbolSetSize; y++) {
+            CuAssertDblEquals(testCase, expectations[0]->getEmissionExpFcn(expectations[0], sM->matchState, x, y),
+                              expectations[1]->getEmissionExpFcn(expectations[1], sM->matchState, x, y), 1e-6);
+        }
+    }
+    // a large one does
+    CuAssertTrue(testCase, test_totalTransitionExpectation(expectations[2])
+                           < test_totalTransitionExpectation(expectations[0]));
+
+    for (int64_t i = 0; i < 3; i++) {
+        hmmDiscrete_destruct(expectations[i]);
+    }
+    free(sX);
+    free(sY);
+    pairwiseAlignmentBandingParameters_destruct(p);
+    stateMachine_destruct(sM);
+    hmmDiscrete_destruct(hmmD);
+}
+
+static int64_t test_complementBaseIndex(void *base) {
+    int64_t i = emissions_discrete_getBaseIndex(base);
+    return i < 4 ? 3 - i : i;
+}
+
+static void test_hmmDiscrete_expectationsElementIndexFcn(CuTest *testCase) {
+    // the element indices cached in a Sequence by the expectations of one hmm are not used by an hmm that indexes the
+    // elements differently
+    Hmm *hmmD = test_hmmDiscrete_constructEmpty();
+    hmmDiscrete_randomize(hmmD);
+    StateMachineFunctions *sMfs = stateMachineFunctions_construct(emissions_symbol_getGapProb,
+                                                                  emissions_symbol_getGapProb,
+                                                                  emissions_symbol_getMatchProb);
+    StateMachine *sM = getStateMachine5(hmmD, sMfs);
+    PairwiseAlignmentParameters *p = pairwiseAlignmentBandingParameters_construct();
+    char *sX = getRandomSequence(st_randomInt(100, 300));
+    char *sY = evolveSequence(sX);
+    int64_t lX = strlen(sX), lY = strlen(sY);
+    Sequence *SsX = sequence_construct2(lX, sX, sequence_getBase, sequence_sliceNucleotideSequence2);
+    Sequence *SsY = sequence_construct2(lY, sY, sequence_getBase, sequence_sliceNucleotideSequence2);
+
+    Hmm *expectations = hmmDiscrete_getEmptyClone(hmmD);
+    Hmm *complementExpectations = hmmDiscrete_getEmptyClone(hmmD);
+    complementExpectations->getElementIndexFcn = test_complementBaseIndex;
+    stList *anchorPairs = getBlastPairsForPairwiseAlignmentParameters(sX, sY, p);
+    getExpectationsUsingAnchors(sM, expectations, SsX, SsY, anchorPairs, p, diagonalCalculation_Expectations, 0, 0);
+    getExpectationsUsingAnchors(sM, complementExpectations, SsX, SsY, anchorPairs, p,
+                                diagonalCalculation_Expectations, 0, 0);
+
+    // the same emissions, counted under the complemented indices
+    for (int64_t x = 0; x < 4; x++) {
+        for (int64_t y = 0; y < 4; y++) {
+            CuAssertDblEquals(testCase, expectations->getEmissionExpFcn(expectations, sM->matchState, x, y),
+                              complementExpectations->getEmissionExpFcn(complementExpectations, sM->matchState,
+                                                                        3 - x, 3 - y), 1e-6);
+        }
+    }
+
+    stList_destruct(anchorPairs);
+    hmmDiscrete_destruct(expectations);
+    hmmDiscrete_destruct(complementExpectations);
+    sequence_sequenceDestroy(SsX);
+    sequence_sequenceDestroy(SsY);
+    free(sX);
+    free(sY);
+    pairwiseAlignmentBandingParameters_destruct(p);
+    stateMachine_destruct(sM);
+    hmmDiscrete_destruct(hmmD);
+}
+
+static void test_hmmDiscrete_squaremExtrapolate(CuTest *testCase) {
+    // EM steps converging linearly to a fixed point, hmm_k = (1 - w_k) fixedPoint + w_k other with w_k = 0.5 * 0.6^k,
+    // SQUAREM extrapolates the first three to the fixed point
+    Hmm *fixedPoint = test_hmmDiscrete_constructEmpty();
+    Hmm *other = test_hmmDiscrete_constructEmpty();
+    hmmDiscrete_randomize(fixedPoint);
+    hmmDiscrete_randomize(other);
+    hmmDiscrete_normalize2(fixedPoint, TRUE);
+    hmmDiscrete_normalize2(other, TRUE);
+    Hmm *steps[3];
+    for (int64_t k = 0; k < 3; k++) {
+        double w = 0.5 * pow(0.6, k);
+        steps[k] = test_hmmDiscrete_constructEmpty();
+        for (int64_t from = 0; from < fixedPoint->stateNumber; from++) {
+            for (int64_t to = 0; to < fixedPoint->stateNumber; to++) {
+                steps[k]->setTransitionFcn(steps[k], from, to,
+                                           (1 - w) * fixedPoint->getTransitionsExpFcn(fixedPoint, from, to)
+                                           + w * other->getTransitionsExpFcn(other, from, to));
+            }
+        }
+        for (int64_t state = 0; state < fixedPoint->stateNumber; state++) {
+            for (int64_t x = 0; x < fixedPoint->symbolSetSize; x++) {
+                for (int64_t y = 0; y < fixedPoint->symbolSetSize; y++) {
+                    steps[k]->setEmissionExpectationFcn(
+                            steps[k], state, x, y, (1 - w) * fixedPoint->getEmissionExpFcn(fixedPoint, state, x, y)
+                                                   + w * other->getEmissionExpFcn(other, state, x, y));
+                }
+            }
+        }
+    }
+    Hmm *extrapolated = test_hmmDiscrete_constructEmpty();
+    double alpha = hmmDiscrete_squaremExtrapolate(steps[0], steps[1], steps[2], extrapolated);
+    CuAssertDblEquals(testCase, -1.0 / (1.0 - 0.6), alpha, 1e-9);
+    for (int64_t from = 0; from < fixedPoint->stateNumber; from++) {
+        for (int64_t to = 0; to < fixedPoint->stateNumber; to++) {
+            CuAssertDblEquals(testCase, fixedPoint->getTransitionsExpFcn(fixedPoint, from, to),
+                              extrapolated->getTransitionsExpFcn(extrapolated, from, to), 1e-9);
+        }
+    }
+    for (int64_t state = 0; state < fixedPoint->stateNumber; state++) {
+        for (int64_t x = 0; x < fixedPoint->symbolSetSize; x++) {
+            for (int64_t y = 0; y < fixedPoint->symbolSetSize; y++) {
+                CuAssertDblEquals(testCase, fixedPoint->getEmissionExpFcn(fixedPoint, state, x, y),
+                                  extrapolated->getEmissionExpFcn(extrapolated, state, x, y), 1e-9);
+            }
+        }
+    }
+
+    // at the fixed point the extrapolation is the plain EM step
+    alpha = hmmDiscrete_squaremExtrapolate(fixedPoint, fixedPoint, fixedPoint, extrapolated);
+    CuAssertDblEquals(testCase, -1.0, alpha, 0.0);
+    for (int64_t from = 0; from < fixedPoint->stateNumber; from++) {
+        for (int64_t to = 0; to < fixedPoint->stateNumber; to++) {
+            CuAssertDblEquals(testCase, fixedPoint->getTransitionsExpFcn(fixedPoint, from, to),
+                              extrapolated->getTransitionsExpFcn(extrapolated, from, to), 1e-12);
+        }
+    }
+
+    for (int64_t k = 0; k < 3; k++) {
+        hmmDiscrete_destruct(steps[k]);
+    }
+    hmmDiscrete_destruct(extrapolated);
+    hmmDiscrete_destruct(fixedPoint);
+    hmmDiscrete_destruct(other);
+}
+
+static void test_hmmDiscrete_blendExpectations(CuTest *testCase) {
+    // two mini-batches, of 2 and 4 pairs, blended into empty running expectations
+    Hmm *batches[2];
+    for (int64_t b = 0; b < 2; b++) {
+        batches[b] = test_hmmDiscrete_constructEmpty();
+        hmmDiscrete_randomize(batches[b]);
+        batches[b]->likelihood = -10.0 * (b + 1);
+    }
+    Hmm *running = test_hmmDiscrete_constructEmpty();
+    hmmDiscrete_blendExpectations(running, batches[0], 0.5, 1.0 / 2);
+    hmmDiscrete_blendExpectations(running, batches[1], 0.25, 1.0 / 4);
+    double w0 = 0.75 * 0.5 / 2, w1 = 0.25 / 4;
+    CuAssertDblEquals(testCase, w0 * -10.0 + w1 * -20.0, running->likelihood, 1e-12);
+    for (int64_t from = 0; from < running->stateNumber; from++) {
+        for (int64_t to = 0; to < running->stateNumber; to++) {
+            CuAssertDblEquals(testCase, w0 * batches[0]->getTransitionsExpFcn(batches[0], from, to)
+                                        + w1 * batches[1]->getTransitionsExpFcn(batches[1], from, to),
+                              running->getTransitionsExpFcn(running, from, to), 1e-12);
+        }
+    }
+    for (int64_t b = 0; b < 2; b++) {
+        hmmDiscrete_destruct(batches[b]);
+    }
+    hmmDiscrete_destruct(running);
+}
+
+// adds a per-pair expectations HMM to the total, as the reduction of the training does
+static void testExpectationsReduction_add(void *expectations, void *total) {
+    hmmDiscrete_addExpectations(total, expectations);
+}
+
+typedef struct _testExpectationsJob {
+    int64_t index;
+    Hmm *expectations;
+    ReorderBuffer *reduction;
+} TestExpectationsJob;
+
+static void testExpectationsJob_run(void *workspace, void *arg) {
+    TestExpectationsJob *job = arg;
+    reorderBuffer_push(job->reduction, job->index, job->expectations);
+}
+
+// sums the expectations through a reorder buffer, pushed by the scheduler's threads (in cost order, whichever
+// thread gets there first) or, with nbThreads 0, from this thread in a shuffled order
+static Hmm *test_hmmDiscrete_reduceExpectations(Hmm **expectations, int64_t nbPairs, int64_t nbThreads) {
+    Hmm *total = test_hmmDiscrete_constructEmpty();
+    ReorderBuffer *reduction = reorderBuffer_construct(nbPairs, testExpectationsReduction_add, total);
+    TestExpectationsJob *jobs = st_malloc(nbPairs * sizeof(TestExpectationsJob));
+    for (int64_t i = 0; i < nbPairs; i++) {
+        jobs[i].index = i;
+        jobs[i].expectations = expectations[i];
+        jobs[i].reduction = reduction;
+    }
+    if (nbThreads == 0) {
+        for (int64_t i = nbPairs - 1; i > 0; i--) {
+            int64_t j = st_randomInt(0, i + 1);
+            TestExpectationsJob job = jobs[i];
+            jobs[i] = jobs[j];
+            jobs[j] = job;
+        }
+        for (int64_t i = 0; i < nbPairs; i++) {
+            testExpectationsJob_run(NULL, &jobs[i]);
+        }
+    } else {
+        JobScheduler *scheduler = jobScheduler_construct();
+        for (int64_t i = 0; i < nbPairs; i++) {
+            jobScheduler_add(scheduler, testExpectationsJob_run, &jobs[i], st_randomInt(1, 100));
+        }
+        jobScheduler_run(scheduler, nbThreads, NULL, NULL, NULL);
+        jobScheduler_destruct(scheduler);
+    }
+    reorderBuffer_destruct(reduction);
+    free(jobs);
+    return total;
+}
+
+static void test_hmmDiscrete_addExpectations(CuTest *testCase) {
+    Hmm *hmmD = test_hmmDiscrete_constructEmpty();
+    hmmDiscrete_randomize(hmmD);
+    StateMachineFunctions *sMfs = stateMachineFunctions_construct(emissions_symbol_getGapProb,
+                                                                  emissions_symbol_getGapProb,
+                                                                  emissions_symbol_getMatchProb);
+    StateMachine *sM = getStateMachine5(hmmD, sMfs);
+    PairwiseAlignmentParameters *p = pairwiseAlignmentBandingParameters_construct();
+
+    // the expectations of each pair go into their own clone, and in one HMM, in order
+    int64_t nbPairs = 20;
+    Hmm *shared = hmmDiscrete_getEmptyClone(hmmD);
+    Hmm **clones = st_malloc(nbPairs * sizeof(Hmm *));
+    for (int64_t i = 0; i < nbPairs; i++) {
+        char *sX = getRandomSequence(st_randomInt(10, 100));
+        char *sY = evolveSequence(sX);
+        clones[i] = hmmDiscrete_getEmptyClone(hmmD);
+        CuAssertTrue(testCase, clones[i]->type == hmmD->type);
+        CuAssertTrue(testCase, clones[i]->symbolSetSize == hmmD->symbolSetSize);
+        CuAssertDblEquals(testCase, 0.0, clones[i]->getTransitionsExpFcn(clones[i], 0, 0), 0.0);
+        getExpectations(sM, clones[i], sX, sY, strlen(sX), strlen(sY), p, sequence_getBase,
+                        getBlastPairsForPairwiseAlignmentParameters, 0, 0);
+        getExpectations(sM, shared, sX, sY, strlen(sX), strlen(sY), p, sequence_getBase,
+                        getBlastPairsForPairwiseAlignmentParameters, 0, 0);
+        free(sX);
+        free(sY);
+    }
+
+    // the clones are summed in job order whatever order they are handed over in: the totals of a shuffled
+    // order and of 1 and 4 threads are the same to the bit
+    int64_t nbThreads[4] = { 0, 0, 1, 4 };
+    Hmm *sums[4];
+    for (int64_t k = 0; k < 4; k++) {
+        sums[k] = test_hmmDiscrete_reduceExpectations(clones, nbPairs, nbThreads[k]);
+    }
+    CuAssertDblEquals(testCase, shared->likelihood, sums[0]->likelihood, fabs(shared->likelihood) * 1e-9);
+    for (int64_t k = 1; k < 4; k++) {
+        CuAssertTrue(testCase, sums[0]->likelihood == sums[k]->likelihood);
+        for (int64_t from = 0; from < hmmD->stateNumber; from++) {
+            for (int64_t to = 0; to < hmmD->stateNumber; to++) {
+                CuAssertTrue(testCase, sums[0]->getTransitionsExpFcn(sums[0], from, to)
+                                       == sums[k]->getTransitionsExpFcn(sums[k], from, to));
+            }
+        }
+        for (int64_t state = 0; state < hmmD->stateNumber; state++) {
+            for (int64_t x = 0; x < hmmD->symbolSetSize; x++) {
+                for (int64_t y = 0; y < hmmD->symbolSetSize; y++) {
+                    CuAssertTrue(testCase, sums[0]->getEmissionExpFcn(sums[0], state, x, y)
+                                           == sums[k]->getEmissionExpFcn(sums[k], state, x, y));
+                }
+            }
+        }
+    }
+    // and they are the expectations of all the pairs
+    for (int64_t from = 0; from < hmmD->stateNumber; from++) {
+        for (int64_t to = 0; to < hmmD->stateNumber; to++) {
+            CuAssertDblEquals(testCase, shared->getTransitionsExpFcn(shared, from, to),
+                              sums[0]->getTransitionsExpFcn(sums[0], from, to), 1e-6);
+        }
+    }
+    for (int64_t x = 0; x < hmmD->symbolSetSize; x++) {
+        for (int64_t y = 0; y < hmmD->symbolSetSize; y++) {
+            CuAssertDblEquals(testCase, shared->getEmissionExpFcn(shared, sM->matchState, x, y),
+                              sums[0]->getEmissionExpFcn(sums[0], sM->matchState, x, y), 1e-6);
+        }
+    }
+
+    for (int64_t i = 0; i < nbPairs; i++) {
+        hmmDiscrete_destruct(clones[i]);
+    }
+    for (int64_t k = 0; k < 4; k++) {
+        hmmDiscrete_destruct(sums[k]);
+    }
+    free(clones);
+    hmmDiscrete_destruct(shared);
+    hmmDiscrete_destruct(hmmD);
+    stateMachine_destruct(sM);
+    pairwiseAlignmentBandingParameters_destruct(p);
+}
+
+static void test_indexedFasta(CuTest *testCase) {
+    char *fastaFile = stString_print("./temp%" PRIi64 ".fa", st_randomInt(0, INT64_MAX));
+    char *indexFile = stString_print("%s.fai", fastaFile);
+    CuAssertTrue(testCase, !stFile_exists(fastaFile));
+    FILE *fH = fopen(fastaFile, "w");
+    fprintf(fH, ">one description\nACGTA\nCGTAc\ngt\n>two\nTTTT\nGG\n>empty\n>one\nACG\n");
+    fclose(fH);
+
+    for (int64_t pass = 0; pass < 2; pass++) {
+        // the first pass builds and saves the index, the second one loads it
+        IndexedFasta *fasta = indexedFasta_construct(fastaFile);
+        CuAssertTrue(testCase, stFile_exists(indexFile));
+        CuAssertIntEquals(testCase, 4, indexedFasta_getNumberOfSequences(fasta));
+        CuAssertStrEquals(testCase, "one", indexedFasta_getSequenceName(fasta, 0));
+        CuAssertIntEquals(testCase, 0, indexedFasta_getOrdinal(fasta, "one")); // the longest "one"
+        CuAssertIntEquals(testCase, 1, indexedFasta_getOrdinal(fasta, "two"));
+        CuAssertIntEquals(testCase, -1, indexedFasta_getOrdinal(fasta, "three"));
+        CuAssertIntEquals(testCase, 12, indexedFasta_getSequenceLength(fasta, 0));
+        CuAssertIntEquals(testCase, 6, indexedFasta_getSequenceLength(fasta, 1));
+        CuAssertIntEquals(testCase, 0, indexedFasta_getSequenceLength(fasta, 2));
+
+        char *seq = indexedFasta_getSubSequence(fasta, 0, 0, 12, TRUE, FALSE);
+        CuAssertStrEquals(testCase, "ACGTACGTAcgt", seq);
+        free(seq);
+        seq = indexedFasta_getSubSequence(fasta, 0, 3, 11, TRUE, TRUE);
+        CuAssertStrEquals(testCase, "TACGTACG", seq);
+        free(seq);
+        // reverse strand regions are given as [end, start)
+        seq = indexedFasta_getSubSequence(fasta, 1, 6, 2, FALSE, TRUE);
+        CuAssertStrEquals(testCase, "CCAA", seq);
+        free(seq);
+        seq = indexedFasta_getSubSequence(fasta, 2, 0, 0, TRUE, TRUE);
+        CuAssertStrEquals(testCase, "", seq);
+        free(seq);
+        indexedFasta_destruct(fasta);
+    }
+    stFile_rmrf(indexFile);
+
+    // a one line file without a header, as written by the scripts
+    fH = fopen(fastaFile, "w");
+    fprintf(fH, "GATTACA\n");
+    fclose(fH);
+    IndexedFasta *fasta = indexedFasta_construct(fastaFile);
+    CuAssertIntEquals(testCase, 1, indexedFasta_getNumberOfSequences(fasta));
+    CuAssertIntEquals(testCase, 0, indexedFasta_getOrdinal(fasta, ""));
+    char *seq = indexedFasta_getSubSequence(fasta, 0, 1, 5, TRUE, TRUE);
+    CuAssertStrEquals(testCase, "ATTA", seq);
+    free(seq);
+    indexedFasta_destruct(fasta);
+
+    // lines of different lengths are read but not indexed
+    fH = fopen(fastaFile, "w");
+    fprintf(fH, ">ragged\nAC\nGTAC\nG\n");
+    fclose(fH);
+    stFile_rmrf(indexFile);
+    fasta = indexedFasta_construct(fastaFile);
+    CuAssertTrue(testCase, !stFile_exists(indexFile));
+    CuAssertIntEquals(testCase, 7, indexedFasta_getSequenceLength(fasta, 0));
+    seq = indexedFasta_getSubSequence(fasta, 0, 1, 6, TRUE, TRUE);
+    CuAssertStrEquals(testCase, "CGTAC", seq);
+    free(seq);
+    indexedFasta_destruct(fasta);
+
+    // an index that doesn't reach the end of the file is rebuilt, even when it is newer
+    fH = fopen(fastaFile, "w");
+    fprintf(fH, ">grown\nACGT\nAC\n");
+    fclose(fH);
+    fH = fopen(indexFile, "w");
+    fprintf(fH, "grown\t4\t7\t4\t5\n");
+    fclose(fH);
+    fasta = indexedFasta_construct(fastaFile);
+    CuAssertIntEquals(testCase, 6, indexedFasta_getSequenceLength(fasta, 0));
+    seq = indexedFasta_getSubSequence(fasta, 0, 2, 6, TRUE, TRUE);
+    CuAssertStrEquals(testCase, "GTAC", seq);
+    free(seq);
+    indexedFasta_destruct(fasta);
+
+    stFile_rmrf(indexFile);
+    stFile_rmrf(fastaFile);
+    free(indexFile);
+    free(fastaFile);
+}
+
 CuSuite* pairwiseAlignmentTestSuite(void) {
     CuSuite* suite = CuSuiteNew();
 
@@ -951,17 +1633,26 @@ CuSuite* pairwiseAlignmentTestSuite(void) {
     SUITE_ADD_TEST(suite, test_cell);
     SUITE_ADD_TEST(suite, test_dpDiagonal);
     SUITE_ADD_TEST(suite, test_dpMatrix);
+    SUITE_ADD_TEST(suite, test_alignedPairBuffer);
     SUITE_ADD_TEST(suite, test_diagonalDPCalculations);
     SUITE_ADD_TEST(suite, test_getSplitPoints);
+    SUITE_ADD_TEST(suite, test_getPosteriorProbsWithBandingPeakMemory);
     SUITE_ADD_TEST(suite, test_getBlastPairs);
     SUITE_ADD_TEST(suite, test_getBlastPairsWithRecursion);
     SUITE_ADD_TEST(suite, test_filterToRemoveOverlap);
     SUITE_ADD_TEST(suite, test_getAlignedPairs);
     SUITE_ADD_TEST(suite, test_getAlignedPairsWithBanding);
+    SUITE_ADD_TEST(suite, test_getAlignedPairsWithSink);
     SUITE_ADD_TEST(suite, test_getAlignedPairsWithRaggedEnds);
     SUITE_ADD_TEST(suite, test_hmmDiscrete_5State_symbols);
     SUITE_ADD_TEST(suite, test_hmmDiscrete_5StateAsymmetric_symbols);
     SUITE_ADD_TEST(suite, test_hmmDiscrete_EM_5State_symbols);
+    SUITE_ADD_TEST(suite, test_hmmDiscrete_addExpectations);
+    SUITE_ADD_TEST(suite, test_hmmDiscrete_expectationsThreshold);
+    SUITE_ADD_TEST(suite, test_hmmDiscrete_expectationsElementIndexFcn);
+    SUITE_ADD_TEST(suite, test_hmmDiscrete_squaremExtrapolate);
+    SUITE_ADD_TEST(suite, test_hmmDiscrete_blendExpectations);
+    SUITE_ADD_TEST(suite, test_indexedFasta);
 
     return suite;
 }
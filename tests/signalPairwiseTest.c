@@ -14,6 +14,8 @@
 #include "emissionMatrix.h"
 #include "multipleAligner.h"
 #include "randomSequences.h"
+#include "signalSeeding.h"
+#include "posteriorProbs.h"
 
 
 // brute force probability formulae
@@ -98,7 +100,7 @@ static void checkAlignedPairsForEchelon(CuTest *testCase, stList *blastPairs, in
 //////////////////////////////////////////////Function Tests/////////////////////////////////////////////////////////
 
 static void test_poissonPosteriorProb(CuTest *testCase) {
-    double event1[] = {62.784241, 0.664989, 0.00332005312085};
+    float event1[] = {62.784241, 0.664989, 0.00332005312085};
     double test0 = emissions_signal_getDurationProb(event1, 0);
     double test1 = emissions_signal_getDurationProb(event1, 1);
     double test2 = emissions_signal_getDurationProb(event1, 2);
@@ -118,7 +120,7 @@ static void test_getLogGaussPdfMatchProb(CuTest *testCase) {
     double eventModel[] = {0, 0, 1.0};
     double control = test_standardNormalPdf(0);
     char *kmer1 = "AAAAAA";
-    double event1[] = {0};
+    float event1[] = {0};
     double test = emissions_signal_logGaussMatchProb(eventModel, kmer1, event1);
     double expTest = exp(test);
     CuAssertDblEquals(testCase, expTest, control, 0.001);
@@ -126,7 +128,7 @@ static void test_getLogGaussPdfMatchProb(CuTest *testCase) {
 
     char *modelFile = stString_print("../../cPecan/models/template_median68pA.model");
     StateMachine *sM = getSignalStateMachine3Vanilla(modelFile);
-    double event2[] = {62.784241};
+    float event2[] = {62.784241};
     double control2 = test_normalPdf(62.784241, sM->EMISSION_MATCH_PROBS[1], sM->EMISSION_MATCH_PROBS[2]);
     double test2 = emissions_signal_logGaussMatchProb(sM->EMISSION_MATCH_PROBS, kmer1, event2);
     CuAssertDblEquals(testCase, test2, log(control2), 0.001);
@@ -139,14 +141,14 @@ static void test_bivariateGaussPdfMatchProb(CuTest *testCase) {
     double control = test_standardNormalPdf(0);
     double controlSq = control * control;
     char *kmer1 = "AAAAAA";
-    double event1[] = {0, 0}; // mean noise
+    float event1[] = {0, 0}; // mean noise
     double test = emissions_signal_getBivariateGaussPdfMatchProb(eventModel, kmer1, event1);
     double eTest = exp(test);
     CuAssertDblEquals(testCase, controlSq, eTest, 0.001);
 
     char *modelFile = stString_print("../../cPecan/models/template_median68pA.model");
     StateMachine *sM = getSignalStateMachine3Vanilla(modelFile);
-    double event2[] = {62.784241, 0.664989};
+    float event2[] = {62.784241, 0.664989};
     double control2a = test_normalPdf(62.784241, sM->EMISSION_MATCH_PROBS[1], sM->EMISSION_MATCH_PROBS[2]);
     double control2b = test_normalPdf(0.664989, sM->EMISSION_MATCH_PROBS[3], sM->EMISSION_MATCH_PROBS[4]);
     double control2Sq = control2a * control2b;
@@ -161,7 +163,7 @@ static void test_twoDistributionPdf(CuTest *testCase) {
     char *modelFile = stString_print("../../cPecan/models/template_median68pA.model");
     StateMachine *sM = getSignalStateMachine3Vanilla(modelFile);
 
-    double event[] = {62.784241, 0.664989}; // level_mean and noise_mean for AAAAAA
+    float event[] = {62.784241, 0.664989}; // level_mean and noise_mean for AAAAAA
     char *kmer1 = "AAAAAA";
 
     // get a sample match prob
@@ -192,7 +194,7 @@ static void test_strawMan_cell(CuTest *testCase) {
     int64_t testLength = 5;
 
     // make an event sequence and nucleotide sequence
-    double fakeEventSeq[15] = {
+    float fakeEventSeq[15] = {
             60.032615, 0.791316, 0.005, //ATGACA
             60.332089, 0.620198, 0.012, //TGACAC
             61.618848, 0.747567, 0.008, //GACACA
@@ -209,7 +211,7 @@ static void test_strawMan_cell(CuTest *testCase) {
 
     // test sequence_getEvent
     for (int64_t i = 0; i < testLength; i++) {
-        CuAssertDblEquals(testCase, *(double *)eventSeq->get(eventSeq->elements, i),
+        CuAssertDblEquals(testCase, nanopore_getEventMean(eventSeq->get(eventSeq->elements, i)),
                           fakeEventSeq[i * NB_EVENT_PARAMS], 0.0);
     }
 
@@ -257,7 +259,7 @@ static void test_stateMachine4_cell(CuTest *testCase) {
     int64_t testLength = 5;
 
     // make an event sequence and nucleotide sequence
-    double fakeEventSeq[15] = {
+    float fakeEventSeq[15] = {
             60.032615, 0.791316, 0.005, //ATGACA
             60.332089, 0.620198, 0.012, //TGACAC
             61.618848, 0.747567, 0.008, //GACACA
@@ -316,7 +318,7 @@ static void test_vanilla_cell(CuTest *testCase) {
     int64_t testLength = 5;
 
     // make an event sequence and nucleotide sequence
-    double fakeEventSeq[15] = {
+    float fakeEventSeq[15] = {
                               60.032615, 0.791316, 0.005, //ATGACA
                               60.332089, 0.620198, 0.012, //TGACAC
                               61.618848, 0.747567, 0.008, //GACACA
@@ -333,7 +335,7 @@ static void test_vanilla_cell(CuTest *testCase) {
 
     // test sequence_getEvent
     for (int64_t i = 0; i < testLength; i++) {
-        CuAssertDblEquals(testCase, *(double *)eventSeq->get(eventSeq->elements, i),
+        CuAssertDblEquals(testCase, nanopore_getEventMean(eventSeq->get(eventSeq->elements, i)),
                           fakeEventSeq[i * NB_EVENT_PARAMS], 0.0);
     }
 
@@ -381,7 +383,7 @@ static void test_echelon_cell(CuTest *testCase) {
     int64_t testLength = 5;
 
     // event sequence and nucleotide sequence
-    double fakeEventSeq[15] = {
+    float fakeEventSeq[15] = {
             60.032615, 0.791316, 0.005, //ATGACA
             60.332089, 0.620198, 0.012, //TGACAC
             61.618848, 0.747567, 0.008, //GACACA
@@ -399,7 +401,7 @@ static void test_echelon_cell(CuTest *testCase) {
 
     // test sequence_getEvent
     for (int64_t i = 0; i < testLength; i++) {
-        CuAssertDblEquals(testCase, *(double *)eventSeq->get(eventSeq->elements, i),
+        CuAssertDblEquals(testCase, nanopore_getEventMean(eventSeq->get(eventSeq->elements, i)),
                           fakeEventSeq[i * NB_EVENT_PARAMS], 0.0);
     }
 
@@ -580,7 +582,7 @@ static void test_vanilla_dpDiagonal(CuTest *testCase) {
 static void test_strawMan_diagonalDPCalculations(CuTest *testCase) {
     // make some DNA sequences and fake nanopore read data
     char *sX = "ACGATACGGACAT";
-    double sY[21] = {
+    float sY[21] = {
             58.743435, 0.887833, 0.0571, //ACGATA 0
             53.604965, 0.816836, 0.0571, //CGATAC 1
             58.432015, 0.735143, 0.0571, //GATACG 2
@@ -646,8 +648,8 @@ static void test_strawMan_diagonalDPCalculations(CuTest *testCase) {
     }
 
     // Now do the posterior probabilities, get aligned pairs with posterior match probs above threshold
-    stList *alignedPairs = stList_construct3(0, (void (*)(void *)) stIntTuple_destruct);
-    void *extraArgs[1] = { alignedPairs };
+    AlignedPairBuffer *alignedPairBuffer = alignedPairBuffer_construct(0);
+    void *extraArgs[1] = { alignedPairBuffer };
     for (int64_t i = 1; i <= lX + lY; i++) {
         PairwiseAlignmentParameters *p = pairwiseAlignmentBandingParameters_construct();
         p->threshold = 0.2;
@@ -655,6 +657,8 @@ static void test_strawMan_diagonalDPCalculations(CuTest *testCase) {
                                                totalProbForward, p, extraArgs);
         pairwiseAlignmentBandingParameters_destruct(p);
     }
+    stList *alignedPairs = alignedPairBuffer_toList(alignedPairBuffer);
+    alignedPairBuffer_destruct(alignedPairBuffer);
 
     // Make a list of the correct anchor points
     stSortedSet *alignedPairsSet = stSortedSet_construct3((int (*)(const void *, const void *)) stIntTuple_cmpFn,
@@ -688,7 +692,7 @@ static void test_stateMachine4_diagonalDPCalculations(CuTest *testCase) {
     // make some DNA sequences and fake nanopore read data
     //char *sX = "ACGATACGGACAT";
     char *sX = "CCAAATATATTACAACACACGATACGGACATCCAAATATATTACAACACCCAAATATAGCGTAACAC";
-    double sY[21] = {
+    float sY[21] = {
             58.743435, 0.887833, 0.0571, //ACGATA 0
             53.604965, 0.816836, 0.0571, //CGATAC 1
             58.432015, 0.735143, 0.0571, //GATACG 2
@@ -754,8 +758,8 @@ static void test_stateMachine4_diagonalDPCalculations(CuTest *testCase) {
     }
 
     // Now do the posterior probabilities, get aligned pairs with posterior match probs above threshold
-    stList *alignedPairs = stList_construct3(0, (void (*)(void *)) stIntTuple_destruct);
-    void *extraArgs[1] = { alignedPairs };
+    AlignedPairBuffer *alignedPairBuffer = alignedPairBuffer_construct(0);
+    void *extraArgs[1] = { alignedPairBuffer };
     for (int64_t i = 1; i <= lX + lY; i++) {
         PairwiseAlignmentParameters *p = pairwiseAlignmentBandingParameters_construct();
         p->threshold = 0.2;
@@ -763,6 +767,8 @@ static void test_stateMachine4_diagonalDPCalculations(CuTest *testCase) {
                                                totalProbForward, p, extraArgs);
         pairwiseAlignmentBandingParameters_destruct(p);
     }
+    stList *alignedPairs = alignedPairBuffer_toList(alignedPairBuffer);
+    alignedPairBuffer_destruct(alignedPairBuffer);
 
     // Make a list of the correct anchor points
     stSortedSet *alignedPairsSet = stSortedSet_construct3((int (*)(const void *, const void *)) stIntTuple_cmpFn,
@@ -795,7 +801,7 @@ static void test_stateMachine4_diagonalDPCalculations(CuTest *testCase) {
 static void test_vanilla_diagonalDPCalculations(CuTest *testCase) {
     // make some DNA sequences and fake nanopore read data
     char *sX = "ACGATACGGACAT";
-    double sY[21] = {
+    float sY[21] = {
             58.743435, 0.887833, 0.0571, //ACGATA 0
             53.604965, 0.816836, 0.0571, //CGATAC 1
             58.432015, 0.735143, 0.0571, //GATACG 2
@@ -861,8 +867,8 @@ static void test_vanilla_diagonalDPCalculations(CuTest *testCase) {
     }
 
     // Now do the posterior probabilities, get aligned pairs with posterior match probs above threshold
-    stList *alignedPairs = stList_construct3(0, (void (*)(void *)) stIntTuple_destruct);
-    void *extraArgs[1] = { alignedPairs };
+    AlignedPairBuffer *alignedPairBuffer = alignedPairBuffer_construct(0);
+    void *extraArgs[1] = { alignedPairBuffer };
     for (int64_t i = 1; i <= lX + lY; i++) {
         PairwiseAlignmentParameters *p = pairwiseAlignmentBandingParameters_construct();
         p->threshold = 0.5;
@@ -870,6 +876,8 @@ static void test_vanilla_diagonalDPCalculations(CuTest *testCase) {
                                                totalProbForward, p, extraArgs);
         pairwiseAlignmentBandingParameters_destruct(p);
     }
+    stList *alignedPairs = alignedPairBuffer_toList(alignedPairBuffer);
+    alignedPairBuffer_destruct(alignedPairBuffer);
 
     // Make a list of the correct anchor points
     stSortedSet *alignedPairsSet = stSortedSet_construct3((int (*)(const void *, const void *)) stIntTuple_cmpFn,
@@ -899,7 +907,7 @@ static void test_vanilla_diagonalDPCalculations(CuTest *testCase) {
 static void test_echelon_diagonalDPCalculations(CuTest *testCase) {
     // make some DNA sequences and fake nanopore read data
     char *sX = "ACGATACGGACAT";
-    double sY[21] = {
+    float sY[21] = {
             58.743435, 0.887833, 0.0571, //ACGATA 0
             53.604965, 0.816836, 0.0571, //CGATAC 1
             58.432015, 0.735143, 0.0571, //GATACG 2
@@ -965,8 +973,8 @@ static void test_echelon_diagonalDPCalculations(CuTest *testCase) {
     }
 
     // Now do the posterior probabilities, get aligned pairs with posterior match probs above threshold
-    stList *alignedPairs = stList_construct3(0, (void (*)(void *)) stIntTuple_destruct);
-    void *extraArgs[1] = { alignedPairs };
+    AlignedPairBuffer *alignedPairBuffer = alignedPairBuffer_construct(0);
+    void *extraArgs[1] = { alignedPairBuffer };
     for (int64_t i = 1; i <= lX + lY; i++) {
         PairwiseAlignmentParameters *p = pairwiseAlignmentBandingParameters_construct();
         p->threshold = 0.5;
@@ -974,6 +982,8 @@ static void test_echelon_diagonalDPCalculations(CuTest *testCase) {
                                                     totalProbForward, p, extraArgs);
         pairwiseAlignmentBandingParameters_destruct(p);
     }
+    stList *alignedPairs = alignedPairBuffer_toList(alignedPairBuffer);
+    alignedPairBuffer_destruct(alignedPairBuffer);
 
     // Make a list of the correct anchor points
     stSortedSet *alignedPairsSet = stSortedSet_construct3((int (*)(const void *, const void *)) stIntTuple_cmpFn,
@@ -1458,6 +1468,299 @@ static void test_echelon_getAlignedPairsWithBanding(CuTest *testCase) {
     stateMachine_destruct(sMt);
 }
 
+static void test_signalSeeding_syntheticEvents(CuTest *testCase) {
+    // load the reference sequence and the model
+    char *ZymoReference = stString_print("../../cPecan/tests/test_npReads/ZymoRef.txt");
+    FILE *fH = fopen(ZymoReference, "r");
+    char *ZymoReferenceSeq = stFile_getLineFromFile(fH);
+    char *templateModelFile = stString_print("../../cPecan/models/template_median68pA.model");
+    StateMachine *sMt = getStrawManStateMachine3(templateModelFile);
+    int64_t lX = sequence_correctSeqLength(strlen(ZymoReferenceSeq), event);
+
+    // make events that have exactly the model level of each reference kmer, every third kmer gets a second event
+    float *events = st_malloc(2 * lX * NB_EVENT_PARAMS * sizeof(float));
+    int64_t *kmerToEvent = st_malloc(lX * sizeof(int64_t));
+    int64_t nbEvents = 0;
+    for (int64_t x = 0; x < lX; x++) {
+        int64_t kmerIndex = emissions_discrete_getKmerIndexFromKmer(ZymoReferenceSeq + x);
+        kmerToEvent[x] = nbEvents;
+        for (int64_t n = 0; n < (x % 3 == 0 ? 2 : 1); n++) {
+            events[nbEvents * NB_EVENT_PARAMS] = sMt->EMISSION_MATCH_PROBS[1 + (kmerIndex * MODEL_PARAMS)];
+            events[nbEvents * NB_EVENT_PARAMS + 1] = 1.0;
+            events[nbEvents * NB_EVENT_PARAMS + 2] = 0.01;
+            nbEvents++;
+        }
+    }
+
+    // the nearest kmer to an event is the one it was made from, or one with the same level
+    int64_t *discreteEvents = signalSeeding_discretizeEvents(sMt->EMISSION_MATCH_PROBS, events, nbEvents);
+    for (int64_t x = 0; x < lX; x++) {
+        double level = events[kmerToEvent[x] * NB_EVENT_PARAMS];
+        // the events hold the levels as floats
+        float nearest = sMt->EMISSION_MATCH_PROBS[1 + (discreteEvents[kmerToEvent[x]] * MODEL_PARAMS)];
+        CuAssertDblEquals(testCase, level, nearest, 0.0);
+    }
+
+    // the anchors should all be on the path the events were made from
+    SignalSeedingParameters *sp = signalSeedingParameters_construct();
+    stList *anchorPairs = signalSeeding_getAnchorPairs(sMt->EMISSION_MATCH_PROBS, ZymoReferenceSeq, events,
+                                                       nbEvents, sp);
+    CuAssertTrue(testCase, stList_length(anchorPairs) > lX / 2);
+    for (int64_t i = 0; i < stList_length(anchorPairs); i++) {
+        stIntTuple *pair = stList_get(anchorPairs, i);
+        CuAssertIntEquals(testCase, kmerToEvent[stIntTuple_get(pair, 0)], stIntTuple_get(pair, 1));
+    }
+
+    // clean
+    fclose(fH);
+    free(ZymoReference);
+    free(ZymoReferenceSeq);
+    free(templateModelFile);
+    free(events);
+    free(kmerToEvent);
+    free(discreteEvents);
+    stList_destruct(anchorPairs);
+    signalSeedingParameters_destruct(sp);
+    stateMachine_destruct(sMt);
+}
+
+static void test_strawMan_getAlignedPairsWithSignalSeeding(CuTest *testCase) {
+    // load the reference sequence and the nanopore read
+    char *ZymoReference = stString_print("../../cPecan/tests/test_npReads/ZymoRef.txt");
+    FILE *fH = fopen(ZymoReference, "r");
+    char *ZymoReferenceSeq = stFile_getLineFromFile(fH);
+    char *npReadFile = stString_print("../../cPecan/tests/test_npReads/ZymoC_ch_1_file1.npRead");
+    NanoporeRead *npRead = nanopore_loadNanoporeReadFromFile(npReadFile);
+
+    // get sequence lengths
+    int64_t lX = sequence_correctSeqLength(strlen(ZymoReferenceSeq), event);
+    int64_t lY = npRead->nbTemplateEvents;
+
+    // load stateMachine from model file and scale it to the read
+    char *templateModelFile = stString_print("../../cPecan/models/template_median68pA.model");
+    StateMachine *sMt = getStrawManStateMachine3(templateModelFile);
+    emissions_signal_scaleModel(sMt, npRead->templateParams.scale, npRead->templateParams.shift,
+                                npRead->templateParams.var, npRead->templateParams.scale_sd,
+                                npRead->templateParams.var_sd);
+
+    // get anchors from the signal, no guide alignment
+    SignalSeedingParameters *sp = signalSeedingParameters_construct();
+    stList *anchorPairs = signalSeeding_getAnchorPairs(sMt->EMISSION_MATCH_PROBS, ZymoReferenceSeq,
+                                                       npRead->templateEvents, lY, sp);
+    CuAssertTrue(testCase, stList_length(anchorPairs) > 0);
+    int64_t pX = -1, pY = -1;
+    for (int64_t i = 0; i < stList_length(anchorPairs); i++) {
+        stIntTuple *pair = stList_get(anchorPairs, i);
+        CuAssertTrue(testCase, stIntTuple_get(pair, 0) > pX);
+        CuAssertTrue(testCase, stIntTuple_get(pair, 1) > pY);
+        CuAssertTrue(testCase, stIntTuple_get(pair, 0) < lX);
+        CuAssertTrue(testCase, stIntTuple_get(pair, 1) < lY);
+        pX = stIntTuple_get(pair, 0);
+        pY = stIntTuple_get(pair, 1);
+    }
+
+    // the anchors make a valid band
+    PairwiseAlignmentParameters *p = pairwiseAlignmentBandingParameters_construct();
+    Sequence *refSeq = sequence_construct2(lX, ZymoReferenceSeq, sequence_getKmer,
+                                           sequence_sliceNucleotideSequence2);
+    Sequence *templateSeq = sequence_construct2(lY, npRead->templateEvents, sequence_getEvent,
+                                                sequence_sliceEventSequence2);
+    stList *alignedPairs = getAlignedPairsUsingAnchors(sMt, refSeq, templateSeq, anchorPairs, p,
+                                                       diagonalCalculationPosteriorMatchProbs,
+                                                       0, 0);
+    checkAlignedPairs(testCase, alignedPairs, lX, lY);
+    CuAssertTrue(testCase, stList_length(alignedPairs) > 0);
+
+    // clean
+    fclose(fH);
+    pairwiseAlignmentBandingParameters_destruct(p);
+    signalSeedingParameters_destruct(sp);
+    nanopore_nanoporeReadDestruct(npRead);
+    sequence_sequenceDestroy(refSeq);
+    sequence_sequenceDestroy(templateSeq);
+    stList_destruct(anchorPairs);
+    stList_destruct(alignedPairs);
+    stateMachine_destruct(sMt);
+}
+
+static char *test_readWholeFile(const char *file) {
+    FILE *fH = fopen(file, "rb");
+    fseek(fH, 0, SEEK_END);
+    int64_t length = ftell(fH);
+    fseek(fH, 0, SEEK_SET);
+    char *contents = st_malloc((length + 1) * sizeof(char));
+    if (fread(contents, sizeof(char), length, fH) != (size_t) length) {
+        st_errAbort("test_readWholeFile: couldn't read %s\n", file);
+    }
+    contents[length] = '\0';
+    fclose(fH);
+    return contents;
+}
+
+static void test_posteriorProbs_binaryRoundTrip(CuTest *testCase) {
+    char *binaryFile = stString_print("../../cPecan/tests/test_npReads/tempPosteriors.bin");
+    char *tsvFile = stString_print("../../cPecan/tests/test_npReads/tempPosteriors.tsv");
+    char *expectedTsvFile = stString_print("../../cPecan/tests/test_npReads/tempPosteriorsExpected.tsv");
+    remove(binaryFile);
+
+    char *target = getRandomSequence(200);
+    FILE *binaryH = fopen(binaryFile, "ab");
+    FILE *expectedH = fopen(expectedTsvFile, "w");
+    // one chunk per strand, the second one has the reference kmers reverse complemented
+    for (int64_t c = 0; c < 2; c++) {
+        char strand = c == 0 ? 't' : 'c';
+        double scale = 1.0 + c * 0.05, shift = c * 2.5;
+        PosteriorProbsChunk *chunk = posteriorProbsChunk_construct("contig_1", "read_1", strand, c == 1,
+                                                                   scale, shift, KMER_LENGTH);
+        for (int64_t i = 0; i < 150; i++) {
+            int64_t x = st_randomInt(0, 200 - KMER_LENGTH);
+            double eventMean = st_random() * 100, eventNoise = st_random(), eventDuration = st_random() / 10;
+            double levelMean = st_random() * 100, noiseMean = st_random(), posterior = st_random();
+            posteriorProbsChunk_add(chunk, x + 1000, i, target + x, eventMean, eventNoise, eventDuration,
+                                    levelMean, noiseMean, posterior);
+
+            char *kmer = stString_getSubString(target, x, KMER_LENGTH);
+            char *refKmer = c == 1 ? stString_reverseComplementString(kmer) : stString_copy(kmer);
+            posteriorProbs_writeTsvRow(expectedH, "contig_1", x + 1000, refKmer, "read_1", strand, i, eventMean,
+                                       eventNoise, eventDuration, kmer, KMER_LENGTH, levelMean, noiseMean,
+                                       posterior, scale, shift);
+            free(kmer);
+            free(refKmer);
+        }
+        CuAssertIntEquals(testCase, 150, chunk->length);
+        CuAssertTrue(testCase, stList_length(chunk->kmers) <= 150);
+        posteriorProbsChunk_write(chunk, binaryH);
+        CuAssertIntEquals(testCase, 0, chunk->length);
+        posteriorProbsChunk_destruct(chunk);
+    }
+    fclose(binaryH);
+    fclose(expectedH);
+
+    // the chunks read back have the header values
+    binaryH = fopen(binaryFile, "rb");
+    PosteriorProbsChunk *chunk = posteriorProbsChunk_read(binaryH);
+    CuAssertTrue(testCase, chunk != NULL);
+    CuAssertStrEquals(testCase, "contig_1", chunk->contig);
+    CuAssertStrEquals(testCase, "read_1", chunk->readLabel);
+    CuAssertTrue(testCase, chunk->strand == 't');
+    CuAssertIntEquals(testCase, 150, chunk->length);
+    posteriorProbsChunk_destruct(chunk);
+    chunk = posteriorProbsChunk_read(binaryH);
+    CuAssertTrue(testCase, chunk != NULL);
+    CuAssertTrue(testCase, chunk->strand == 'c');
+    CuAssertTrue(testCase, chunk->refKmerIsReverseComplement);
+    CuAssertDblEquals(testCase, 2.5, chunk->shift, 0.0);
+    posteriorProbsChunk_destruct(chunk);
+    CuAssertTrue(testCase, posteriorProbsChunk_read(binaryH) == NULL);
+    fclose(binaryH);
+
+    // the converted tsv is the same as writing the tsv directly
+    CuAssertIntEquals(testCase, 300, posteriorProbs_convertToTsv(binaryFile, tsvFile));
+    char *tsv = test_readWholeFile(tsvFile);
+    char *expectedTsv = test_readWholeFile(expectedTsvFile);
+    CuAssertStrEquals(testCase, expectedTsv, tsv);
+
+    remove(binaryFile);
+    remove(tsvFile);
+    remove(expectedTsvFile);
+    free(tsv);
+    free(expectedTsv);
+    free(target);
+    free(binaryFile);
+    free(tsvFile);
+    free(expectedTsvFile);
+}
+
+static void test_nanopore_binaryNpRead(CuTest *testCase) {
+    char *npReadFile = stString_print("../../cPecan/tests/test_npReads/ZymoC_ch_1_file1.npRead");
+    char *binaryFile = stString_print("../../cPecan/tests/test_npReads/tempZymoC_ch_1_file1.npRead.bin");
+    NanoporeRead *npRead = nanopore_loadNanoporeReadFromFile(npReadFile);
+    nanopore_writeNanoporeReadToBinaryFile(npRead, binaryFile);
+    NanoporeRead *binaryNpRead = nanopore_loadNanoporeReadFromFile(binaryFile);
+    CuAssertTrue(testCase, binaryNpRead->mappedFile != NULL);
+
+    CuAssertIntEquals(testCase, npRead->readLength, binaryNpRead->readLength);
+    CuAssertIntEquals(testCase, npRead->nbTemplateEvents, binaryNpRead->nbTemplateEvents);
+    CuAssertIntEquals(testCase, npRead->nbComplementEvents, binaryNpRead->nbComplementEvents);
+    CuAssertDblEquals(testCase, npRead->templateParams.scale, binaryNpRead->templateParams.scale, 0.0);
+    CuAssertDblEquals(testCase, npRead->templateParams.var_sd, binaryNpRead->templateParams.var_sd, 0.0);
+    CuAssertDblEquals(testCase, npRead->complementParams.shift, binaryNpRead->complementParams.shift, 0.0);
+    CuAssertDblEquals(testCase, npRead->complementParams.var_sd, binaryNpRead->complementParams.var_sd, 0.0);
+    CuAssertIntEquals(testCase, npRead->readLength, strlen(binaryNpRead->twoDread));
+    CuAssertTrue(testCase, strncmp(npRead->twoDread, binaryNpRead->twoDread, npRead->readLength) == 0);
+    for (int64_t i = 0; i < npRead->readLength; i++) {
+        CuAssertIntEquals(testCase, npRead->templateEventMap[i], binaryNpRead->templateEventMap[i]);
+        CuAssertIntEquals(testCase, npRead->complementEventMap[i], binaryNpRead->complementEventMap[i]);
+    }
+    for (int64_t i = 0; i < npRead->nbTemplateEvents * NB_EVENT_PARAMS; i++) {
+        CuAssertDblEquals(testCase, npRead->templateEvents[i], binaryNpRead->templateEvents[i], 0.0);
+    }
+    for (int64_t i = 0; i < npRead->nbComplementEvents * NB_EVENT_PARAMS; i++) {
+        CuAssertDblEquals(testCase, npRead->complementEvents[i], binaryNpRead->complementEvents[i], 0.0);
+    }
+
+    // descaling a mapped read doesn't change the file
+    nanopore_descaleNanoporeRead(binaryNpRead);
+    CuAssertTrue(testCase, binaryNpRead->templateEvents[0] != npRead->templateEvents[0]);
+    nanopore_nanoporeReadDestruct(binaryNpRead);
+    binaryNpRead = nanopore_loadNanoporeReadFromFile(binaryFile);
+    CuAssertDblEquals(testCase, npRead->templateEvents[0], binaryNpRead->templateEvents[0], 0.0);
+
+    nanopore_nanoporeReadDestruct(binaryNpRead);
+    nanopore_nanoporeReadDestruct(npRead);
+    remove(binaryFile);
+    free(npReadFile);
+    free(binaryFile);
+}
+
+static void test_nanopore_npReadArchive(CuTest *testCase) {
+    char *npReadFile = stString_print("../../cPecan/tests/test_npReads/ZymoC_ch_1_file1.npRead");
+    char *archiveFile = stString_print("../../cPecan/tests/test_npReads/tempArchive.npa");
+    NanoporeRead *npRead = nanopore_loadNanoporeReadFromFile(npReadFile);
+    // the second read is the first one with its events shifted
+    NanoporeRead *shiftedNpRead = nanopore_loadNanoporeReadFromFile(npReadFile);
+    for (int64_t i = 0; i < shiftedNpRead->nbTemplateEvents * NB_EVENT_PARAMS; i++) {
+        shiftedNpRead->templateEvents[i] += 1.0;
+    }
+    NanoporeReadArchiveWriter *writer = nanoporeReadArchiveWriter_construct(archiveFile);
+    nanoporeReadArchiveWriter_add(writer, "read_1", npRead);
+    nanoporeReadArchiveWriter_add(writer, "read_2", shiftedNpRead);
+    nanoporeReadArchiveWriter_destruct(writer);
+
+    NanoporeReadArchive *archive = nanoporeReadArchive_construct(archiveFile);
+    CuAssertIntEquals(testCase, 2, nanoporeReadArchive_getNumberOfReads(archive));
+    CuAssertStrEquals(testCase, "read_1", nanoporeReadArchive_getReadName(archive, 0));
+    CuAssertStrEquals(testCase, "read_2", nanoporeReadArchive_getReadName(archive, 1));
+    CuAssertTrue(testCase, nanoporeReadArchive_getReadByName(archive, "read_3") == NULL);
+
+    NanoporeRead *archivedNpRead = nanoporeReadArchive_getReadByName(archive, "read_2");
+    CuAssertIntEquals(testCase, npRead->readLength, archivedNpRead->readLength);
+    CuAssertIntEquals(testCase, npRead->nbComplementEvents, archivedNpRead->nbComplementEvents);
+    CuAssertStrEquals(testCase, shiftedNpRead->twoDread, archivedNpRead->twoDread);
+    CuAssertDblEquals(testCase, npRead->complementParams.var, archivedNpRead->complementParams.var, 0.0);
+    for (int64_t i = 0; i < npRead->nbTemplateEvents * NB_EVENT_PARAMS; i++) {
+        CuAssertDblEquals(testCase, shiftedNpRead->templateEvents[i], archivedNpRead->templateEvents[i], 0.0);
+    }
+    for (int64_t i = 0; i < npRead->readLength; i++) {
+        CuAssertIntEquals(testCase, npRead->complementEventMap[i], archivedNpRead->complementEventMap[i]);
+    }
+    // reads are copies, descaling one doesn't change the archive
+    nanopore_descaleNanoporeRead(archivedNpRead);
+    nanopore_nanoporeReadDestruct(archivedNpRead);
+    archivedNpRead = nanoporeReadArchive_getRead(archive, 0);
+    for (int64_t i = 0; i < npRead->nbTemplateEvents * NB_EVENT_PARAMS; i++) {
+        CuAssertDblEquals(testCase, npRead->templateEvents[i], archivedNpRead->templateEvents[i], 0.0);
+    }
+    nanopore_nanoporeReadDestruct(archivedNpRead);
+
+    nanoporeReadArchive_destruct(archive);
+    nanopore_nanoporeReadDestruct(npRead);
+    nanopore_nanoporeReadDestruct(shiftedNpRead);
+    remove(archiveFile);
+    free(npReadFile);
+    free(archiveFile);
+}
+
 static void test_continuousPairHmm(CuTest *testCase) {
     // make the hmm object
     Hmm *hmm = continuousPairHmm_constructEmpty(0.0, 3, NUM_OF_KMERS, threeState,
@@ -1601,6 +1904,88 @@ static void test_vanillaHmm(CuTest *testCase) {
     vanillaHmm_destruct(hmm);
 }
 
+static void test_continuousHmm_binaryExpectations(CuTest *testCase) {
+    // two threeState expectation files, the second has twice the expectations of the first
+    char *files[3];
+    for (int64_t f = 0; f < 2; f++) {
+        Hmm *hmm = hmmContinuous_getEmptyHmm(threeState, 0.0, 0.0);
+        for (int64_t from = 0; from < hmm->stateNumber; from++) {
+            for (int64_t to = 0; to < hmm->stateNumber; to++) {
+                hmm->addToTransitionExpectationFcn(hmm, from, to, (f + 1) * (from * hmm->stateNumber + to + 0.5));
+            }
+        }
+        for (int64_t i = 0; i < hmm->symbolSetSize; i++) {
+            hmm->setEmissionExpectationFcn(hmm, 0, i, 0, (f + 1) * (i + 0.25));
+        }
+        hmm->likelihood = -10.0 * (f + 1);
+        files[f] = stString_print("./temp%" PRIi64 ".expectations", st_randomInt(0, INT64_MAX));
+        CuAssertTrue(testCase, !stFile_exists(files[f]));
+        hmmContinuous_writeToBinaryFile(files[f], hmm, threeState);
+        hmmContinuous_destruct(hmm, threeState);
+    }
+
+    // the loader takes the binary layout
+    Hmm *hmm = continuousPairHmm_loadFromFile(files[0]);
+    CuAssertTrue(testCase, hmm->type == threeState);
+    CuAssertDblEquals(testCase, -10.0, hmm->likelihood, 0.0);
+    for (int64_t from = 0; from < hmm->stateNumber; from++) {
+        for (int64_t to = 0; to < hmm->stateNumber; to++) {
+            CuAssertDblEquals(testCase, from * hmm->stateNumber + to + 0.5,
+                              hmm->getTransitionsExpFcn(hmm, from, to), 0.0);
+        }
+    }
+    for (int64_t i = 0; i < hmm->symbolSetSize; i++) {
+        CuAssertDblEquals(testCase, i + 0.25, hmm->getEmissionExpFcn(hmm, 0, i, 0), 0.0);
+    }
+    continuousPairHmm_destruct(hmm);
+
+    // merged expectations are the sums, whatever the number of threads
+    for (int64_t nbThreads = 1; nbThreads <= 3; nbThreads++) {
+        hmm = hmmContinuous_mergeBinaryExpectations(files, 2, nbThreads);
+        CuAssertTrue(testCase, hmm->type == threeState);
+        CuAssertDblEquals(testCase, -30.0, hmm->likelihood, 0.0);
+        for (int64_t from = 0; from < hmm->stateNumber; from++) {
+            for (int64_t to = 0; to < hmm->stateNumber; to++) {
+                CuAssertDblEquals(testCase, 3 * (from * hmm->stateNumber + to + 0.5),
+                                  hmm->getTransitionsExpFcn(hmm, from, to), 0.0);
+            }
+        }
+        for (int64_t i = 0; i < hmm->symbolSetSize; i++) {
+            CuAssertDblEquals(testCase, 3 * (i + 0.25), hmm->getEmissionExpFcn(hmm, 0, i, 0), 0.0);
+        }
+        hmmContinuous_destruct(hmm, threeState);
+    }
+
+    // a vanilla file keeps its match models
+    Hmm *vHmm = hmmContinuous_getEmptyHmm(vanilla, 0.0, 0.0);
+    for (int64_t i = 0; i < 60; i++) {
+        vHmm->setTransitionFcn(vHmm, i, 0, i + 1.0);
+    }
+    int64_t nb_matchModelBuckets = 1 + (vHmm->symbolSetSize * MODEL_PARAMS);
+    for (int64_t i = 0; i < nb_matchModelBuckets; i++) {
+        ((VanillaHmm *) vHmm)->matchModel[i] = i * 0.5;
+        ((VanillaHmm *) vHmm)->scaledMatchModel[i] = i * 0.25;
+    }
+    files[2] = stString_print("./temp%" PRIi64 ".expectations", st_randomInt(0, INT64_MAX));
+    CuAssertTrue(testCase, !stFile_exists(files[2]));
+    hmmContinuous_writeToBinaryFile(files[2], vHmm, vanilla);
+    vanillaHmm_destruct(vHmm);
+    vHmm = vanillaHmm_loadFromFile(files[2]);
+    for (int64_t i = 0; i < 60; i++) {
+        CuAssertDblEquals(testCase, i + 1.0, vHmm->getTransitionsExpFcn(vHmm, i, 0), 0.0);
+    }
+    for (int64_t i = 0; i < nb_matchModelBuckets; i++) {
+        CuAssertDblEquals(testCase, i * 0.5, ((VanillaHmm *) vHmm)->matchModel[i], 0.0);
+        CuAssertDblEquals(testCase, i * 0.25, ((VanillaHmm *) vHmm)->scaledMatchModel[i], 0.0);
+    }
+    vanillaHmm_destruct(vHmm);
+
+    for (int64_t f = 0; f < 3; f++) {
+        stFile_rmrf(files[f]);
+        free(files[f]);
+    }
+}
+
 static void test_continuousPairHmm_em(CuTest *testCase) {
     // load the reference sequence
     char *referencePath = stString_print("../../cPecan/tests/test_npReads/ZymoRef.txt");
@@ -1713,6 +2098,323 @@ static void test_continuousPairHmm_em(CuTest *testCase) {
     stateMachine_destruct(sMt);
 }
 
+// the expectations of the template events of npRead, aligned to referenceSeq with the anchors of its 2D read
+static Hmm *test_continuousPairHmm_getExpectations(StateMachine *sMt, char *referenceSeq, NanoporeRead *npRead,
+                                                   PairwiseAlignmentParameters *p) {
+    int64_t lX = sequence_correctSeqLength(strlen(referenceSeq), event);
+    int64_t lY = npRead->nbTemplateEvents;
+    Hmm *cpHmm = continuousPairHmm_constructEmpty(0.0, 3, NUM_OF_KMERS, threeState,
+                                                  continuousPairHmm_addToTransitionsExpectation,
+                                                  continuousPairHmm_setTransitionExpectation,
+                                                  continuousPairHmm_getTransitionExpectation,
+                                                  continuousPairHmm_addToKmerGapExpectation,
+                                                  continuousPairHmm_setKmerGapExpectation,
+                                                  continuousPairHmm_getKmerGapExpectation,
+                                                  emissions_discrete_getKmerIndexFromKmer);
+    stList *anchorPairs = getBlastPairsForPairwiseAlignmentParameters(referenceSeq, npRead->twoDread, p);
+    stList *remappedAnchors = nanopore_remapAnchorPairs(anchorPairs, npRead->templateEventMap);
+    stList *filteredRemappedAnchors = filterToRemoveOverlap(remappedAnchors);
+    Sequence *refSeq = sequence_construct2(lX, referenceSeq, sequence_getKmer, sequence_sliceNucleotideSequence2);
+    Sequence *templateSeq = sequence_construct2(lY, npRead->templateEvents, sequence_getEvent,
+                                                sequence_sliceEventSequence2);
+
+    getExpectationsUsingAnchors(sMt, cpHmm, refSeq, templateSeq, filteredRemappedAnchors,
+                                p, diagonalCalculation_Expectations, 0, 0);
+
+    sequence_sequenceDestroy(refSeq);
+    sequence_sequenceDestroy(templateSeq);
+    stList_destruct(filteredRemappedAnchors);
+    return cpHmm;
+}
+
+static Hmm *test_continuousPairHmm_train(char *referenceSeq, NanoporeRead *npRead, double expectationsPruning,
+                                         int64_t iterations) {
+    // start from the default transitions of the model
+    StateMachine *sMt = getStrawManStateMachine3("../../cPecan/models/template_median68pA.model");
+    emissions_signal_scaleModel(sMt, npRead->templateParams.scale, npRead->templateParams.shift,
+                                npRead->templateParams.var, npRead->templateParams.scale_sd,
+                                npRead->templateParams.var_sd);
+    PairwiseAlignmentParameters *p = pairwiseAlignmentBandingParameters_construct();
+    p->expectationsPruning = expectationsPruning;
+
+    Hmm *cpHmm = NULL;
+    for (int64_t iter = 0; iter < iterations; iter++) {
+        if (cpHmm != NULL) {
+            continuousPairHmm_destruct(cpHmm);
+        }
+        cpHmm = test_continuousPairHmm_getExpectations(sMt, referenceSeq, npRead, p);
+        continuousPairHmm_normalize(cpHmm);
+        continuousPairHmm_loadTransitionsAndKmerGapProbs(sMt, cpHmm);
+    }
+    pairwiseAlignmentBandingParameters_destruct(p);
+    stateMachine_destruct(sMt);
+    return cpHmm;
+}
+
+static void test_continuousPairHmm_emWithPruning(CuTest *testCase) {
+    char *referencePath = stString_print("../../cPecan/tests/test_npReads/ZymoRef.txt");
+    FILE *fH = fopen(referencePath, "r");
+    char *ZymoReferenceSeq = stFile_getLineFromFile(fH);
+    fclose(fH);
+    NanoporeRead *npRead = nanopore_loadNanoporeReadFromFile(
+            "../../cPecan/tests/test_npReads/ZymoC_ch_1_file1.npRead");
+
+    // the expectations skipping the cells under 1e-4 of the best one of their diagonal train the same model
+    Hmm *full = test_continuousPairHmm_train(ZymoReferenceSeq, npRead, 0.0, 3);
+    Hmm *pruned = test_continuousPairHmm_train(ZymoReferenceSeq, npRead, 1e-4, 3);
+    CuAssertDblEquals(testCase, full->likelihood, pruned->likelihood, fabs(full->likelihood) * 1e-6);
+    for (int64_t from = 0; from < full->stateNumber; from++) {
+        for (int64_t to = 0; to < full->stateNumber; to++) {
+            CuAssertDblEquals(testCase, full->getTransitionsExpFcn(full, from, to),
+                              pruned->getTransitionsExpFcn(pruned, from, to), 1e-3);
+        }
+    }
+    for (int64_t x = 0; x < full->symbolSetSize; x++) {
+        CuAssertDblEquals(testCase, full->getEmissionExpFcn(full, 0, x, 0),
+                          pruned->getEmissionExpFcn(pruned, 0, x, 0), 1e-3);
+    }
+
+    continuousPairHmm_destruct(full);
+    continuousPairHmm_destruct(pruned);
+    nanopore_nanoporeReadDestruct(npRead);
+    free(ZymoReferenceSeq);
+    free(referencePath);
+}
+
+static void test_continuousPairHmm_stepwiseEm(CuTest *testCase) {
+    // the step sizes decay as (k + 2)^-decay
+    CuAssertDblEquals(testCase, 0.5, hmm_stepwiseEmStepSize(0, 1.0), 0.0);
+    CuAssertDblEquals(testCase, pow(3.0, -0.7), hmm_stepwiseEmStepSize(1, 0.7), 1e-15);
+    for (int64_t k = 0; k < 10; k++) {
+        CuAssertTrue(testCase, hmm_stepwiseEmStepSize(k + 1, 0.7) < hmm_stepwiseEmStepSize(k, 0.7));
+    }
+
+    char *referencePath = stString_print("../../cPecan/tests/test_npReads/ZymoRef.txt");
+    FILE *fH = fopen(referencePath, "r");
+    char *ZymoReferenceSeq = stFile_getLineFromFile(fH);
+    fclose(fH);
+    NanoporeRead *npRead = nanopore_loadNanoporeReadFromFile(
+            "../../cPecan/tests/test_npReads/ZymoC_ch_1_file1.npRead");
+    StateMachine *sMt = getStrawManStateMachine3("../../cPecan/models/template_median68pA.model");
+    emissions_signal_scaleModel(sMt, npRead->templateParams.scale, npRead->templateParams.shift,
+                                npRead->templateParams.var, npRead->templateParams.scale_sd,
+                                npRead->templateParams.var_sd);
+    PairwiseAlignmentParameters *p = pairwiseAlignmentBandingParameters_construct();
+
+    // the expectations of the read, of two copies of it and one EM step from them
+    Hmm *oneRead = test_continuousPairHmm_getExpectations(sMt, ZymoReferenceSeq, npRead, p);
+    Hmm *twoReads = hmmContinuous_getEmptyHmm(threeState, 0.0, 0.0);
+    hmmContinuous_addExpectations(twoReads, oneRead, threeState);
+    hmmContinuous_addExpectations(twoReads, oneRead, threeState);
+    Hmm *emStep = hmmContinuous_getEmptyHmm(threeState, 0.0, 0.0);
+    hmmContinuous_addExpectations(emStep, oneRead, threeState);
+    hmmContinuous_maximize(emStep, threeState);
+
+    // two passes over a batch of three copies of the read in mini-batches of two, as vanillaAlign --miniBatch 2:
+    // updates 0 to 3 over mini-batches of 2, 1, 2 and 1 reads. Per read, every mini-batch has the expectations of
+    // the read, so the running ones are (1 - kept) times them, kept the product of (1 - step size) of the updates
+    Hmm *running = hmmContinuous_getEmptyHmm(threeState, 0.0, 0.0);
+    int64_t nbReads = 3, miniBatchSize = 2, update = 0;
+    double kept = 1.0;
+    for (int64_t epoch = 0; epoch < 2; epoch++) {
+        for (int64_t start = 0; start < nbReads; start += miniBatchSize) {
+            int64_t size = start + miniBatchSize <= nbReads ? miniBatchSize : nbReads - start;
+            Hmm *hmm = hmmContinuous_stepwiseEmUpdate(running, size == 2 ? twoReads : oneRead, size, update, 0.7,
+                                                      threeState);
+            kept *= 1 - hmm_stepwiseEmStepSize(update, 0.7);
+            CuAssertDblEquals(testCase, (1 - kept) * oneRead->likelihood, running->likelihood,
+                              fabs(oneRead->likelihood) * 1e-12);
+            for (int64_t from = 0; from < running->stateNumber; from++) {
+                for (int64_t to = 0; to < running->stateNumber; to++) {
+                    CuAssertDblEquals(testCase, (1 - kept) * oneRead->getTransitionsExpFcn(oneRead, from, to),
+                                      running->getTransitionsExpFcn(running, from, to), 1e-9);
+                    // the M-step of a copy, the running expectations aren't normalized
+                    CuAssertDblEquals(testCase, emStep->getTransitionsExpFcn(emStep, from, to),
+                                      hmm->getTransitionsExpFcn(hmm, from, to), 1e-9);
+                }
+            }
+            for (int64_t x = 0; x < running->symbolSetSize; x++) {
+                CuAssertDblEquals(testCase, (1 - kept) * oneRead->getEmissionExpFcn(oneRead, 0, x, 0),
+                                  running->getEmissionExpFcn(running, 0, x, 0), 1e-9);
+                CuAssertDblEquals(testCase, emStep->getEmissionExpFcn(emStep, 0, x, 0),
+                                  hmm->getEmissionExpFcn(hmm, 0, x, 0), 1e-9);
+            }
+            hmmContinuous_destruct(hmm, threeState);
+            update++;
+        }
+    }
+    CuAssertIntEquals(testCase, 4, update);
+
+    // the vanilla match models aren't trained, they come with the expectations of the mini-batch
+    StateMachine *sMv = getSignalStateMachine3Vanilla("../../cPecan/models/template_median68pA.model");
+    emissions_signal_scaleModel(sMv, npRead->templateParams.scale, npRead->templateParams.shift,
+                                npRead->templateParams.var, npRead->templateParams.scale_sd,
+                                npRead->templateParams.var_sd);
+    Hmm *vExpectations = hmmContinuous_getEmptyHmm(vanilla, 0.0, 0.0);
+    vanillaHmm_implantMatchModelsintoHmm(sMv, vExpectations);
+    vanillaHmm_randomizeKmerSkipBins(vExpectations);
+    Hmm *vRunning = hmmContinuous_getEmptyHmm(vanilla, 0.0, 0.0);
+    Hmm *vHmm = hmmContinuous_stepwiseEmUpdate(vRunning, vExpectations, 2, 0, 0.7, vanilla);
+    VanillaHmm *expected = (VanillaHmm *) vExpectations;
+    int64_t nb_matchModelBuckets = 1 + (vExpectations->symbolSetSize * MODEL_PARAMS);
+    for (int64_t i = 0; i < nb_matchModelBuckets; i++) {
+        CuAssertDblEquals(testCase, expected->matchModel[i], ((VanillaHmm *) vRunning)->matchModel[i], 0.0);
+        CuAssertDblEquals(testCase, expected->matchModel[i], ((VanillaHmm *) vHmm)->matchModel[i], 0.0);
+        CuAssertDblEquals(testCase, expected->scaledMatchModel[i], ((VanillaHmm *) vHmm)->scaledMatchModel[i],
+                          0.0);
+    }
+    // the M-step normalizes both halves of the skip bins
+    for (int64_t half = 0; half < 2; half++) {
+        double total = 0.0;
+        for (int64_t bin = half * 30; bin < (half + 1) * 30; bin++) {
+            total += vExpectations->getTransitionsExpFcn(vExpectations, bin, 0);
+        }
+        for (int64_t bin = half * 30; bin < (half + 1) * 30; bin++) {
+            CuAssertDblEquals(testCase, vExpectations->getTransitionsExpFcn(vExpectations, bin, 0) / total,
+                              vHmm->getTransitionsExpFcn(vHmm, bin, 0), 1e-12);
+        }
+    }
+
+    hmmContinuous_destruct(vHmm, vanilla);
+    hmmContinuous_destruct(vRunning, vanilla);
+    hmmContinuous_destruct(vExpectations, vanilla);
+    stateMachine_destruct(sMv);
+    hmmContinuous_destruct(running, threeState);
+    hmmContinuous_destruct(emStep, threeState);
+    hmmContinuous_destruct(twoReads, threeState);
+    hmmContinuous_destruct(oneRead, threeState);
+    pairwiseAlignmentBandingParameters_destruct(p);
+    stateMachine_destruct(sMt);
+    nanopore_nanoporeReadDestruct(npRead);
+    free(ZymoReferenceSeq);
+    free(referencePath);
+}
+
+static Hmm *test_continuousPairHmm_copy(Hmm *hmm) {
+    Hmm *copy = hmmContinuous_getEmptyHmm(threeState, 0.0, 0.0);
+    hmmContinuous_addExpectations(copy, hmm, threeState);
+    return copy;
+}
+
+static void test_continuousPairHmm_checkSameParameters(CuTest *testCase, Hmm *expected, Hmm *hmm) {
+    for (int64_t from = 0; from < expected->stateNumber; from++) {
+        for (int64_t to = 0; to < expected->stateNumber; to++) {
+            CuAssertDblEquals(testCase, expected->getTransitionsExpFcn(expected, from, to),
+                              hmm->getTransitionsExpFcn(hmm, from, to), 0.0);
+        }
+    }
+    for (int64_t x = 0; x < expected->symbolSetSize; x++) {
+        CuAssertDblEquals(testCase, expected->getEmissionExpFcn(expected, 0, x, 0),
+                          hmm->getEmissionExpFcn(hmm, 0, x, 0), 0.0);
+    }
+}
+
+static void test_continuousPairHmm_squaremCycle(CuTest *testCase) {
+    // hmm0, hmm1 = EM(hmm0), hmm2 = EM(hmm1) and the EM step from their extrapolation
+    Hmm *hmms[4];
+    for (int64_t k = 0; k < 4; k++) {
+        hmms[k] = hmmContinuous_getEmptyHmm(threeState, 0.0, 0.0);
+        continuousPairHmm_randomize(hmms[k]);
+    }
+    Hmm *extrapolated = test_continuousPairHmm_copy(hmms[2]);
+    double alpha = hmmContinuous_squaremExtrapolate(hmms[0], hmms[1], hmms[2], extrapolated, threeState);
+
+    // the EM step from the extrapolation is kept when its likelihood is at least the one of hmm1 (-90), otherwise
+    // training goes on from hmm2
+    double likelihoods[3] = { -90.0, -85.0, -95.0 };
+    for (int64_t t = 0; t < 3; t++) {
+        HmmSquaremCycle cycle;
+        hmmContinuous_squaremStart(&cycle, hmms[0], threeState);
+        CuAssertIntEquals(testCase, 1, cycle.step);
+
+        Hmm *hmm1 = test_continuousPairHmm_copy(hmms[1]);
+        CuAssertPtrEquals(testCase, hmm1, hmmContinuous_squaremStep(&cycle, hmm1, -100.0, threeState));
+        CuAssertIntEquals(testCase, 2, cycle.step);
+        hmmContinuous_destruct(hmm1, threeState);
+
+        Hmm *next = hmmContinuous_squaremStep(&cycle, test_continuousPairHmm_copy(hmms[2]), -90.0, threeState);
+        CuAssertIntEquals(testCase, 3, cycle.step);
+        CuAssertDblEquals(testCase, alpha, cycle.alpha, 0.0);
+        test_continuousPairHmm_checkSameParameters(testCase, extrapolated, next);
+        hmmContinuous_destruct(next, threeState);
+
+        Hmm *emStep = test_continuousPairHmm_copy(hmms[3]);
+        Hmm *last = hmmContinuous_squaremStep(&cycle, emStep, likelihoods[t], threeState);
+        CuAssertIntEquals(testCase, 0, cycle.step);
+        CuAssertTrue(testCase, cycle.rejected == (t == 2));
+        if (cycle.rejected) {
+            test_continuousPairHmm_checkSameParameters(testCase, hmms[2], last);
+        } else {
+            CuAssertPtrEquals(testCase, emStep, last);
+        }
+        hmmContinuous_destruct(last, threeState);
+    }
+
+    hmmContinuous_destruct(extrapolated, threeState);
+    for (int64_t k = 0; k < 4; k++) {
+        hmmContinuous_destruct(hmms[k], threeState);
+    }
+}
+
+// EM step on the template of the test read, likelihood is the one of hmm
+static Hmm *test_continuousPairHmm_emStep(StateMachine *sMt, Hmm *hmm, char *referenceSeq, NanoporeRead *npRead,
+                                          PairwiseAlignmentParameters *p, double *likelihood) {
+    continuousPairHmm_loadTransitionsAndKmerGapProbs(sMt, hmm);
+    Hmm *next = test_continuousPairHmm_getExpectations(sMt, referenceSeq, npRead, p);
+    *likelihood = next->likelihood;
+    hmmContinuous_maximize(next, threeState);
+    return next;
+}
+
+static void test_continuousPairHmm_squaremRejected(CuTest *testCase) {
+    char *referencePath = stString_print("../../cPecan/tests/test_npReads/ZymoRef.txt");
+    FILE *fH = fopen(referencePath, "r");
+    char *ZymoReferenceSeq = stFile_getLineFromFile(fH);
+    fclose(fH);
+    NanoporeRead *npRead = nanopore_loadNanoporeReadFromFile(
+            "../../cPecan/tests/test_npReads/ZymoC_ch_1_file1.npRead");
+    StateMachine *sMt = getStrawManStateMachine3("../../cPecan/models/template_median68pA.model");
+    emissions_signal_scaleModel(sMt, npRead->templateParams.scale, npRead->templateParams.shift,
+                                npRead->templateParams.var, npRead->templateParams.scale_sd,
+                                npRead->templateParams.var_sd);
+    PairwiseAlignmentParameters *p = pairwiseAlignmentBandingParameters_construct();
+
+    // two real EM steps from a random model
+    Hmm *hmm0 = hmmContinuous_getEmptyHmm(threeState, 0.0, 0.0);
+    continuousPairHmm_randomize(hmm0);
+    double likelihoods[3];
+    HmmSquaremCycle cycle;
+    hmmContinuous_squaremStart(&cycle, hmm0, threeState);
+    Hmm *hmm1 = test_continuousPairHmm_emStep(sMt, hmm0, ZymoReferenceSeq, npRead, p, &likelihoods[0]);
+    CuAssertPtrEquals(testCase, hmm1, hmmContinuous_squaremStep(&cycle, hmm1, likelihoods[0], threeState));
+    Hmm *hmm2 = test_continuousPairHmm_emStep(sMt, hmm1, ZymoReferenceSeq, npRead, p, &likelihoods[1]);
+    Hmm *expected = test_continuousPairHmm_copy(hmm2);
+    Hmm *extrapolated = hmmContinuous_squaremStep(&cycle, hmm2, likelihoods[1], threeState);
+    CuAssertIntEquals(testCase, 3, cycle.step);
+
+    // an extrapolation that went all the way back to hmm0: the EM step from it has the likelihood of hmm0, which
+    // the first EM step raised, so the cycle drops it and training goes on from hmm2
+    Hmm *emStep = test_continuousPairHmm_emStep(sMt, hmm0, ZymoReferenceSeq, npRead, p, &likelihoods[2]);
+    CuAssertDblEquals(testCase, likelihoods[0], likelihoods[2], 0.0);
+    CuAssertTrue(testCase, likelihoods[0] < likelihoods[1]);
+    Hmm *last = hmmContinuous_squaremStep(&cycle, emStep, likelihoods[2], threeState);
+    CuAssertIntEquals(testCase, 0, cycle.step);
+    CuAssertTrue(testCase, cycle.rejected);
+    CuAssertPtrEquals(testCase, hmm2, last);
+    test_continuousPairHmm_checkSameParameters(testCase, expected, last);
+
+    hmmContinuous_destruct(last, threeState);
+    hmmContinuous_destruct(expected, threeState);
+    hmmContinuous_destruct(extrapolated, threeState);
+    hmmContinuous_destruct(hmm1, threeState);
+    hmmContinuous_destruct(hmm0, threeState);
+    pairwiseAlignmentBandingParameters_destruct(p);
+    stateMachine_destruct(sMt);
+    nanopore_nanoporeReadDestruct(npRead);
+    free(ZymoReferenceSeq);
+    free(referencePath);
+}
+
 static void test_vanillaHmm_em(CuTest *testCase) {
     // load the reference sequence
     char *referencePath = stString_print("../../cPecan/tests/test_npReads/ZymoRef.txt");
@@ -1839,9 +2541,19 @@ CuSuite *signalPairwiseTestSuite(void) {
     SUITE_ADD_TEST(suite, test_vanilla_getAlignedPairsWithBanding);
     SUITE_ADD_TEST(suite, test_vanilla_getAlignedPairsWithoutScaling);
     SUITE_ADD_TEST(suite, test_echelon_getAlignedPairsWithBanding);
+    SUITE_ADD_TEST(suite, test_signalSeeding_syntheticEvents);
+    SUITE_ADD_TEST(suite, test_strawMan_getAlignedPairsWithSignalSeeding);
+    SUITE_ADD_TEST(suite, test_posteriorProbs_binaryRoundTrip);
+    SUITE_ADD_TEST(suite, test_nanopore_binaryNpRead);
+    SUITE_ADD_TEST(suite, test_nanopore_npReadArchive);
     SUITE_ADD_TEST(suite, test_continuousPairHmm);
     SUITE_ADD_TEST(suite, test_vanillaHmm);
+    SUITE_ADD_TEST(suite, test_continuousHmm_binaryExpectations);
     SUITE_ADD_TEST(suite, test_continuousPairHmm_em);
+    SUITE_ADD_TEST(suite, test_continuousPairHmm_emWithPruning);
+    SUITE_ADD_TEST(suite, test_continuousPairHmm_stepwiseEm);
+    SUITE_ADD_TEST(suite, test_continuousPairHmm_squaremCycle);
+    SUITE_ADD_TEST(suite, test_continuousPairHmm_squaremRejected);
     SUITE_ADD_TEST(suite, test_vanillaHmm_em);
     return suite;
 }
@@ -1,15 +1,49 @@
+// for open_memstream
+#define _POSIX_C_SOURCE 200809L
 #include <getopt.h>
+#include <pthread.h>
 #include "pairwiseAlignment.h"
 #include "pairwiseAligner.h"
 #include "emissionMatrix.h"
 #include "stateMachine.h"
 #include "nanopore.h"
 #include "continuousHmm.h"
+#include "posteriorProbs.h"
+#include "outputQueue.h"
+#include "indexedFasta.h"
+#include "jobScheduler.h"
+#include "memoryBudget.h"
+#include "reorderBuffer.h"
 
 
 void usage() {
     fprintf(stderr, "vanillaAlign binary, meant to be used through the signalAlign program.\n");
     fprintf(stderr, "See doc for signalAlign for help\n");
+    fprintf(stderr, "--batch file (- for stdin): align the reads listed in the file, one per line with the tab "
+            "separated fields readLabel, npRead, guide alignment (exonerate cigar), output file (one per line) and "
+            "optionally the template and complement models of the read (empty for the model of the run), the "
+            "models, HMMs, HDPs and reference are loaded once\n");
+    fprintf(stderr, "--batchExpectations: the outputs of the batch are prefixes of expectation files\n");
+    fprintf(stderr, "--threads n: number of reads of the batch aligned at the same time, default 1. With one the "
+            "template and complement of the read are aligned at the same time, with more each read aligns them "
+            "one after the other so the run uses n threads\n");
+    fprintf(stderr, "--memoryBudget n: megabytes of alignment matrices and aligned pairs the reads aligned at the "
+            "same time may hold, a read starts once its estimated peak fits and traces back more often if it "
+            "doesn't fit at all, default no limit\n");
+    fprintf(stderr, "--train n: n iterations of Baum-Welch on the reads of the batch (whose outputs are ignored), the "
+            "expectations are summed in memory and the HDPs given with -v and -w are updated in place, the "
+            "likelihoods of each iteration are printed to stdout\n");
+    fprintf(stderr, "--outTemplateHmm, --outComplementHmm file: where --train writes the trained HMMs\n");
+    fprintf(stderr, "--squarem: with --train, every three passes over the reads make two EM steps and an "
+            "extrapolation of them (SQUAREM), which is kept when it doesn't lower the likelihood. Not for the HDP "
+            "models\n");
+    fprintf(stderr, "--miniBatch n: with --train, stepwise (online) EM, the HMMs are updated after every n reads "
+            "of the batch (in batch order) by blending their expectations into running ones, --train is then the "
+            "number of passes over the batch and each update prints a line. Not for the HDP models\n");
+    fprintf(stderr, "--stepSizeDecay a: step size (k + 2)^-a of the k-th update of --miniBatch, in (0.5, 1], "
+            "default 0.7\n");
+    fprintf(stderr, "--pruneExpectations f: the expectations skip the cells whose posterior is less than f times the "
+            "best one of their diagonal (the mass skipped goes to the cells kept), default 0 (every cell)\n");
 }
 
 void printPairwiseAlignmentSummary(struct PairwiseAlignment *pA) {
@@ -23,48 +57,39 @@ void printPairwiseAlignmentSummary(struct PairwiseAlignment *pA) {
     st_uglyf("end    2: %lld\n", pA->end2);
 }
 
-void writePosteriorProbs(char *posteriorProbsFile, char *readFile, double *matchModel, double scale, double shift,
-                         double *events, char *target, bool forward, char *contig,
+void writePosteriorProbs(FILE *fH, PosteriorProbsChunk *chunk, char *readFile, double *matchModel, double scale,
+                         double shift, float *events, char *target, bool forward, char *contig,
                          int64_t eventSequenceOffset, int64_t referenceSequenceOffset,
-                         stList *alignedPairs, Strand strand) {
+                         AlignedPairBuffer *alignedPairs, Strand strand) {
     // label for tsv output
-    char *strandLabel;
-    if (strand == template) {
-        strandLabel = "t";
-    }
-    if (strand == complement) {
-        strandLabel = "c";
-    }
+    char strandLabel = strand == template ? 't' : 'c';
+    // the reference kmer is reported on the strand of the reference
+    bool refKmerIsReverseComplement = (strand == complement && forward) || (strand == template && (!forward));
+    int64_t refLength = (int64_t)strlen(target);
 
-    // open the file for output
-    FILE *fH = fopen(posteriorProbsFile, "a");
-    for(int64_t i = 0; i < stList_length(alignedPairs); i++) {
+    for(int64_t i = 0; i < alignedPairs->length; i++) {
         // grab the aligned pair
-        stIntTuple *aPair = stList_get(alignedPairs, i);
-        int64_t x_i = stIntTuple_get(aPair, 1);
+        int64_t x_i = alignedPairs->x[i];
         int64_t x_adj;  // x is the reference coordinate that we record in the aligned pairs w
-        if ((strand == template && forward) || (strand == complement && (!forward))) {
-            x_adj = stIntTuple_get(aPair, 1) + referenceSequenceOffset;
-        }
-        if ((strand == complement && forward) || (strand == template && (!forward))) {
-            int64_t refLength = (int64_t)strlen(target);
+        if (!refKmerIsReverseComplement) {
+            x_adj = x_i + referenceSequenceOffset;
+        } else {
             int64_t refLengthInEvents = refLength - KMER_LENGTH;
             x_adj = refLengthInEvents - (x_i + (refLength - referenceSequenceOffset));
         }
-        int64_t y = stIntTuple_get(aPair, 2) + eventSequenceOffset;             // event index
-        double p = ((double)stIntTuple_get(aPair, 0)) / PAIR_ALIGNMENT_PROB_1;  // posterior prob
+        int64_t y = alignedPairs->y[i] + eventSequenceOffset;                  // event index
+        double p = ((double)alignedPairs->probs[i]) / PAIR_ALIGNMENT_PROB_1;   // posterior prob
 
         // get the observations from the events
-        double eventMean = events[(y * NB_EVENT_PARAMS)];
-        double eventNoise = events[(y * NB_EVENT_PARAMS) + 1];
-        double eventDuration = events[(y * NB_EVENT_PARAMS) + 2];
-        double descaledMean = (eventMean - shift) / scale;
+        float *event = events + (y * NB_EVENT_PARAMS);
+        double eventMean = nanopore_getEventMean(event);
+        double eventNoise = nanopore_getEventNoise(event);
+        double eventDuration = nanopore_getEventDuration(event);
 
         // make the kmer string at the target index,
-        char *k_i = st_malloc(KMER_LENGTH * sizeof(char));
-        for (int64_t k = 0; k < KMER_LENGTH; k++) {
-            k_i[k] = *(target + (x_i + k));
-        }
+        char k_i[KMER_LENGTH + 1];
+        memcpy(k_i, target + x_i, KMER_LENGTH * sizeof(char));
+        k_i[KMER_LENGTH] = '\0';
 
         // get the kmer index
         int64_t targetKmerIndex = emissions_discrete_getKmerIndexFromKmer(k_i);
@@ -72,37 +97,218 @@ void writePosteriorProbs(char *posteriorProbsFile, char *readFile, double *match
         // get the expected event mean amplitude and noise
         double E_levelu = matchModel[1 + (targetKmerIndex * MODEL_PARAMS)];
         double E_noiseu = matchModel[1 + (targetKmerIndex * MODEL_PARAMS + 2)];
-        double deScaled_E_levelu = (E_levelu - shift) / scale;
 
-        // make reference kmer
-        char *refKmer;
-        if ((strand == template && forward) || (strand == complement && (!forward))) {
-            refKmer = k_i;
-        }
-        if ((strand == complement && forward) || (strand == template && (!forward))) {
-            refKmer = stString_reverseComplementString(k_i);
+        if (chunk != NULL) {
+            // binary output, the reference kmer and the descaled values are derived when converting
+            posteriorProbsChunk_add(chunk, x_adj, y, k_i, eventMean, eventNoise, eventDuration, E_levelu, E_noiseu,
+                                    p);
+            continue;
         }
+
+        // make reference kmer
+        char *refKmer = refKmerIsReverseComplement ? stString_reverseComplementString(k_i) : k_i;
         // write to disk
-        fprintf(fH, "%s\t%lld\t%s\t%s\t%s\t%lld\t%f\t%f\t%f\t%s\t%f\t%f\t%f\t%f\t%f\n",
-                contig, x_adj, refKmer, readFile, strandLabel, y, eventMean, eventNoise, eventDuration, k_i, E_levelu,
-                E_noiseu, p, descaledMean, deScaled_E_levelu);
+        posteriorProbs_writeTsvRow(fH, contig, x_adj, refKmer, readFile, strandLabel, y, eventMean, eventNoise,
+                                   eventDuration, k_i, KMER_LENGTH, E_levelu, E_noiseu, p, scale, shift);
         // old format
         //fprintf(fH, "%lld\t%lld\t%s\t%s\t%s\t%f\t%f\t%f\t%f\t%f\t%f\n",
         //        x_adj, y, k_i, readFile, strandLabel, eventMean, eventNoise, eventDuration, p, E_levelu, E_noiseu);
         // cleanup
-        free(k_i);
+        if (refKmerIsReverseComplement) {
+            free(refKmer);
+        }
     }
-    fclose(fH);
 }
 
-stList *getRemappedAnchorPairs(stList *unmappedAnchors, int64_t *eventMap, int64_t mapOffset) {
+// formatted output waiting for the strand before it
+typedef struct _heldBuffer {
+    char *buffer;
+    int64_t length;
+} HeldBuffer;
+
+// Collects the streamed posteriors of one strand, formats them into a memory buffer that is handed to the output
+// queue (if given) and keeps the totals for the alignment score. The strands of a read share the queue, the
+// buffers of a writer that follows another are held until that one is finished so the file gets the template
+// records and then the complement ones whichever strand is aligned faster
+typedef struct _posteriorProbsWriter {
+    OutputQueue *queue;
+    FILE *fH; // memory stream the rows are formatted into
+    char *buffer;
+    size_t bufferLength;
+    struct _posteriorProbsWriter *previous; // NULL or the writer whose output goes first
+    stList *heldBuffers;
+    pthread_mutex_t lock;
+    bool finished; // all the output was handed to the queue, guarded by lock
+    PosteriorProbsChunk *chunk; // NULL unless writing the binary format
+    char *readFile;
+    double *matchModel;
+    double scale;
+    double shift;
+    float *events;
+    char *target;
+    bool forward;
+    char *contig;
+    int64_t eventSequenceOffset;
+    int64_t referenceSequenceOffset;
+    Strand strand;
+    double totalScore;
+    int64_t alignedPairsNumber;
+} PosteriorProbsWriter;
+
+// rows are written to the binary file in chunks of this many aligned pairs
+#define POSTERIOR_PROBS_CHUNK_LENGTH 100000
+// formatted output is handed to the output queue once it is at least this many bytes
+#define POSTERIOR_PROBS_BUFFER_LENGTH (1 << 20)
+// maximum number of buffers waiting for the writer thread
+#define POSTERIOR_PROBS_MAX_PENDING_BUFFERS 16
+
+static void posteriorProbsWriter_openBuffer(PosteriorProbsWriter *writer) {
+    writer->buffer = NULL;
+    writer->bufferLength = 0;
+    writer->fH = open_memstream(&writer->buffer, &writer->bufferLength);
+    if (writer->fH == NULL) {
+        st_errAbort("vanillaAlign - couldn't open memory stream for posteriors\n");
+    }
+}
+
+static bool posteriorProbsWriter_isFinished(PosteriorProbsWriter *writer) {
+    pthread_mutex_lock(&writer->lock);
+    bool finished = writer->finished;
+    pthread_mutex_unlock(&writer->lock);
+    return finished;
+}
+
+static void posteriorProbsWriter_pushHeldBuffers(PosteriorProbsWriter *writer) {
+    for (int64_t i = 0; i < stList_length(writer->heldBuffers); i++) {
+        HeldBuffer *held = stList_get(writer->heldBuffers, i);
+        outputQueue_push(writer->queue, held->buffer, held->length);
+        free(held);
+    }
+    stList_destruct(writer->heldBuffers);
+    writer->heldBuffers = stList_construct();
+}
+
+// hands the formatted output to the queue, or holds it while the previous writer isn't finished
+static void posteriorProbsWriter_closeBuffer(PosteriorProbsWriter *writer) {
+    fclose(writer->fH);
+    if (writer->bufferLength == 0) {
+        free(writer->buffer);
+        return;
+    }
+    if (writer->previous != NULL && !posteriorProbsWriter_isFinished(writer->previous)) {
+        HeldBuffer *held = st_malloc(sizeof(HeldBuffer));
+        held->buffer = writer->buffer;
+        held->length = (int64_t)writer->bufferLength;
+        stList_append(writer->heldBuffers, held);
+        return;
+    }
+    posteriorProbsWriter_pushHeldBuffers(writer);
+    outputQueue_push(writer->queue, writer->buffer, (int64_t)writer->bufferLength);
+}
+
+// previous is NULL or the writer of the strand whose records go first in the file
+PosteriorProbsWriter *posteriorProbsWriter_construct(OutputQueue *queue, PosteriorProbsWriter *previous,
+                                                     bool binaryPosteriors,
+                                                     char *readFile, double *matchModel,
+                                                     double scale, double shift, float *events, char *target,
+                                                     bool forward, char *contig, int64_t eventSequenceOffset,
+                                                     int64_t referenceSequenceOffset, Strand strand) {
+    PosteriorProbsWriter *writer = st_malloc(sizeof(PosteriorProbsWriter));
+    writer->queue = queue;
+    writer->fH = NULL;
+    writer->chunk = NULL;
+    writer->previous = previous;
+    writer->heldBuffers = stList_construct();
+    pthread_mutex_init(&writer->lock, NULL);
+    writer->finished = FALSE;
+    if (queue != NULL) {
+        posteriorProbsWriter_openBuffer(writer);
+        if (binaryPosteriors) {
+            bool refKmerIsReverseComplement = (strand == complement && forward) || (strand == template && (!forward));
+            writer->chunk = posteriorProbsChunk_construct(contig, readFile, strand == template ? 't' : 'c',
+                                                          refKmerIsReverseComplement, scale, shift, KMER_LENGTH);
+        }
+    }
+    writer->readFile = readFile;
+    writer->matchModel = matchModel;
+    writer->scale = scale;
+    writer->shift = shift;
+    writer->events = events;
+    writer->target = target;
+    writer->forward = forward;
+    writer->contig = contig;
+    writer->eventSequenceOffset = eventSequenceOffset;
+    writer->referenceSequenceOffset = referenceSequenceOffset;
+    writer->strand = strand;
+    writer->totalScore = 0.0;
+    writer->alignedPairsNumber = 0;
+    return writer;
+}
+
+// formats what is left, called once the strand is aligned. Its output is with the queue unless the previous writer
+// isn't finished yet
+void posteriorProbsWriter_finish(PosteriorProbsWriter *writer) {
+    if (writer->chunk != NULL) {
+        posteriorProbsChunk_write(writer->chunk, writer->fH);
+        posteriorProbsChunk_destruct(writer->chunk);
+        writer->chunk = NULL;
+    }
+    if (writer->fH != NULL) {
+        posteriorProbsWriter_closeBuffer(writer);
+        writer->fH = NULL;
+    }
+    pthread_mutex_lock(&writer->lock);
+    writer->finished = TRUE;
+    pthread_mutex_unlock(&writer->lock);
+}
+
+// hands whatever is still held to the output queue, the previous writer has to be finished. Doesn't destruct the
+// queue
+void posteriorProbsWriter_destruct(PosteriorProbsWriter *writer) {
+    posteriorProbsWriter_finish(writer);
+    posteriorProbsWriter_pushHeldBuffers(writer);
+    stList_destruct(writer->heldBuffers);
+    pthread_mutex_destroy(&writer->lock);
+    free(writer);
+}
+
+// sink for getAlignedPairsUsingAnchorsWithSink, gets the next aligned pairs of the strand sorted by x + y
+void posteriorProbsWriter_write(AlignedPairBuffer *alignedPairs, void *extraArgs) {
+    PosteriorProbsWriter *writer = extraArgs;
+    writer->totalScore += alignedPairBuffer_totalScore(alignedPairs);
+    writer->alignedPairsNumber += alignedPairs->length;
+    if (writer->queue == NULL) {
+        return;
+    }
+    writePosteriorProbs(writer->fH, writer->chunk, writer->readFile, writer->matchModel, writer->scale,
+                        writer->shift, writer->events, writer->target, writer->forward, writer->contig,
+                        writer->eventSequenceOffset, writer->referenceSequenceOffset, alignedPairs, writer->strand);
+    if (writer->chunk != NULL && writer->chunk->length >= POSTERIOR_PROBS_CHUNK_LENGTH) {
+        posteriorProbsChunk_write(writer->chunk, writer->fH);
+    }
+    fflush(writer->fH); // updates bufferLength
+    if (writer->bufferLength >= POSTERIOR_PROBS_BUFFER_LENGTH) {
+        posteriorProbsWriter_closeBuffer(writer);
+        posteriorProbsWriter_openBuffer(writer);
+    }
+}
+
+double posteriorProbsWriter_scoreByPosteriorProbabilityIgnoringGaps(PosteriorProbsWriter *writer) {
+    /*
+     * Gives the average posterior match probability per base of the two sequences, ignoring indels.
+     */
+    return 100.0 * writer->totalScore / ((double) writer->alignedPairsNumber * PAIR_ALIGNMENT_PROB_1);
+}
+
+stList *getRemappedAnchorPairs(stList *unmappedAnchors, int32_t *eventMap, int64_t mapOffset) {
     stList *remapedAnchors = nanopore_remapAnchorPairsWithOffset(unmappedAnchors, eventMap, mapOffset);
     stList *filteredRemappedAnchors = filterToRemoveOverlap(remapedAnchors);
+    stList_destruct(remapedAnchors);
     return filteredRemappedAnchors;
 }
 
-StateMachine *buildStateMachine(const char *modelFile, NanoporeReadAdjustmentParameters npp, StateMachineType type,
-                                Strand strand, NanoporeHDP *nHdp) {
+// loads the model without scaling it to a read
+StateMachine *loadStateMachine(const char *modelFile, StateMachineType type, Strand strand, NanoporeHDP *nHdp) {
     if ((type != threeState) && (type != vanilla) && (type != echelon)
         && (type != fourState) && (type != threeStateHdp)) {
         st_errAbort("vanillaAlign - incompatable stateMachine type request");
@@ -110,80 +316,77 @@ StateMachine *buildStateMachine(const char *modelFile, NanoporeReadAdjustmentPar
 
     if (type == vanilla) {
         StateMachine *sM = getSignalStateMachine3Vanilla(modelFile);
-        emissions_signal_scaleModel(sM, npp.scale, npp.shift, npp.var, npp.scale_sd, npp.var_sd);
         stateMachine3Vanilla_setStrandTransitionsToDefaults(sM, strand);
         return sM;
     }
     if (type == threeState) {
-        StateMachine *sM = getStrawManStateMachine3(modelFile);
-        emissions_signal_scaleModel(sM, npp.scale, npp.shift, npp.var, npp.scale_sd, npp.var_sd);
-        return sM;
+        return getStrawManStateMachine3(modelFile);
     }
     if (type == fourState) {
-        StateMachine *sM = getStateMachine4(modelFile);
-        emissions_signal_scaleModel(sM, npp.scale, npp.shift, npp.var, npp.scale_sd, npp.var_sd);
-        return sM;
+        return getStateMachine4(modelFile);
     }
     if (type == echelon) {
-        StateMachine *sM = getStateMachineEchelon(modelFile);
-        emissions_signal_scaleModel(sM, npp.scale, npp.shift, npp.var, npp.scale_sd, npp.var_sd);
-        return sM;
+        return getStateMachineEchelon(modelFile);
     }
     if (type == threeStateHdp) {
-        StateMachine *sM = getHdpStateMachine3(nHdp);
-        return sM;
+        return getHdpStateMachine3(nHdp);
     }
     else {
-        st_errAbort("vanillaAlign - ERROR: buildStateMachine, didn't get correct input\n");
+        st_errAbort("vanillaAlign - ERROR: loadStateMachine, didn't get correct input\n");
     }
     return 0;
 }
 
+void scaleStateMachine(StateMachine *sM, NanoporeReadAdjustmentParameters npp) {
+    // the HDP densities are for descaled events
+    if (sM->type != threeStateHdp) {
+        emissions_signal_scaleModel(sM, npp.scale, npp.shift, npp.var, npp.scale_sd, npp.var_sd);
+    }
+}
+
+StateMachine *buildStateMachine(const char *modelFile, NanoporeReadAdjustmentParameters npp, StateMachineType type,
+                                Strand strand, NanoporeHDP *nHdp) {
+    StateMachine *sM = loadStateMachine(modelFile, type, strand, nHdp);
+    scaleStateMachine(sM, npp);
+    return sM;
+}
+
+// samples the HDP given the assignments passed to it
+static void sampleHdp(NanoporeHDP *nHdp) {
+    fprintf(stderr, "vanillaAlign - Running Gibbs on HDP\n");
+    execute_nhdp_gibbs_sampling(nHdp, 10000, 100000, 100, FALSE);
+    finalize_nhdp_distributions(nHdp);
+}
+
 void updateHdpFromAssignments(const char *nHdpFile, const char *expectationsFile, const char *nHdpOutFile) {
     NanoporeHDP *nHdp = deserialize_nhdp(nHdpFile);
     Hmm *hdpHmm = hdpHmm_loadFromFile(expectationsFile, nHdp);
     hmmContinuous_destruct(hdpHmm, hdpHmm->type);
 
-    fprintf(stderr, "vanillaAlign - Running Gibbs on HDP\n");
-    execute_nhdp_gibbs_sampling(nHdp, 10000, 100000, 100, FALSE);
-    finalize_nhdp_distributions(nHdp);
+    sampleHdp(nHdp);
 
     fprintf(stderr, "vanillaAlign - Serializing HDP to %s\n", nHdpOutFile);
-    serialize_nhdp(nHdp, nHdpOutFile);
+    serialize_nhdp_binary(nHdp, nHdpOutFile);
     destroy_nanopore_hdp(nHdp);
 }
 
-void loadHmmRoutine(const char *hmmFile, StateMachine *sM, StateMachineType type) {
+Hmm *loadHmmRoutine(const char *hmmFile, StateMachineType type) {
     if ((type != vanilla) && (type != threeState) && (type != threeStateHdp)) {
         st_errAbort("LoadSignalHmm : unupported stateMachineType");
     }
-    hmmContinuous_loadSignalHmm(hmmFile, sM, type);
-}
-
-static double totalScore(stList *alignedPairs) {
-    double score = 0.0;
-    for (int64_t i = 0; i < stList_length(alignedPairs); i++) {
-        stIntTuple *aPair = stList_get(alignedPairs, i);
-        score += stIntTuple_get(aPair, 0);
-    }
-    return score;
+    fprintf(stderr, "vanillaAlign - loading HMM from file, %s\n", hmmFile);
+    return hmmContinuous_loadSignalHmmFromFile(hmmFile, type);
 }
 
-double scoreByPosteriorProbabilityIgnoringGaps(stList *alignedPairs) {
-    /*
-     * Gives the average posterior match probability per base of the two sequences, ignoring indels.
-     */
-    return 100.0 * totalScore(alignedPairs) / ((double) stList_length(alignedPairs) * PAIR_ALIGNMENT_PROB_1);
-}
-
-stList *performSignalAlignmentP(StateMachine *sM, Sequence *sY, int64_t *eventMap, int64_t mapOffset, char *target,
-                                PairwiseAlignmentParameters *p, stList *unmappedAnchors,
-                                void *(*targetGetFcn)(void *, int64_t),
-                                void (*posteriorProbFcn)(StateMachine *sM, int64_t xay, DpMatrix *forwardDpMatrix,
-                                                         DpMatrix *backwardDpMatrix, Sequence* sX, Sequence* sY,
-                                                         double totalProbability, PairwiseAlignmentParameters *p,
-                                                         void *extraArgs),
-                                bool banded) {
+void performSignalAlignmentP(StateMachine *sM, Sequence *sY, int32_t *eventMap, int64_t mapOffset, char *target,
+                             PairwiseAlignmentParameters *p, stList *unmappedAnchors,
+                             void *(*targetGetFcn)(void *, int64_t),
+                             void (*posteriorProbFcn)(StateMachine *sM, int64_t xay, DpMatrix *forwardDpMatrix,
+                                                      DpMatrix *backwardDpMatrix, Sequence* sX, Sequence* sY,
+                                                      double totalProbability, PairwiseAlignmentParameters *p,
+                                                      void *extraArgs),
+                             bool banded,
+                             void (*sinkFn)(AlignedPairBuffer *alignedPairs, void *sinkArgs), void *sinkArgs) {
     int64_t lX = sequence_correctSeqLength(strlen(target), event);
     if (banded) {
         fprintf(stderr, "vanillaAlign - doing banded alignment\n");
@@ -198,69 +401,55 @@ stList *performSignalAlignmentP(StateMachine *sM, Sequence *sY, int64_t *eventMa
             sequence_padSequence(sX);
         }
 
-        // do alignment
-        stList *alignedPairs = getAlignedPairsUsingAnchors(sM, sX, sY, filteredRemappedAnchors, p,
-                                                           posteriorProbFcn, 1, 1);
-        return alignedPairs;
+        // do alignment, the aligned pairs are handed to the sink after each traceback
+        getAlignedPairsUsingAnchorsWithSink(sM, sX, sY, filteredRemappedAnchors, p, posteriorProbFcn, 1, 1,
+                                            sinkFn, sinkArgs);
+        sequence_sequenceDestroy(sX);
+        stList_destruct(filteredRemappedAnchors);
     } else {
         fprintf(stderr, "vanillaAlign - doing non-banded alignment\n");
 
-        stList *alignedPairs = getAlignedPairsWithoutBanding(sM, target, sY->elements, lX, sY->length, p, targetGetFcn,
-                                                             sequence_getEvent, posteriorProbFcn, 1, 1);
-        return alignedPairs;
+        AlignedPairBuffer *alignedPairs = getAlignedPairBufferWithoutBanding(sM, target, sY->elements, lX,
+                                                                             sY->length, p, targetGetFcn,
+                                                                             sequence_getEvent, posteriorProbFcn,
+                                                                             1, 1);
+        alignedPairBuffer_sortByXPlusYCoordinate(alignedPairs); //Ensure the coordinates are increasing
+        sinkFn(alignedPairs, sinkArgs);
+        alignedPairBuffer_destruct(alignedPairs);
     }
 }
 
-stList *performSignalAlignment(StateMachine *sM, const char *hmmFile, Sequence *eventSequence, int64_t *eventMap,
-                               int64_t mapOffset,
-                               char *target, PairwiseAlignmentParameters *p, stList *unmappedAncors, bool banded) {
+void performSignalAlignment(StateMachine *sM, Sequence *eventSequence, int32_t *eventMap,
+                            int64_t mapOffset, char *target, PairwiseAlignmentParameters *p, stList *unmappedAncors,
+                            bool banded, void (*sinkFn)(AlignedPairBuffer *alignedPairs, void *sinkArgs),
+                            void *sinkArgs) {
     if ((sM->type != threeState) && (sM->type != vanilla) && (sM->type != echelon) && (sM->type != fourState) &&
         (sM->type != threeStateHdp)) {
         st_errAbort("vanillaAlign - You're trying to do the wrong king of alignment");
     }
 
-    // load HMM if given
-    if (hmmFile != NULL) {
-        fprintf(stderr, "loading HMM from file, %s\n", hmmFile);
-        loadHmmRoutine(hmmFile, sM, sM->type);
-    }
-
     // decision tree for different stateMachine types
     if ((sM->type == vanilla) || (sM->type == echelon)) {
         if (sM->type == vanilla) {
-            stList *alignedPairs = performSignalAlignmentP(sM, eventSequence, eventMap, mapOffset,
-                                                           target, p, unmappedAncors, sequence_getKmer2,
-                                                           diagonalCalculationPosteriorMatchProbs, banded);
-            return alignedPairs;
+            performSignalAlignmentP(sM, eventSequence, eventMap, mapOffset, target, p, unmappedAncors,
+                                    sequence_getKmer2, diagonalCalculationPosteriorMatchProbs, banded,
+                                    sinkFn, sinkArgs);
         } else {
-            stList *alignedPairs = performSignalAlignmentP(sM, eventSequence, eventMap, mapOffset,
-                                                           target, p, unmappedAncors, sequence_getKmer2,
-                                                           diagonalCalculationMultiPosteriorMatchProbs, banded);
-            return alignedPairs;
+            performSignalAlignmentP(sM, eventSequence, eventMap, mapOffset, target, p, unmappedAncors,
+                                    sequence_getKmer2, diagonalCalculationMultiPosteriorMatchProbs, banded,
+                                    sinkFn, sinkArgs);
         }
     } else if ((sM->type == threeState) || (sM->type == fourState)) {
-        stList *alignedPairs = performSignalAlignmentP(sM, eventSequence, eventMap, mapOffset, target, p,
-                                                       unmappedAncors, sequence_getKmer,
-                                                       diagonalCalculationPosteriorMatchProbs, banded);
-        return alignedPairs;
+        performSignalAlignmentP(sM, eventSequence, eventMap, mapOffset, target, p, unmappedAncors,
+                                sequence_getKmer, diagonalCalculationPosteriorMatchProbs, banded,
+                                sinkFn, sinkArgs);
     } else if (sM->type == threeStateHdp) {
-        stList *alignedPairs = performSignalAlignmentP(sM, eventSequence, eventMap, mapOffset, target, p,
-                                                       unmappedAncors, sequence_getKmer3,
-                                                       diagonalCalculationPosteriorMatchProbs, banded);
-        return alignedPairs;
+        performSignalAlignmentP(sM, eventSequence, eventMap, mapOffset, target, p, unmappedAncors,
+                                sequence_getKmer3, diagonalCalculationPosteriorMatchProbs, banded,
+                                sinkFn, sinkArgs);
     } else {
         st_errAbort("vanillaAlign - ERROR: incorrect stateMachine not correct type\n");
     }
-    return 0;
-}
-
-char *getSubSequence(char *seq, int64_t start, int64_t end, bool strand) {
-    if (strand) {
-        seq = stString_getSubString(seq, start, end - start);
-        return seq;
-    }
-    seq = stString_getSubString(seq, end, start - end);
-    return seq;
 }
 
 void rebasePairwiseAlignmentCoordinates(int64_t *start, int64_t *end, int64_t *strand,
@@ -275,37 +464,42 @@ void rebasePairwiseAlignmentCoordinates(int64_t *start, int64_t *end, int64_t *s
     }
 }
 
-stList *guideAlignmentToRebasedAnchorPairs(struct PairwiseAlignment *pA, PairwiseAlignmentParameters *p) {
+// the guide alignment is left as it is, the cost of a batch read is estimated from it before it is aligned and the
+// jobs of a batch keep theirs for every iteration of the training
+stList *guideAlignmentToRebasedAnchorPairs(const struct PairwiseAlignment *pA, PairwiseAlignmentParameters *p) {
     // check if we need to flip the reference
     bool flipStrand1 = !pA->strand1;
     int64_t refCoordShift = (pA->strand1 ? pA->start1 : pA->end1);
 
     // rebase the reference alignment to (0), but not the nanopore read, this is corrected when remapping the
-    // anchorPairs
-    rebasePairwiseAlignmentCoordinates(&(pA->start1), &(pA->end1), &(pA->strand1), -refCoordShift, flipStrand1);
-    checkPairwiseAlignment(pA);
+    // anchorPairs. The copy shares the operation list, which is only read
+    struct PairwiseAlignment rebasedPA = *pA;
+    rebasePairwiseAlignmentCoordinates(&(rebasedPA.start1), &(rebasedPA.end1), &(rebasedPA.strand1),
+                                       -refCoordShift, flipStrand1);
+    checkPairwiseAlignment(&rebasedPA);
 
     //Convert input alignment into anchor pairs
     stList *unfilteredAnchorPairs = convertPairwiseForwardStrandAlignmentToAnchorPairs(
-            pA, p->constraintDiagonalTrim);
+            &rebasedPA, p->constraintDiagonalTrim);
 
     // sort
     stList_sort(unfilteredAnchorPairs, (int (*)(const void *, const void *)) stIntTuple_cmpFn);
 
     // filter
     stList *anchorPairs = filterToRemoveOverlap(unfilteredAnchorPairs);
+    stList_destruct(unfilteredAnchorPairs);
 
     return anchorPairs;
 }
 
-Sequence *makeEventSequenceFromPairwiseAlignment(double *events, int64_t queryStart, int64_t queryEnd,
-                                                 int64_t *eventMap) {
+Sequence *makeEventSequenceFromPairwiseAlignment(float *events, int64_t queryStart, int64_t queryEnd,
+                                                 int32_t *eventMap) {
     // find the event mapped to the start and end of the 2D read alignment
     int64_t startIdx = eventMap[queryStart];
     int64_t endIdx = eventMap[queryEnd];
 
     // move the event pointer to the first event
-    size_t elementSize = sizeof(double);
+    size_t elementSize = sizeof(float);
     void *elements = (char *)events + ((startIdx * NB_EVENT_PARAMS) * elementSize);
 
     // make the eventSequence
@@ -315,20 +509,9 @@ Sequence *makeEventSequenceFromPairwiseAlignment(double *events, int64_t querySt
     return eventS;
 }
 
-void getSignalExpectations(const char *model, const char *inputHmm, NanoporeHDP *nHdp,
-                           Hmm *hmmExpectations, StateMachineType type,
-                           NanoporeReadAdjustmentParameters npp, Sequence *eventSequence,
-                           int64_t *eventMap, int64_t mapOffset, char *trainingTarget, PairwiseAlignmentParameters *p,
-                           stList *unmappedAnchors, Strand strand) {
-    // load match model, build stateMachine
-    StateMachine *sM = buildStateMachine(model, npp, type, strand, nHdp);
-
-    // load HMM
-    if (inputHmm != NULL) {
-        fprintf(stderr, "vanillaAlign - loading HMM from file, %s\n", inputHmm);
-        loadHmmRoutine(inputHmm, sM, type);
-    }
-
+void getSignalExpectations(StateMachine *sM, Hmm *hmmExpectations, StateMachineType type, Sequence *eventSequence,
+                           int32_t *eventMap, int64_t mapOffset, char *trainingTarget, PairwiseAlignmentParameters *p,
+                           stList *unmappedAnchors) {
     // correct sequence length
     int64_t lX = sequence_correctSeqLength(strlen(trainingTarget), event);
 
@@ -337,25 +520,708 @@ void getSignalExpectations(const char *model, const char *inputHmm, NanoporeHDP
 
     // make sequence objects, separate the target sequences based on HMM type, also implant the match model if we're
     // using a conditional model
+    Sequence *target;
     if (type == vanilla) {
-        Sequence *target = sequence_construct2(lX, trainingTarget, sequence_getKmer2,
-                                               sequence_sliceNucleotideSequence2);
+        target = sequence_construct2(lX, trainingTarget, sequence_getKmer2, sequence_sliceNucleotideSequence2);
         vanillaHmm_implantMatchModelsintoHmm(sM, hmmExpectations);
-
-        getExpectationsUsingAnchors(sM, hmmExpectations, target, eventSequence, filteredRemappedAnchors, p,
-                                    diagonalCalculation_Expectations, 1, 1);
     } else if (type == threeStateHdp) {
-        Sequence *target = sequence_construct2(lX, trainingTarget, sequence_getKmer3,
-                                               sequence_sliceNucleotideSequence2);
-        getExpectationsUsingAnchors(sM, hmmExpectations, target, eventSequence, filteredRemappedAnchors, p,
-                                    diagonalCalculation_Expectations, 1, 1);
+        target = sequence_construct2(lX, trainingTarget, sequence_getKmer3, sequence_sliceNucleotideSequence2);
+    } else {
+        target = sequence_construct2(lX, trainingTarget, sequence_getKmer, sequence_sliceNucleotideSequence2);
+    }
+    getExpectationsUsingAnchors(sM, hmmExpectations, target, eventSequence, filteredRemappedAnchors, p,
+                                diagonalCalculation_Expectations, 1, 1);
+    sequence_sequenceDestroy(target);
+    stList_destruct(filteredRemappedAnchors);
+}
+
+// what all the reads of a run share, loaded once
+typedef struct _alignerOptions {
+    StateMachineType sMtype;
+    bool banded;
+    char *modelFiles[2];    // by strand
+    Hmm *hmms[2];           // NULL unless given
+    NanoporeHDP *nHdps[2];  // NULL unless given
+    IndexedFasta *reference;
+    char *targetFile;
+    NanoporeReadArchive *npReadArchive; // NULL when the reads are npRead files
+    bool binaryPosteriors;
+    char *cytosine_substitute;
+    double threshold;
+    double expectationsPruning;
+    int64_t diagExpansion;
+    int64_t constraintTrim;
+    MemoryBudget *memoryBudget; // NULL unless given, shared by the reads aligned at the same time
+    int64_t nbThreads;          // reads aligned at the same time, the strands of a read only get threads when 1
+    Hmm *trainingExpectations[2]; // NULL unless training, the expectations of the reads are summed into them
+    ReorderBuffer *trainingReduction; // adds the expectations of the reads in job order
+} AlignerOptions;
+
+// one read to align, or to get expectations from when the expectation files are given
+typedef struct _alignmentJob {
+    char *readLabel;
+    char *npRead;            // npRead file, or name of the read in the archive
+    struct PairwiseAlignment *pA; // guide alignment
+    char *posteriorsFile;    // NULL to only report the scores
+    char *expectationsFiles[2];
+    char *modelFiles[2];     // NULL for the models of the run
+    int64_t cost;            // -1 until alignmentJob_estimateCost is called
+    int64_t index;           // when training, the expectations of the reads are summed in this order
+} AlignmentJob;
+
+static void alignmentJob_destruct(AlignmentJob *job) {
+    free(job->readLabel);
+    free(job->npRead);
+    destructPairwiseAlignment(job->pA);
+    free(job->posteriorsFile);
+    for (int64_t s = 0; s < 2; s++) {
+        free(job->expectationsFiles[s]);
+        free(job->modelFiles[s]);
+    }
+    free(job);
+}
+
+// the stateMachines a thread keeps for the models of the run, their match models are restored and rescaled for
+// each read instead of reloading the model files
+typedef struct _alignerWorkspace {
+    AlignerOptions *options;
+    StateMachine *sMs[2];
+    double *matchModels[2]; // unscaled
+} AlignerWorkspace;
+
+static void *alignerWorkspace_construct(void *options) {
+    AlignerWorkspace *workspace = st_calloc(1, sizeof(AlignerWorkspace));
+    workspace->options = options;
+    return workspace;
+}
+
+static void alignerWorkspace_destruct(void *arg) {
+    AlignerWorkspace *workspace = arg;
+    for (int64_t s = 0; s < 2; s++) {
+        if (workspace->sMs[s] != NULL) {
+            stateMachine_destruct(workspace->sMs[s]);
+            free(workspace->matchModels[s]);
+        }
+    }
+    free(workspace);
+}
+
+static StateMachine *alignerWorkspace_getStateMachine(AlignerWorkspace *workspace, AlignerOptions *options,
+                                                      AlignmentJob *job, Strand strand,
+                                                      NanoporeReadAdjustmentParameters npp) {
+    if (job->modelFiles[strand] != NULL) {
+        // models of this read only
+        StateMachine *sM = buildStateMachine(job->modelFiles[strand], npp, options->sMtype, strand,
+                                             options->nHdps[strand]);
+        if (options->hmms[strand] != NULL) {
+            hmmContinuous_loadExpectations(sM, options->hmms[strand], options->sMtype);
+        }
+        return sM;
+    }
+    StateMachine *sM = workspace->sMs[strand];
+    size_t matchModelSize = 0;
+    if (sM == NULL) {
+        sM = loadStateMachine(options->modelFiles[strand], options->sMtype, strand, options->nHdps[strand]);
+        if (options->hmms[strand] != NULL) {
+            hmmContinuous_loadExpectations(sM, options->hmms[strand], options->sMtype);
+        }
+        matchModelSize = (1 + sM->parameterSetSize * MODEL_PARAMS) * sizeof(double);
+        workspace->sMs[strand] = sM;
+        workspace->matchModels[strand] = st_malloc(matchModelSize);
+        memcpy(workspace->matchModels[strand], sM->EMISSION_MATCH_PROBS, matchModelSize);
     } else {
-        Sequence *target = sequence_construct2(lX, trainingTarget, sequence_getKmer,
-                                               sequence_sliceNucleotideSequence2);
-        getExpectationsUsingAnchors(sM, hmmExpectations, target, eventSequence, filteredRemappedAnchors, p,
-                                    diagonalCalculation_Expectations, 1, 1);
+        matchModelSize = (1 + sM->parameterSetSize * MODEL_PARAMS) * sizeof(double);
+        memcpy(sM->EMISSION_MATCH_PROBS, workspace->matchModels[strand], matchModelSize);
+    }
+    scaleStateMachine(sM, npp);
+    return sM;
+}
+
+// destructs the stateMachines of the read's own models
+static void alignmentJob_releaseStateMachine(AlignmentJob *job, Strand strand, StateMachine *sM) {
+    if (job->modelFiles[strand] != NULL) {
+        stateMachine_destruct(sM);
+    }
+}
+
+// peak memory of aligning the event sequence of one strand to the target (or of getting its expectations)
+static int64_t strandAlignmentMemory(AlignerOptions *options, bool getExpectations, PairwiseAlignmentParameters *p,
+                                     stList *remappedAnchors, int64_t lX, Sequence *eventSequence,
+                                     int64_t stateNumber) {
+    if (!options->banded && !getExpectations) {
+        // getAlignedPairBufferWithoutBanding fills both matrices
+        return 2 * (lX + 1) * (eventSequence->length + 1) * stateNumber * (int64_t) sizeof(double);
+    }
+    if (getExpectations) {
+        return getPosteriorProbsWithBandingPeakMemory(remappedAnchors, lX, eventSequence->length, stateNumber, p);
+    }
+    return getAlignedPairsUsingAnchorsPeakMemory(remappedAnchors, lX, eventSequence->length, stateNumber, p, TRUE);
+}
+
+// reserves the peak memory of the template and complement alignments of a read, they run at the same time. When
+// they need more than the whole budget the traceback is done more often (p->traceBackDiagonals is kept, it is
+// what the accuracy at the traceback points depends on) until they fit or it can't be done more often. Returns the
+// bytes reserved
+static int64_t reserveAlignmentMemory(AlignerOptions *options, AlignmentJob *job, bool getExpectations,
+                                      PairwiseAlignmentParameters *p, stList *anchorPairs, NanoporeRead *npRead,
+                                      int64_t mapOffset, char *target, Sequence *tEventSequence,
+                                      Sequence *cEventSequence, int64_t tStateNumber, int64_t cStateNumber) {
+    int64_t lX = sequence_correctSeqLength(strlen(target), event);
+    stList *tAnchors = getRemappedAnchorPairs(anchorPairs, npRead->templateEventMap, mapOffset);
+    stList *cAnchors = getRemappedAnchorPairs(anchorPairs, npRead->complementEventMap, mapOffset);
+    int64_t budget = memoryBudget_getBudget(options->memoryBudget);
+    int64_t minDiagsBetweenTraceBack = p->minDiagsBetweenTraceBack;
+    int64_t memory;
+    while (1) {
+        memory = strandAlignmentMemory(options, getExpectations, p, tAnchors, lX, tEventSequence, tStateNumber)
+                 + strandAlignmentMemory(options, getExpectations, p, cAnchors, lX, cEventSequence, cStateNumber);
+        if (memory <= budget || !options->banded || p->minDiagsBetweenTraceBack / 2 <= p->traceBackDiagonals + 1) {
+            break;
+        }
+        p->minDiagsBetweenTraceBack /= 2;
+    }
+    stList_destruct(tAnchors);
+    stList_destruct(cAnchors);
+    if (p->minDiagsBetweenTraceBack != minDiagsBetweenTraceBack) {
+        fprintf(stderr, "vanillaAlign - %s is over the memory budget, tracing back every %" PRIi64 " diagonals\n",
+                job->readLabel, p->minDiagsBetweenTraceBack);
+    }
+    if (memory > budget) {
+        fprintf(stderr, "vanillaAlign - %s needs %" PRIi64 " bytes, more than the budget, it runs alone\n",
+                job->readLabel, memory);
+    }
+    return memoryBudget_reserve(options->memoryBudget, memory);
+}
+
+// with an archive the npRead of the job is the name of the read in the archive
+static NanoporeRead *alignmentJob_loadRead(AlignmentJob *job, AlignerOptions *options) {
+    if (options->npReadArchive == NULL) {
+        return nanopore_loadNanoporeReadFromFile(job->npRead);
+    }
+    NanoporeRead *npRead = nanoporeReadArchive_getReadByName(options->npReadArchive, job->npRead);
+    if (npRead == NULL) {
+        st_errAbort("vanillaAlign - read %s isn't in the npRead archive\n", job->npRead);
+    }
+    return npRead;
+}
+
+static void alignRead(AlignerOptions *options, AlignerWorkspace *workspace, AlignmentJob *job) {
+    StateMachineType sMtype = options->sMtype;
+    const struct PairwiseAlignment *pA = job->pA;
+
+    // load nanopore read
+    NanoporeRead *npRead = alignmentJob_loadRead(job, options);
+
+    // descale events if using hdp
+    if (sMtype == threeStateHdp) {
+        fprintf(stderr, "vanillaAlign - descaling Nanopore Events\n");
+        nanopore_descaleNanoporeRead(npRead);
+    }
+
+    // make some params
+    PairwiseAlignmentParameters *p = pairwiseAlignmentBandingParameters_construct();
+    p->threshold = options->threshold;
+    p->constraintDiagonalTrim = options->constraintTrim;
+    p->diagonalExpansion = options->diagExpansion;
+    p->expectationsThreshold = EXPECTATIONS_THRESHOLD;
+    p->expectationsPruning = options->expectationsPruning;
+
+    // put in to help with debugdebugging
+    // printPairwiseAlignmentSummary(pA);
+
+    // slice out the section of the reference we're aligning to, a reference with more than one sequence is
+    // looked up by the contig of the guide alignment
+    int64_t referenceOrdinal = 0;
+    if (indexedFasta_getNumberOfSequences(options->reference) != 1) {
+        referenceOrdinal = indexedFasta_getOrdinal(options->reference, pA->contig1);
+        if (referenceOrdinal < 0) {
+            st_errAbort("vanillaAlign - ERROR: contig %s isn't in %s\n", pA->contig1, options->targetFile);
+        }
+    }
+    char *trimmedRefSeq = indexedFasta_getSubSequence(options->reference, referenceOrdinal, pA->start1, pA->end1,
+                                                      pA->strand1, TRUE);
+
+    // reverse complement for complement event sequence
+    char *rc_trimmedRefSeq = stString_reverseComplementString(trimmedRefSeq);
+
+    // change bases to methylated/hydroxymethylated, if asked to
+    char *cytosine_substitute = options->cytosine_substitute;
+    char *templateTargetSeq = cytosine_substitute == NULL ? trimmedRefSeq : stString_replace(trimmedRefSeq, "C",
+                                                                                             cytosine_substitute);
+    char *complementTargetSeq = cytosine_substitute == NULL ? rc_trimmedRefSeq : stString_replace(rc_trimmedRefSeq,
+                                                                                                  "C",
+                                                                                                  cytosine_substitute);
+
+    // constrain the event sequence to the positions given by the guide alignment
+    Sequence *tEventSequence = makeEventSequenceFromPairwiseAlignment(npRead->templateEvents,
+                                                                      pA->start2, pA->end2,
+                                                                      npRead->templateEventMap);
+
+    Sequence *cEventSequence = makeEventSequenceFromPairwiseAlignment(npRead->complementEvents,
+                                                                      pA->start2, pA->end2,
+                                                                      npRead->complementEventMap);
+
+
+    // the aligned pairs start at (0,0) so we need to correct them based on the guide alignment later.
+    // record the pre-zeroed alignment start and end coordinates here
+
+    // for the events:
+    int64_t tCoordinateShift = npRead->templateEventMap[pA->start2];
+    int64_t cCoordinateShift = npRead->complementEventMap[pA->start2];
+
+    // and for the reference:
+    int64_t rCoordinateShift_t = pA->start1;
+    int64_t rCoordinateShift_c = pA->end1;
+    bool forward = pA->strand1;  // keep track of whether this is a forward mapped read or not
+
+    stList *anchorPairs = guideAlignmentToRebasedAnchorPairs(pA, p);
+
+    bool training = options->trainingExpectations[template] != NULL;
+    bool getExpectations = training ||
+                           ((job->expectationsFiles[template] != NULL) && (job->expectationsFiles[complement] != NULL));
+
+    // make the stateMachines
+    StateMachine *sMt = alignerWorkspace_getStateMachine(workspace, options, job, template, npRead->templateParams);
+    StateMachine *sMc = alignerWorkspace_getStateMachine(workspace, options, job, complement,
+                                                         npRead->complementParams);
+
+    // wait until the memory of both alignments fits in the budget
+    int64_t reservedMemory = 0;
+    if (options->memoryBudget != NULL) {
+        reservedMemory = reserveAlignmentMemory(options, job, getExpectations, p, anchorPairs, npRead, pA->start2,
+                                                trimmedRefSeq, tEventSequence, cEventSequence,
+                                                sMt->stateNumber, sMc->stateNumber);
+    }
+
+    if (getExpectations) {
+        // Expectation Routine //
+        if ((sMtype != threeState) && (sMtype != vanilla) && (sMtype != threeStateHdp)) {
+            st_errAbort("vanillaAlign - getting expectations not allowed for this HMM type, yet");
+        }
+
+        // make empty HMM to collect expectations
+        Hmm *templateExpectations = hmmContinuous_getEmptyHmm(sMtype, 0.0001, p->threshold);
+        Hmm *complementExpectations = hmmContinuous_getEmptyHmm(sMtype, 0.0001, p->threshold);
+
+        // the pool's threads are not OpenMP threads, a team here would be nbThreads teams at once
+        #pragma omp parallel sections num_threads(2) if(options->nbThreads == 1)
+        {
+            {
+                // get expectations for template
+                fprintf(stderr, "vanillaAlign - getting expectations for template\n");
+                getSignalExpectations(sMt, templateExpectations, sMtype, tEventSequence, npRead->templateEventMap,
+                                      pA->start2, templateTargetSeq, p, anchorPairs);
+                alignmentJob_releaseStateMachine(job, template, sMt);
+
+                if (sMtype == threeStateHdp) {
+                    fprintf(stderr, "vanillaAlign - got %lld HDP assignments\n",
+                            hmmContinuous_howManyAssignments(templateExpectations));
+                }
+                if (!training) {
+                    // write to file
+                    fprintf(stderr, "vanillaAlign - writing expectations to file: %s\n",
+                            job->expectationsFiles[template]);
+                    hmmContinuous_writeToBinaryFile(job->expectationsFiles[template], templateExpectations, sMtype);
+                }
+            }
+
+            #pragma omp section
+            {
+                // get expectations for the complement
+                fprintf(stderr, "vanillaAlign - getting expectations for complement\n");
+                getSignalExpectations(sMc, complementExpectations, sMtype, cEventSequence,
+                                      npRead->complementEventMap, pA->start2, complementTargetSeq, p, anchorPairs);
+                alignmentJob_releaseStateMachine(job, complement, sMc);
+
+                if (sMtype == threeStateHdp) {
+                    fprintf(stderr, "vanillaAlign - got %lld HDP assignments\n",
+                            hmmContinuous_howManyAssignments(complementExpectations));
+                }
+                if (!training) {
+                    // write to file
+                    fprintf(stderr, "vanillaAlign - writing expectations to file: %s\n",
+                            job->expectationsFiles[complement]);
+                    hmmContinuous_writeToBinaryFile(job->expectationsFiles[complement], complementExpectations, sMtype);
+                }
+            }
+        }
+
+        if (training) {
+            // summed in job order by addTrainingExpectations
+            Hmm **expectations = st_malloc(2 * sizeof(Hmm *));
+            expectations[template] = templateExpectations;
+            expectations[complement] = complementExpectations;
+            reorderBuffer_push(options->trainingReduction, job->index, expectations);
+        } else {
+            hmmContinuous_destruct(templateExpectations, sMtype);
+            hmmContinuous_destruct(complementExpectations, sMtype);
+        }
+    } else {
+        // Alignment Procedure //
+        PosteriorProbsWriter *templateWriter, *complementWriter;
+        double templatePosteriorScore, complementPosteriorScore;
+        // both strands hand their formatted posteriors to one writer thread, the aligned pairs are written to file
+        // as they are computed
+        OutputQueue *posteriorProbsQueue = job->posteriorsFile == NULL ? NULL :
+                                           outputQueue_construct(job->posteriorsFile, options->binaryPosteriors,
+                                                                 POSTERIOR_PROBS_MAX_PENDING_BUFFERS);
+        templateWriter = posteriorProbsWriter_construct(posteriorProbsQueue, NULL, options->binaryPosteriors,
+                                                        job->readLabel, sMt->EMISSION_MATCH_PROBS,
+                                                        npRead->templateParams.scale, npRead->templateParams.shift,
+                                                        npRead->templateEvents, trimmedRefSeq, forward, pA->contig1,
+                                                        tCoordinateShift, rCoordinateShift_t, template);
+        complementWriter = posteriorProbsWriter_construct(posteriorProbsQueue, templateWriter,
+                                                          options->binaryPosteriors, job->readLabel,
+                                                          sMc->EMISSION_MATCH_PROBS, npRead->complementParams.scale,
+                                                          npRead->complementParams.shift, npRead->complementEvents,
+                                                          rc_trimmedRefSeq, forward, pA->contig1, cCoordinateShift,
+                                                          rCoordinateShift_c, complement);
+        #pragma omp parallel sections num_threads(2) if(options->nbThreads == 1)
+        {
+            {
+                // Template alignment
+                fprintf(stderr, "vanillaAlign - starting template alignment\n");
+
+                // get aligned pairs
+                performSignalAlignment(sMt, tEventSequence, npRead->templateEventMap, pA->start2, trimmedRefSeq, p,
+                                       anchorPairs, options->banded, posteriorProbsWriter_write, templateWriter);
+                posteriorProbsWriter_finish(templateWriter);
+
+                templatePosteriorScore = posteriorProbsWriter_scoreByPosteriorProbabilityIgnoringGaps(templateWriter);
+                alignmentJob_releaseStateMachine(job, template, sMt);
+            }
+            #pragma omp section
+            {
+                // Complement alignment
+                fprintf(stderr, "vanillaAlign - starting complement alignment\n");
+
+                // get aligned pairs
+                performSignalAlignment(sMc, cEventSequence, npRead->complementEventMap, pA->start2,
+                                       rc_trimmedRefSeq, p, anchorPairs, options->banded,
+                                       posteriorProbsWriter_write, complementWriter);
+                posteriorProbsWriter_finish(complementWriter);
+
+                complementPosteriorScore =
+                        posteriorProbsWriter_scoreByPosteriorProbabilityIgnoringGaps(complementWriter);
+                alignmentJob_releaseStateMachine(job, complement, sMc);
+            }
+        }
+        // one call, so the lines of reads aligned at the same time don't interleave
+        fprintf(stdout, "%s %lld\t%lld(%f)\t%lld(%f)\n", job->readLabel, stList_length(anchorPairs),
+                templateWriter->alignedPairsNumber, templatePosteriorScore, complementWriter->alignedPairsNumber,
+                complementPosteriorScore);
+        // final alignment clean up
+        posteriorProbsWriter_destruct(templateWriter);
+        posteriorProbsWriter_destruct(complementWriter);
+        if (posteriorProbsQueue != NULL) {
+            outputQueue_destruct(posteriorProbsQueue);
+        }
+        fprintf(stderr, "vanillaAlign - SUCCESS: finished alignment of query %s\n", job->readLabel);
+    }
+
+    if (options->memoryBudget != NULL) {
+        memoryBudget_release(options->memoryBudget, reservedMemory);
+    }
+    nanopore_nanoporeReadDestruct(npRead);
+    sequence_sequenceDestroy(tEventSequence);
+    sequence_sequenceDestroy(cEventSequence);
+    pairwiseAlignmentBandingParameters_destruct(p);
+    stList_destruct(anchorPairs);
+    if (templateTargetSeq != trimmedRefSeq) {
+        free(templateTargetSeq);
+        free(complementTargetSeq);
+    }
+    free(trimmedRefSeq);
+    free(rc_trimmedRefSeq);
+}
+
+// scheduler job
+static void alignBatchRead(void *workspace, void *job) {
+    alignRead(((AlignerWorkspace *) workspace)->options, workspace, job);
+}
+
+// band areas of the template and complement alignments, over the rebased anchors of the guide alignment remapped
+// to the events as alignRead does. Estimated once (the read is loaded for its event maps, binary npReads and
+// archives are only mmaped) and kept in job->cost
+static int64_t alignmentJob_estimateCost(AlignmentJob *job, AlignerOptions *options) {
+    if (job->cost >= 0) {
+        return job->cost;
+    }
+    const struct PairwiseAlignment *pA = job->pA;
+    NanoporeRead *npRead = alignmentJob_loadRead(job, options);
+    PairwiseAlignmentParameters *p = pairwiseAlignmentBandingParameters_construct();
+    p->constraintDiagonalTrim = options->constraintTrim;
+    stList *anchorPairs = guideAlignmentToRebasedAnchorPairs(pA, p);
+    int64_t lX = sequence_correctSeqLength(llabs(pA->end1 - pA->start1), event);
+    int32_t *eventMaps[2] = { npRead->templateEventMap, npRead->complementEventMap };
+    job->cost = 0;
+    for (int64_t s = 0; s < 2; s++) {
+        stList *remappedAnchors = getRemappedAnchorPairs(anchorPairs, eventMaps[s], pA->start2);
+        int64_t lY = eventMaps[s][pA->end2] - eventMaps[s][pA->start2];
+        job->cost += getBandArea(remappedAnchors, lX, lY, options->diagExpansion);
+        stList_destruct(remappedAnchors);
+    }
+    stList_destruct(anchorPairs);
+    pairwiseAlignmentBandingParameters_destruct(p);
+    nanopore_nanoporeReadDestruct(npRead);
+    return job->cost;
+}
+
+// the batch lists one read per line, tab separated:
+//     readLabel  npRead  guide alignment (exonerate cigar)  output  [templateModel complementModel]
+// the output is the posteriors file, or with expectations the prefix of the .template.expectations and
+// .complement.expectations files, an empty model is the model of the run. Blank lines and lines starting with '#'
+// are skipped. The reads are aligned at the same time so two lines can't have the same output. Returns the jobs,
+// they are kept for the iterations of the training
+static stList *readBatch(const char *batchFile, bool getExpectations) {
+    FILE *fH = stString_eq(batchFile, "-") ? stdin : fopen(batchFile, "r");
+    if (fH == NULL) {
+        st_errAbort("vanillaAlign - ERROR: couldn't open batch %s\n", batchFile);
+    }
+    stList *jobs = stList_construct3(0, (void (*)(void *)) alignmentJob_destruct);
+    stSet *outputs = stSet_construct3(stHash_stringKey, stHash_stringEqualKey, free);
+    char *line;
+    int64_t lineNumber = 0;
+    while ((line = stFile_getLineFromFile(fH)) != NULL) {
+        lineNumber++;
+        if (strlen(line) == 0 || line[0] == '#') {
+            free(line);
+            continue;
+        }
+        stList *tokens = stString_splitByString(line, "\t");
+        if (stList_length(tokens) != 4 && stList_length(tokens) != 6) {
+            st_errAbort("vanillaAlign - ERROR: line %" PRIi64 " of batch %s has %" PRIi64 " fields, expected 4 or "
+                        "6\n", lineNumber, batchFile, stList_length(tokens));
+        }
+        AlignmentJob *job = st_calloc(1, sizeof(AlignmentJob));
+        job->readLabel = stString_copy(stList_get(tokens, 0));
+        job->npRead = stString_copy(stList_get(tokens, 1));
+        FILE *cigarFH = fmemopen(stList_get(tokens, 2), strlen(stList_get(tokens, 2)), "r");
+        job->pA = cigarFH == NULL ? NULL : cigarRead(cigarFH);
+        job->cost = -1;
+        if (job->pA == NULL) {
+            st_errAbort("vanillaAlign - ERROR: couldn't parse the guide alignment on line %" PRIi64 " of batch %s\n",
+                        lineNumber, batchFile);
+        }
+        fclose(cigarFH);
+        if (stSet_search(outputs, stList_get(tokens, 3)) != NULL) {
+            st_errAbort("vanillaAlign - ERROR: output %s on line %" PRIi64 " of batch %s is the output of an earlier "
+                        "line\n", (char *) stList_get(tokens, 3), lineNumber, batchFile);
+        }
+        stSet_insert(outputs, stString_copy(stList_get(tokens, 3)));
+        if (getExpectations) {
+            job->expectationsFiles[template] = stString_print("%s.template.expectations",
+                                                              (char *) stList_get(tokens, 3));
+            job->expectationsFiles[complement] = stString_print("%s.complement.expectations",
+                                                                (char *) stList_get(tokens, 3));
+        } else {
+            job->posteriorsFile = stString_copy(stList_get(tokens, 3));
+        }
+        if (stList_length(tokens) == 6) {
+            for (int64_t s = 0; s < 2; s++) {
+                char *modelFile = stList_get(tokens, 4 + s);
+                job->modelFiles[s] = strlen(modelFile) == 0 ? NULL : stString_copy(modelFile);
+            }
+        }
+        stList_append(jobs, job);
+        stList_destruct(tokens);
+        free(line);
+    }
+    if (fH != stdin) {
+        fclose(fH);
+    }
+    stSet_destruct(outputs);
+    return jobs;
+}
+
+// the models, HMMs, HDPs and reference are shared by all the reads, each thread keeps its own stateMachines (made
+// again for each batch, so they pick up the HMMs of the run). The longest alignments start first and threads that
+// run out of reads take them from the others
+static void alignBatch(AlignerOptions *options, stList *jobs, int64_t nbThreads) {
+    JobScheduler *scheduler = jobScheduler_construct();
+    for (int64_t i = 0; i < stList_length(jobs); i++) {
+        AlignmentJob *job = stList_get(jobs, i);
+        job->cost = alignmentJob_estimateCost(job, options);
+        jobScheduler_add(scheduler, alignBatchRead, job, job->cost);
+    }
+    fprintf(stderr, "vanillaAlign - aligning %" PRIi64 " reads with %" PRIi64 " threads\n", stList_length(jobs),
+            nbThreads);
+    jobScheduler_run(scheduler, nbThreads, alignerWorkspace_construct, alignerWorkspace_destruct, options);
+    fprintf(stderr, "vanillaAlign - SUCCESS: finished batch, %" PRIi64 " reads (%" PRIi64 " stolen)\n",
+            stList_length(jobs), jobScheduler_getNumberOfSteals(scheduler));
+    jobScheduler_destruct(scheduler);
+}
+
+// M-step for one strand: the HDP is sampled given the assignments of the iteration and the summed expectations
+// are normalized into the HMM of the next iteration
+static void trainStrand(AlignerOptions *options, Strand strand) {
+    Hmm *hmm = options->trainingExpectations[strand];
+    options->trainingExpectations[strand] = NULL;
+    if (options->sMtype == threeStateHdp) {
+        hdpHmm_passAssignmentsToHdp(hmm, options->nHdps[strand]);
+        sampleHdp(options->nHdps[strand]);
+    }
+    hmmContinuous_maximize(hmm, options->sMtype);
+    if (options->hmms[strand] != NULL) {
+        hmmContinuous_destruct(options->hmms[strand], options->sMtype);
+    }
+    options->hmms[strand] = hmm;
+}
+
+// sums the expectations of a read into the training HMMs, called in job order so the sums don't depend on the
+// number of threads or on which thread aligned which read
+static void addTrainingExpectations(void *arg, void *extraArg) {
+    Hmm **expectations = arg;
+    AlignerOptions *options = extraArg;
+    for (int64_t s = 0; s < 2; s++) {
+        hmmContinuous_addExpectations(options->trainingExpectations[s], expectations[s], options->sMtype);
+        hmmContinuous_destruct(expectations[s], options->sMtype);
+    }
+    free(expectations);
+}
+
+static int alignmentJob_cmpByDecreasingCost(const void *a, const void *b) {
+    const AlignmentJob *jobA = a, *jobB = b;
+    if (jobA->cost != jobB->cost) {
+        return jobA->cost > jobB->cost ? -1 : 1;
+    }
+    return jobA->index < jobB->index ? -1 : (jobA->index > jobB->index ? 1 : 0);
+}
+
+// Baum-Welch in one process, the E-step of each iteration runs the reads of the batch on the thread pool and sums
+// their expectations in memory instead of writing expectation files for mergeExpectations. Prints the iteration,
+// the template and complement likelihoods and their change from the previous iteration. With squarem the
+// iterations go by the three EM steps of a HmmSquaremCycle, once there are HMMs to start from
+static void trainHmms(AlignerOptions *options, stList *jobs, int64_t nbIterations, int64_t nbThreads, bool squarem) {
+    // the expectations are summed in the order the scheduler starts the reads (most expensive first), so few of
+    // them wait for an earlier read. Stealing takes reads out of that order, so the window holds all of them
+    for (int64_t i = 0; i < stList_length(jobs); i++) {
+        AlignmentJob *job = stList_get(jobs, i);
+        job->cost = alignmentJob_estimateCost(job, options);
+        job->index = i;
+    }
+    stList_sort(jobs, alignmentJob_cmpByDecreasingCost);
+    for (int64_t i = 0; i < stList_length(jobs); i++) {
+        ((AlignmentJob *) stList_get(jobs, i))->index = i;
+    }
+
+    double likelihoods[2] = {0.0, 0.0};
+    HmmSquaremCycle cycles[2];
+    cycles[template].step = cycles[complement].step = 0;
+    for (int64_t i = 0; i < nbIterations; i++) {
+        fprintf(stderr, "vanillaAlign - training iteration %" PRIi64 "\n", i);
+        if (squarem && cycles[template].step == 0 && i + 2 < nbIterations
+            && options->hmms[template] != NULL && options->hmms[complement] != NULL) {
+            for (int64_t s = 0; s < 2; s++) {
+                hmmContinuous_squaremStart(&cycles[s], options->hmms[s], options->sMtype);
+            }
+        }
+        for (int64_t s = 0; s < 2; s++) {
+            options->trainingExpectations[s] = hmmContinuous_getEmptyHmm(options->sMtype, 0.0, options->threshold);
+        }
+        options->trainingReduction = reorderBuffer_construct(stList_length(jobs), addTrainingExpectations, options);
+        alignBatch(options, jobs, nbThreads);
+        reorderBuffer_destruct(options->trainingReduction);
+        options->trainingReduction = NULL;
+        double previousLikelihoods[2] = {likelihoods[template], likelihoods[complement]};
+        for (int64_t s = 0; s < 2; s++) {
+            likelihoods[s] = options->trainingExpectations[s]->likelihood;
+        }
+
+        #pragma omp parallel sections
+        {
+            {
+                trainStrand(options, template);
+            }
+
+            #pragma omp section
+            {
+                trainStrand(options, complement);
+            }
+        }
+
+        for (int64_t s = 0; s < 2 && cycles[s].step > 0; s++) {
+            const char *strand = s == template ? "template" : "complement";
+            options->hmms[s] = hmmContinuous_squaremStep(&cycles[s], options->hmms[s], likelihoods[s],
+                                                         options->sMtype);
+            if (cycles[s].step == 3) {
+                fprintf(stderr, "vanillaAlign - %s extrapolation step %f\n", strand, cycles[s].alpha);
+            } else if (cycles[s].step == 0 && cycles[s].rejected) {
+                fprintf(stderr, "vanillaAlign - %s extrapolation lowered the likelihood, keeping the EM step\n",
+                        strand);
+            }
+        }
+
+        if (i == 0) {
+            fprintf(stdout, "%" PRIi64 "\t%f\t%f\n", i, likelihoods[template], likelihoods[complement]);
+        } else {
+            fprintf(stdout, "%" PRIi64 "\t%f\t%f\t%f\t%f\n", i, likelihoods[template], likelihoods[complement],
+                    likelihoods[template] - previousLikelihoods[template],
+                    likelihoods[complement] - previousLikelihoods[complement]);
+        }
+        fflush(stdout);
+    }
+}
+
+// stepwise EM (Liang and Klein, 2009): the expectations of each mini-batch of reads, per read, are blended into
+// running expectations with a decaying step size and the HMMs are maximized from those after every mini-batch.
+// Prints the update, the epoch and the template and complement likelihoods per read of the mini-batch
+static void trainHmmsOnline(AlignerOptions *options, stList *jobs, int64_t nbEpochs, int64_t miniBatchSize,
+                            double stepSizeDecay, int64_t nbThreads) {
+    Hmm *running[2];
+    for (int64_t s = 0; s < 2; s++) {
+        running[s] = hmmContinuous_getEmptyHmm(options->sMtype, 0.0, options->threshold);
+    }
+    int64_t update = 0;
+    for (int64_t epoch = 0; epoch < nbEpochs; epoch++) {
+        for (int64_t start = 0; start < stList_length(jobs); start += miniBatchSize) {
+            // the reads of the mini-batch are summed most expensive first, as in trainHmms
+            stList *miniBatch = stList_construct();
+            for (int64_t i = start; i < start + miniBatchSize && i < stList_length(jobs); i++) {
+                AlignmentJob *job = stList_get(jobs, i);
+                job->cost = alignmentJob_estimateCost(job, options);
+                job->index = i;
+                stList_append(miniBatch, job);
+            }
+            stList_sort(miniBatch, alignmentJob_cmpByDecreasingCost);
+            for (int64_t i = 0; i < stList_length(miniBatch); i++) {
+                ((AlignmentJob *) stList_get(miniBatch, i))->index = i;
+            }
+
+            fprintf(stderr, "vanillaAlign - training update %" PRIi64 " (epoch %" PRIi64 ")\n", update, epoch);
+            for (int64_t s = 0; s < 2; s++) {
+                options->trainingExpectations[s] = hmmContinuous_getEmptyHmm(options->sMtype, 0.0,
+                                                                             options->threshold);
+            }
+            options->trainingReduction = reorderBuffer_construct(stList_length(miniBatch), addTrainingExpectations,
+                                                                 options);
+            alignBatch(options, miniBatch, nbThreads);
+            reorderBuffer_destruct(options->trainingReduction);
+            options->trainingReduction = NULL;
+
+            double likelihoods[2];
+            for (int64_t s = 0; s < 2; s++) {
+                Hmm *expectations = options->trainingExpectations[s];
+                options->trainingExpectations[s] = NULL;
+                likelihoods[s] = expectations->likelihood / stList_length(miniBatch);
+                Hmm *hmm = hmmContinuous_stepwiseEmUpdate(running[s], expectations, stList_length(miniBatch),
+                                                          update, stepSizeDecay, options->sMtype);
+                hmmContinuous_destruct(expectations, options->sMtype);
+                if (options->hmms[s] != NULL) {
+                    hmmContinuous_destruct(options->hmms[s], options->sMtype);
+                }
+                options->hmms[s] = hmm;
+            }
+            fprintf(stdout, "%" PRIi64 "\t%" PRIi64 "\t%f\t%f\n", update, epoch, likelihoods[template],
+                    likelihoods[complement]);
+            fflush(stdout);
+            stList_destruct(miniBatch);
+            update++;
+        }
+    }
+    for (int64_t s = 0; s < 2; s++) {
+        hmmContinuous_destruct(running[s], options->sMtype);
     }
-    stateMachine_destruct(sM);
 }
 
 int main(int argc, char *argv[]) {
@@ -375,8 +1241,10 @@ int main(int argc, char *argv[]) {
     char *complementModelFile = stString_print("../../cPecan/models/complement_median68pA_pop2.model");
     char *readLabel = NULL;
     char *npReadFile = NULL;
+    char *npReadArchiveFile = NULL;
     char *targetFile = NULL;
     char *posteriorProbsFile = NULL;
+    bool binaryPosteriors = FALSE;
     char *templateHmmFile = NULL;
     char *complementHmmFile = NULL;
     char *templateExpectationsFile = NULL;
@@ -384,6 +1252,17 @@ int main(int argc, char *argv[]) {
     char *templateHdp = NULL;
     char *complementHdp = NULL;
     char *cytosine_substitute = NULL;
+    char *batchFile = NULL;
+    bool batchExpectations = FALSE;
+    int64_t nbThreads = 1;
+    int64_t memoryBudget = 0;
+    int64_t trainingIterations = 0;
+    char *outTemplateHmmFile = NULL;
+    char *outComplementHmmFile = NULL;
+    double expectationsPruning = 0.0;
+    bool squarem = FALSE;
+    int64_t miniBatchSize = 0;
+    double stepSizeDecay = 0.7;
 
     int key;
     while (1) {
@@ -402,8 +1281,10 @@ int main(int argc, char *argv[]) {
                 {"complementModel",         required_argument,  0,  'C'},
                 {"readLabel",               required_argument,  0,  'L'},
                 {"npRead",                  required_argument,  0,  'q'},
+                {"npReadArchive",           required_argument,  0,  'A'},
                 {"reference",               required_argument,  0,  'r'},
                 {"posteriors",              required_argument,  0,  'u'},
+                {"binaryPosteriors",        no_argument,        0,  'B'},
                 {"inTemplateHmm",           required_argument,  0,  'y'},
                 {"inComplementHmm",         required_argument,  0,  'z'},
                 {"templateHdp",             required_argument,  0,  'v'},
@@ -413,12 +1294,23 @@ int main(int argc, char *argv[]) {
                 {"diagonalExpansion",       required_argument,  0,  'x'},
                 {"threshold",               required_argument,  0,  'D'},
                 {"constraintTrim",          required_argument,  0,  'm'},
+                {"batch",                   required_argument,  0,  'n'},
+                {"batchExpectations",       no_argument,        0,  'E'},
+                {"threads",                 required_argument,  0,  'j'},
+                {"memoryBudget",            required_argument,  0,  'G'},
+                {"train",                   required_argument,  0,  'N'},
+                {"outTemplateHmm",          required_argument,  0,  'Y'},
+                {"outComplementHmm",        required_argument,  0,  'Z'},
+                {"pruneExpectations",       required_argument,  0,  'P'},
+                {"squarem",                 no_argument,        0,  'Q'},
+                {"miniBatch",               required_argument,  0,  'K'},
+                {"stepSizeDecay",           required_argument,  0,  'k'},
 
                 {0, 0, 0, 0} };
 
         int option_index = 0;
 
-        key = getopt_long(argc, argv, "h:sdfeb:U:p:M:a:T:C:L:q:r:u:y:z:v:w:t:c:i:x:D:m:",
+        key = getopt_long(argc, argv, "h:sdfeb:U:p:M:a:T:C:L:q:A:r:u:By:z:v:w:t:c:i:x:D:m:n:Ej:G:N:Y:Z:P:QK:k:",
                           long_options, &option_index);
 
         if (key == -1) {
@@ -471,12 +1363,18 @@ int main(int argc, char *argv[]) {
             case 'q':
                 npReadFile = stString_copy(optarg);
                 break;
+            case 'A':
+                npReadArchiveFile = stString_copy(optarg);
+                break;
             case 'r':
                 targetFile = stString_copy(optarg);
                 break;
             case 'u':
                 posteriorProbsFile = stString_copy(optarg);
                 break;
+            case 'B':
+                binaryPosteriors = TRUE;
+                break;
             case 't':
                 templateExpectationsFile = stString_copy(optarg);
                 break;
@@ -512,6 +1410,57 @@ int main(int argc, char *argv[]) {
                 assert (constraintTrim >= 0);
                 constraintTrim = (int64_t)constraintTrim;
                 break;
+            case 'n':
+                batchFile = stString_copy(optarg);
+                break;
+            case 'E':
+                batchExpectations = TRUE;
+                break;
+            case 'j':
+                j = sscanf(optarg, "%" PRIi64 "", &nbThreads);
+                if (j != 1 || nbThreads < 1) {
+                    st_errAbort("vanillaAlign - ERROR: invalid number of threads %s\n", optarg);
+                }
+                break;
+            case 'G':
+                j = sscanf(optarg, "%" PRIi64 "", &memoryBudget);
+                if (j != 1 || memoryBudget < 1) {
+                    st_errAbort("vanillaAlign - ERROR: invalid memory budget %s\n", optarg);
+                }
+                break;
+            case 'N':
+                j = sscanf(optarg, "%" PRIi64 "", &trainingIterations);
+                if (j != 1 || trainingIterations < 1) {
+                    st_errAbort("vanillaAlign - ERROR: invalid number of training iterations %s\n", optarg);
+                }
+                break;
+            case 'Y':
+                outTemplateHmmFile = stString_copy(optarg);
+                break;
+            case 'Z':
+                outComplementHmmFile = stString_copy(optarg);
+                break;
+            case 'Q':
+                squarem = TRUE;
+                break;
+            case 'K':
+                j = sscanf(optarg, "%" PRIi64 "", &miniBatchSize);
+                if (j != 1 || miniBatchSize < 1) {
+                    st_errAbort("vanillaAlign - ERROR: invalid mini-batch size %s\n", optarg);
+                }
+                break;
+            case 'k':
+                j = sscanf(optarg, "%lf", &stepSizeDecay);
+                if (j != 1 || stepSizeDecay <= 0.5 || stepSizeDecay > 1.0) {
+                    st_errAbort("vanillaAlign - ERROR: the step size decay must be in (0.5, 1], got %s\n", optarg);
+                }
+                break;
+            case 'P':
+                j = sscanf(optarg, "%lf", &expectationsPruning);
+                if (j != 1 || expectationsPruning < 0.0 || expectationsPruning >= 1.0) {
+                    st_errAbort("vanillaAlign - ERROR: invalid expectations pruning %s\n", optarg);
+                }
+                break;
             default:
                 usage();
                 return 1;
@@ -559,6 +1508,30 @@ int main(int argc, char *argv[]) {
         }
     }
 
+    if (trainingIterations > 0) {
+        if (batchFile == NULL) {
+            st_errAbort("vanillaAlign - ERROR: training needs a batch of reads\n");
+        }
+        if ((outTemplateHmmFile == NULL) || (outComplementHmmFile == NULL)) {
+            st_errAbort("vanillaAlign - ERROR: need to specify where to put the trained HMMs\n");
+        }
+        if ((sMtype != threeState) && (sMtype != vanilla) && (sMtype != threeStateHdp)) {
+            st_errAbort("vanillaAlign - ERROR: training not allowed for this HMM type, yet\n");
+        }
+        if ((sMtype == threeStateHdp) && ((templateHdp == NULL) || (complementHdp == NULL))) {
+            st_errAbort("vanillaAlign - ERROR: need the HDPs to train this HMM type\n");
+        }
+        if (squarem && (sMtype == threeStateHdp)) {
+            st_errAbort("vanillaAlign - ERROR: can't extrapolate the EM steps of the HDP models, they are sampled\n");
+        }
+        if ((miniBatchSize > 0) && (sMtype == threeStateHdp)) {
+            st_errAbort("vanillaAlign - ERROR: no stepwise EM for the HDP models, they are sampled\n");
+        }
+        if ((miniBatchSize > 0) && squarem) {
+            st_errAbort("vanillaAlign - ERROR: --squarem and --miniBatch don't go together\n");
+        }
+    }
+
     if (sMtype == threeState) {
         fprintf(stderr, "vanillaAlign - using strawMan model\n");
     }
@@ -599,206 +1572,101 @@ int main(int argc, char *argv[]) {
         fprintf(stderr, "vanillaAlign - using NanoporeHDPs\n");
     }
 
-    // load reference sequence (reference sequence)
-    FILE *reference = fopen(targetFile, "r");
-    char *referenceSequence = stFile_getLineFromFile(reference);
-
-    // load nanopore read
-    NanoporeRead *npRead = nanopore_loadNanoporeReadFromFile(npReadFile);
-
-    // descale events if using hdp
-    if (sMtype == threeStateHdp) {
-        fprintf(stderr, "vanillaAlign - descaling Nanopore Events\n");
-        nanopore_descaleNanoporeRead(npRead);
-    }
-
-    // make some params
-    PairwiseAlignmentParameters *p = pairwiseAlignmentBandingParameters_construct();
-    p->threshold = threshold;
-    p->constraintDiagonalTrim = constraintTrim;
-    p->diagonalExpansion = diagExpansion;
-    // get pairwise alignment from stdin, in exonerate CIGAR format
-    FILE *fileHandleIn = stdin;
-
-    // parse input
-    struct PairwiseAlignment *pA;
-    pA = cigarRead(fileHandleIn);
-
-    // put in to help with debugdebugging
-    // printPairwiseAlignmentSummary(pA);
-
-    // slice out the section of the reference we're aligning to
-    char *trimmedRefSeq = getSubSequence(referenceSequence, pA->start1, pA->end1, pA->strand1);
-    trimmedRefSeq = (pA->strand1 ? trimmedRefSeq : stString_reverseComplementString(trimmedRefSeq));
-
-    // reverse complement for complement event sequence
-    char *rc_trimmedRefSeq = stString_reverseComplementString(trimmedRefSeq);
-
-    // change bases to methylated/hydroxymethylated, if asked to
-    char *templateTargetSeq = cytosine_substitute == NULL ? trimmedRefSeq : stString_replace(trimmedRefSeq, "C",
-                                                                                             cytosine_substitute);
-    char *complementTargetSeq = cytosine_substitute == NULL ? rc_trimmedRefSeq : stString_replace(rc_trimmedRefSeq,
-                                                                                                  "C",
-                                                                                                  cytosine_substitute);
-
-    // constrain the event sequence to the positions given by the guide alignment
-    Sequence *tEventSequence = makeEventSequenceFromPairwiseAlignment(npRead->templateEvents,
-                                                                      pA->start2, pA->end2,
-                                                                      npRead->templateEventMap);
-
-    Sequence *cEventSequence = makeEventSequenceFromPairwiseAlignment(npRead->complementEvents,
-                                                                      pA->start2, pA->end2,
-                                                                      npRead->complementEventMap);
-
-
-    // the aligned pairs start at (0,0) so we need to correct them based on the guide alignment later.
-    // record the pre-zeroed alignment start and end coordinates here
-
-    // for the events:
-    int64_t tCoordinateShift = npRead->templateEventMap[pA->start2];
-    int64_t cCoordinateShift = npRead->complementEventMap[pA->start2];
-
-    // and for the reference:
-    int64_t rCoordinateShift_t = pA->start1;
-    int64_t rCoordinateShift_c = pA->end1;
-    bool forward = pA->strand1;  // keep track of whether this is a forward mapped read or not
-
-    stList *anchorPairs = guideAlignmentToRebasedAnchorPairs(pA, p);
-
-    if ((templateExpectationsFile != NULL) && (complementExpectationsFile != NULL)) {
-        // Expectation Routine //
-        if ((sMtype != threeState) && (sMtype != vanilla) && (sMtype != threeStateHdp)) {
-            st_errAbort("vanillaAlign - getting expectations not allowed for this HMM type, yet");
-        }
-
-        // make empty HMM to collect expectations
-        Hmm *templateExpectations = hmmContinuous_getEmptyHmm(sMtype, 0.0001, p->threshold);
-        Hmm *complementExpectations = hmmContinuous_getEmptyHmm(sMtype, 0.0001, p->threshold);
-
-        #pragma omp parallel sections
-        {
-            {
-                // get expectations for template
-                fprintf(stderr, "vanillaAlign - getting expectations for template\n");
-                getSignalExpectations(templateModelFile, templateHmmFile, nHdpT,
-                                      templateExpectations, sMtype, npRead->templateParams,
-                                      tEventSequence, npRead->templateEventMap, pA->start2, templateTargetSeq, p,
-                                      anchorPairs, template);
-
-                // write to file
-                fprintf(stderr, "vanillaAlign - writing expectations to file: %s\n", templateExpectationsFile);
-                if (sMtype == threeStateHdp) {
-                    fprintf(stderr, "vanillaAlign - got %lld HDP assignments\n",
-                            hmmContinuous_howManyAssignments(templateExpectations));
-                }
-                hmmContinuous_writeToFile(templateExpectationsFile, templateExpectations, sMtype);
-            }
-
-            #pragma omp section
-            {
-                // get expectations for the complement
-                fprintf(stderr, "vanillaAlign - getting expectations for complement\n");
-                getSignalExpectations(complementModelFile, complementHmmFile, nHdpC,
-                                      complementExpectations, sMtype,
-                                      npRead->complementParams, cEventSequence, npRead->complementEventMap, pA->start2,
-                                      complementTargetSeq, p, anchorPairs, complement);
-
-                // write to file
-                fprintf(stderr, "vanillaAlign - writing expectations to file: %s\n", complementExpectationsFile);
-                if (sMtype == threeStateHdp) {
-                    fprintf(stderr, "vanillaAlign - got %lld HDP assignments\n",
-                            hmmContinuous_howManyAssignments(complementExpectations));
-                }
-                hmmContinuous_writeToFile(complementExpectationsFile, complementExpectations, sMtype);
-            }
+    AlignerOptions options;
+    options.sMtype = sMtype;
+    options.banded = banded;
+    options.modelFiles[template] = templateModelFile;
+    options.modelFiles[complement] = complementModelFile;
+    options.nHdps[template] = nHdpT;
+    options.nHdps[complement] = nHdpC;
+    options.binaryPosteriors = binaryPosteriors;
+    options.cytosine_substitute = cytosine_substitute;
+    options.threshold = threshold;
+    options.expectationsPruning = expectationsPruning;
+    options.diagExpansion = diagExpansion;
+    options.constraintTrim = constraintTrim;
+    options.targetFile = targetFile;
+    options.memoryBudget = memoryBudget == 0 ? NULL : memoryBudget_construct(memoryBudget * 1024 * 1024);
+    options.nbThreads = batchFile == NULL ? 1 : nbThreads;
+    options.trainingExpectations[template] = NULL;
+    options.trainingExpectations[complement] = NULL;
+    options.trainingReduction = NULL;
+
+    // read the HMMs once, they're loaded into every stateMachine
+    options.hmms[template] = templateHmmFile == NULL ? NULL : loadHmmRoutine(templateHmmFile, sMtype);
+    options.hmms[complement] = complementHmmFile == NULL ? NULL : loadHmmRoutine(complementHmmFile, sMtype);
+
+    // index the reference, only the regions of the guide alignments are read
+    options.reference = indexedFasta_construct(targetFile);
+
+    // with an archive the reads are fetched by name
+    options.npReadArchive = npReadArchiveFile == NULL ? NULL : nanoporeReadArchive_construct(npReadArchiveFile);
+
+    if (trainingIterations > 0) {
+        // Training //
+        stList *jobs = readBatch(batchFile, TRUE);
+        if (stList_length(jobs) == 0) {
+            st_errAbort("vanillaAlign - ERROR: no reads to train on in %s\n", batchFile);
         }
-
-        hmmContinuous_destruct(templateExpectations, sMtype);
-        hmmContinuous_destruct(complementExpectations, sMtype);
-        nanopore_nanoporeReadDestruct(npRead);
-        sequence_sequenceDestroy(tEventSequence);
-        sequence_sequenceDestroy(cEventSequence);
-        pairwiseAlignmentBandingParameters_destruct(p);
-        destructPairwiseAlignment(pA);
-        stList_destruct(anchorPairs);
-        if (nHdpT != NULL) {
-            destroy_nanopore_hdp(nHdpT);
+        if (miniBatchSize > 0) {
+            trainHmmsOnline(&options, jobs, trainingIterations, miniBatchSize, stepSizeDecay, nbThreads);
+        } else {
+            trainHmms(&options, jobs, trainingIterations, nbThreads, squarem);
         }
-        if (nHdpC != NULL) {
-            destroy_nanopore_hdp(nHdpC);
+        stList_destruct(jobs);
+
+        hmmContinuous_writeToFile(outTemplateHmmFile, options.hmms[template], sMtype);
+        hmmContinuous_writeToFile(outComplementHmmFile, options.hmms[complement], sMtype);
+        fprintf(stderr, "vanillaAlign - wrote the trained HMMs to %s and %s\n", outTemplateHmmFile,
+                outComplementHmmFile);
+        if (sMtype == threeStateHdp) {
+            fprintf(stderr, "vanillaAlign - Serializing HDPs to %s and %s\n", templateHdp, complementHdp);
+            serialize_nhdp_binary(nHdpT, templateHdp);
+            serialize_nhdp_binary(nHdpC, complementHdp);
         }
-
-        return 0;
+    } else if (batchFile != NULL) {
+        // Batch //
+        stList *jobs = readBatch(batchFile, batchExpectations);
+        alignBatch(&options, jobs, nbThreads);
+        stList_destruct(jobs);
     } else {
-        // Alignment Procedure //
-        StateMachine *sMt, *sMc;
-        stList *templateAlignedPairs, *complementAlignedPairs;
-        double templatePosteriorScore, complementPosteriorScore;
-        #pragma omp parallel sections
-        {
-            {
-                // Template alignment
-                fprintf(stderr, "vanillaAlign - starting template alignment\n");
-
-                // make template stateMachine
-                sMt = buildStateMachine(templateModelFile, npRead->templateParams, sMtype, template, nHdpT);
-
-                // get aligned pairs
-                templateAlignedPairs = performSignalAlignment(sMt, templateHmmFile, tEventSequence,
-                                                                      npRead->templateEventMap, pA->start2, trimmedRefSeq,
-                                                                      p, anchorPairs, banded);
-
-                templatePosteriorScore = scoreByPosteriorProbabilityIgnoringGaps(templateAlignedPairs);
-
-                // sort
-                stList_sort(templateAlignedPairs, sortByXPlusYCoordinate2); //Ensure the coordinates are increasing
-
-                // write to file
-                if (posteriorProbsFile != NULL) {
-                    writePosteriorProbs(posteriorProbsFile, readLabel, sMt->EMISSION_MATCH_PROBS,
-                                        npRead->templateParams.scale, npRead->templateParams.shift,
-                                        npRead->templateEvents, trimmedRefSeq, forward, pA->contig1,
-                                        tCoordinateShift, rCoordinateShift_t,
-                                        templateAlignedPairs, template);
-                }
-            }
-            #pragma omp section
-            {
-                // Complement alignment
-                fprintf(stderr, "vanillaAlign - starting complement alignment\n");
-                sMc = buildStateMachine(complementModelFile, npRead->complementParams, sMtype, complement, nHdpC);
+        // get pairwise alignment from stdin, in exonerate CIGAR format
+        AlignmentJob job;
+        job.readLabel = readLabel;
+        job.npRead = npReadFile;
+        job.pA = cigarRead(stdin);
+        job.posteriorsFile = posteriorProbsFile;
+        job.expectationsFiles[template] = templateExpectationsFile;
+        job.expectationsFiles[complement] = complementExpectationsFile;
+        job.modelFiles[template] = NULL;
+        job.modelFiles[complement] = NULL;
+
+        AlignerWorkspace *workspace = alignerWorkspace_construct(&options);
+        alignRead(&options, workspace, &job);
+        alignerWorkspace_destruct(workspace);
+        destructPairwiseAlignment(job.pA);
+    }
 
-                // get aligned pairs
-                complementAlignedPairs = performSignalAlignment(sMc, complementHmmFile, cEventSequence,
-                                                                        npRead->complementEventMap, pA->start2,
-                                                                        rc_trimmedRefSeq, p, anchorPairs, banded);
-
-                complementPosteriorScore = scoreByPosteriorProbabilityIgnoringGaps(complementAlignedPairs);
-
-                // sort
-                stList_sort(complementAlignedPairs, sortByXPlusYCoordinate2); //Ensure the coordinates are increasing
-
-                // write to file
-                if (posteriorProbsFile != NULL) {
-                    writePosteriorProbs(posteriorProbsFile, readLabel, sMc->EMISSION_MATCH_PROBS,
-                                        npRead->complementParams.scale, npRead->complementParams.shift,
-                                        npRead->complementEvents, rc_trimmedRefSeq,
-                                        forward, pA->contig1, cCoordinateShift, rCoordinateShift_c,
-                                        complementAlignedPairs, complement);
-                }
-            }
+    // clean up
+    for (int64_t s = 0; s < 2; s++) {
+        if (options.hmms[s] != NULL) {
+            hmmContinuous_destruct(options.hmms[s], sMtype);
         }
-        fprintf(stdout, "%s %lld\t%lld(%f)\t", readLabel, stList_length(anchorPairs),
-                stList_length(templateAlignedPairs), templatePosteriorScore);
-        fprintf(stdout, "%lld(%f)\n", stList_length(complementAlignedPairs), complementPosteriorScore);
-        // final alignment clean up
-        stateMachine_destruct(sMt);
-        sequence_sequenceDestroy(tEventSequence);
-        stList_destruct(templateAlignedPairs);
-        stateMachine_destruct(sMc);
-        sequence_sequenceDestroy(cEventSequence);
-        stList_destruct(complementAlignedPairs);
-        fprintf(stderr, "vanillaAlign - SUCCESS: finished alignment of query %s, exiting\n", readLabel);
+    }
+    indexedFasta_destruct(options.reference);
+    if (options.memoryBudget != NULL) {
+        fprintf(stderr, "vanillaAlign - at most %" PRIi64 " bytes of alignments were reserved at once\n",
+                memoryBudget_getPeakReserved(options.memoryBudget));
+        memoryBudget_destruct(options.memoryBudget);
+    }
+    if (options.npReadArchive != NULL) {
+        nanoporeReadArchive_destruct(options.npReadArchive);
+    }
+    if (nHdpT != NULL) {
+        destroy_nanopore_hdp(nHdpT);
+    }
+    if (nHdpC != NULL) {
+        destroy_nanopore_hdp(nHdpC);
     }
 
     return 0;